@@ -0,0 +1,663 @@
+/* aio.c - The ethtool.aio module: queries for asyncio event loops
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <Python.h>
+#include "include/py3c/compat.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/ethtool.h>
+#include <linux/if.h>
+#include <linux/sockios.h>
+
+#include "aio.h"
+#include "device.h"
+#include "fastcall.h"
+#include "perfcounters.h"
+#include "rtnetlink.h"
+#include "sweep.h"
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+/*
+ * The functions of ethtool.aio return asyncio futures instead of blocking
+ * the event loop.  The requests are made by a native worker thread of the
+ * module instance, which never takes the GIL: it reads the answers into
+ * the job, then signals the eventfd of the job.  The event loop watches
+ * that with add_reader(), and its callback builds the result and completes
+ * the future.  The worker keeps a control socket and a NETLINK connection
+ * open for all requests.
+ */
+
+struct ethtool_aio;
+
+/** A request handed to the worker */
+struct aio_job {
+    struct aio_job *next;  /**< Next in the queue */
+    int refs;  /**< The worker and the completion callback */
+    int efd;  /**< eventfd signalled once the job is done */
+    perf_api api;  /**< Function the requests are accounted to */
+    /** Makes the requests, on the worker without the GIL */
+    void (*run)(struct ethtool_aio *aio, struct aio_job *job);
+    /** Builds the result, on the event loop with the GIL */
+    PyObject *(*result)(struct ethtool_state *state, struct aio_job *job);
+    struct perf_counters counters;  /**< Requests made by the worker */
+    int err;  /**< errno of the failed request, 0 on success */
+
+    /* ethtool requests */
+    struct ifreq ifr;
+    union {
+        struct ethtool_coalesce coal;
+        struct ethtool_ringparam ring;
+    } data;
+
+    /* snapshot() */
+    int mask;  /**< What to get, see sweep_parse_what() */
+    struct sweep_ns ns;
+};
+
+/** The worker thread of a module instance and its queue */
+struct ethtool_aio {
+    pthread_mutex_t mtx;  /**< Protects the queue and stop */
+    pthread_cond_t cond;  /**< Signalled when a job is queued */
+    struct aio_job *head;
+    struct aio_job **tail;
+    int stop;
+    pthread_t thread;
+    pid_t pid;  /**< Process the thread was started in */
+    /* Only used by the worker */
+    int ctl_fd;  /**< Control socket, -1 until needed */
+    struct nl_connection *nlc;  /**< NETLINK connection, NULL until needed */
+};
+
+static void aio_job_unref(struct aio_job *job)
+{
+    if (__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    if (job->efd >= 0) {
+        close(job->efd);
+    }
+    sweep_ns_release(&job->ns);
+    free(job);
+}
+
+static struct aio_job *aio_job_new(perf_api api)
+{
+    struct aio_job *job = calloc(1, sizeof(*job));
+
+    if (job == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    job->refs = 1;
+    job->efd = -1;
+    job->api = api;
+    return job;
+}
+
+/* Tells the event loop a job is done and drops the reference of the worker */
+static void aio_job_done(struct aio_job *job)
+{
+    uint64_t one = 1;
+
+    if (write(job->efd, &one, sizeof(one)) < 0) {
+        /* Cannot happen with a counter below 2^64 - 1 */
+    }
+    aio_job_unref(job);
+}
+
+static void *aio_worker(void *arg)
+{
+    struct ethtool_aio *aio = arg;
+
+    for (;;) {
+        struct aio_job *job;
+        int stop;
+
+        pthread_mutex_lock(&aio->mtx);
+        while (aio->head == NULL && !aio->stop) {
+            pthread_cond_wait(&aio->cond, &aio->mtx);
+        }
+        job = aio->head;
+        if (job != NULL) {
+            aio->head = job->next;
+            if (aio->head == NULL) {
+                aio->tail = &aio->head;
+            }
+        }
+        stop = aio->stop;
+        pthread_mutex_unlock(&aio->mtx);
+
+        if (job == NULL) {
+            break;
+        }
+        if (stop) {
+            job->err = ECANCELED;
+        } else {
+            perf_current = &job->counters;
+            job->run(aio, job);
+        }
+        aio_job_done(job);
+    }
+
+    if (aio->ctl_fd >= 0) {
+        close(aio->ctl_fd);
+    }
+    if (aio->nlc != NULL) {
+        disconnect_netlink(aio->nlc);
+    }
+    return NULL;
+}
+
+/**
+ * Gets the worker of a module instance, starting it on the first request
+ * and again in a child process, which does not inherit the thread
+ *
+ * @return Returns the worker, otherwise NULL with a Python exception set.
+ */
+static struct ethtool_aio *aio_start(struct ethtool_state *state)
+{
+    struct ethtool_aio *aio;
+    sigset_t all, old;
+    int err = 0;
+
+    ethtool_mutex_lock(&state->aio_mtx);
+    aio = state->aio;
+    /* After fork() its locks may be held by a thread which is gone, so it
+     * is left alone */
+    if (aio == NULL || aio->pid != getpid()) {
+        aio = calloc(1, sizeof(*aio));
+        if (aio == NULL) {
+            err = ENOMEM;
+        }
+    }
+    if (aio != NULL && aio != state->aio) {
+        pthread_mutex_init(&aio->mtx, NULL);
+        pthread_cond_init(&aio->cond, NULL);
+        aio->tail = &aio->head;
+        aio->pid = getpid();
+        aio->ctl_fd = -1;
+        /* Signals are for the Python threads to handle */
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        err = pthread_create(&aio->thread, NULL, aio_worker, aio);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (err != 0) {
+            pthread_cond_destroy(&aio->cond);
+            pthread_mutex_destroy(&aio->mtx);
+            free(aio);
+            aio = NULL;
+        } else {
+            state->aio = aio;
+        }
+    }
+    ethtool_mutex_unlock(&state->aio_mtx);
+
+    if (aio == NULL) {
+        errno = err;
+        PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return aio;
+}
+
+/**
+ * Stops the worker of a module instance, if it was started.  Jobs still
+ * queued fail with ECANCELED.
+ *
+ * @param state Module instance
+ */
+void ethtool_aio_stop(struct ethtool_state *state)
+{
+    struct ethtool_aio *aio = state->aio;
+
+    state->aio = NULL;
+    if (aio == NULL || aio->pid != getpid()) {
+        return;
+    }
+    pthread_mutex_lock(&aio->mtx);
+    aio->stop = 1;
+    pthread_cond_signal(&aio->cond);
+    pthread_mutex_unlock(&aio->mtx);
+    pthread_join(aio->thread, NULL);
+    pthread_cond_destroy(&aio->cond);
+    pthread_mutex_destroy(&aio->mtx);
+    free(aio);
+}
+
+/* Runs an ethtool request on the worker */
+static void aio_run_ethtool(struct ethtool_aio *aio, struct aio_job *job)
+{
+    if (aio->ctl_fd < 0) {
+        aio->ctl_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (aio->ctl_fd < 0) {
+            job->err = errno;
+            return;
+        }
+    }
+    job->ifr.ifr_data = (caddr_t) &job->data;
+    perf_count(ioctls, 1);
+    if (ioctl(aio->ctl_fd, SIOCETHTOOL, &job->ifr) < 0) {
+        job->err = errno;
+    }
+}
+
+/* Dumps the links and addresses on the worker */
+static void aio_run_snapshot(struct ethtool_aio *aio, struct aio_job *job)
+{
+    int err;
+
+    if (aio->nlc == NULL) {
+        aio->nlc = connect_netlink(NULL);
+        if (aio->nlc == NULL) {
+            job->err = ENOMEM;
+            return;
+        }
+        aio->nlc->nogil = 1;
+    }
+    err = sweep_dump(aio->nlc, sweep_addr_family(job->mask), 0, &job->ns);
+    if (err < 0) {
+        /* Start over with a new connection */
+        job->err = -err;
+        disconnect_netlink(aio->nlc);
+        aio->nlc = NULL;
+    }
+}
+
+static PyObject *aio_coalesce_result(struct ethtool_state *state __unused,
+                                     struct aio_job *job)
+{
+    if (job->err != 0) {
+        errno = job->err;
+        return PyErr_SetFromErrno(PyExc_IOError);
+    }
+    return coalesce_to_dict(&job->data.coal);
+}
+
+static PyObject *aio_ringparam_result(struct ethtool_state *state __unused,
+                                      struct aio_job *job)
+{
+    if (job->err != 0) {
+        errno = job->err;
+        return PyErr_SetFromErrno(PyExc_IOError);
+    }
+    return ringparam_to_dict(&job->data.ring);
+}
+
+static PyObject *aio_snapshot_result(struct ethtool_state *state,
+                                     struct aio_job *job)
+{
+    if (job->err != 0) {
+        errno = job->err;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return sweep_result(state, job->mask, &job->ns);
+}
+
+/* Adds the requests of the worker to the counters of the function */
+static void aio_count(struct ethtool_state *state, struct aio_job *job)
+{
+    struct perf_counters *c = &state->perf.counters[job->api];
+
+    ethtool_counter_add(&c->ioctls, job->counters.ioctls);
+    ethtool_counter_add(&c->netlink_opens, job->counters.netlink_opens);
+    ethtool_counter_add(&c->netlink_dumps, job->counters.netlink_dumps);
+    ethtool_counter_add(&c->netlink_msgs, job->counters.netlink_msgs);
+    ethtool_counter_add(&c->netlink_bytes, job->counters.netlink_bytes);
+    ethtool_counter_add(&c->netlink_retries, job->counters.netlink_retries);
+}
+
+/**
+ * add_reader() callback of a job: completes its future once the worker is
+ * done with it
+ *
+ * @param ctx  Tuple of the capsule of the job, the future, the event loop
+ *             and the module
+ */
+static PyObject *aio_done(PyObject *ctx, PyObject *unused __unused)
+{
+    struct aio_job *job = PyCapsule_GetPointer(PyTuple_GET_ITEM(ctx, 0),
+                                               NULL);
+    PyObject *future = PyTuple_GET_ITEM(ctx, 1);
+    PyObject *loop = PyTuple_GET_ITEM(ctx, 2);
+    struct ethtool_state *state = ethtool_get_state(PyTuple_GET_ITEM(ctx, 3));
+    PyObject *result, *ret;
+    uint64_t count;
+    int done;
+
+    if (read(job->efd, &count, sizeof(count)) < 0) {
+        if (errno == EAGAIN) {
+            Py_RETURN_NONE;
+        }
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    ret = PyObject_CallMethod(loop, "remove_reader", "i", job->efd);
+    if (ret == NULL) {
+        return NULL;
+    }
+    Py_DECREF(ret);
+    aio_count(state, job);
+
+    /* Cancelled meanwhile */
+    ret = PyObject_CallMethod(future, "done", NULL);
+    if (ret == NULL) {
+        return NULL;
+    }
+    done = PyObject_IsTrue(ret);
+    Py_DECREF(ret);
+    if (done < 0) {
+        return NULL;
+    }
+    if (done) {
+        Py_RETURN_NONE;
+    }
+
+    result = job->result(state, job);
+    if (result == NULL) {
+        PyObject *type, *value, *tb;
+
+        PyErr_Fetch(&type, &value, &tb);
+        PyErr_NormalizeException(&type, &value, &tb);
+        ret = PyObject_CallMethod(future, "set_exception", "(O)", value);
+        Py_XDECREF(type);
+        Py_XDECREF(value);
+        Py_XDECREF(tb);
+    } else {
+        ret = PyObject_CallMethod(future, "set_result", "(O)", result);
+        Py_DECREF(result);
+    }
+    if (ret == NULL) {
+        return NULL;
+    }
+    Py_DECREF(ret);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef aio_done_def = {
+    .ml_name = "aio_done",
+    .ml_meth = aio_done,
+    .ml_flags = METH_NOARGS,
+};
+
+static void aio_capsule_free(PyObject *capsule)
+{
+    aio_job_unref(PyCapsule_GetPointer(capsule, NULL));
+}
+
+/* Gets the event loop of the calling coroutine, or the current one */
+static PyObject *aio_loop(void)
+{
+    PyObject *asyncio, *loop = NULL;
+
+    asyncio = PyImport_ImportModule("asyncio");
+    if (asyncio == NULL) {
+        return NULL;
+    }
+    if (PyObject_HasAttrString(asyncio, "get_running_loop")) {
+        loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL);
+        if (loop == NULL && PyErr_ExceptionMatches(PyExc_RuntimeError)) {
+            PyErr_Clear();
+        }
+    }
+    if (loop == NULL && !PyErr_Occurred()) {
+        loop = PyObject_CallMethod(asyncio, "get_event_loop", NULL);
+    }
+    Py_DECREF(asyncio);
+    return loop;
+}
+
+/**
+ * Hands a job to the worker
+ *
+ * @param self  The module
+ * @param job   The job, whose reference is taken over
+ *
+ * @return Returns a new reference to the future of the job, otherwise NULL
+ *         with a Python exception set.
+ */
+static PyObject *aio_submit(PyObject *self, struct aio_job *job)
+{
+    struct ethtool_aio *aio;
+    PyObject *capsule, *loop = NULL, *future = NULL, *ctx = NULL;
+    PyObject *callback = NULL, *ret = NULL, *added;
+
+    job->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (job->efd < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        aio_job_unref(job);
+        return NULL;
+    }
+    /* From now on the capsule holds the reference of the callback */
+    capsule = PyCapsule_New(job, NULL, aio_capsule_free);
+    if (capsule == NULL) {
+        aio_job_unref(job);
+        return NULL;
+    }
+
+    aio = aio_start(ethtool_get_state(self));
+    if (aio == NULL)
+        goto out;
+    loop = aio_loop();
+    if (loop == NULL)
+        goto out;
+    future = PyObject_CallMethod(loop, "create_future", NULL);
+    if (future == NULL)
+        goto out;
+    ctx = PyTuple_Pack(4, capsule, future, loop, self);
+    if (ctx == NULL)
+        goto out;
+    callback = PyCFunction_New(&aio_done_def, ctx);
+    if (callback == NULL)
+        goto out;
+    added = PyObject_CallMethod(loop, "add_reader", "iO", job->efd,
+                                callback);
+    if (added == NULL)
+        goto out;
+    Py_DECREF(added);
+
+    __atomic_add_fetch(&job->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&aio->mtx);
+    job->next = NULL;
+    *aio->tail = job;
+    aio->tail = &job->next;
+    pthread_cond_signal(&aio->cond);
+    pthread_mutex_unlock(&aio->mtx);
+
+    Py_INCREF(future);
+    ret = future;
+
+out:
+    Py_XDECREF(callback);
+    Py_XDECREF(ctx);
+    Py_XDECREF(future);
+    Py_XDECREF(loop);
+    Py_DECREF(capsule);
+    return ret;
+}
+
+/* Queues an ethtool request on the device argument of fname() */
+static PyObject *aio_ethtool(PyObject *self, const char *fname,
+                             PyObject *const *args, Py_ssize_t nargs,
+                             PyObject *kwnames, perf_api api, int cmd,
+                             PyObject *(*result)(struct ethtool_state *,
+                                                 struct aio_job *))
+{
+    static const char *const names[] = { "device" };
+    PyObject *devname;
+    const char *name;
+    struct aio_job *job;
+
+    if (fastcall_unpack(fname, args, nargs, kwnames, names, 1, 1,
+                        &devname) < 0)
+        return NULL;
+    if (!PyStr_Check(devname)) {
+        PyErr_Format(PyExc_TypeError,
+                     "%s() argument 1 must be str, not %.50s",
+                     fname, Py_TYPE(devname)->tp_name);
+        return NULL;
+    }
+    name = dev_name_as_string(devname);
+    if (name == NULL)
+        return NULL;
+
+    job = aio_job_new(api);
+    if (job == NULL)
+        return NULL;
+    strncpy(job->ifr.ifr_name, name, IFNAMSIZ - 1);
+    /* cmd is the first member of every ethtool request structure */
+    job->data.coal.cmd = cmd;
+    job->run = aio_run_ethtool;
+    job->result = result;
+    return aio_submit(self, job);
+}
+
+/**
+ * Gets the coalescing settings of a device, as get_coalesce() does
+ *
+ * @return Future of the dict
+ */
+static PyObject *aio_get_coalesce(PyObject *self, FASTCALL_PARAMS)
+{
+    return aio_ethtool(self, "get_coalesce", FASTCALL_ARGS, FASTCALL_NARGS,
+                       FASTCALL_KWNAMES, PERF_API_AIO_GET_COALESCE,
+                       ETHTOOL_GCOALESCE, aio_coalesce_result);
+}
+
+/**
+ * Gets the ring parameters of a device, as get_ringparam() does
+ *
+ * @return Future of the dict
+ */
+static PyObject *aio_get_ringparam(PyObject *self, FASTCALL_PARAMS)
+{
+    return aio_ethtool(self, "get_ringparam", FASTCALL_ARGS, FASTCALL_NARGS,
+                       FASTCALL_KWNAMES, PERF_API_AIO_GET_RINGPARAM,
+                       ETHTOOL_GRINGPARAM, aio_ringparam_result);
+}
+
+/**
+ * Gets the devices and addresses of the namespace of the module, with one
+ * NETLINK dump of the links and one of the addresses
+ *
+ * @param what  As for sweep_namespaces()
+ *
+ * @return Future of a dict as sweep_namespaces() gives for a namespace
+ */
+static PyObject *aio_snapshot(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "what" };
+    PyObject *what = NULL;
+    struct aio_job *job;
+    int mask;
+
+    if (fastcall_unpack("snapshot", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 0, 1, &what) < 0)
+        return NULL;
+    mask = sweep_parse_what(what);
+    if (mask < 0)
+        return NULL;
+
+    job = aio_job_new(PERF_API_AIO_SNAPSHOT);
+    if (job == NULL)
+        return NULL;
+    job->mask = mask;
+    job->ns.fd = -1;
+    job->run = aio_run_snapshot;
+    job->result = aio_snapshot_result;
+    return aio_submit(self, job);
+}
+
+PERF_FASTCALL_WRAPPER(aio_snapshot, PERF_API_AIO_SNAPSHOT)
+PERF_FASTCALL_WRAPPER(aio_get_coalesce, PERF_API_AIO_GET_COALESCE)
+PERF_FASTCALL_WRAPPER(aio_get_ringparam, PERF_API_AIO_GET_RINGPARAM)
+
+static PyMethodDef aio_methods[] = {
+    {
+        .ml_name = "snapshot",
+        .ml_meth = (PyCFunction)perf_aio_snapshot,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "snapshot(what=None): returns a future of the devices and "
+        "addresses of the current network namespace, a dict as "
+        "sweep_namespaces() gives for a namespace."
+    },
+    {
+        .ml_name = "get_coalesce",
+        .ml_meth = (PyCFunction)perf_aio_get_coalesce,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "get_coalesce(device): returns a future of the dict of "
+        "ethtool.get_coalesce()."
+    },
+    {
+        .ml_name = "get_ringparam",
+        .ml_meth = (PyCFunction)perf_aio_get_ringparam,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "get_ringparam(device): returns a future of the dict of "
+        "ethtool.get_ringparam()."
+    },
+    { .ml_name = NULL, },
+};
+
+/**
+ * Creates the ethtool.aio module of a module instance, whose functions
+ * belong to the instance
+ *
+ * @return Returns 0 on success, otherwise -1 with a Python exception set.
+ */
+int ethtool_aio_init(PyObject *m)
+{
+    PyObject *aio, *modules, *doc;
+    PyMethodDef *def;
+
+    aio = PyModule_New("ethtool.aio");
+    if (aio == NULL)
+        return -1;
+    doc = PyStr_FromString("Queries for asyncio event loops: the functions "
+                           "return futures and leave the requests to a "
+                           "native thread.");
+    if (doc == NULL || PyObject_SetAttrString(aio, "__doc__", doc) < 0)
+        goto err;
+    Py_CLEAR(doc);
+
+    for (def = aio_methods; def->ml_name != NULL; def++) {
+        PyObject *fn = PyCFunction_NewEx(def, m, NULL);
+
+        if (fn == NULL || PyModule_AddObject(aio, def->ml_name, fn) < 0) {
+            Py_XDECREF(fn);
+            goto err;
+        }
+    }
+
+    /* import ethtool.aio works too, for the first instance */
+    modules = PyImport_GetModuleDict();
+    if (PyDict_GetItemString(modules, "ethtool.aio") == NULL
+            && PyDict_SetItemString(modules, "ethtool.aio", aio) < 0)
+        goto err;
+    if (PyModule_AddObject(m, "aio", aio) < 0)
+        goto err;
+    return 0;
+
+err:
+    Py_XDECREF(doc);
+    Py_DECREF(aio);
+    return -1;
+}
@@ -0,0 +1,24 @@
+/*
+ * aio.h - The ethtool.aio module: queries for asyncio event loops
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _AIO_H
+#define _AIO_H
+
+#include <Python.h>
+
+#include "modstate.h"
+
+int ethtool_aio_init(PyObject *m);
+void ethtool_aio_stop(struct ethtool_state *state);
+
+#endif
@@ -0,0 +1,469 @@
+/*
+ * columns.c - Columnar snapshots of the interfaces of a namespace
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <Python.h>
+#include "include/py3c/compat.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/if.h>
+#include <linux/if_link.h>
+
+#include "columns.h"
+#include "etherinfo_struct.h"
+#include "etherinfo.h"
+#include "netns.h"
+#include "perfcounters.h"
+#include "rtnetlink.h"
+#include "sweep.h"
+
+/*
+ * snapshot_columns() keeps each attribute of the links in a C array of its
+ * own, an ethtool.Column, which hands it out through the buffer protocol:
+ * NumPy and pandas wrap it without copying and without a Python object per
+ * link.  Names and hardware addresses are offsets into a table of the
+ * distinct strings, NUL terminated.
+ */
+
+/** ethtool.Column object: a read-only typed array */
+typedef struct {
+    PyObject_HEAD
+    void *data;
+    Py_ssize_t len;
+    Py_ssize_t itemsize;
+    char *format;  /**< Of the struct module, static */
+} PyEthtoolColumn;
+
+/* The columns, in the order of the dict */
+enum {
+    COL_IFINDEX,
+    COL_FLAGS,
+    COL_MTU,
+    COL_NAME,
+    COL_HWADDR,
+    COL_STATS,  /* The first counters of struct rtnl_link_stats64 */
+    COL_STRINGS = COL_STATS + 10,
+    COL_MAX
+};
+
+static const struct {
+    const char *name;
+    char *format;
+    Py_ssize_t itemsize;
+} col_descs[COL_MAX] = {
+    [COL_IFINDEX] = { "ifindex", "i", sizeof(int) },
+    [COL_FLAGS] = { "flags", "I", sizeof(unsigned int) },
+    [COL_MTU] = { "mtu", "I", sizeof(unsigned int) },
+    [COL_NAME] = { "name", "I", sizeof(unsigned int) },
+    [COL_HWADDR] = { "hwaddr", "I", sizeof(unsigned int) },
+    [COL_STATS + 0] = { "rx_packets", "Q", sizeof(__u64) },
+    [COL_STATS + 1] = { "tx_packets", "Q", sizeof(__u64) },
+    [COL_STATS + 2] = { "rx_bytes", "Q", sizeof(__u64) },
+    [COL_STATS + 3] = { "tx_bytes", "Q", sizeof(__u64) },
+    [COL_STATS + 4] = { "rx_errors", "Q", sizeof(__u64) },
+    [COL_STATS + 5] = { "tx_errors", "Q", sizeof(__u64) },
+    [COL_STATS + 6] = { "rx_dropped", "Q", sizeof(__u64) },
+    [COL_STATS + 7] = { "tx_dropped", "Q", sizeof(__u64) },
+    [COL_STATS + 8] = { "multicast", "Q", sizeof(__u64) },
+    [COL_STATS + 9] = { "collisions", "Q", sizeof(__u64) },
+    [COL_STRINGS] = { "strings", "B", 1 },
+};
+
+/** The distinct strings of the columns, one after the other */
+struct col_strings {
+    char *data;
+    size_t len;
+    size_t size;
+    unsigned int *slots;  /**< Hash table of their offsets + 1, 0 if free */
+    size_t nslots;  /**< A power of 2, at least twice the strings */
+};
+
+/**
+ * Adds a string to the table, unless already in
+ *
+ * @return Returns its offset, (unsigned int)-1 if out of memory
+ */
+static unsigned int col_string(struct col_strings *strings, const char *s)
+{
+    size_t len = strlen(s) + 1, i;
+    unsigned int hash = 2166136261U;  /* FNV-1a */
+
+    for (i = 0; i < len - 1; i++)
+        hash = (hash ^ (unsigned char)s[i]) * 16777619U;
+    for (i = hash & (strings->nslots - 1); strings->slots[i] != 0;
+            i = (i + 1) & (strings->nslots - 1)) {
+        const char *other = strings->data + strings->slots[i] - 1;
+
+        if (strcmp(other, s) == 0)
+            return strings->slots[i] - 1;
+    }
+
+    if (strings->len + len > strings->size) {
+        size_t size = strings->size * 2;
+        char *data;
+
+        while (size < strings->len + len)
+            size *= 2;
+        data = realloc(strings->data, size);
+        if (data == NULL)
+            return (unsigned int)-1;
+        strings->data = data;
+        strings->size = size;
+    }
+    memcpy(strings->data + strings->len, s, len);
+    strings->slots[i] = strings->len + 1;
+    strings->len += len;
+    return strings->slots[i] - 1;
+}
+
+/**
+ * Makes a column of len zeroed items
+ *
+ * @return New reference to the column, NULL with a Python exception set
+ */
+static PyEthtoolColumn *col_new(struct ethtool_state *state, int col,
+                                size_t len)
+{
+    PyEthtoolColumn *column;
+
+    column = (PyEthtoolColumn *)state->column_type->tp_alloc(
+        state->column_type, 0);
+    if (column == NULL)
+        return NULL;
+    column->itemsize = col_descs[col].itemsize;
+    column->format = col_descs[col].format;
+    column->data = calloc(len + 1, column->itemsize);
+    if (column->data == NULL) {
+        Py_DECREF(column);
+        return (PyEthtoolColumn *)PyErr_NoMemory();
+    }
+    column->len = len;
+    return column;
+}
+
+/** A link of the dump, sorted by interface index */
+struct col_row {
+    int ifindex;
+    unsigned int flags;
+    struct rtattr *mtu;
+    struct rtattr *name;
+    struct rtattr *hwaddr;  /**< NULL if it has none */
+    struct rtattr *stats;  /**< IFLA_STATS64, NULL if it has none */
+};
+
+static int col_row_cmp(const void *a, const void *b)
+{
+    const struct col_row *x = a, *y = b;
+
+    return (x->ifindex > y->ifindex) - (x->ifindex < y->ifindex);
+}
+
+/**
+ * Parses the RTM_NEWLINK messages of a dump into rows
+ *
+ * @return Returns the rows, sorted, NULL if out of memory
+ */
+static struct col_row *col_parse(struct sweep_buf *buf, size_t *nrows)
+{
+    struct col_row *rows;
+    struct nlmsghdr *nlh;
+    size_t len = buf->len, n = 0;
+
+    for (nlh = (struct nlmsghdr *) buf->data; NLMSG_OK(nlh, len);
+            nlh = NLMSG_NEXT(nlh, len))
+        n++;
+    rows = malloc((n + 1) * sizeof(*rows));
+    if (rows == NULL)
+        return NULL;
+
+    *nrows = 0;
+    len = buf->len;
+    for (nlh = (struct nlmsghdr *) buf->data; NLMSG_OK(nlh, len);
+            nlh = NLMSG_NEXT(nlh, len)) {
+        struct col_row *row = &rows[*nrows];
+        struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+        struct rtattr *tb[IFLA_MAX + 1];
+
+        if (nlh->nlmsg_type != RTM_NEWLINK
+                || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+            continue;
+        rtnetlink_parse_attrs(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+        if (tb[IFLA_IFNAME] == NULL)
+            continue;
+        row->ifindex = ifi->ifi_index;
+        row->flags = ifi->ifi_flags;
+        row->mtu = tb[IFLA_MTU];
+        row->name = tb[IFLA_IFNAME];
+        row->hwaddr = tb[IFLA_ADDRESS];
+        row->stats = tb[IFLA_STATS64];
+        (*nrows)++;
+    }
+
+    qsort(rows, *nrows, sizeof(*rows), col_row_cmp);
+    return rows;
+}
+
+/**
+ * Fills in the columns from the rows of a dump
+ *
+ * @return Returns 0 on success, -1 if out of memory
+ */
+static int col_fill(PyEthtoolColumn **columns, struct col_row *rows,
+                    size_t nrows, struct col_strings *strings)
+{
+    size_t i;
+    int j;
+
+    for (i = 0; i < nrows; i++) {
+        struct col_row *row = &rows[i];
+        struct rtattr *rta;
+        char name[IFNAMSIZ], hwaddr[HWADDR_STRLEN];
+        size_t size;
+
+        ((int *)columns[COL_IFINDEX]->data)[i] = row->ifindex;
+        ((unsigned int *)columns[COL_FLAGS]->data)[i] = row->flags;
+        rta = row->mtu;
+        if (rta != NULL && RTA_PAYLOAD(rta) >= sizeof(__u32))
+            ((unsigned int *)columns[COL_MTU]->data)[i] =
+                *(__u32 *)RTA_DATA(rta);
+
+        rta = row->name;
+        size = strnlen(RTA_DATA(rta), RTA_PAYLOAD(rta));
+        if (size >= IFNAMSIZ)
+            size = IFNAMSIZ - 1;
+        memcpy(name, RTA_DATA(rta), size);
+        name[size] = '\0';
+        rta = row->hwaddr;
+        format_hwaddr_buf(hwaddr, rta != NULL ? RTA_DATA(rta) : NULL,
+                          rta != NULL && RTA_PAYLOAD(rta) <= 32
+                          ? RTA_PAYLOAD(rta) : 0);
+        if ((((unsigned int *)columns[COL_NAME]->data)[i] =
+                 col_string(strings, name)) == (unsigned int)-1
+                || (((unsigned int *)columns[COL_HWADDR]->data)[i] =
+                        col_string(strings, hwaddr)) == (unsigned int)-1)
+            return -1;
+
+        /* The 64 bit counters are not aligned in the message */
+        rta = row->stats;
+        if (rta == NULL)
+            continue;
+        for (j = 0; j < COL_STRINGS - COL_STATS
+                && (j + 1) * sizeof(__u64) <= RTA_PAYLOAD(rta); j++)
+            memcpy((__u64 *)columns[COL_STATS + j]->data + i,
+                   (char *)RTA_DATA(rta) + j * sizeof(__u64),
+                   sizeof(__u64));
+    }
+    return 0;
+}
+
+/**
+ * Builds the dict of the columns of the links of a dump
+ *
+ * @return New reference to the dict, NULL with a Python exception set
+ */
+static PyObject *col_result(struct ethtool_state *state,
+                            struct sweep_buf *buf)
+{
+    PyEthtoolColumn *columns[COL_MAX] = { NULL };
+    struct col_strings strings = { NULL };
+    struct col_row *rows;
+    PyObject *dict = NULL;
+    size_t nrows;
+    int i;
+
+    rows = col_parse(buf, &nrows);
+    if (rows == NULL)
+        return PyErr_NoMemory();
+
+    /* A name and an address per link at most */
+    strings.size = 4096;
+    strings.data = malloc(strings.size);
+    for (strings.nslots = 16; strings.nslots < 4 * nrows; strings.nslots *= 2)
+        ;
+    strings.slots = calloc(strings.nslots, sizeof(*strings.slots));
+    if (strings.data == NULL || strings.slots == NULL) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    for (i = 0; i < COL_STRINGS; i++) {
+        columns[i] = col_new(state, i, nrows);
+        if (columns[i] == NULL)
+            goto out;
+    }
+    if (col_fill(columns, rows, nrows, &strings) < 0) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    columns[COL_STRINGS] = col_new(state, COL_STRINGS, 0);
+    if (columns[COL_STRINGS] == NULL)
+        goto out;
+    free(columns[COL_STRINGS]->data);
+    columns[COL_STRINGS]->data = strings.data;
+    columns[COL_STRINGS]->len = strings.len;
+    strings.data = NULL;
+
+    dict = PyDict_New();
+    for (i = 0; dict != NULL && i < COL_MAX; i++) {
+        if (PyDict_SetItemString(dict, col_descs[i].name,
+                                 (PyObject *)columns[i]) < 0)
+            Py_CLEAR(dict);
+    }
+
+out:
+    for (i = 0; i < COL_MAX; i++)
+        Py_XDECREF(columns[i]);
+    free(strings.data);
+    free(strings.slots);
+    free(rows);
+    return dict;
+}
+
+/**
+ * Takes a columnar snapshot of the interfaces of a namespace, with a
+ * NETLINK dump of the links and their statistics
+ *
+ * @param netns  Keyword-only namespace of the interfaces
+ *
+ * @return Python dict mapping the name of each column to an ethtool.Column,
+ *         NULL with a Python exception set
+ */
+PyObject *snapshot_columns(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "netns" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    PyObject *argv[1] = { NULL }, *ret = NULL;
+    struct sweep_ns dump = { .fd = -1 };
+    struct nl_connection *nlc;
+    struct ethtool_netns *ns;
+    int err;
+
+    /* netns is keyword-only */
+    if (fastcall_unpack("snapshot_columns", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 0,
+                        FASTCALL_NARGS > 0 ? 0 : 1, argv) < 0)
+        return NULL;
+    if (ethtool_netns_get(state, argv[0], &ns) < 0)
+        return NULL;
+
+    nlc = connect_netlink(ns);
+    if (nlc == NULL) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Could not open a NETLINK connection");
+        goto out;
+    }
+    err = sweep_dump_nogil(nlc, -1, 1, &dump);
+    disconnect_netlink(nlc);
+    if (err < 0) {
+        errno = -err;
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto out;
+    }
+    ret = col_result(state, &dump.links);
+
+out:
+    sweep_ns_release(&dump);
+    ethtool_netns_put(state, ns);
+    return ret;
+}
+
+static int column_getbuffer(PyEthtoolColumn *self, Py_buffer *view,
+                            int flags)
+{
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "ethtool.Column is read-only");
+        return -1;
+    }
+    view->buf = self->data;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = self->len * self->itemsize;
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->len : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES
+                    ? &self->itemsize : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static Py_ssize_t column_length(PyEthtoolColumn *self)
+{
+    return self->len;
+}
+
+static PyObject *column_repr(PyEthtoolColumn *self)
+{
+    return PyStr_FromFormat("<ethtool.Column of %zd '%s'>", self->len,
+                            self->format);
+}
+
+static void column_dealloc(PyEthtoolColumn *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+    free(self->data);
+    type->tp_free((PyObject *)self);
+    ethtool_type_decref(type);
+}
+
+static const char column_doc[] =
+    "Column of ethtool.snapshot_columns(): a read-only array of the "
+    "interfaces, exposed through the buffer protocol for memoryview() or "
+    "numpy.asarray() to wrap without copying.";
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+static PyType_Slot column_slots[] = {
+    {Py_tp_dealloc, column_dealloc},
+    {Py_tp_repr, column_repr},
+    {Py_tp_doc, (void *)column_doc},
+    {Py_sq_length, column_length},
+    {Py_bf_getbuffer, column_getbuffer},
+    {0, NULL}
+};
+
+PyType_Spec PyEthtoolColumn_Spec = {
+    .name = "ethtool.Column",
+    .basicsize = sizeof(PyEthtoolColumn),
+    .flags = Py_TPFLAGS_DEFAULT | ETHTOOL_TPFLAGS_IMMUTABLE,
+    .slots = column_slots,
+};
+#else
+static PySequenceMethods column_as_sequence = {
+    .sq_length = (lenfunc)column_length,
+};
+
+static PyBufferProcs column_as_buffer = {
+    .bf_getbuffer = (getbufferproc)column_getbuffer,
+};
+
+#ifndef Py_TPFLAGS_HAVE_NEWBUFFER
+#define Py_TPFLAGS_HAVE_NEWBUFFER 0
+#endif
+
+PyTypeObject PyEthtoolColumn_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ethtool.Column",
+    .tp_basicsize = sizeof(PyEthtoolColumn),
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+    .tp_dealloc = (destructor)column_dealloc,
+    .tp_repr = (reprfunc)column_repr,
+    .tp_as_sequence = &column_as_sequence,
+    .tp_as_buffer = &column_as_buffer,
+    .tp_doc = column_doc,
+};
+#endif
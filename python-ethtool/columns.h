@@ -0,0 +1,30 @@
+/*
+ * columns.h - Columnar snapshots of the interfaces of a namespace
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _COLUMNS_H
+#define _COLUMNS_H
+
+#include <Python.h>
+
+#include "fastcall.h"
+#include "modstate.h"
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+extern PyType_Spec PyEthtoolColumn_Spec;
+#else
+extern PyTypeObject PyEthtoolColumn_Type;
+#endif
+
+PyObject *snapshot_columns(PyObject *self, FASTCALL_PARAMS);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * device.h - Requests on a single device and the ethtool.Device class
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _DEVICE_H
+#define _DEVICE_H
+
+#include <Python.h>
+#include <sys/socket.h>
+#include <linux/if.h>
+
+#include "modstate.h"
+
+/**
+ * Control socket and request structure of a device.  Only ifr_name is
+ * preserved between requests, every request fills in the rest of ifr.
+ */
+struct dev_req {
+    int fd;
+    struct ifreq ifr;
+};
+
+/**
+ * A request on a device, as done by both the module functions and the
+ * ethtool.Device methods
+ *
+ * @param req    The device
+ * @param value  The value to set for setters, NULL for getters
+ *
+ * @return New reference to the result, NULL with a Python exception set on
+ *         failure
+ */
+typedef PyObject *(*dev_op)(struct dev_req *req, PyObject *value);
+
+int dev_socket(void);
+void dev_req_set_name(struct dev_req *req, const char *devname);
+const char *dev_name_as_string(PyObject *name);
+
+PyObject *dev_get_hwaddr(struct dev_req *req, PyObject *value);
+PyObject *dev_get_ipaddr(struct dev_req *req, PyObject *value);
+PyObject *dev_get_flags(struct dev_req *req, PyObject *value);
+PyObject *dev_get_netmask(struct dev_req *req, PyObject *value);
+PyObject *dev_get_broadcast(struct dev_req *req, PyObject *value);
+PyObject *dev_get_module(struct dev_req *req, PyObject *value);
+PyObject *dev_get_businfo(struct dev_req *req, PyObject *value);
+PyObject *dev_get_tso(struct dev_req *req, PyObject *value);
+PyObject *dev_set_tso(struct dev_req *req, PyObject *value);
+PyObject *dev_get_ufo(struct dev_req *req, PyObject *value);
+PyObject *dev_get_gso(struct dev_req *req, PyObject *value);
+PyObject *dev_set_gso(struct dev_req *req, PyObject *value);
+PyObject *dev_get_gro(struct dev_req *req, PyObject *value);
+PyObject *dev_set_gro(struct dev_req *req, PyObject *value);
+PyObject *dev_get_sg(struct dev_req *req, PyObject *value);
+PyObject *dev_get_wireless_protocol(struct dev_req *req, PyObject *value);
+PyObject *dev_get_coalesce(struct dev_req *req, PyObject *value);
+PyObject *dev_set_coalesce(struct dev_req *req, PyObject *value);
+PyObject *dev_get_ringparam(struct dev_req *req, PyObject *value);
+PyObject *dev_set_ringparam(struct dev_req *req, PyObject *value);
+PyObject *dev_get_link_settings(struct dev_req *req, PyObject *value);
+PyObject *dev_set_link_settings(struct dev_req *req, PyObject *value);
+PyObject *dev_get_ts_info(struct dev_req *req, PyObject *value);
+
+struct ethtool_coalesce;
+struct ethtool_ringparam;
+PyObject *coalesce_to_dict(struct ethtool_coalesce *coal);
+PyObject *ringparam_to_dict(struct ethtool_ringparam *ring);
+
+/** ethtool.Device object */
+typedef struct {
+    PyObject_HEAD
+    struct ethtool_state *state;  /**< Module the class belongs to */
+    PyObject *name;  /**< Current device name, a Python string */
+    int ifindex;  /**< Interface index the object is bound to */
+    struct dev_req req;  /**< fd is -1 once the object is closed */
+} PyEthtoolDevice;
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+extern PyType_Spec PyEthtoolDevice_Spec;
+#else
+extern PyTypeObject PyEthtoolDevice_Type;
+#endif
+
+#endif
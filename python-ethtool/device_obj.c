@@ -0,0 +1,548 @@
+/*
+ * device_obj.c - ethtool.Device class
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+/**
+ * @file   device_obj.c
+ *
+ * @brief  A handle on a single device.  The interface index, the request
+ *         structure and a control socket are set up once, so polling a
+ *         device only costs the ioctl() calls themselves.  The handle is
+ *         bound to the interface index: renames are followed, requests on
+ *         a device which has been removed (or removed and created again)
+ *         fail with ENODEV until refresh() is called.
+ */
+
+#include <Python.h>
+#include "include/py3c/compat.h"
+#include "structmember.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "device.h"
+#include "fastcall.h"
+#include "modstate.h"
+#include "netns.h"
+#include "perfcounters.h"
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+/*
+ * The object may be used by several threads, which a free-threaded build of
+ * Python runs in parallel.  Everything changing the object or its request
+ * structure is done in a critical section on the object.
+ */
+
+/* Sets the name of the device, both in the object and in the request */
+static int device_set_name(PyEthtoolDevice *self, const char *name)
+{
+    PyObject *pyname = PyStr_FromString(name);
+    PyObject *old = self->name;
+
+    if (pyname == NULL) {
+        return -1;
+    }
+    /* The name attribute is read without the critical section */
+    ethtool_store_ptr(&self->name, pyname);
+    Py_XDECREF(old);
+    dev_req_set_name(&self->req, name);
+    return 0;
+}
+
+/**
+ * Binds the object to the device currently called name
+ *
+ * @return Returns 0 on success, otherwise -1 with a Python exception set.
+ */
+static int device_bind_name(PyEthtoolDevice *self, const char *name)
+{
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ);
+    ifr.ifr_name[IFNAMSIZ - 1] = 0;
+
+    perf_count(ioctls, 1);
+    if (ioctl(self->req.fd, SIOCGIFINDEX, &ifr) < 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+
+    self->ifindex = ifr.ifr_ifindex;
+    return device_set_name(self, ifr.ifr_name);
+}
+
+/**
+ * Binds the object to the device with interface index ifindex
+ *
+ * @return Returns 0 on success, otherwise -1 with a Python exception set.
+ */
+static int device_bind_index(PyEthtoolDevice *self, int ifindex)
+{
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_ifindex = ifindex;
+
+    perf_count(ioctls, 1);
+    if (ioctl(self->req.fd, SIOCGIFNAME, &ifr) < 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+
+    self->ifindex = ifindex;
+    return device_set_name(self, ifr.ifr_name);
+}
+
+/**
+ * Makes sure the object still refers to the device it was bound to before
+ * a request is made.  The name is looked up first, which is a single
+ * ioctl() when nothing changed; if it now belongs to another interface (or
+ * none), the device has either been renamed, in which case the new name is
+ * used, or it is gone.
+ *
+ * @return Returns 0 if the request can go ahead, otherwise -1 with a Python
+ *         exception set.
+ */
+static int device_check(PyEthtoolDevice *self)
+{
+    struct ifreq ifr;
+    PyObject *err_args;
+    int err;
+
+    if (self->req.fd < 0) {
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed device");
+        return -1;
+    }
+
+    memcpy(ifr.ifr_name, self->req.ifr.ifr_name, IFNAMSIZ);
+    perf_count(ioctls, 1);
+    err = ioctl(self->req.fd, SIOCGIFINDEX, &ifr);
+    if (err == 0 && ifr.ifr_ifindex == self->ifindex) {
+        return 0;
+    }
+    if (err < 0 && errno != ENODEV) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_ifindex = self->ifindex;
+    perf_count(ioctls, 1);
+    if (ioctl(self->req.fd, SIOCGIFNAME, &ifr) == 0) {
+        /* Renamed */
+        return device_set_name(self, ifr.ifr_name);
+    }
+
+    err_args = Py_BuildValue("(is)", ENODEV, "Device was removed or replaced");
+    if (err_args != NULL) {
+        PyErr_SetObject(PyExc_IOError, err_args);
+        Py_DECREF(err_args);
+    }
+    return -1;
+}
+
+/**
+ * Runs a request on the device
+ *
+ * @param self        The device
+ * @param fname       Name of the method, for error messages
+ * @param args        Method arguments: the value to set for setters, by
+ * @param nargs       position or by name, nothing for getters
+ * @param kwnames
+ * @param value_name  Name of the value parameter of setters, NULL for getters
+ * @param op          The request
+ *
+ * @return The result of op
+ */
+static PyObject *device_call(PyEthtoolDevice *self, const char *fname,
+                             PyObject *const *args, Py_ssize_t nargs,
+                             PyObject *kwnames, const char *value_name,
+                             dev_op op)
+{
+    PyObject *value = NULL;
+    PyObject *ret = NULL;
+
+    if (fastcall_unpack(fname, args, nargs, kwnames, &value_name,
+                        value_name ? 1 : 0, value_name ? 1 : 0, &value) < 0)
+        return NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (device_check(self) == 0) {
+        ret = op(&self->req, value);
+    }
+    Py_END_CRITICAL_SECTION();
+
+    return ret;
+}
+
+/**
+ * Defines device_<fn>(), the method fn() taking the value parameter
+ * value_name for setters, running dev_<fn>() on the device.  Calls are
+ * accounted like the module function.
+ */
+#define DEVICE_METHOD(fn, value_name, api) \
+    PERF_WRAPPER(device_##fn, api, device_call, \
+                 (PyEthtoolDevice *self, FASTCALL_PARAMS), \
+                 (self, #fn, FASTCALL_ARGS, FASTCALL_NARGS, \
+                  FASTCALL_KWNAMES, value_name, dev_##fn), \
+                 &self->state->perf, self->name)
+
+DEVICE_METHOD(get_module, NULL, PERF_API_GET_MODULE)
+DEVICE_METHOD(get_businfo, NULL, PERF_API_GET_BUSINFO)
+DEVICE_METHOD(get_hwaddr, NULL, PERF_API_GET_HWADDR)
+DEVICE_METHOD(get_ipaddr, NULL, PERF_API_GET_IPADDR)
+DEVICE_METHOD(get_netmask, NULL, PERF_API_GET_NETMASK)
+DEVICE_METHOD(get_broadcast, NULL, PERF_API_GET_BROADCAST)
+DEVICE_METHOD(get_coalesce, NULL, PERF_API_GET_COALESCE)
+DEVICE_METHOD(set_coalesce, "settings", PERF_API_SET_COALESCE)
+DEVICE_METHOD(get_ringparam, NULL, PERF_API_GET_RINGPARAM)
+DEVICE_METHOD(set_ringparam, "settings", PERF_API_SET_RINGPARAM)
+DEVICE_METHOD(get_tso, NULL, PERF_API_GET_TSO)
+DEVICE_METHOD(set_tso, "value", PERF_API_SET_TSO)
+DEVICE_METHOD(get_ufo, NULL, PERF_API_GET_UFO)
+DEVICE_METHOD(get_gso, NULL, PERF_API_GET_GSO)
+DEVICE_METHOD(set_gso, "value", PERF_API_SET_GSO)
+DEVICE_METHOD(get_gro, NULL, PERF_API_GET_GRO)
+DEVICE_METHOD(set_gro, "value", PERF_API_SET_GRO)
+DEVICE_METHOD(get_sg, NULL, PERF_API_GET_SG)
+DEVICE_METHOD(get_link_settings, NULL, PERF_API_GET_LINK_SETTINGS)
+DEVICE_METHOD(set_link_settings, "settings", PERF_API_SET_LINK_SETTINGS)
+DEVICE_METHOD(get_ts_info, NULL, PERF_API_GET_TS_INFO)
+DEVICE_METHOD(get_flags, NULL, PERF_API_GET_FLAGS)
+DEVICE_METHOD(get_wireless_protocol, NULL, PERF_API_GET_WIRELESS_PROTOCOL)
+
+static PyObject *device_refresh(PyEthtoolDevice *self, PyObject *notused)
+{
+    char name[IFNAMSIZ];
+    int err = -1;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->req.fd < 0) {
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed device");
+    } else {
+        memcpy(name, self->req.ifr.ifr_name, IFNAMSIZ);
+        err = device_bind_name(self, name);
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (err < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *device_close(PyEthtoolDevice *self, PyObject *notused)
+{
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->req.fd >= 0) {
+        close(self->req.fd);
+        self->req.fd = -1;
+    }
+    Py_END_CRITICAL_SECTION();
+    Py_RETURN_NONE;
+}
+
+static PyObject *device_enter(PyEthtoolDevice *self, PyObject *notused)
+{
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *device_exit(PyEthtoolDevice *self, PyObject *args)
+{
+    return device_close(self, NULL);
+}
+
+static PyMethodDef device_methods[] = {
+    {"get_module", (PyCFunction)device_get_module,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the name of the driver"},
+    {"get_businfo", (PyCFunction)device_get_businfo,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the bus address of the device"},
+    {"get_hwaddr", (PyCFunction)device_get_hwaddr,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the hardware address"},
+    {"get_ipaddr", (PyCFunction)device_get_ipaddr,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the IPv4 address"},
+    {"get_netmask", (PyCFunction)device_get_netmask,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the IPv4 netmask"},
+    {"get_broadcast", (PyCFunction)device_get_broadcast,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the IPv4 broadcast address"},
+    {"get_coalesce", (PyCFunction)device_get_coalesce,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the interrupt coalescing settings as a dict"},
+    {"set_coalesce", (PyCFunction)device_set_coalesce,
+     METH_FASTCALL_KEYWORDS,
+     "Sets the interrupt coalescing settings from a dict"},
+    {"get_ringparam", (PyCFunction)device_get_ringparam,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the ring buffer sizes as a dict"},
+    {"set_ringparam", (PyCFunction)device_set_ringparam,
+     METH_FASTCALL_KEYWORDS,
+     "Sets the ring buffer sizes from a dict"},
+    {"get_tso", (PyCFunction)device_get_tso,
+     METH_FASTCALL_KEYWORDS,
+     "Returns whether TCP segmentation offload is enabled"},
+    {"set_tso", (PyCFunction)device_set_tso,
+     METH_FASTCALL_KEYWORDS,
+     "Enables or disables TCP segmentation offload"},
+    {"get_ufo", (PyCFunction)device_get_ufo,
+     METH_FASTCALL_KEYWORDS,
+     "Returns whether UDP fragmentation offload is enabled"},
+    {"get_gso", (PyCFunction)device_get_gso,
+     METH_FASTCALL_KEYWORDS,
+     "Returns whether generic segmentation offload is enabled"},
+    {"set_gso", (PyCFunction)device_set_gso,
+     METH_FASTCALL_KEYWORDS,
+     "Enables or disables generic segmentation offload"},
+    {"get_gro", (PyCFunction)device_get_gro,
+     METH_FASTCALL_KEYWORDS,
+     "Returns whether generic receive offload is enabled"},
+    {"set_gro", (PyCFunction)device_set_gro,
+     METH_FASTCALL_KEYWORDS,
+     "Enables or disables generic receive offload"},
+    {"get_sg", (PyCFunction)device_get_sg,
+     METH_FASTCALL_KEYWORDS,
+     "Returns whether scatter-gather is enabled"},
+    {"get_link_settings", (PyCFunction)device_get_link_settings,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the link settings as a dict, see ethtool.get_link_settings()"},
+    {"set_link_settings", (PyCFunction)device_set_link_settings,
+     METH_FASTCALL_KEYWORDS,
+     "Applies link settings from a dict, see ethtool.set_link_settings()"},
+    {"get_ts_info", (PyCFunction)device_get_ts_info,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the time stamping capabilities, see ethtool.get_ts_info()"},
+    {"get_flags", (PyCFunction)device_get_flags,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the IFF_* interface flags"},
+    {"get_wireless_protocol", (PyCFunction)device_get_wireless_protocol,
+     METH_FASTCALL_KEYWORDS,
+     "Returns the wireless protocol name"},
+    {"refresh", (PyCFunction)device_refresh, METH_NOARGS,
+     "Binds the object to the device now having its name, after the "
+     "device it referred to was removed or replaced"},
+    {"close", (PyCFunction)device_close, METH_NOARGS,
+     "Closes the control socket"},
+    {"__enter__", (PyCFunction)device_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction)device_exit, METH_VARARGS, NULL},
+    {NULL}
+};
+
+static PyMemberDef device_members[] = {
+    {"name", T_OBJECT, offsetof(PyEthtoolDevice, name), READONLY,
+     "Current name of the device"},
+    {"ifindex", T_INT, offsetof(PyEthtoolDevice, ifindex), READONLY,
+     "Interface index of the device"},
+    {NULL}
+};
+
+static PyObject *device_new(PyTypeObject *type, PyObject *args __unused,
+                            PyObject *kwds __unused)
+{
+    struct ethtool_state *state = ethtool_type_state(type);
+    PyEthtoolDevice *self;
+
+    if (state == NULL)
+        return NULL;
+
+    self = (PyEthtoolDevice *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+        self->state = state;
+        self->name = NULL;
+        self->ifindex = 0;
+        self->req.fd = -1;
+    }
+    return (PyObject *)self;
+}
+
+/**
+ * Opens a control socket in a network namespace
+ *
+ * @param netns  The netns argument, NULL or None for the current namespace
+ *
+ * @return Returns the socket, otherwise -1 with a Python exception set.
+ */
+static int device_socket(struct ethtool_state *state, PyObject *netns)
+{
+    struct ethtool_netns *ns;
+    int fd;
+
+    if (ethtool_netns_get(state, netns, &ns) < 0)
+        return -1;
+    if (ns == NULL)
+        return dev_socket();
+
+    /* The object owns its socket, the namespace cache may close its own */
+    fd = fcntl(ns->ctl_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0)
+        PyErr_SetFromErrno(PyExc_OSError);
+    ethtool_netns_put(state, ns);
+    return fd;
+}
+
+/* Binds the object to device, using the control socket the object has */
+static int device_bind(PyEthtoolDevice *self, PyObject *device)
+{
+    int err;
+
+    if (PyStr_Check(device)) {
+        const char *name = dev_name_as_string(device);
+
+        if (name == NULL)
+            return -1;
+        err = device_bind_name(self, name);
+    } else {
+        Py_ssize_t ifindex;
+
+        if (!PyIndex_Check(device)) {
+            PyErr_SetString(PyExc_TypeError,
+                            "Device() argument must be a device name or an "
+                            "interface index");
+            return -1;
+        }
+        ifindex = PyNumber_AsSsize_t(device, NULL);
+        if (ifindex == -1 && PyErr_Occurred())
+            return -1;
+        if (ifindex <= 0 || ifindex > INT_MAX) {
+            errno = ENODEV;
+            PyErr_SetFromErrno(PyExc_IOError);
+            return -1;
+        }
+        err = device_bind_index(self, ifindex);
+    }
+
+    return err;
+}
+
+static int device_init(PyEthtoolDevice *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "device", "netns", NULL };
+    PyObject *device, *netns = NULL;
+    int fd, err;
+
+    /* netns is keyword-only where the Python version can tell */
+#if PY_MAJOR_VERSION >= 3
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|$O:Device", kwlist,
+                                     &device, &netns))
+        return -1;
+#else
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:Device", kwlist,
+                                     &device, &netns))
+        return -1;
+#endif
+
+    fd = device_socket(self->state, netns);
+    if (fd < 0)
+        return -1;
+
+    /* __init__() may be called again, on an object in use, which keeps its
+     * socket unless the new device is found */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    {
+        int old_fd = self->req.fd;
+
+        self->req.fd = fd;
+        err = device_bind(self, device);
+        if (err < 0) {
+            self->req.fd = old_fd;
+            fd = -1;
+        } else {
+            fd = old_fd;
+        }
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (fd >= 0)
+        close(fd);
+    return err;
+}
+
+static void device_dealloc(PyEthtoolDevice *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+    if (self->req.fd >= 0)
+        close(self->req.fd);
+    Py_XDECREF(self->name);
+    type->tp_free((PyObject *)self);
+    ethtool_type_decref(type);
+}
+
+static PyObject *device_repr(PyEthtoolDevice *self)
+{
+    PyObject *ret;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    ret = PyStr_FromFormat("<ethtool.Device %s ifindex %d%s>",
+                           self->name ? PyStr_AsString(self->name) : "?",
+                           self->ifindex,
+                           self->req.fd < 0 ? " (closed)" : "");
+    Py_END_CRITICAL_SECTION();
+    return ret;
+}
+
+static const char device_doc[] =
+    "Device(name_or_ifindex, *, netns=None)\n\n"
+    "Handle on a network device, with the same getters and setters as the "
+    "module functions taking a device name.  The interface index and a "
+    "control socket are set up once, in the network namespace netns if "
+    "given.  The handle follows renames of the device; once the device is "
+    "removed (or removed and created again under the same name) requests "
+    "fail with ENODEV until refresh() is called.";
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+static PyType_Slot device_slots[] = {
+    {Py_tp_new, device_new},
+    {Py_tp_init, device_init},
+    {Py_tp_dealloc, device_dealloc},
+    {Py_tp_repr, device_repr},
+    {Py_tp_methods, device_methods},
+    {Py_tp_members, device_members},
+    {Py_tp_doc, (void *)device_doc},
+    {0, NULL}
+};
+
+PyType_Spec PyEthtoolDevice_Spec = {
+    .name = "ethtool.Device",
+    .basicsize = sizeof(PyEthtoolDevice),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE
+             | ETHTOOL_TPFLAGS_IMMUTABLE,
+    .slots = device_slots,
+};
+#else
+PyTypeObject PyEthtoolDevice_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ethtool.Device",
+    .tp_basicsize = sizeof(PyEthtoolDevice),
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .tp_new = device_new,
+    .tp_init = (initproc)device_init,
+    .tp_dealloc = (destructor)device_dealloc,
+    .tp_repr = (reprfunc)device_repr,
+    .tp_methods = device_methods,
+    .tp_members = device_members,
+    .tp_doc = device_doc,
+};
+#endif
@@ -35,8 +35,11 @@
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <net/if.h>
 #include "etherinfo_struct.h"
 #include "etherinfo.h"
+#include "perfcounters.h"
+#include "rtnetlink.h"
 
 /*
  *
@@ -73,22 +76,33 @@ static void callback_nl_link(struct nl_object *obj, void *arg)
 }
 
 
+/** Where callback_nl_address() and callback_msg_address() save the
+ *  addresses */
+struct nl_address_arg {
+    struct ethtool_state *state;  /**< Module creating the address objects */
+    PyObject *addrlist;  /**< Python list of addresses */
+    int index;  /**< Interface whose addresses are wanted */
+    int family;  /**< Address family wanted */
+};
+
 /**
  *  libnl callback function.  Does the real parsing of a record returned by
  *  NETLINK.  This function parses ADDRESS related packets
  *
  * @param obj   Pointer to a struct nl_object response
- * @param arg   Pointer to a struct etherinfo element where the parse result
+ * @param arg   Pointer to a struct nl_address_arg where the parse result
  *              will be saved
  */
 static void callback_nl_address(struct nl_object *obj, void *arg)
 {
-    PyObject *py_addrlist = (PyObject *) arg;
+    struct nl_address_arg *nl_arg = (struct nl_address_arg *) arg;
+    PyObject *py_addrlist = nl_arg->addrlist;
     struct rtnl_addr *rtaddr = (struct rtnl_addr *) obj;
     PyObject *addr_obj = NULL;
     int af_family = -1;
 
-    if (py_addrlist == NULL) {
+    /* Stop at the first error, it is raised once the loop is done */
+    if (py_addrlist == NULL || PyErr_Occurred()) {
         return;
     }
 
@@ -101,7 +115,7 @@ static void callback_nl_address(struct nl_object *obj, void *arg)
     }
 
     /* Prepare a new Python object with the IP address */
-    addr_obj = make_python_address_from_rtnl_addr(rtaddr);
+    addr_obj = make_python_address_from_rtnl_addr(nl_arg->state, rtaddr);
     if (!addr_obj) {
         return;
     }
@@ -111,6 +125,148 @@ static void callback_nl_address(struct nl_object *obj, void *arg)
 }
 
 
+/**
+ * Formats a hardware address the way nl_addr2str() does for a libnl link,
+ * whose address family libnl guesses from the length
+ *
+ * @param buf   Where to write it, of HWADDR_STRLEN bytes
+ * @param addr  The address
+ * @param len   Its length, 0 if the link has none
+ */
+void format_hwaddr_buf(char *buf, const unsigned char *addr, int len)
+{
+    char *p;
+    int i;
+
+    if (len == 0) {
+        strcpy(buf, "none");
+        return;
+    }
+    if (len == 4 || len == 16) {
+        inet_ntop(len == 4 ? AF_INET : AF_INET6, addr, buf, HWADDR_STRLEN);
+        return;
+    }
+
+    /* MAX_ADDR_LEN bytes at most, which fit */
+    p = buf;
+    *p = '\0';
+    for (i = 0; i < len && p + 4 <= buf + HWADDR_STRLEN; i++) {
+        p += sprintf(p, i ? ":%02x" : "%02x", addr[i]);
+    }
+}
+
+/**
+ * Formats a hardware address, see format_hwaddr_buf()
+ *
+ * @return Returns a Python string, NULL on error
+ */
+PyObject *format_hwaddr_data(const unsigned char *addr, int len)
+{
+    char hwaddr[HWADDR_STRLEN];
+
+    format_hwaddr_buf(hwaddr, addr, len);
+    return PyStr_FromString(hwaddr);
+}
+
+/**
+ * Formats the hardware address of a link, see format_hwaddr_data()
+ *
+ * @param rta  IFLA_ADDRESS attribute, NULL if the link has none
+ *
+ * @return Returns a Python string, NULL on error
+ */
+PyObject *format_hwaddr(struct rtattr *rta)
+{
+    if (rta == NULL) {
+        return format_hwaddr_data(NULL, 0);
+    }
+    return format_hwaddr_data(RTA_DATA(rta), RTA_PAYLOAD(rta));
+}
+
+/**
+ * rtnetlink_query() handler parsing the RTM_NEWLINK answer to a request for
+ * a single link.  It saves the interface index of a device looked up by
+ * name, and its hardware address unless it is known already.
+ *
+ * @param nlh   The message
+ * @param arg   Pointer to the PyEtherInfo object of the device
+ */
+static void callback_msg_link(struct nlmsghdr *nlh, void *arg)
+{
+    PyEtherInfo *ethi = (PyEtherInfo *) arg;
+    struct ifinfomsg *ifi;
+    struct rtattr *tb[IFLA_ADDRESS + 1];
+
+    /* Nothing to forget when the link is asked for again: it is only used
+     * once a message for it has been read completely */
+    if (nlh == NULL) {
+        return;
+    }
+    ifi = NLMSG_DATA(nlh);
+    if (nlh->nlmsg_type != RTM_NEWLINK
+            || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi))
+            || PyErr_Occurred()) {
+        return;
+    }
+    if (ethi->index < 0) {
+        ethi->index = ifi->ifi_index;
+    }
+    if (ethi->hwaddress != NULL || ifi->ifi_index != ethi->index) {
+        return;
+    }
+
+    rtnetlink_parse_attrs(tb, IFLA_ADDRESS, IFLA_RTA(ifi),
+                          IFLA_PAYLOAD(nlh));
+    ethi->hwaddress = format_hwaddr(tb[IFLA_ADDRESS]);
+}
+
+/**
+ * rtnetlink_query() handler parsing the RTM_NEWADDR messages of an address
+ * dump, like callback_nl_address() does with the libnl objects
+ *
+ * @param nlh   The message
+ * @param arg   Pointer to a struct nl_address_arg where the parse result
+ *              will be saved
+ */
+static void callback_msg_address(struct nlmsghdr *nlh, void *arg)
+{
+    struct nl_address_arg *nl_arg = (struct nl_address_arg *) arg;
+    struct ifaddrmsg *ifa;
+    struct rtattr *tb[IFA_BROADCAST + 1];
+    PyObject *addr_obj;
+
+    /* Stop at the first error, it is raised once the dump is read */
+    if (nl_arg->addrlist == NULL || PyErr_Occurred()) {
+        return;
+    }
+    /* The dump is read again, start over */
+    if (nlh == NULL) {
+        PyList_SetSlice(nl_arg->addrlist, 0, PyList_GET_SIZE(nl_arg->addrlist),
+                        NULL);
+        return;
+    }
+    ifa = NLMSG_DATA(nlh);
+    if (nlh->nlmsg_type != RTM_NEWADDR
+            || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa))) {
+        return;
+    }
+    /* Without strict checking the kernel dumps the addresses of all
+     * interfaces */
+    if ((int) ifa->ifa_index != nl_arg->index
+            || ifa->ifa_family != nl_arg->family) {
+        return;
+    }
+
+    rtnetlink_parse_attrs(tb, IFA_BROADCAST, IFA_RTA(ifa), IFA_PAYLOAD(nlh));
+    addr_obj = make_python_address_from_ifaddrmsg(nl_arg->state, ifa, tb);
+    if (!addr_obj) {
+        return;
+    }
+    PyList_Append(nl_arg->addrlist, addr_obj);
+    Py_DECREF(addr_obj);
+}
+
+
 /**
  * Sets the etherinfo.index member to the corresponding device set in
  * etherinfo.device
@@ -118,11 +274,12 @@ static void callback_nl_address(struct nl_object *obj, void *arg)
  * @param self A pointer the current PyEtherInfo Python object which contains
  *             the device name and the place where to save the corresponding
  *             index value.
+ * @param nlc  libnl socket of a connection taken with open_netlink()
  *
  * @return Returns 1 on success, otherwise 0.  On error, a Python error
  *         exception is set.
  */
-static int _set_device_index(PyEtherInfo *self)
+static int _set_device_index(PyEtherInfo *self, struct nl_sock *nlc)
 {
     struct nl_cache *link_cache;
     struct rtnl_link *link;
@@ -132,7 +289,9 @@ static int _set_device_index(PyEtherInfo *self)
      * interface index if we have that
      */
     if (self->index < 0) {
-        if ((errno = rtnl_link_alloc_cache(get_nlc(),
+        perf_count(netlink_dumps, 1);
+        perf_count(cache_allocs, 1);
+        if ((errno = rtnl_link_alloc_cache(nlc,
                                            AF_UNSPEC, &link_cache)) < 0) {
             PyErr_SetString(PyExc_OSError, nl_geterror(errno));
             return 0;
@@ -160,6 +319,195 @@ static int _set_device_index(PyEtherInfo *self)
 }
 
 
+/*
+ * The native reader of rtnetlink.c.  These functions return 1 on success,
+ * 0 with a Python exception set on errors, and NATIVE_FALLBACK if the
+ * request is to be left to libnl.
+ */
+#define NATIVE_FALLBACK -1
+
+/* Raises the error for a dump which was still interrupted after all
+ * retries */
+static void raise_interrupted(void)
+{
+    PyObject *args;
+
+    args = Py_BuildValue("(is)", EINTR,
+                         "NETLINK dump interrupted by concurrent changes");
+    if (args != NULL) {
+        PyErr_SetObject(PyExc_OSError, args);
+        Py_DECREF(args);
+    }
+}
+
+/* Raises the error the native reader failed with, or tells to fall back to
+ * libnl for errors the reader may be the cause of */
+static int native_error(int err)
+{
+    switch (err) {
+    case -EMSGSIZE:  /* A message did not fit into the buffer */
+    case -EINVAL:  /* The kernel does not understand the request */
+    case -EOPNOTSUPP:
+    case -EBADMSG:
+        return NATIVE_FALLBACK;
+
+    case -ENODEV:
+        errno = ENODEV;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return 0;
+
+    case -EINTR:  /* Still interrupted after all retries */
+        raise_interrupted();
+        return 0;
+
+    default:
+        errno = -err;
+        PyErr_SetFromErrno(PyExc_OSError);
+        return 0;
+    }
+}
+
+/**
+ * Asks for the link of a device, by its index if it is known, by its name
+ * otherwise, see callback_msg_link()
+ *
+ * @return Returns 0 on success, otherwise a negative errno
+ */
+static int native_query_link(PyEtherInfo *self, struct nl_connection *nlc)
+{
+    struct rtnetlink_request req;
+    const char *name;
+
+    rtnetlink_request_init(&req, RTM_GETLINK, 0, sizeof(req.u.ifi));
+    req.u.ifi.ifi_family = AF_UNSPEC;
+    if (self->index > 0) {
+        req.u.ifi.ifi_index = self->index;
+    } else {
+        name = PyStr_AsString(self->device);
+        if (name == NULL || strlen(name) >= IFNAMSIZ) {
+            return -ENODEV;
+        }
+        rtnetlink_request_attr(&req, IFLA_IFNAME, name, strlen(name) + 1);
+    }
+#ifdef RTEXT_FILTER_SKIP_STATS
+    {
+        /* The statistics make up most of the message */
+        __u32 mask = RTEXT_FILTER_SKIP_STATS;
+
+        rtnetlink_request_attr(&req, IFLA_EXT_MASK, &mask, sizeof(mask));
+    }
+#endif
+    return rtnetlink_query(nlc, &req, callback_msg_link, self);
+}
+
+/**
+ * _set_device_index() for the native reader, which looks the device up by
+ * name instead of dumping all links
+ */
+static int _native_set_device_index(PyEtherInfo *self,
+                                    struct nl_connection *nlc)
+{
+    int err;
+
+    if (self->index < 0) {
+        err = native_query_link(self, nlc);
+        if (err < 0) {
+            return native_error(err);
+        }
+        if (PyErr_Occurred()) {
+            return 0;
+        }
+        if (self->index <= 0) {
+            errno = ENODEV;
+            PyErr_SetFromErrno(PyExc_IOError);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** _get_etherinfo_link() for the native reader */
+static int _native_get_etherinfo_link(PyEtherInfo *self,
+                                      struct nl_connection *nlc)
+{
+    int err;
+
+    /* Looking the device up reads its hardware address too */
+    if (self->index < 0) {
+        return _native_set_device_index(self, nlc);
+    }
+    if (self->hwaddress != NULL) {
+        return 1;
+    }
+
+    err = native_query_link(self, nlc);
+    /* A device which is gone has no address, as in the libnl dump */
+    if (err < 0 && err != -ENODEV) {
+        return native_error(err);
+    }
+    return PyErr_Occurred() ? 0 : 1;
+}
+
+/**
+ * _get_etherinfo_address() for the native reader
+ *
+ * @param addrlist  Where to store the list of addresses on success
+ */
+static int _native_get_etherinfo_address(PyEtherInfo *self,
+                                         struct nl_connection *nlc,
+                                         nlQuery query, PyObject **addrlist)
+{
+    struct rtnetlink_request req;
+    struct nl_address_arg nl_arg;
+    int family = query == NLQRY_ADDR4 ? AF_INET : AF_INET6;
+    int ret, err;
+
+    ret = _native_set_device_index(self, nlc);
+    if (ret != 1) {
+        return ret;
+    }
+
+    nl_arg.state = self->state;
+    nl_arg.addrlist = PyList_New(0);
+    nl_arg.index = self->index;
+    nl_arg.family = family;
+    if (nl_arg.addrlist == NULL) {
+        return 0;
+    }
+
+    rtnetlink_request_init(&req, RTM_GETADDR, NLM_F_DUMP, sizeof(req.u.ifa));
+    req.u.ifa.ifa_family = family;
+    /* With strict checking, the kernel only dumps the addresses of the
+     * device.  It does not flag such dumps as interrupted, though, which
+     * only matters if they take several parts: the addresses of all devices
+     * are dumped then. */
+    if (!(self->split_dumps & (1 << query)) && rtnetlink_set_strict(nlc, 1)) {
+        req.u.ifa.ifa_index = self->index;
+        req.one_part = 1;
+    }
+    err = rtnetlink_query(nlc, &req, callback_msg_address, &nl_arg);
+    if (err == -EAGAIN) {
+        self->split_dumps |= 1 << query;
+        callback_msg_address(NULL, &nl_arg);
+        req.u.ifa.ifa_index = 0;
+        req.one_part = 0;
+        err = rtnetlink_query(nlc, &req, callback_msg_address, &nl_arg);
+    }
+
+    /* A device which is gone has no addresses, as in the libnl dump */
+    if (err < 0 && err != -ENODEV) {
+        Py_DECREF(nl_arg.addrlist);
+        return native_error(err);
+    }
+    if (PyErr_Occurred()) {
+        Py_DECREF(nl_arg.addrlist);
+        return 0;
+    }
+    *addrlist = nl_arg.addrlist;
+    return 1;
+}
+
+
 /*
  *
  *   Exported functions - API frontend
@@ -167,37 +515,28 @@ static int _set_device_index(PyEtherInfo *self)
  */
 
 /**
- * Populate the PyEtherInfo Python object with link information for the current
- * device
+ * Does the work of get_etherinfo_link() with a NETLINK connection
  *
  * @param self  Pointer to the device object, a PyEtherInfo Python object
+ * @param nlc   libnl socket of a connection taken with open_netlink()
  *
  * @return Returns 1 on success, otherwise 0
  */
-int get_etherinfo_link(PyEtherInfo *self)
+static int _get_etherinfo_link(PyEtherInfo *self, struct nl_sock *nlc)
 {
     struct nl_cache *link_cache;
     struct rtnl_link *link;
     int err = 0;
 
-    if (!self) {
-        return 0;
-    }
-
-    /* Open a NETLINK connection on-the-fly */
-    if (!open_netlink(self)) {
-        PyErr_Format(PyExc_RuntimeError,
-                     "Could not open a NETLINK connection for %s",
-                     PyStr_AsString(self->device));
-        return 0;
-    }
-
-    if (_set_device_index(self) != 1) {
+    if (_set_device_index(self, nlc) != 1) {
         return 0;
     }
 
     /* Extract MAC/hardware address of the interface */
-    if ((err = rtnl_link_alloc_cache(get_nlc(), AF_UNSPEC, &link_cache)) < 0) {
+    perf_count(netlink_dumps, 1);
+    perf_count(cache_allocs, 1);
+    if ((err = rtnl_link_alloc_cache(nlc, AF_UNSPEC,
+                                     &link_cache)) < 0) {
         PyErr_SetString(PyExc_OSError, nl_geterror(err));
         return 0;
     }
@@ -205,6 +544,7 @@ int get_etherinfo_link(PyEtherInfo *self)
     if (!link) {
         errno = ENOMEM;
         PyErr_SetFromErrno(PyExc_OSError);
+        nl_cache_free(link_cache);
         return 0;
     }
     rtnl_link_set_ifindex(link, self->index);
@@ -216,46 +556,103 @@ int get_etherinfo_link(PyEtherInfo *self)
     return 1;
 }
 
+/**
+ * Populate the PyEtherInfo Python object with link information for the current
+ * device
+ *
+ * @param self  Pointer to the device object, a PyEtherInfo Python object
+ *
+ * @return Returns 1 on success, otherwise 0
+ */
+int get_etherinfo_link(PyEtherInfo *self)
+{
+    struct nl_connection *nlc;
+    int ret = 0;
+
+    if (!self) {
+        return 0;
+    }
+
+    /* Threads may query the same object in parallel */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    /* Open a NETLINK connection on-the-fly */
+    nlc = open_netlink(self);
+    if (nlc == NULL) {
+        PyErr_Format(PyExc_RuntimeError,
+                     "Could not open a NETLINK connection for %s",
+                     PyStr_AsString(self->device));
+    } else {
+        ret = NATIVE_FALLBACK;
+        if (!ethtool_load_flag(&self->state->netlink_libnl)) {
+            ret = _native_get_etherinfo_link(self, nlc);
+        }
+        if (ret == NATIVE_FALLBACK) {
+            rtnetlink_set_strict(nlc, 0);
+            ret = _get_etherinfo_link(self, nlc->sock);
+        }
+        release_netlink(self, nlc);
+    }
+    Py_END_CRITICAL_SECTION();
+
+    return ret;
+}
+
 
 
 /**
- * Query NETLINK for device IP address configuration
+ * Does the work of get_etherinfo_address() with a NETLINK connection
  *
  * @param self   A PyEtherInfo Python object for the current device to retrieve
  *               IP address configuration data from
+ * @param nlc    libnl socket of a connection taken with open_netlink()
  * @param query  What to query for.  Must be NLQRY_ADDR4 for IPv4 addresses or
  *               NLQRY_ADDR6 for IPv6 addresses.
  *
  * @return Returns a Python list containing PyNetlinkIPaddress objects on
  *         success, otherwise NULL
  */
-PyObject * get_etherinfo_address(PyEtherInfo *self, nlQuery query)
+static PyObject * _get_etherinfo_address(PyEtherInfo *self,
+                                         struct nl_sock *nlc, nlQuery query)
 {
     struct nl_cache *addr_cache;
     struct rtnl_addr *addr;
+    struct nl_address_arg nl_arg;
     PyObject *addrlist = NULL;
-    int err = 0;
+    int attempt, err = 0;
 
-    if (!self) {
+    if(!_set_device_index(self, nlc)) {
         return NULL;
     }
 
-    /* Open a NETLINK connection on-the-fly */
-    if (!open_netlink(self)) {
-        PyErr_Format(PyExc_RuntimeError,
-                     "Could not open a NETLINK connection for %s",
-                     PyStr_AsString(self->device));
+    /* Query the for requested info via NETLINK */
+    /* Extract IP address information */
+    perf_count(cache_allocs, 1);
+    if ((err = nl_cache_alloc_name("route/addr", &addr_cache)) < 0) {
+        PyErr_SetString(PyExc_OSError, nl_geterror(err));
         return NULL;
     }
 
-    if(!_set_device_index(self)) {
-        return NULL;
+    /* rtnl_addr_alloc_cache() would dump again as long as the dump is
+     * interrupted, keeping what it read before */
+    for (attempt = 0; ; attempt++) {
+        perf_count(netlink_dumps, 1);
+        err = nl_rtgen_request(nlc, RTM_GETADDR, AF_UNSPEC, NLM_F_DUMP);
+        if (err >= 0) {
+            err = nl_cache_pickup(nlc, addr_cache);
+        }
+        if (err != -NLE_DUMP_INTR || attempt == RTNETLINK_RETRIES) {
+            break;
+        }
+        perf_count(netlink_retries, 1);
+        nl_cache_clear(addr_cache);
+        rtnetlink_backoff(attempt);
     }
-
-    /* Query the for requested info via NETLINK */
-    /* Extract IP address information */
-    if ((err = rtnl_addr_alloc_cache(get_nlc(), &addr_cache)) < 0) {
-        PyErr_SetString(PyExc_OSError, nl_geterror(err));
+    if (err < 0) {
+        if (err == -NLE_DUMP_INTR) {
+            raise_interrupted();
+        } else {
+            PyErr_SetString(PyExc_OSError, nl_geterror(err));
+        }
         nl_cache_free(addr_cache);
         return NULL;
     }
@@ -265,6 +662,7 @@ PyObject * get_etherinfo_address(PyEtherInfo *self, nlQuery query)
     if (!addr) {
         errno = ENOMEM;
         PyErr_SetFromErrno(PyExc_OSError);
+        nl_cache_free(addr_cache);
         return NULL;
     }
     rtnl_addr_set_ifindex(addr, self->index);
@@ -279,18 +677,74 @@ PyObject * get_etherinfo_address(PyEtherInfo *self, nlQuery query)
         break;
 
     default:
-        return NULL;
+        PyErr_SetString(PyExc_ValueError, "Unknown address query");
+        goto out;
     }
 
     /* Retrieve all address information */
     addrlist = PyList_New(0);  /* The list where to put the address object */
-    assert(addrlist);
+    if (!addrlist) {
+        goto out;
+    }
+    nl_arg.state = self->state;
+    nl_arg.addrlist = addrlist;
 
     /* Loop through all configured addresses */
     nl_cache_foreach_filter(addr_cache, OBJ_CAST(addr),
-                            callback_nl_address, addrlist);
+                            callback_nl_address, &nl_arg);
+    if (PyErr_Occurred()) {
+        Py_CLEAR(addrlist);
+    }
+
+out:
     rtnl_addr_put(addr);
     nl_cache_free(addr_cache);
 
     return addrlist;
 }
+
+/**
+ * Query NETLINK for device IP address configuration
+ *
+ * @param self   A PyEtherInfo Python object for the current device to retrieve
+ *               IP address configuration data from
+ * @param query  What to query for.  Must be NLQRY_ADDR4 for IPv4 addresses or
+ *               NLQRY_ADDR6 for IPv6 addresses.
+ *
+ * @return Returns a Python list containing PyNetlinkIPaddress objects on
+ *         success, otherwise NULL
+ */
+PyObject * get_etherinfo_address(PyEtherInfo *self, nlQuery query)
+{
+    struct nl_connection *nlc;
+    PyObject *addrlist = NULL;
+    int ret = NATIVE_FALLBACK;
+
+    if (!self) {
+        return NULL;
+    }
+
+    /* Threads may query the same object in parallel */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    /* Open a NETLINK connection on-the-fly */
+    nlc = open_netlink(self);
+    if (nlc == NULL) {
+        PyErr_Format(PyExc_RuntimeError,
+                     "Could not open a NETLINK connection for %s",
+                     PyStr_AsString(self->device));
+    } else {
+        if (!ethtool_load_flag(&self->state->netlink_libnl)
+                && (query == NLQRY_ADDR4 || query == NLQRY_ADDR6)) {
+            ret = _native_get_etherinfo_address(self, nlc, query, &addrlist);
+        }
+        if (ret == NATIVE_FALLBACK) {
+            /* libnl asks for the dumps in a way strict checking rejects */
+            rtnetlink_set_strict(nlc, 0);
+            addrlist = _get_etherinfo_address(self, nlc->sock, query);
+        }
+        release_netlink(self, nlc);
+    }
+    Py_END_CRITICAL_SECTION();
+
+    return addrlist;
+}
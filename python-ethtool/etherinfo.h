@@ -23,8 +23,18 @@ typedef enum {NLQRY_ADDR4, NLQRY_ADDR6} nlQuery;
 int get_etherinfo_link(PyEtherInfo *data);
 PyObject * get_etherinfo_address(PyEtherInfo *self, nlQuery query);
 
-int open_netlink(PyEtherInfo *);
-struct nl_sock * get_nlc();
+/* Of a formatted hardware address, MAX_ADDR_LEN bytes */
+#define HWADDR_STRLEN 130
+
+struct rtattr;
+void format_hwaddr_buf(char *buf, const unsigned char *addr, int len);
+PyObject *format_hwaddr(struct rtattr *rta);
+PyObject *format_hwaddr_data(const unsigned char *addr, int len);
+
+struct nl_connection;
+struct nl_connection * open_netlink(PyEtherInfo *);
+void release_netlink(PyEtherInfo *, struct nl_connection *);
 void close_netlink(PyEtherInfo *);
+void free_netlink_pool(struct ethtool_state *);
 
 #endif
@@ -28,10 +28,13 @@
 #include <bytesobject.h>
 #include "structmember.h"
 
+#include <arpa/inet.h>
 #include <netlink/route/rtnl.h>
 #include <netlink/route/addr.h>
 #include "etherinfo_struct.h"
 #include "etherinfo.h"
+#include "netns.h"
+#include "perfcounters.h"
 
 /**
  * ethtool.etherinfo deallocator - cleans up when a object is deleted
@@ -40,12 +43,18 @@
  */
 static void _ethtool_etherinfo_dealloc(PyEtherInfo *self)
 {
+    PyTypeObject *type = Py_TYPE(self);
+
     close_netlink(self);
+    ethtool_netns_put(self->state, self->netns);
+    self->netns = NULL;
     Py_XDECREF(self->device);
     self->device = NULL;
     Py_XDECREF(self->hwaddress);
     self->hwaddress = NULL;
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    ethtool_freelist_free(&self->state->etherinfo_freelist,
+                          self->state->freelist_limit, (PyObject *) self);
+    ethtool_type_decref(type);
 }
 
 
@@ -57,7 +66,8 @@ static void _ethtool_etherinfo_dealloc(PyEtherInfo *self)
 
   The return value is a *borrowed reference* (or NULL)
 */
-static PyNetlinkIPaddress * get_last_ipv4_address(PyObject *addrlist)
+static PyNetlinkIPaddress * get_last_ipv4_address(PyEtherInfo *self,
+                                                   PyObject *addrlist)
 {
     Py_ssize_t size;
 
@@ -73,7 +83,7 @@ static PyNetlinkIPaddress * get_last_ipv4_address(PyObject *addrlist)
     if (size > 0) {
         PyNetlinkIPaddress *item = (PyNetlinkIPaddress *)
              PyList_GetItem(addrlist, size - 1);
-        if (Py_TYPE(item) == &ethtool_netlink_ip_address_Type) {
+        if (Py_TYPE(item) == self->state->address_type) {
             return item;
         }
     }
@@ -81,6 +91,24 @@ static PyNetlinkIPaddress * get_last_ipv4_address(PyObject *addrlist)
     return NULL;
 }
 
+/*
+ * Appends tail to str, for building strings piece by piece.  Both references
+ * are stolen, either may be NULL after an error.
+ *
+ * Returns the new string, or NULL on error
+ */
+static PyObject *str_append(PyObject *str, PyObject *tail)
+{
+    PyObject *ret = NULL;
+
+    if (str != NULL && tail != NULL) {
+        ret = PyStr_Concat(str, tail);
+    }
+    Py_XDECREF(str);
+    Py_XDECREF(tail);
+    return ret;
+}
+
 /**
  * Creates a human readable format of the information when object is being
  * treated as a string
@@ -93,59 +121,71 @@ PyObject *_ethtool_etherinfo_str(PyEtherInfo *self)
 {
     PyObject *ret = NULL;
     PyObject *ipv4addrs = NULL, *ipv6addrs = NULL;
+    Py_ssize_t i;
 
     if (!self) {
         PyErr_SetString(PyExc_AttributeError, "No data available");
         return NULL;
     }
 
-    get_etherinfo_link(self);
+    if (!get_etherinfo_link(self)) {
+        return NULL;
+    }
+    ipv4addrs = get_etherinfo_address(self, NLQRY_ADDR4);
+    if (!ipv4addrs) {
+        return NULL;
+    }
+    ipv6addrs = get_etherinfo_address(self, NLQRY_ADDR6);
+    if (!ipv6addrs) {
+        Py_DECREF(ipv4addrs);
+        return NULL;
+    }
 
     ret = PyStr_FromFormat("Device %s:\n", PyStr_AsString(self->device));
 
     if (self->hwaddress) {
-        ret = PyStr_Concat(ret,
-                           PyStr_FromFormat("\tMAC address: %s\n",
-                                            PyStr_AsString(self->hwaddress)));
+        ret = str_append(ret,
+                         PyStr_FromFormat("\tMAC address: %s\n",
+                                          PyStr_AsString(self->hwaddress)));
     }
 
-    ipv4addrs = get_etherinfo_address(self, NLQRY_ADDR4);
-    if (ipv4addrs) {
-        Py_ssize_t i;
-        for (i = 0; i < PyList_Size(ipv4addrs); i++) {
-            PyNetlinkIPaddress *py_addr = (PyNetlinkIPaddress *)
-                PyList_GetItem(ipv4addrs, i);
-            PyObject *tmp = PyStr_FromFormat("\tIPv4 address: ");
-            tmp = PyStr_Concat(tmp, py_addr->local);
-            tmp = PyStr_Concat(tmp,
-                               PyStr_FromFormat("/%d", py_addr->prefixlen));
-            if (py_addr->ipv4_broadcast) {
-                tmp = PyStr_Concat(
-                    tmp, PyStr_FromFormat("\tBroadcast: %s\n",
-                                          PyStr_AsString(
-                                            py_addr->ipv4_broadcast)));
-            } else {
-                tmp = PyStr_Concat(tmp, PyStr_FromFormat("\n"));
-            }
-
-            ret = PyStr_Concat(ret, tmp);
+    /* The addresses are formatted straight from their binary form */
+    for (i = 0; ret != NULL && i < PyList_Size(ipv4addrs); i++) {
+        PyNetlinkIPaddress *py_addr = (PyNetlinkIPaddress *)
+            PyList_GetItem(ipv4addrs, i);
+        char local[INET6_ADDRSTRLEN + 8], bcast[INET6_ADDRSTRLEN + 8];
+
+        netlink_ip_address_format(py_addr, NLADDR_LOCAL,
+                                  local, sizeof(local));
+        if (netlink_ip_address_format(py_addr, NLADDR_BROADCAST,
+                                      bcast, sizeof(bcast))) {
+            ret = str_append(
+                ret, PyStr_FromFormat("\tIPv4 address: %s/%d"
+                                      "\tBroadcast: %s\n",
+                                      local, py_addr->prefixlen, bcast));
+        } else {
+            ret = str_append(
+                ret, PyStr_FromFormat("\tIPv4 address: %s/%d\n",
+                                      local, py_addr->prefixlen));
         }
     }
 
-    ipv6addrs = get_etherinfo_address(self, NLQRY_ADDR6);
-    if (ipv6addrs) {
-        Py_ssize_t i;
-        for (i = 0; i < PyList_Size(ipv6addrs); i++) {
-            PyNetlinkIPaddress *py_addr = (PyNetlinkIPaddress *)
-                PyList_GetItem(ipv6addrs, i);
-            PyObject *tmp = PyStr_FromFormat("\tIPv6 address: [%s] %s/%d\n",
-                                             PyStr_AsString(py_addr->scope),
-                                             PyStr_AsString(py_addr->local),
-                                             py_addr->prefixlen);
-            ret = PyStr_Concat(ret, tmp);
-        }
+    for (i = 0; ret != NULL && i < PyList_Size(ipv6addrs); i++) {
+        PyNetlinkIPaddress *py_addr = (PyNetlinkIPaddress *)
+            PyList_GetItem(ipv6addrs, i);
+        char local[INET6_ADDRSTRLEN + 8], scope[32];
+
+        netlink_ip_address_format(py_addr, NLADDR_LOCAL,
+                                  local, sizeof(local));
+        netlink_ip_address_format(py_addr, NLADDR_SCOPE,
+                                  scope, sizeof(scope));
+        ret = str_append(ret,
+                         PyStr_FromFormat("\tIPv6 address: [%s] %s/%d\n",
+                                          scope, local, py_addr->prefixlen));
     }
 
+    Py_DECREF(ipv4addrs);
+    Py_DECREF(ipv6addrs);
     return ret;
 }
 
@@ -189,18 +229,28 @@ static PyObject *_ethtool_etherinfo_get_ipv6_addresses(PyEtherInfo *self,
 }
 
 
+PERF_WRAPPER(perf_get_ipv4_addresses, PERF_API_ETHERINFO_GET_IPV4_ADDRESSES,
+             _ethtool_etherinfo_get_ipv4_addresses,
+             (PyEtherInfo *self, PyObject *notused), (self, notused),
+             &self->state->perf, self->device)
+PERF_WRAPPER(perf_get_ipv6_addresses, PERF_API_ETHERINFO_GET_IPV6_ADDRESSES,
+             _ethtool_etherinfo_get_ipv6_addresses,
+             (PyEtherInfo *self, PyObject *notused), (self, notused),
+             &self->state->perf, self->device)
+
+
 /**
  * Defines all available methods in the ethtool.etherinfo class
  *
  */
 static PyMethodDef _ethtool_etherinfo_methods[] = {
     {   "get_ipv4_addresses",
-        (PyCFunction)_ethtool_etherinfo_get_ipv4_addresses, METH_NOARGS,
+        (PyCFunction)perf_get_ipv4_addresses, METH_NOARGS,
         "Retrieve configured IPv4 addresses.  "
         "Returns a list of NetlinkIPaddress objects"
     },
     {   "get_ipv6_addresses",
-        (PyCFunction)_ethtool_etherinfo_get_ipv6_addresses, METH_NOARGS,
+        (PyCFunction)perf_get_ipv6_addresses, METH_NOARGS,
         "Retrieve configured IPv6 addresses.  "
         "Returns a list of NetlinkIPaddress objects"
     },
@@ -222,11 +272,14 @@ static PyObject *get_mac_addr(PyObject *obj, void *info)
 {
     PyEtherInfo *self = (PyEtherInfo *) obj;
 
-    get_etherinfo_link(self);
+    if (!get_etherinfo_link(self)) {
+        return NULL;
+    }
     if (self->hwaddress) {
         Py_INCREF(self->hwaddress);
+        return self->hwaddress;
     }
-    return self->hwaddress;
+    Py_RETURN_NONE;
 }
 
 static PyObject *get_ipv4_addr(PyObject *obj, void *info)
@@ -234,22 +287,22 @@ static PyObject *get_ipv4_addr(PyObject *obj, void *info)
     PyEtherInfo *self = (PyEtherInfo *) obj;
     PyObject *addrlist;
     PyNetlinkIPaddress *py_addr;
+    PyObject *ret;
 
     addrlist = get_etherinfo_address(self, NLQRY_ADDR4);
+    if (!addrlist) {
+        return NULL;
+    }
     /* For compatiblity with old approach, return last IPv4 address: */
-    py_addr = get_last_ipv4_address(addrlist);
+    py_addr = get_last_ipv4_address(self, addrlist);
     if (py_addr) {
-        if (py_addr->local) {
-            Py_INCREF(py_addr->local);
-            return py_addr->local;
-        }
-    }
-
-    if (PyErr_Occurred()) {
-        return NULL;
+        ret = netlink_ip_address_str(py_addr, NLADDR_LOCAL);
     } else {
-        Py_RETURN_NONE;
+        ret = Py_None;
+        Py_INCREF(ret);
     }
+    Py_DECREF(addrlist);
+    return ret;
 }
 
 static PyObject *get_ipv4_mask(PyObject *obj, void *info)
@@ -257,18 +310,18 @@ static PyObject *get_ipv4_mask(PyObject *obj, void *info)
     PyEtherInfo *self = (PyEtherInfo *) obj;
     PyObject *addrlist;
     PyNetlinkIPaddress *py_addr;
+    int prefixlen = 0;
 
     addrlist = get_etherinfo_address(self, NLQRY_ADDR4);
-    py_addr = get_last_ipv4_address(addrlist);
-    if (py_addr) {
-        return PyInt_FromLong(py_addr->prefixlen);
-    }
-
-    if (PyErr_Occurred()) {
+    if (!addrlist) {
         return NULL;
-    } else {
-        return PyInt_FromLong(0);
     }
+    py_addr = get_last_ipv4_address(self, addrlist);
+    if (py_addr) {
+        prefixlen = py_addr->prefixlen;
+    }
+    Py_DECREF(addrlist);
+    return PyInt_FromLong(prefixlen);
 }
 
 static PyObject *get_ipv4_bcast(PyObject *obj, void *info)
@@ -277,29 +330,37 @@ static PyObject *get_ipv4_bcast(PyObject *obj, void *info)
     PyObject *addrlist;
     PyNetlinkIPaddress *py_addr;
 
-    addrlist = get_etherinfo_address(self, NLQRY_ADDR4);
-    py_addr = get_last_ipv4_address(addrlist);
-    if (py_addr) {
-        if (py_addr->ipv4_broadcast) {
-            Py_INCREF(py_addr->ipv4_broadcast);
-            return py_addr->ipv4_broadcast;
-        }
-    }
+    PyObject *ret;
 
-    if (PyErr_Occurred()) {
+    addrlist = get_etherinfo_address(self, NLQRY_ADDR4);
+    if (!addrlist) {
         return NULL;
+    }
+    py_addr = get_last_ipv4_address(self, addrlist);
+    if (py_addr && py_addr->has_broadcast) {
+        ret = netlink_ip_address_str(py_addr, NLADDR_BROADCAST);
     } else {
-        return PyStr_FromString("0.0.0.0");
+        ret = PyStr_FromString("0.0.0.0");
     }
+    Py_DECREF(addrlist);
+    return ret;
 }
 
+PERF_GETTER_WRAPPER(get_mac_addr, PERF_API_ETHERINFO_MAC_ADDRESS)
+PERF_GETTER_WRAPPER(get_ipv4_addr, PERF_API_ETHERINFO_IPV4_ADDRESS)
+PERF_GETTER_WRAPPER(get_ipv4_mask, PERF_API_ETHERINFO_IPV4_NETMASK)
+PERF_GETTER_WRAPPER(get_ipv4_bcast, PERF_API_ETHERINFO_IPV4_BROADCAST)
+PERF_WRAPPER(perf_etherinfo_str, PERF_API_ETHERINFO_STR,
+             _ethtool_etherinfo_str, (PyEtherInfo *self), (self),
+             &self->state->perf, self->device)
+
 
 static PyGetSetDef _ethtool_etherinfo_attributes[] = {
     {"device", get_device, NULL, "device", NULL},
-    {"mac_address", get_mac_addr, NULL, "MAC address", NULL},
-    {"ipv4_address", get_ipv4_addr, NULL, "IPv4 address", NULL},
-    {"ipv4_netmask", get_ipv4_mask, NULL, "IPv4 netmask", NULL},
-    {"ipv4_broadcast", get_ipv4_bcast, NULL, "IPv4 broadcast", NULL},
+    {"mac_address", perf_get_mac_addr, NULL, "MAC address", NULL},
+    {"ipv4_address", perf_get_ipv4_addr, NULL, "IPv4 address", NULL},
+    {"ipv4_netmask", perf_get_ipv4_mask, NULL, "IPv4 netmask", NULL},
+    {"ipv4_broadcast", perf_get_ipv4_bcast, NULL, "IPv4 broadcast", NULL},
     {NULL},
 };
 
@@ -308,14 +369,32 @@ static PyGetSetDef _ethtool_etherinfo_attributes[] = {
  * Definition of the functions a Python class/object requires.
  *
  */
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+static PyType_Slot _ethtool_etherinfo_slots[] = {
+    {Py_tp_dealloc, _ethtool_etherinfo_dealloc},
+    {Py_tp_str, perf_etherinfo_str},
+    {Py_tp_getset, _ethtool_etherinfo_attributes},
+    {Py_tp_methods, _ethtool_etherinfo_methods},
+    {Py_tp_doc, "Contains information about a specific ethernet device"},
+    {0, NULL}
+};
+
+PyType_Spec PyEtherInfo_Spec = {
+    .name = "ethtool.etherinfo",
+    .basicsize = sizeof(PyEtherInfo),
+    .flags = Py_TPFLAGS_DEFAULT | ETHTOOL_TPFLAGS_IMMUTABLE,
+    .slots = _ethtool_etherinfo_slots,
+};
+#else
 PyTypeObject PyEtherInfo_Type = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "ethtool.etherinfo",
     .tp_basicsize = sizeof(PyEtherInfo),
     .tp_flags = Py_TPFLAGS_DEFAULT,
     .tp_dealloc = (destructor)_ethtool_etherinfo_dealloc,
-    .tp_str = (reprfunc)_ethtool_etherinfo_str,
+    .tp_str = (reprfunc)perf_etherinfo_str,
     .tp_getset = _ethtool_etherinfo_attributes,
     .tp_methods = _ethtool_etherinfo_methods,
     .tp_doc = "Contains information about a specific ethernet device"
 };
+#endif
@@ -28,17 +28,32 @@
 
 #include <netlink/route/addr.h>
 
-/* Python object containing data baked from a (struct rtnl_addr) */
+#include "modstate.h"
+
+/* Text attributes of a PyNetlinkIPaddress, formatted on first use */
+typedef enum {
+    NLADDR_LOCAL,  /**< Configured local IP address */
+    NLADDR_PEER,  /**< Configured peer IP address, with a prefix */
+    NLADDR_BROADCAST,  /**< Configured IPv4 broadcast address */
+    NLADDR_SCOPE,  /**< IP address scope */
+    NLADDR_FIELDS
+} nlAddrField;
+
+/* Python object containing data baked from a (struct rtnl_addr).  The
+ * addresses are kept in binary, network byte order. */
 typedef struct PyNetlinkIPaddress {
     PyObject_HEAD
     int family;  /**< int: must be AF_INET or AF_INET6 */
-    PyObject *local;  /**< string: Configured local IP address */
-    PyObject *peer;  /**< string: Configured peer IP address */
-    PyObject *ipv4_broadcast;  /**< string: Configured IPv4 broadcast add. */
     int prefixlen;  /**< int: Configured network prefix (netmask) */
-    PyObject *scope;  /**< string: IP address scope */
+    int scope;  /**< int: IP address scope, RT_SCOPE_* */
+    unsigned char has_peer;  /**< Is a peer address configured? */
+    unsigned char has_broadcast;  /**< Is a broadcast address configured? */
+    unsigned char peer_prefixlen;  /**< Prefix length of the peer address */
+    unsigned char local[16];  /**< Local IP address */
+    unsigned char peer[16];  /**< Peer IP address */
+    unsigned char broadcast[4];  /**< IPv4 broadcast address */
+    PyObject *strings[NLADDR_FIELDS];  /**< Text forms, NULL until used */
 } PyNetlinkIPaddress;
-extern PyTypeObject ethtool_netlink_ip_address_Type;
 
 /**
  * The Python object containing information about a single interface
@@ -46,15 +61,39 @@ extern PyTypeObject ethtool_netlink_ip_address_Type;
  */
 typedef struct {
     PyObject_HEAD
+    struct ethtool_state *state;  /**< Module the object was created by */
     PyObject *device;  /**< Device name */
     int index;  /**< NETLINK index reference */
     PyObject *hwaddress;  /**< string: HW address / MAC address of device */
     unsigned short nlc_active;  /**< Is this instance using NETLINK? */
+    unsigned char split_dumps;  /**< Bit per NLQRY_ADDR* query whose dumps
+                                 *   take several datagrams */
+    struct ethtool_netns *netns;  /**< Network namespace of the device, NULL
+                                   *   for the current one */
 } PyEtherInfo;
 
 
 
-PyObject * make_python_address_from_rtnl_addr(struct rtnl_addr *addr);
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+extern PyType_Spec PyEtherInfo_Spec;
+extern PyType_Spec ethtool_netlink_ip_address_Spec;
+#else
+extern PyTypeObject PyEtherInfo_Type;
+extern PyTypeObject ethtool_netlink_ip_address_Type;
+#endif
+
+PyObject * make_python_address_from_rtnl_addr(struct ethtool_state *state,
+                                              struct rtnl_addr *addr);
+struct ifaddrmsg;
+struct rtattr;
+PyObject * make_python_address_from_ifaddrmsg(struct ethtool_state *state,
+                                              const struct ifaddrmsg *ifa,
+                                              struct rtattr *tb[]);
+const char * netlink_ip_address_format(PyNetlinkIPaddress *addr,
+                                       nlAddrField field,
+                                       char *buf, size_t len);
+PyObject * netlink_ip_address_str(PyNetlinkIPaddress *addr,
+                                  nlAddrField field);
 
 
 #endif
@@ -218,6 +218,19 @@ struct ethtool_pauseparam {
     u32 tx_pause;
 };
 
+/* for getting and setting the number of RX, TX and other queues */
+struct ethtool_channels {
+    u32 cmd;  /* ETHTOOL_{G,S}CHANNELS */
+    u32 max_rx;  /* Maximum RX only queues, read-only */
+    u32 max_tx;  /* Maximum TX only queues, read-only */
+    u32 max_other;  /* Maximum other queues, e.g. link interrupts, read-only */
+    u32 max_combined;  /* Maximum queues of both RX and TX, read-only */
+    u32 rx_count;
+    u32 tx_count;
+    u32 other_count;
+    u32 combined_count;
+};
+
 #define ETH_GSTRING_LEN 32
 enum ethtool_stringset {
     ETH_SS_TEST = 0,
@@ -253,6 +266,52 @@ struct ethtool_stats {
     u64 data[0];
 };
 
+/* for querying the time stamping capabilities and PTP clock of a device */
+struct ethtool_ts_info {
+    u32 cmd;  /* ETHTOOL_GET_TS_INFO */
+    u32 so_timestamping;  /* SOF_TIMESTAMPING_* flags supported */
+    s32 phc_index;  /* PTP hardware clock index, -1 if none */
+    u32 tx_types;  /* bit N set if HWTSTAMP_TX_* value N is supported */
+    u32 tx_reserved[3];
+    u32 rx_filters;  /* bit N set if HWTSTAMP_FILTER_* value N works */
+    u32 rx_reserved[3];
+};
+
+/* The link mode bitmaps are limited to what fits in a signed 8 bit word
+ * count, see link_mode_masks_nwords below.
+ */
+#define ETHTOOL_LINK_MODE_MASK_MAX_NU32 127
+
+/* for getting and setting link settings with link mode bitmaps of
+ * arbitrary size (replaces struct ethtool_cmd)
+ */
+struct ethtool_link_settings {
+    u32 cmd;  /* ETHTOOL_{G,S}LINKSETTINGS */
+    u32 speed;  /* Link speed (Mbps) or SPEED_UNKNOWN */
+    u8 duplex;  /* Duplex, half, full or unknown */
+    u8 port;  /* Which connector port */
+    u8 phy_address;
+    u8 autoneg;  /* Enable or disable autonegotiation */
+    u8 mdio_support;  /* ETH_MDIO_SUPPORTS_* flags, read-only */
+    u8 eth_tp_mdix;  /* ETH_TP_MDI_* status, read-only */
+    u8 eth_tp_mdix_ctrl;  /* ETH_TP_MDI_* control */
+    /* Number of u32 words in each of the bitmaps below.  The kernel
+     * answers a request with a mismatching size with the negated size
+     * it expects, leaving all other fields but cmd zeroed.
+     */
+    s8 link_mode_masks_nwords;
+    u8 transceiver;  /* Which tranceiver is used, read-only */
+    u8 master_slave_cfg;
+    u8 master_slave_state;
+    u8 rate_matching;
+    u32 reserved[7];
+    /* u32 supported[link_mode_masks_nwords];
+     * u32 advertising[link_mode_masks_nwords];
+     * u32 lp_advertising[link_mode_masks_nwords];
+     */
+    u32 link_mode_masks[0];
+};
+
 /* CMDs currently supported */
 #define ETHTOOL_GSET        0x00000001  /* Get settings. */
 #define ETHTOOL_SSET        0x00000002  /* Set settings, privileged. */
@@ -292,6 +351,11 @@ struct ethtool_stats {
 #define ETHTOOL_SGSO        0x00000024  /* Set GSO enable (e.v.) */
 #define ETHTOOL_GGRO        0x0000002b  /* Get GRO enable (e.v.) */
 #define ETHTOOL_SGRO        0x0000002c  /* Set GRO enable (e.v.) */
+#define ETHTOOL_GCHANNELS   0x0000003c  /* Get no of channels */
+#define ETHTOOL_SCHANNELS   0x0000003d  /* Set no of channels, priv. */
+#define ETHTOOL_GET_TS_INFO 0x00000041  /* Get time stamping and PHC info */
+#define ETHTOOL_GLINKSETTINGS 0x0000004c  /* Get link settings */
+#define ETHTOOL_SLINKSETTINGS 0x0000004d  /* Set link settings, priv. */
 
 /* compatibility with older code */
 #define SPARC_ETH_GSET ETHTOOL_GSET
@@ -338,10 +402,12 @@ struct ethtool_stats {
 #define SPEED_100 100
 #define SPEED_1000 1000
 #define SPEED_10000 10000
+#define SPEED_UNKNOWN -1
 
 /* Duplex, half or full. */
 #define DUPLEX_HALF 0x00
 #define DUPLEX_FULL 0x01
+#define DUPLEX_UNKNOWN 0xff
 
 /* Which connector port. */
 #define PORT_TP 0x00
@@ -349,6 +415,9 @@ struct ethtool_stats {
 #define PORT_MII 0x02
 #define PORT_FIBRE 0x03
 #define PORT_BNC 0x04
+#define PORT_DA 0x05
+#define PORT_NONE 0xef
+#define PORT_OTHER 0xff
 
 /* Which tranceiver to use. */
 #define XCVR_INTERNAL 0x00
@@ -20,14 +20,19 @@
 #include <bytesobject.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 #include <sys/socket.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <ifaddrs.h>
+#include <netlink/socket.h>
 #include <netlink/route/addr.h>
 #include <linux/wireless.h>
 #if !defined IFF_UP
@@ -37,33 +42,66 @@
 #include "etherinfo_struct.h"
 #include "etherinfo_obj.h"
 #include "etherinfo.h"
-
-extern PyTypeObject PyEtherInfo_Type;
+#include "perfcounters.h"
+#include "modstate.h"
+#include "device.h"
+#include "fastcall.h"
+#include "freelist.h"
+#include "aio.h"
+#include "columns.h"
+#include "shmstats.h"
+#include "netns.h"
+#include "snapshot.h"
+#include "sweep.h"
+#include "rtnetlink.h"
 
 #ifndef IFF_DYNAMIC
 #define IFF_DYNAMIC 0x8000  /* dialup device with changing addresses*/
 #endif
 
-typedef unsigned long long u64;
-typedef __uint32_t u32;
-typedef __uint16_t u16;
-typedef __uint8_t u8;
-
-#include "ethtool-copy.h"
+#include "settings.h"
 #include <linux/sockios.h>  /* for SIOCETHTOOL */
+#include <linux/net_tstamp.h>  /* for SOF_TIMESTAMPING_* and HWTSTAMP_* */
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #define _PATH_PROCNET_DEV "/proc/net/dev"
 
-static PyObject *get_active_devices(PyObject *self __unused,
-                                    PyObject *args __unused)
+/* Lists the addresses of the namespace the caller is in */
+static int list_addresses(void *ifaddr)
 {
-    PyObject *list;
+    return getifaddrs((struct ifaddrs **) ifaddr);
+}
+
+static PyObject *get_active_devices(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "netns" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    struct ethtool_netns *ns;
+    PyObject *list, *netns;
     struct ifaddrs *ifaddr, *ifa;
+    int err;
 
-    if (getifaddrs(&ifaddr) == -1)
-        return PyErr_SetFromErrno(PyExc_OSError);
+    /* netns is keyword-only */
+    if (fastcall_unpack("get_active_devices", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 0,
+                        FASTCALL_NARGS > 0 ? 0 : 1, &netns) < 0)
+        return NULL;
+    if (ethtool_netns_get(state, netns, &ns) < 0)
+        return NULL;
+
+    /* glibc dumps both the links and the addresses over NETLINK */
+    perf_count(netlink_dumps, 2);
+    if (ns == NULL) {
+        err = getifaddrs(&ifaddr);
+    } else {
+        err = ethtool_netns_run(ns, list_addresses, &ifaddr);
+    }
+    if (err == -1)
+        PyErr_SetFromErrno(PyExc_OSError);
+    ethtool_netns_put(state, ns);
+    if (err == -1)
+        return NULL;
 
     list = PyList_New(0);
     for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
@@ -80,16 +118,42 @@ static PyObject *get_active_devices(PyObject *self __unused,
     return list;
 }
 
-static PyObject *get_devices(PyObject *self __unused, PyObject *args __unused)
+/* Opens the device list of the namespace the caller is in.  /proc/net is
+ * the one of the main thread. */
+static int open_procnet_dev(void *unused __unused)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/self/task/%ld/net/dev",
+             (long) syscall(SYS_gettid));
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * Lists the devices of a namespace, from /proc/net/dev
+ *
+ * @param ns  The namespace, NULL for the current one
+ *
+ * @return Python list of device names on success, otherwise NULL.
+ */
+static PyObject *list_devices(struct ethtool_netns *ns)
 {
     char buffer[256];
     char *ret;
-    PyObject *list = PyList_New(0);
-    FILE *fd = fopen(_PATH_PROCNET_DEV, "r");
+    PyObject *list;
+    FILE *fd;
 
-    if (fd == NULL) {
-        return PyErr_SetFromErrno(PyExc_OSError);
+    if (ns == NULL) {
+        fd = fopen(_PATH_PROCNET_DEV, "r");
+    } else {
+        int procfd = ethtool_netns_run(ns, open_procnet_dev, NULL);
+
+        fd = procfd < 0 ? NULL : fdopen(procfd, "r");
+        if (procfd >= 0 && fd == NULL)
+            close(procfd);
     }
+    if (fd == NULL)
+        return PyErr_SetFromErrno(PyExc_OSError);
     /* skip over first two lines */
     ret = fgets(buffer, 256, fd);
     ret = fgets(buffer, 256, fd);
@@ -98,6 +162,7 @@ static PyObject *get_devices(PyObject *self __unused, PyObject *args __unused)
         return PyErr_SetFromErrno(PyExc_OSError);
     }
 
+    list = PyList_New(0);
     while (!feof(fd)) {
         PyObject *str;
         char *name = buffer;
@@ -120,109 +185,55 @@ static PyObject *get_devices(PyObject *self __unused, PyObject *args __unused)
     return list;
 }
 
-static PyObject *get_hwaddress(PyObject *self __unused, PyObject *args)
-{
-    struct ifreq ifr;
-    int fd, err;
-    const char *devname;
-    char hwaddr[20];
-
-    if (!PyArg_ParseTuple(args, "s", &devname))
-        return NULL;
-
-    /* Setup our request structure. */
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(&ifr.ifr_name[0], devname, IFNAMSIZ);
-    ifr.ifr_name[IFNAMSIZ - 1] = 0;
-
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        return PyErr_SetFromErrno(PyExc_OSError);
-    }
-
-    /* Get current settings. */
-    err = ioctl(fd, SIOCGIFHWADDR, &ifr);
-    if (err < 0) {
-        PyErr_SetFromErrno(PyExc_IOError);
-        close(fd);
-        return NULL;
-    }
-
-    close(fd);
-
-    sprintf(hwaddr, "%02x:%02x:%02x:%02x:%02x:%02x",
-            (unsigned int)ifr.ifr_hwaddr.sa_data[0] % 256,
-            (unsigned int)ifr.ifr_hwaddr.sa_data[1] % 256,
-            (unsigned int)ifr.ifr_hwaddr.sa_data[2] % 256,
-            (unsigned int)ifr.ifr_hwaddr.sa_data[3] % 256,
-            (unsigned int)ifr.ifr_hwaddr.sa_data[4] % 256,
-            (unsigned int)ifr.ifr_hwaddr.sa_data[5] % 256);
-
-    return PyStr_FromString(hwaddr);
-}
-
-static PyObject *get_ipaddress(PyObject *self __unused, PyObject *args)
+static PyObject *get_devices(PyObject *self, FASTCALL_PARAMS)
 {
-    struct ifreq ifr;
-    int fd, err;
-    const char *devname;
-    char ipaddr[20];
-
-    if (!PyArg_ParseTuple(args, "s", &devname))
+    static const char *const names[] = { "netns" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    struct ethtool_netns *ns;
+    PyObject *list, *netns;
+
+    /* netns is keyword-only */
+    if (fastcall_unpack("get_devices", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 0,
+                        FASTCALL_NARGS > 0 ? 0 : 1, &netns) < 0)
         return NULL;
-
-    /* Setup our request structure. */
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(&ifr.ifr_name[0], devname, IFNAMSIZ);
-    ifr.ifr_name[IFNAMSIZ - 1] = 0;
-
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        return PyErr_SetFromErrno(PyExc_OSError);
-    }
-
-    /* Get current settings. */
-    err = ioctl(fd, SIOCGIFADDR, &ifr);
-    if (err < 0) {
-        PyErr_SetFromErrno(PyExc_IOError);
-        close(fd);
+    if (ethtool_netns_get(state, netns, &ns) < 0)
         return NULL;
-    }
-
-    close(fd);
-
-    sprintf(ipaddr, "%u.%u.%u.%u",
-            (unsigned int)ifr.ifr_addr.sa_data[2] % 256,
-            (unsigned int)ifr.ifr_addr.sa_data[3] % 256,
-            (unsigned int)ifr.ifr_addr.sa_data[4] % 256,
-            (unsigned int)ifr.ifr_addr.sa_data[5] % 256);
 
-    return PyStr_FromString(ipaddr);
+    list = list_devices(ns);
+    ethtool_netns_put(state, ns);
+    return list;
 }
 
-
 /**
  * Retrieves the current information about all interfaces.
  * All interfaces will be returned as a list of objects per interface.
  *
  * @param self Not used
- * @param args Python arguments - device name(s) as either a string or a list
+ * @param args Python arguments - device name(s) as either a string or a list,
+ *             and the keyword-only netns the devices are in
  *
  * @return Python list of objects on success, otherwise NULL.
  */
-static PyObject *get_interfaces_info(PyObject *self __unused, PyObject *args) {
+static PyObject *get_interfaces_info(PyObject *self, FASTCALL_PARAMS) {
+    static const char *const names[] = { "devices", "netns" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    struct ethtool_netns *ns;
     PyObject *devlist = NULL;
-    PyObject *inargs = NULL;
+    PyObject *argv[2];
+    PyObject *inargs;
     char **fetch_devs = NULL;
     int i = 0, fetch_devs_len = 0;
 
-    if (!PyArg_ParseTuple(args, "|O", &inargs)) {
+    /* netns is keyword-only */
+    if (fastcall_unpack("get_interfaces_info", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 0,
+                        FASTCALL_NARGS > 1 ? 1 : 2, argv) < 0) {
         PyErr_SetString(PyExc_LookupError,
                         "Argument must be either a string, list or a tuple");
         return NULL;
     }
+    inargs = argv[0];
 
     /* Parse input arguments if we got them */
     if (inargs != NULL) {
@@ -265,7 +276,17 @@ static PyObject *get_interfaces_info(PyObject *self __unused, PyObject *args) {
         }
     }
 
+    if (ethtool_netns_get(state, argv[1], &ns) < 0) {
+        free(fetch_devs);
+        return NULL;
+    }
+
     devlist = PyList_New(0);
+    if (!devlist) {
+        ethtool_netns_put(state, ns);
+        free(fetch_devs);
+        return NULL;
+    }
     for (i = 0; i < fetch_devs_len; i++) {
         PyEtherInfo *dev = NULL;
 
@@ -273,173 +294,295 @@ static PyObject *get_interfaces_info(PyObject *self __unused, PyObject *args) {
          * objects to use when quering for device info
          */
 
-        dev = PyObject_New(PyEtherInfo, &PyEtherInfo_Type);
+        dev = (PyEtherInfo *) ethtool_freelist_alloc(
+            &state->etherinfo_freelist, state->etherinfo_type);
         if (!dev) {
-            PyErr_SetFromErrno(PyExc_OSError);
+            Py_DECREF(devlist);
+            ethtool_netns_put(state, ns);
             free(fetch_devs);
             return NULL;
         }
 
+        dev->state = state;
         dev->device = PyStr_FromString(fetch_devs[i]);
         dev->hwaddress = NULL;
         dev->index = -1;
+        dev->nlc_active = 0;
+        dev->split_dumps = 0;
+        dev->netns = ns;
+        if (ns != NULL)
+            ethtool_netns_hold(state, ns);
 
         /* Append device object to the device list */
         PyList_Append(devlist, (PyObject *)dev);
         Py_DECREF(dev);
     }
+    ethtool_netns_put(state, ns);
     free(fetch_devs);
 
     return devlist;
 }
 
 
-static PyObject *get_flags (PyObject *self __unused, PyObject *args)
+/**
+ * Opens a control socket for device requests
+ *
+ * @return Returns the socket, otherwise -1 with a Python exception set.
+ */
+int dev_socket(void)
 {
-    struct ifreq ifr;
-    const char *devname;
-    int fd, err;
-
-    if (!PyArg_ParseTuple(args, "s", &devname))
-        return NULL;
-
-    /* Setup our request structure. */
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(&ifr.ifr_name[0], devname, IFNAMSIZ);
-    ifr.ifr_name[IFNAMSIZ - 1] = 0;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
 
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (fd < 0) {
-        return PyErr_SetFromErrno(PyExc_OSError);
+        PyErr_SetFromErrno(PyExc_OSError);
     }
-    err = ioctl(fd, SIOCGIFFLAGS, &ifr);
-    if(err < 0) {
-        PyErr_SetFromErrno(PyExc_IOError);
-        close(fd);
+    return fd;
+}
+
+/* Sets up the request structure for a device */
+void dev_req_set_name(struct dev_req *req, const char *devname)
+{
+    memset(&req->ifr, 0, sizeof(req->ifr));
+    strncpy(&req->ifr.ifr_name[0], devname, IFNAMSIZ);
+    req->ifr.ifr_name[IFNAMSIZ - 1] = 0;
+}
+
+/*
+ * Returns the C string of a device name string, NULL with a Python exception
+ * set if it cannot be encoded or has an embedded NUL, as the "s" format does
+ */
+const char *dev_name_as_string(PyObject *name)
+{
+    char *s;
+    Py_ssize_t len;
+
+#if PY_MAJOR_VERSION >= 3
+    s = (char *)PyUnicode_AsUTF8AndSize(name, &len);
+    if (s == NULL)
+        return NULL;
+#else
+    if (PyString_AsStringAndSize(name, &s, &len) < 0)
+        return NULL;
+#endif
+    if (strlen(s) != (size_t)len) {
+        PyErr_SetString(PyExc_ValueError, "embedded null character");
         return NULL;
     }
+    return s;
+}
 
-    close(fd);
+/* Issues a SIOCGIF* style request, sets a Python exception on failure */
+static int dev_ioctl(struct dev_req *req, unsigned long request)
+{
+    int err;
 
-    return Py_BuildValue("h", ifr.ifr_flags);
+    perf_count(ioctls, 1);
+    err = ioctl(req->fd, request, &req->ifr);
+    if (err < 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+    }
+    return err;
 }
 
-static PyObject *get_netmask (PyObject *self __unused, PyObject *args)
+/**
+ * Runs a request on a device given by name, as the module functions do: a
+ * control socket is opened for the request only, unless the device is in
+ * another network namespace, whose cached control socket is used.
+ *
+ * @param state       Module instance
+ * @param fname       Name of the module function, for error messages
+ * @param args        Arguments of the module function: the device name,
+ * @param nargs       followed by the value to set for setters, by position
+ * @param kwnames     or by name, and the keyword-only netns
+ * @param value_name  Name of the value parameter of setters, NULL for getters
+ * @param op          The request
+ *
+ * @return The result of op
+ */
+static PyObject *dev_function(struct ethtool_state *state, const char *fname,
+                              PyObject *const *args, Py_ssize_t nargs,
+                              PyObject *kwnames, const char *value_name,
+                              dev_op op)
 {
-    struct ifreq ifr;
-    int fd, err;
-    const char *devname;
-    char netmask[20];
+    const char *names[3];
+    int nnames = 0;
+    PyObject *argv[3], *devname, *ret;
+    const char *name;
+    struct ethtool_netns *ns;
+    struct dev_req req;
+
+    names[nnames++] = "device";
+    if (value_name)
+        names[nnames++] = value_name;
+    names[nnames] = "netns";
+    /* Too many positional arguments are reported against nnames */
+    if (fastcall_unpack(fname, args, nargs, kwnames, names, nnames,
+                        nargs > nnames ? nnames : nnames + 1, argv) < 0)
+        return NULL;
 
-    if (!PyArg_ParseTuple(args, "s", &devname))
+    devname = argv[0];
+    if (!PyStr_Check(devname)) {
+        PyErr_Format(PyExc_TypeError,
+                     "%s() argument 1 must be str, not %.50s",
+                     fname, Py_TYPE(devname)->tp_name);
+        return NULL;
+    }
+
+    name = dev_name_as_string(devname);
+    if (name == NULL)
         return NULL;
 
     /* Setup our request structure. */
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(&ifr.ifr_name[0], devname, IFNAMSIZ);
-    ifr.ifr_name[IFNAMSIZ - 1] = 0;
+    dev_req_set_name(&req, name);
+
+    if (ethtool_netns_get(state, argv[nnames], &ns) < 0)
+        return NULL;
+    if (ns != NULL) {
+        req.fd = ns->ctl_fd;
+        ret = op(&req, value_name ? argv[1] : NULL);
+        ethtool_netns_put(state, ns);
+        return ret;
+    }
 
     /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        return PyErr_SetFromErrno(PyExc_OSError);
+    req.fd = dev_socket();
+    if (req.fd < 0) {
+        return NULL;
     }
 
+    ret = op(&req, value_name ? argv[1] : NULL);
+
+    close(req.fd);
+    return ret;
+}
+
+PyObject *dev_get_hwaddr(struct dev_req *req, PyObject *value __unused)
+{
+    struct ifreq *ifr = &req->ifr;
+    char hwaddr[20];
+
     /* Get current settings. */
-    err = ioctl(fd, SIOCGIFNETMASK, &ifr);
-    if (err < 0) {
-        PyErr_SetFromErrno(PyExc_IOError);
-        close(fd);
+    if (dev_ioctl(req, SIOCGIFHWADDR) < 0)
         return NULL;
-    }
 
-    close(fd);
+    sprintf(hwaddr, "%02x:%02x:%02x:%02x:%02x:%02x",
+            (unsigned int)ifr->ifr_hwaddr.sa_data[0] % 256,
+            (unsigned int)ifr->ifr_hwaddr.sa_data[1] % 256,
+            (unsigned int)ifr->ifr_hwaddr.sa_data[2] % 256,
+            (unsigned int)ifr->ifr_hwaddr.sa_data[3] % 256,
+            (unsigned int)ifr->ifr_hwaddr.sa_data[4] % 256,
+            (unsigned int)ifr->ifr_hwaddr.sa_data[5] % 256);
+
+    return PyStr_FromString(hwaddr);
+}
+
+PyObject *dev_get_ipaddr(struct dev_req *req, PyObject *value __unused)
+{
+    struct ifreq *ifr = &req->ifr;
+    char ipaddr[20];
+
+    /* Get current settings. */
+    if (dev_ioctl(req, SIOCGIFADDR) < 0)
+        return NULL;
+
+    sprintf(ipaddr, "%u.%u.%u.%u",
+            (unsigned int)ifr->ifr_addr.sa_data[2] % 256,
+            (unsigned int)ifr->ifr_addr.sa_data[3] % 256,
+            (unsigned int)ifr->ifr_addr.sa_data[4] % 256,
+            (unsigned int)ifr->ifr_addr.sa_data[5] % 256);
+
+    return PyStr_FromString(ipaddr);
+}
+
+PyObject *dev_get_flags(struct dev_req *req, PyObject *value __unused)
+{
+    if (dev_ioctl(req, SIOCGIFFLAGS) < 0)
+        return NULL;
+
+    return Py_BuildValue("h", req->ifr.ifr_flags);
+}
+
+PyObject *dev_get_netmask(struct dev_req *req, PyObject *value __unused)
+{
+    struct ifreq *ifr = &req->ifr;
+    char netmask[20];
+
+    /* Get current settings. */
+    if (dev_ioctl(req, SIOCGIFNETMASK) < 0)
+        return NULL;
 
     sprintf(netmask, "%u.%u.%u.%u",
-            (unsigned int)ifr.ifr_netmask.sa_data[2] % 256,
-            (unsigned int)ifr.ifr_netmask.sa_data[3] % 256,
-            (unsigned int)ifr.ifr_netmask.sa_data[4] % 256,
-            (unsigned int)ifr.ifr_netmask.sa_data[5] % 256);
+            (unsigned int)ifr->ifr_netmask.sa_data[2] % 256,
+            (unsigned int)ifr->ifr_netmask.sa_data[3] % 256,
+            (unsigned int)ifr->ifr_netmask.sa_data[4] % 256,
+            (unsigned int)ifr->ifr_netmask.sa_data[5] % 256);
 
     return PyStr_FromString(netmask);
 }
 
-static PyObject *get_broadcast(PyObject *self __unused, PyObject *args)
+PyObject *dev_get_broadcast(struct dev_req *req, PyObject *value __unused)
 {
-    struct ifreq ifr;
-    int fd, err;
-    const char *devname;
+    struct ifreq *ifr = &req->ifr;
     char broadcast[20];
 
-    if (!PyArg_ParseTuple(args, "s", &devname))
+    /* Get current settings. */
+    if (dev_ioctl(req, SIOCGIFBRDADDR) < 0)
         return NULL;
 
-    /* Setup our request structure. */
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(&ifr.ifr_name[0], devname, IFNAMSIZ);
-    ifr.ifr_name[IFNAMSIZ - 1] = 0;
+    sprintf(broadcast, "%u.%u.%u.%u",
+            (unsigned int)ifr->ifr_broadaddr.sa_data[2] % 256,
+            (unsigned int)ifr->ifr_broadaddr.sa_data[3] % 256,
+            (unsigned int)ifr->ifr_broadaddr.sa_data[4] % 256,
+            (unsigned int)ifr->ifr_broadaddr.sa_data[5] % 256);
 
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        return PyErr_SetFromErrno(PyExc_OSError);
-    }
+    return PyStr_FromString(broadcast);
+}
+
+/**
+ * Issues an ethtool command on a device
+ *
+ * @param req    The device
+ * @param cmd    ETHTOOL_* command
+ * @param value  Command structure, starting with the cmd field
+ *
+ * @return Returns 0 on success, otherwise a negative value with a Python
+ *         exception set.
+ */
+static int send_command(struct dev_req *req, int cmd, void *value)
+{
+    int err;
+    struct ethtool_value *eval = value;
+
+    req->ifr.ifr_data = (caddr_t)eval;
+    eval->cmd = cmd;
 
     /* Get current settings. */
-    err = ioctl(fd, SIOCGIFBRDADDR, &ifr);
+    perf_count(ioctls, 1);
+    err = ioctl(req->fd, SIOCETHTOOL, &req->ifr);
     if (err < 0) {
         PyErr_SetFromErrno(PyExc_IOError);
-        close(fd);
-        return NULL;
     }
 
-    close(fd);
-
-    sprintf(broadcast, "%u.%u.%u.%u",
-            (unsigned int)ifr.ifr_broadaddr.sa_data[2] % 256,
-            (unsigned int)ifr.ifr_broadaddr.sa_data[3] % 256,
-            (unsigned int)ifr.ifr_broadaddr.sa_data[4] % 256,
-            (unsigned int)ifr.ifr_broadaddr.sa_data[5] % 256);
-
-    return PyStr_FromString(broadcast);
+    return err;
 }
 
-static PyObject *get_module(PyObject *self __unused, PyObject *args)
+PyObject *dev_get_module(struct dev_req *req, PyObject *value __unused)
 {
-    struct ethtool_cmd ecmd;
-    struct ifreq ifr;
-    int fd, err;
+    struct ethtool_drvinfo drvinfo;
+    const char *devname = req->ifr.ifr_name;
     char buf[2048];
-    const char *devname;
-
-    if (!PyArg_ParseTuple(args, "s", &devname))
-        return NULL;
+    int err;
 
     /* Setup our control structures. */
-    memset(&ecmd, 0, sizeof(ecmd));
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(&ifr.ifr_name[0], devname, IFNAMSIZ);
-    ifr.ifr_name[IFNAMSIZ - 1] = 0;
-    ifr.ifr_data = (caddr_t) &buf;
-    ecmd.cmd = ETHTOOL_GDRVINFO;
-    memcpy(&buf, &ecmd, sizeof(ecmd));
-
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        return PyErr_SetFromErrno(PyExc_OSError);
-    }
+    memset(&drvinfo, 0, sizeof(drvinfo));
 
     /* Get current settings. */
-    err = ioctl(fd, SIOCETHTOOL, &ifr);
+    err = send_command(req, ETHTOOL_GDRVINFO, &drvinfo);
 
     if (err < 0) {  /* failed? */
-        PyErr_SetFromErrno(PyExc_IOError);
         FILE *file;
         int found = 0;
         char driver[101], dev[101];
-        close(fd);
 
         /* Before bailing, maybe it is a PCMCIA/PC Card? */
         file = fopen("/var/lib/pcmcia/stab", "r");
@@ -472,222 +615,104 @@ static PyObject *get_module(PyObject *self __unused, PyObject *args)
         }
     }
 
-    close(fd);
-    return PyStr_FromString(((struct ethtool_drvinfo *)buf)->driver);
+    return PyStr_FromString(drvinfo.driver);
 }
 
-static PyObject *get_businfo(PyObject *self __unused, PyObject *args)
+PyObject *dev_get_businfo(struct dev_req *req, PyObject *value __unused)
 {
-    struct ethtool_cmd ecmd;
-    struct ifreq ifr;
-    int fd, err;
-    char buf[1024];
-    const char *devname;
-
-    if (!PyArg_ParseTuple(args, "s", &devname))
-        return NULL;
+    struct ethtool_drvinfo drvinfo;
 
     /* Setup our control structures. */
-    memset(&ecmd, 0, sizeof(ecmd));
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(&ifr.ifr_name[0], devname, IFNAMSIZ);
-    ifr.ifr_name[IFNAMSIZ - 1] = 0;
-    ifr.ifr_data = (caddr_t) &buf;
-    ecmd.cmd = ETHTOOL_GDRVINFO;
-    memcpy(&buf, &ecmd, sizeof(ecmd));
-
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        return PyErr_SetFromErrno(PyExc_OSError);
-    }
+    memset(&drvinfo, 0, sizeof(drvinfo));
 
     /* Get current settings. */
-    err = ioctl(fd, SIOCETHTOOL, &ifr);
-
-    if (err < 0) {  /* failed? */
-        PyErr_SetFromErrno(PyExc_IOError);
-        close(fd);
+    if (send_command(req, ETHTOOL_GDRVINFO, &drvinfo) < 0)
         return NULL;
-    }
 
-    close(fd);
-    return PyStr_FromString(((struct ethtool_drvinfo *)buf)->bus_info);
+    return PyStr_FromString(drvinfo.bus_info);
 }
 
-static int send_command(int cmd, const char *devname, void *value)
+static PyObject *dev_get_int_value(struct dev_req *req, int cmd)
 {
-    /* Setup our request structure. */
-    int fd, err;
-    struct ifreq ifr;
-    struct ethtool_value *eval = value;
-
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(&ifr.ifr_name[0], devname, IFNAMSIZ);
-    ifr.ifr_name[IFNAMSIZ - 1] = 0;
-    ifr.ifr_data = (caddr_t)eval;
-    eval->cmd = cmd;
-
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        PyErr_SetFromErrno(PyExc_OSError);
-        return -1;
-    }
+    struct ethtool_value eval;
 
-    /* Get current settings. */
-    err = ioctl(fd, SIOCETHTOOL, &ifr);
-    if (err < 0) {
-        PyErr_SetFromErrno(PyExc_IOError);
-    }
+    if (send_command(req, cmd, &eval) < 0)
+        return NULL;
 
-    close(fd);
-    return err;
+    return Py_BuildValue("b", *(int *)&eval.data);
 }
 
-static int get_dev_value(int cmd, PyObject *args, void *value)
+static PyObject *dev_set_int_value(struct dev_req *req, int cmd,
+                                   PyObject *value)
 {
-    const char *devname;
-    int err = -1;
+    struct ethtool_value eval;
 
-    if (PyArg_ParseTuple(args, "s", &devname))
-        err = send_command(cmd, devname, value);
+    if (!PyArg_Parse(value, "i", &eval.data))
+        return NULL;
 
-    return err;
+    if (send_command(req, cmd, &eval) < 0)
+        return NULL;
+
+    Py_RETURN_NONE;
 }
 
-static int get_dev_int_value(int cmd, PyObject *args, int *value)
+PyObject *dev_get_tso(struct dev_req *req, PyObject *value __unused)
 {
-    struct ethtool_value eval;
-    int rc = get_dev_value(cmd, args, &eval);
-
-    if (rc == 0)
-        *value = *(int *)&eval.data;
-
-    return rc;
+    return dev_get_int_value(req, ETHTOOL_GTSO);
 }
 
-static int dev_set_int_value(int cmd, PyObject *args)
+PyObject *dev_set_tso(struct dev_req *req, PyObject *value)
 {
-    struct ethtool_value eval;
-    const char *devname;
-
-    if (!PyArg_ParseTuple(args, "si", &devname, &eval.data))
-        return -1;
-
-    return send_command(cmd, devname, &eval);
+    return dev_set_int_value(req, ETHTOOL_STSO, value);
 }
 
-static PyObject *get_tso(PyObject *self __unused, PyObject *args)
+PyObject *dev_get_ufo(struct dev_req *req, PyObject *value __unused)
 {
-    int value = 0;
-
-    if (get_dev_int_value(ETHTOOL_GTSO, args, &value) < 0)
-        return NULL;
-
-    return Py_BuildValue("b", value);
+    return dev_get_int_value(req, ETHTOOL_GUFO);
 }
 
-static PyObject *set_tso(PyObject *self __unused, PyObject *args)
+PyObject *dev_get_gso(struct dev_req *req, PyObject *value __unused)
 {
-    if (dev_set_int_value(ETHTOOL_STSO, args) < 0)
-        return NULL;
-
-    Py_RETURN_NONE;
+    return dev_get_int_value(req, ETHTOOL_GGSO);
 }
 
-static PyObject *get_ufo(PyObject *self __unused, PyObject *args)
+PyObject *dev_set_gso(struct dev_req *req, PyObject *value)
 {
-    int value = 0;
-
-    if (get_dev_int_value(ETHTOOL_GUFO, args, &value) < 0)
-        return NULL;
-
-    return Py_BuildValue("b", value);
-}
-
-static PyObject *get_gso(PyObject *self __unused, PyObject *args)
-{
-    int value = 0;
-
-    if (get_dev_int_value(ETHTOOL_GGSO, args, &value) < 0)
-        return NULL;
-
-    return Py_BuildValue("b", value);
-}
-
-static PyObject *set_gso(PyObject *self __unused, PyObject *args)
-{
-    if (dev_set_int_value(ETHTOOL_SGSO, args) < 0)
-        return NULL;
-
-    Py_RETURN_NONE;
+    return dev_set_int_value(req, ETHTOOL_SGSO, value);
 }
 
-static PyObject *get_gro(PyObject *self __unused, PyObject *args)
+PyObject *dev_get_gro(struct dev_req *req, PyObject *value __unused)
 {
-    int value = 0;
-
-    if (get_dev_int_value(ETHTOOL_GGRO, args, &value) < 0)
-        return NULL;
-
-    return Py_BuildValue("b", value);
+    return dev_get_int_value(req, ETHTOOL_GGRO);
 }
 
-static PyObject *set_gro(PyObject *self __unused, PyObject *args)
+PyObject *dev_set_gro(struct dev_req *req, PyObject *value)
 {
-    if (dev_set_int_value(ETHTOOL_SGRO, args) < 0)
-        return NULL;
-
-    Py_RETURN_NONE;
+    return dev_set_int_value(req, ETHTOOL_SGRO, value);
 }
 
-static PyObject *get_sg(PyObject *self __unused, PyObject *args)
+PyObject *dev_get_sg(struct dev_req *req, PyObject *value __unused)
 {
-    int value = 0;
-
-    if (get_dev_int_value(ETHTOOL_GSG, args, &value) < 0)
-        return NULL;
-
-    return Py_BuildValue("b", value);
+    return dev_get_int_value(req, ETHTOOL_GSG);
 }
 
-static PyObject *get_wireless_protocol (PyObject *self __unused, PyObject *args)
+PyObject *dev_get_wireless_protocol(struct dev_req *req,
+                                    PyObject *value __unused)
 {
-    struct iwreq iwr;
-    const char *devname;
-    int fd, err;
+    /* struct iwreq starts with the interface name, like struct ifreq */
+    struct iwreq *iwr = (struct iwreq *)&req->ifr;
 
-    if (!PyArg_ParseTuple(args, "s", &devname))
-        return NULL;
-
-    /* Setup our request structure. */
-    memset(&iwr, 0, sizeof(iwr));
-    strncpy(iwr.ifr_name, devname, IFNAMSIZ-1);
-    iwr.ifr_name[IFNAMSIZ-1] = 0;
-
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        PyErr_SetFromErrno(PyExc_OSError);
-        return NULL;
-    }
-    err = ioctl(fd, SIOCGIWNAME, &iwr);
-    if(err < 0) {
-        PyErr_SetFromErrno(PyExc_IOError);
-        close(fd);
+    if (dev_ioctl(req, SIOCGIWNAME) < 0)
         return NULL;
-    }
 
-    close(fd);
-
-    return PyStr_FromString(iwr.u.name);
+    return PyStr_FromString(iwr->u.name);
 }
 
 struct struct_desc {
     char *name;
     unsigned short offset;
     unsigned short size;
+    unsigned char readonly;  /**< Reported by the driver, never set */
 };
 
 #define member_desc(type, member_name) { \
@@ -695,6 +720,12 @@ struct struct_desc {
     .offset = offsetof(type, member_name), \
     .size = sizeof(((type *)0)->member_name), }
 
+#define member_desc_ro(type, member_name) { \
+    .name = #member_name, \
+    .offset = offsetof(type, member_name), \
+    .size = sizeof(((type *)0)->member_name), \
+    .readonly = 1, }
+
 struct struct_desc ethtool_coalesce_desc[] = {
     member_desc(struct ethtool_coalesce, rx_coalesce_usecs),
     member_desc(struct ethtool_coalesce, rx_max_coalesced_frames),
@@ -736,7 +767,10 @@ static PyObject *__struct_desc_create_dict(struct struct_desc *table,
 
         switch (d->size) {
         case sizeof(uint32_t):
-            objval = PyLong_FromLong(*(uint32_t *)val);
+            objval = PyInt_FromLong(*(uint32_t *)val);
+            break;
+        case sizeof(uint8_t):
+            objval = PyInt_FromLong(*(uint8_t *)val);
             break;
         }
 
@@ -770,6 +804,7 @@ static int __struct_desc_from_dict(struct struct_desc *table,
         struct struct_desc *d = &table[i];
         void *val = to + d->offset;
         PyObject *obj;
+        long value;
 
         switch (d->size) {
         case sizeof(uint32_t):
@@ -783,6 +818,26 @@ static int __struct_desc_from_dict(struct struct_desc *table,
             }
             *(uint32_t *)val = PyLong_AsLong(obj);
             break;
+        case sizeof(uint8_t):
+            obj = PyDict_GetItemString(dict, d->name);
+            if (obj == NULL) {
+                snprintf(buf, sizeof(buf),
+                         "Missing dict entry for field %s",
+                         d->name);
+                PyErr_SetString(PyExc_IOError, buf);
+                return -1;
+            }
+            value = PyLong_AsLong(obj);
+            if (value == -1 && PyErr_Occurred())
+                return -1;
+            if (value < 0 || value > UINT8_MAX) {
+                PyErr_Format(PyExc_OverflowError,
+                             "%s must be between 0 and %d", d->name,
+                             UINT8_MAX);
+                return -1;
+            }
+            *(uint8_t *)val = value;
+            break;
         default:
             snprintf(buf, sizeof(buf),
                      "Invalid type size %d for field %s",
@@ -798,263 +853,1949 @@ static int __struct_desc_from_dict(struct struct_desc *table,
 #define struct_desc_from_dict(table, to, dict) \
     __struct_desc_from_dict(table, ARRAY_SIZE(table), to, dict)
 
-static PyObject *get_coalesce(PyObject *self __unused, PyObject *args)
+/* Turns the result of ETHTOOL_GCOALESCE into the dict of get_coalesce() */
+PyObject *coalesce_to_dict(struct ethtool_coalesce *coal)
+{
+    return struct_desc_create_dict(ethtool_coalesce_desc, coal);
+}
+
+PyObject *dev_get_coalesce(struct dev_req *req, PyObject *value __unused)
 {
     struct ethtool_coalesce coal;
 
-    if (get_dev_value(ETHTOOL_GCOALESCE, args, &coal) < 0)
+    if (send_command(req, ETHTOOL_GCOALESCE, &coal) < 0)
         return NULL;
 
-    return struct_desc_create_dict(ethtool_coalesce_desc, &coal);
+    return coalesce_to_dict(&coal);
 }
 
-static PyObject *set_coalesce(PyObject *self __unused, PyObject *args)
+PyObject *dev_set_coalesce(struct dev_req *req, PyObject *dict)
 {
     struct ethtool_coalesce coal;
-    const char *devname;
-    PyObject *dict;
-
-    if (!PyArg_ParseTuple(args, "sO", &devname, &dict))
-        return NULL;
 
     if (struct_desc_from_dict(ethtool_coalesce_desc, &coal, dict) != 0)
         return NULL;
 
-    if (send_command(ETHTOOL_SCOALESCE, devname, &coal))
+    if (send_command(req, ETHTOOL_SCOALESCE, &coal))
         return NULL;
 
     Py_RETURN_NONE;
 }
 
 struct struct_desc ethtool_ringparam_desc[] = {
-    member_desc(struct ethtool_ringparam, rx_max_pending),
-    member_desc(struct ethtool_ringparam, rx_mini_max_pending),
-    member_desc(struct ethtool_ringparam, rx_jumbo_max_pending),
-    member_desc(struct ethtool_ringparam, tx_max_pending),
+    member_desc_ro(struct ethtool_ringparam, rx_max_pending),
+    member_desc_ro(struct ethtool_ringparam, rx_mini_max_pending),
+    member_desc_ro(struct ethtool_ringparam, rx_jumbo_max_pending),
+    member_desc_ro(struct ethtool_ringparam, tx_max_pending),
     member_desc(struct ethtool_ringparam, rx_pending),
     member_desc(struct ethtool_ringparam, rx_mini_pending),
     member_desc(struct ethtool_ringparam, rx_jumbo_pending),
     member_desc(struct ethtool_ringparam, tx_pending),
 };
 
-static PyObject *get_ringparam(PyObject *self __unused, PyObject *args)
+/* Turns the result of ETHTOOL_GRINGPARAM into the dict of get_ringparam() */
+PyObject *ringparam_to_dict(struct ethtool_ringparam *ring)
+{
+    return struct_desc_create_dict(ethtool_ringparam_desc, ring);
+}
+
+PyObject *dev_get_ringparam(struct dev_req *req, PyObject *value __unused)
 {
     struct ethtool_ringparam ring;
 
-    if (get_dev_value(ETHTOOL_GRINGPARAM, args, &ring) < 0)
+    if (send_command(req, ETHTOOL_GRINGPARAM, &ring) < 0)
         return NULL;
 
-    return struct_desc_create_dict(ethtool_ringparam_desc, &ring);
+    return ringparam_to_dict(&ring);
 }
 
-static PyObject *set_ringparam(PyObject *self __unused, PyObject *args)
+PyObject *dev_set_ringparam(struct dev_req *req, PyObject *dict)
 {
     struct ethtool_ringparam ring;
-    const char *devname;
-    PyObject *dict;
-
-    if (!PyArg_ParseTuple(args, "sO", &devname, &dict))
-        return NULL;
 
     if (struct_desc_from_dict(ethtool_ringparam_desc, &ring, dict) != 0)
         return NULL;
 
-    if (send_command(ETHTOOL_SRINGPARAM, devname, &ring))
+    if (send_command(req, ETHTOOL_SRINGPARAM, &ring))
         return NULL;
 
     Py_RETURN_NONE;
 }
 
-static struct PyMethodDef PyEthModuleMethods[] = {
-    {
-        .ml_name = "get_module",
-        .ml_meth = (PyCFunction)get_module,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_businfo",
-        .ml_meth = (PyCFunction)get_businfo,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_hwaddr",
-        .ml_meth = (PyCFunction)get_hwaddress,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_ipaddr",
-        .ml_meth = (PyCFunction)get_ipaddress,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_interfaces_info",
-        .ml_meth = (PyCFunction)get_interfaces_info,
-        .ml_flags = METH_VARARGS,
-        .ml_doc = "Accepts a string, list or tupples of interface names. "
-        "Returns a list of ethtool.etherinfo objets with device information."
-    },
-    {
-        .ml_name = "get_netmask",
-        .ml_meth = (PyCFunction)get_netmask,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_broadcast",
-        .ml_meth = (PyCFunction)get_broadcast,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_coalesce",
-        .ml_meth = (PyCFunction)get_coalesce,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "set_coalesce",
-        .ml_meth = (PyCFunction)set_coalesce,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_devices",
-        .ml_meth = (PyCFunction)get_devices,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_active_devices",
-        .ml_meth = (PyCFunction)get_active_devices,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_ringparam",
-        .ml_meth = (PyCFunction)get_ringparam,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "set_ringparam",
-        .ml_meth = (PyCFunction)set_ringparam,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_tso",
-        .ml_meth = (PyCFunction)get_tso,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "set_tso",
-        .ml_meth = (PyCFunction)set_tso,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_ufo",
-        .ml_meth = (PyCFunction)get_ufo,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_gso",
-        .ml_meth = (PyCFunction)get_gso,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "set_gso",
-        .ml_meth = (PyCFunction)set_gso,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_gro",
-        .ml_meth = (PyCFunction)get_gro,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "set_gro",
-        .ml_meth = (PyCFunction)set_gro,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_sg",
-        .ml_meth = (PyCFunction)get_sg,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_flags",
-        .ml_meth = (PyCFunction)get_flags,
-        .ml_flags = METH_VARARGS,
-    },
-    {
-        .ml_name = "get_wireless_protocol",
-        .ml_meth = (PyCFunction)get_wireless_protocol,
-        .ml_flags = METH_VARARGS,
-    },
-    { .ml_name = NULL, },
+/* Link settings with room for the largest link mode bitmaps the kernel
+ * can hand out: supported, advertising and lp_advertising.
+ */
+struct ethtool_link_usettings {
+    struct ethtool_link_settings base;
+    u32 link_mode_data[3 * ETHTOOL_LINK_MODE_MASK_MAX_NU32];
 };
 
-static struct PyModuleDef moduledef = {
-    PyModuleDef_HEAD_INIT,
-    .m_name = "ethtool",
-    .m_doc = "Python ethtool module",
-    .m_size = -1,
-    .m_methods = PyEthModuleMethods,
+struct struct_desc ethtool_link_settings_desc[] = {
+    member_desc(struct ethtool_link_settings, speed),
+    member_desc(struct ethtool_link_settings, duplex),
+    member_desc(struct ethtool_link_settings, port),
+    member_desc(struct ethtool_link_settings, phy_address),
+    member_desc(struct ethtool_link_settings, autoneg),
+    member_desc(struct ethtool_link_settings, mdio_support),
+    member_desc(struct ethtool_link_settings, eth_tp_mdix),
+    member_desc(struct ethtool_link_settings, eth_tp_mdix_ctrl),
+    member_desc(struct ethtool_link_settings, transceiver),
+    member_desc(struct ethtool_link_settings, master_slave_cfg),
+    member_desc(struct ethtool_link_settings, master_slave_state),
 };
 
-MODULE_INIT_FUNC(ethtool)
+/**
+ * Fetches the link settings of a device.  The size of the link mode
+ * bitmaps is negotiated with the kernel first: a request with zero words
+ * is answered with the (negated) number of words the kernel uses, which
+ * is then used for the real request.
+ *
+ * @param req   The device
+ * @param ecmd  Where to store the settings
+ *
+ * @return Returns 0 on success, otherwise -1 with a Python exception set.
+ */
+static int get_link_usettings(struct dev_req *req,
+                              struct ethtool_link_usettings *ecmd)
 {
-    PyObject *m;
-    m = PyModule_Create(&moduledef);
-    if (m == NULL)
-        return NULL;
+    memset(ecmd, 0, sizeof(*ecmd));
+    if (send_command(req, ETHTOOL_GLINKSETTINGS, ecmd) < 0)
+        return -1;
 
-    // Prepare the ethtool.etherinfo class
-    if (PyType_Ready(&PyEtherInfo_Type) < 0)
+    if (ecmd->base.link_mode_masks_nwords >= 0
+            || ecmd->base.cmd != ETHTOOL_GLINKSETTINGS) {
+        errno = EOPNOTSUPP;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+
+    ecmd->base.link_mode_masks_nwords = -ecmd->base.link_mode_masks_nwords;
+    if (send_command(req, ETHTOOL_GLINKSETTINGS, ecmd) < 0)
+        return -1;
+
+    if (ecmd->base.link_mode_masks_nwords <= 0
+            || ecmd->base.cmd != ETHTOOL_GLINKSETTINGS) {
+        errno = EOPNOTSUPP;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Converts a link mode bitmap to a Python integer, bit N being link mode N */
+static PyObject *link_mode_mask_to_long(const u32 *mask, int nwords)
+{
+    char buf[ETHTOOL_LINK_MODE_MASK_MAX_NU32 * 8 + 1];
+    int i;
+
+    for (i = 0; i < nwords; i++)
+        sprintf(&buf[i * 8], "%08x", mask[nwords - 1 - i]);
+
+#if PY_MAJOR_VERSION >= 3
+    return PyLong_FromString(buf, NULL, 16);
+#else
+    {
+        /* A plain int when the mask fits, as the other settings are */
+        PyObject *obj = PyLong_FromString(buf, NULL, 16), *num;
+
+        if (obj == NULL)
+            return NULL;
+        num = PyNumber_Int(obj);
+        Py_DECREF(obj);
+        return num;
+    }
+#endif
+}
+
+/**
+ * Converts a Python integer back to a link mode bitmap of nwords words
+ *
+ * @return Returns 0 on success, otherwise -1 with a Python exception set.
+ */
+static int link_mode_mask_from_long(PyObject *obj, u32 *mask, int nwords)
+{
+    PyObject *hex;
+    const char *digits;
+    Py_ssize_t len;
+    int i;
+
+    /* "0x..." in lower case, least significant digit last */
+    hex = PyNumber_ToBase(obj, 16);
+    if (hex == NULL)
+        return -1;
+    digits = PyStr_AsString(hex);
+    if (digits == NULL || digits[0] == '-') {
+        PyErr_SetString(PyExc_ValueError,
+                        "Link mode masks must be non-negative integers");
+        Py_DECREF(hex);
+        return -1;
+    }
+    digits += 2;
+    len = strlen(digits);
+
+    if (len > nwords * 8) {
+        PyErr_Format(PyExc_ValueError,
+                     "Link mode mask does not fit in %d bits", nwords * 32);
+        Py_DECREF(hex);
+        return -1;
+    }
+
+    memset(mask, 0, nwords * sizeof(u32));
+    for (i = 0; i < len; i++) {
+        char c = digits[len - 1 - i];
+        u32 nibble = (c <= '9') ? (u32)(c - '0') : (u32)(c - 'a' + 10);
+
+        mask[i / 8] |= nibble << ((i % 8) * 4);
+    }
+
+    Py_DECREF(hex);
+    return 0;
+}
+
+PyObject *dev_get_link_settings(struct dev_req *req, PyObject *value __unused)
+{
+    struct ethtool_link_usettings ecmd;
+    PyObject *dict, *obj;
+    const char *mask_names[] = { "supported", "advertising",
+                                 "lp_advertising" };
+    unsigned int i;
+    int nwords;
+
+    if (get_link_usettings(req, &ecmd) < 0)
         return NULL;
 
-    // Prepare the ethtool IPv6 and IPv4 address types
-    if (PyType_Ready(&ethtool_netlink_ip_address_Type))
+    dict = struct_desc_create_dict(ethtool_link_settings_desc, &ecmd.base);
+    if (dict == NULL)
         return NULL;
 
-    // Setup constants
-    /* Interface is up: */
-    PyModule_AddIntConstant(m, "IFF_UP", IFF_UP);
-    /* Broadcast address valid: */
-    PyModule_AddIntConstant(m, "IFF_BROADCAST", IFF_BROADCAST);
-    /* Turn on debugging: */
-    PyModule_AddIntConstant(m, "IFF_DEBUG", IFF_DEBUG);
-    /* Is a loopback net: */
-    PyModule_AddIntConstant(m, "IFF_LOOPBACK", IFF_LOOPBACK);
-    /* Is a point-to-point link: */
-    PyModule_AddIntConstant(m, "IFF_POINTOPOINT", IFF_POINTOPOINT);
-    /* Avoid use of trailers: */
-    PyModule_AddIntConstant(m, "IFF_NOTRAILERS", IFF_NOTRAILERS);
-    /* Resources allocated: */
-    PyModule_AddIntConstant(m, "IFF_RUNNING", IFF_RUNNING);
-    /* No address resolution protocol: */
-    PyModule_AddIntConstant(m, "IFF_NOARP", IFF_NOARP);
-    /* Receive all packets: */
-    PyModule_AddIntConstant(m, "IFF_PROMISC", IFF_PROMISC);
-    /* Receive all multicast packets: */
-    PyModule_AddIntConstant(m, "IFF_ALLMULTI", IFF_ALLMULTI);
-    /* Master of a load balancer: */
-    PyModule_AddIntConstant(m, "IFF_MASTER", IFF_MASTER);
-    /* Slave of a load balancer: */
-    PyModule_AddIntConstant(m, "IFF_SLAVE", IFF_SLAVE);
-    /* Supports multicast: */
-    PyModule_AddIntConstant(m, "IFF_MULTICAST", IFF_MULTICAST);
-    /* Can set media type: */
-    PyModule_AddIntConstant(m, "IFF_PORTSEL", IFF_PORTSEL);
-    /* Auto media select active: */
-    PyModule_AddIntConstant(m, "IFF_AUTOMEDIA", IFF_AUTOMEDIA); 
-    /* Dialup device with changing addresses: */
-    PyModule_AddIntConstant(m, "IFF_DYNAMIC", IFF_DYNAMIC);
-    /* IPv4 interface: */
-    PyModule_AddIntConstant(m, "AF_INET", AF_INET);
-    /* IPv6 interface: */
-    PyModule_AddIntConstant(m, "AF_INET6", AF_INET6);
-    /* python-ethtool version: */
-    PyModule_AddStringConstant(m, "version", "python-ethtool v" VERSION);
+    /* Speed is reported as SPEED_UNKNOWN (-1) when there is no link */
+    obj = PyInt_FromLong((int32_t)ecmd.base.speed);
+    if (obj == NULL || PyDict_SetItemString(dict, "speed", obj) != 0)
+        goto error;
+    Py_DECREF(obj);
+
+    nwords = ecmd.base.link_mode_masks_nwords;
+    for (i = 0; i < ARRAY_SIZE(mask_names); i++) {
+        obj = link_mode_mask_to_long(&ecmd.link_mode_data[i * nwords],
+                                     nwords);
+        if (obj == NULL || PyDict_SetItemString(dict, mask_names[i], obj) != 0)
+            goto error;
+        Py_DECREF(obj);
+    }
 
-    Py_INCREF(&PyEtherInfo_Type);
-    PyModule_AddObject(m, "etherinfo", (PyObject *)&PyEtherInfo_Type);
+    return dict;
 
-    Py_INCREF(&ethtool_netlink_ip_address_Type);
-    PyModule_AddObject(m, "NetlinkIPaddress",
-                       (PyObject *)&ethtool_netlink_ip_address_Type);
+error:
+    Py_XDECREF(obj);
+    Py_DECREF(dict);
+    return NULL;
+}
 
-    return m;
+PyObject *dev_set_link_settings(struct dev_req *req, PyObject *value)
+{
+    struct ethtool_link_usettings ecmd;
+    PyObject *dict, *obj;
+    int nwords;
+
+    if (!PyArg_Parse(value, "O!", &PyDict_Type, &dict))
+        return NULL;
+
+    /* The kernel only accepts a bitmap size it handed out earlier */
+    if (get_link_usettings(req, &ecmd) < 0)
+        return NULL;
+    nwords = ecmd.base.link_mode_masks_nwords;
+
+    if (struct_desc_from_dict(ethtool_link_settings_desc, &ecmd.base,
+                              dict) != 0)
+        return NULL;
+
+    obj = PyDict_GetItemString(dict, "advertising");
+    if (obj == NULL) {
+        PyErr_SetString(PyExc_IOError,
+                        "Missing dict entry for field advertising");
+        return NULL;
+    }
+    if (link_mode_mask_from_long(obj, &ecmd.link_mode_data[nwords],
+                                 nwords) < 0)
+        return NULL;
+
+    if (PyErr_Occurred())
+        return NULL;
+
+    if (send_command(req, ETHTOOL_SLINKSETTINGS, &ecmd))
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+PyObject *dev_get_ts_info(struct dev_req *req, PyObject *value __unused)
+{
+    struct ethtool_ts_info info;
+
+    memset(&info, 0, sizeof(info));
+    if (send_command(req, ETHTOOL_GET_TS_INFO, &info) < 0)
+        return NULL;
+
+    return Py_BuildValue("{s:I,s:i,s:I,s:I}",
+                         "so_timestamping", info.so_timestamping,
+                         "phc_index", info.phc_index,
+                         "tx_types", info.tx_types,
+                         "rx_filters", info.rx_filters);
+}
+
+struct struct_desc ethtool_channels_desc[] = {
+    member_desc_ro(struct ethtool_channels, max_rx),
+    member_desc_ro(struct ethtool_channels, max_tx),
+    member_desc_ro(struct ethtool_channels, max_other),
+    member_desc_ro(struct ethtool_channels, max_combined),
+    member_desc(struct ethtool_channels, rx_count),
+    member_desc(struct ethtool_channels, tx_count),
+    member_desc(struct ethtool_channels, other_count),
+    member_desc(struct ethtool_channels, combined_count),
+};
+
+struct struct_desc ethtool_pauseparam_desc[] = {
+    member_desc(struct ethtool_pauseparam, autoneg),
+    member_desc(struct ethtool_pauseparam, rx_pause),
+    member_desc(struct ethtool_pauseparam, tx_pause),
+};
+
+static const struct {
+    const char *name;  /**< Key of the result */
+    u32 cmd;
+    u32 set_cmd;  /**< Of apply_profile(), 0 if it cannot be set */
+    size_t offset;  /**< Of the request structure in struct dev_settings */
+} settings_requests[SETTINGS_MAX] = {
+    [SETTINGS_DRIVER] = { "driver", ETHTOOL_GDRVINFO, 0,
+                          offsetof(struct dev_settings, drvinfo) },
+    [SETTINGS_RING] = { "ring", ETHTOOL_GRINGPARAM, ETHTOOL_SRINGPARAM,
+                        offsetof(struct dev_settings, ring) },
+    [SETTINGS_COALESCE] = { "coalesce", ETHTOOL_GCOALESCE, ETHTOOL_SCOALESCE,
+                            offsetof(struct dev_settings, coal) },
+    [SETTINGS_CHANNELS] = { "channels", ETHTOOL_GCHANNELS, ETHTOOL_SCHANNELS,
+                            offsetof(struct dev_settings, channels) },
+    [SETTINGS_PAUSE] = { "pause", ETHTOOL_GPAUSEPARAM, ETHTOOL_SPAUSEPARAM,
+                         offsetof(struct dev_settings, pause) },
+    [SETTINGS_TSO] = { "tso", ETHTOOL_GTSO, ETHTOOL_STSO,
+                       offsetof(struct dev_settings, features[0]) },
+    [SETTINGS_GSO] = { "gso", ETHTOOL_GGSO, ETHTOOL_SGSO,
+                       offsetof(struct dev_settings, features[1]) },
+    [SETTINGS_GRO] = { "gro", ETHTOOL_GGRO, ETHTOOL_SGRO,
+                       offsetof(struct dev_settings, features[2]) },
+    [SETTINGS_SG] = { "sg", ETHTOOL_GSG, ETHTOOL_SSG,
+                      offsetof(struct dev_settings, features[3]) },
+};
+
+/* The fields of the requests made of a structure */
+static const struct {
+    struct struct_desc *table;
+    int nr_entries;
+} settings_descs[SETTINGS_MAX] = {
+    [SETTINGS_RING] = { ethtool_ringparam_desc,
+                        ARRAY_SIZE(ethtool_ringparam_desc) },
+    [SETTINGS_COALESCE] = { ethtool_coalesce_desc,
+                            ARRAY_SIZE(ethtool_coalesce_desc) },
+    [SETTINGS_CHANNELS] = { ethtool_channels_desc,
+                            ARRAY_SIZE(ethtool_channels_desc) },
+    [SETTINGS_PAUSE] = { ethtool_pauseparam_desc,
+                         ARRAY_SIZE(ethtool_pauseparam_desc) },
+};
+
+/**
+ * Makes the requests of get_all_settings() on a device.  Makes no Python
+ * calls, the GIL is released meanwhile.
+ *
+ * @return Returns the number of ioctls issued
+ */
+unsigned int read_settings(int fd, struct dev_settings *settings)
+{
+    struct ifreq ifr;
+    unsigned int i;
+
+    for (i = 0; i < SETTINGS_MAX; i++) {
+        void *data = (char *)settings + settings_requests[i].offset;
+
+        memset(&ifr, 0, sizeof(ifr));
+        memcpy(ifr.ifr_name, settings->name, IFNAMSIZ);
+        *(u32 *)data = settings_requests[i].cmd;
+        ifr.ifr_data = data;
+        settings->err[i] = ioctl(fd, SIOCETHTOOL, &ifr) < 0 ? errno : 0;
+        /* Nothing else will work on it either */
+        if (settings->err[i] == ENODEV)
+            return i + 1;
+    }
+    return SETTINGS_MAX;
+}
+
+/**
+ * Builds the result of get_all_settings() for a device
+ *
+ * @return New reference to the dict, NULL with a Python exception set if a
+ *         request failed other than by being unsupported
+ */
+PyObject *settings_dict(struct dev_settings *settings)
+{
+    struct ethtool_drvinfo *drvinfo = &settings->drvinfo;
+    PyObject *dict, *features = NULL, *value;
+    int i;
+
+    for (i = 0; i < SETTINGS_MAX; i++) {
+        int err = settings->err[i];
+
+        if (err != 0 && err != EOPNOTSUPP) {
+            errno = err;
+            return PyErr_SetFromErrno(PyExc_IOError);
+        }
+    }
+
+    dict = PyDict_New();
+    if (dict == NULL)
+        return NULL;
+    for (i = 0; i < SETTINGS_MAX; i++) {
+        if (settings->err[i] != 0) {
+            Py_INCREF(Py_None);
+            value = Py_None;
+        } else if (i == SETTINGS_DRIVER) {
+            value = Py_BuildValue("{s:s,s:s,s:s,s:s}",
+                                  "driver", drvinfo->driver,
+                                  "version", drvinfo->version,
+                                  "fw_version", drvinfo->fw_version,
+                                  "bus_info", drvinfo->bus_info);
+        } else if (i == SETTINGS_RING) {
+            value = struct_desc_create_dict(ethtool_ringparam_desc,
+                                            &settings->ring);
+        } else if (i == SETTINGS_COALESCE) {
+            value = struct_desc_create_dict(ethtool_coalesce_desc,
+                                            &settings->coal);
+        } else if (i == SETTINGS_CHANNELS) {
+            value = struct_desc_create_dict(ethtool_channels_desc,
+                                            &settings->channels);
+        } else if (i == SETTINGS_PAUSE) {
+            value = struct_desc_create_dict(ethtool_pauseparam_desc,
+                                            &settings->pause);
+        } else {
+            value = PyInt_FromLong(
+                settings->features[i - SETTINGS_TSO].data);
+        }
+        if (value == NULL)
+            goto err;
+
+        /* The offloads go together */
+        if (i >= SETTINGS_TSO) {
+            if (features == NULL) {
+                features = PyDict_New();
+                if (features == NULL
+                        || PyDict_SetItemString(dict, "features",
+                                                features) < 0) {
+                    Py_DECREF(value);
+                    goto err;
+                }
+            }
+            if (PyDict_SetItemString(features, settings_requests[i].name,
+                                     value) < 0) {
+                Py_DECREF(value);
+                goto err;
+            }
+        } else if (PyDict_SetItemString(dict, settings_requests[i].name,
+                                        value) < 0) {
+            Py_DECREF(value);
+            goto err;
+        }
+        Py_DECREF(value);
+    }
+    Py_XDECREF(features);
+    return dict;
+
+err:
+    Py_XDECREF(features);
+    Py_DECREF(dict);
+    return NULL;
+}
+
+/**
+ * Reads the driver information, ring parameters, coalescing, channels,
+ * pause parameters and offloads of many devices at once, on a single
+ * control socket and with the GIL released
+ *
+ * @param devs   Device name or sequence of them, all devices if None
+ * @param netns  Keyword-only namespace of the devices
+ *
+ * @return Python dict mapping each device name to a dict of its settings:
+ *         a dict or None, if the driver does not support it, per category.
+ *         Devices given which do not exist raise IOError; with devs=None
+ *         those removed meanwhile are left out.
+ */
+static PyObject *get_all_settings(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "devs", "netns" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    PyObject *argv[2] = { NULL, NULL };
+    PyObject *devs, *seq = NULL, *ret = NULL;
+    struct dev_settings *settings = NULL;
+    struct ethtool_netns *ns;
+    unsigned long ioctls = 0;
+    Py_ssize_t i, n;
+    int fd = -1;
+
+    /* netns is keyword-only */
+    if (fastcall_unpack("get_all_settings", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 0,
+                        FASTCALL_NARGS > 1 ? 1 : 2, argv) < 0)
+        return NULL;
+    devs = argv[0];
+    if (ethtool_netns_get(state, argv[1], &ns) < 0)
+        return NULL;
+
+    if (devs == NULL || devs == Py_None) {
+        seq = list_devices(ns);
+    } else if (PyStr_Check(devs)) {
+        seq = PyTuple_Pack(1, devs);
+    } else {
+        seq = PySequence_Fast(devs, "devs must be a string or a sequence "
+                              "of strings");
+    }
+    if (seq == NULL)
+        goto out;
+    n = PySequence_Fast_GET_SIZE(seq);
+
+    settings = calloc(n + 1, sizeof(*settings));
+    if (settings == NULL) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    for (i = 0; i < n; i++) {
+        PyObject *name = PySequence_Fast_GET_ITEM(seq, i);
+        const char *s;
+
+        if (!PyStr_Check(name)) {
+            PyErr_Format(PyExc_TypeError,
+                         "device names must be str, not %.50s",
+                         Py_TYPE(name)->tp_name);
+            goto out;
+        }
+        s = dev_name_as_string(name);
+        if (s == NULL)
+            goto out;
+        strncpy(settings[i].name, s, IFNAMSIZ - 1);
+    }
+
+    if (ns != NULL) {
+        fd = ns->ctl_fd;
+    } else {
+        fd = dev_socket();
+        if (fd < 0)
+            goto out;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < n; i++)
+        ioctls += read_settings(fd, &settings[i]);
+    Py_END_ALLOW_THREADS
+    perf_count(ioctls, ioctls);
+
+    ret = PyDict_New();
+    for (i = 0; ret != NULL && i < n; i++) {
+        PyObject *dict;
+
+        /* Removed since it was listed */
+        if (settings[i].err[SETTINGS_DRIVER] == ENODEV
+                && (devs == NULL || devs == Py_None))
+            continue;
+        dict = settings_dict(&settings[i]);
+        if (dict == NULL
+                || PyDict_SetItem(ret, PySequence_Fast_GET_ITEM(seq, i),
+                                  dict) < 0)
+            Py_CLEAR(ret);
+        Py_XDECREF(dict);
+    }
+
+out:
+    if (fd >= 0 && ns == NULL)
+        close(fd);
+    ethtool_netns_put(state, ns);
+    free(settings);
+    Py_XDECREF(seq);
+    return ret;
+}
+
+/** A device of apply_profile(): its settings and those to set */
+struct dev_plan {
+    struct dev_settings cur;  /**< Read first, restored on rollback */
+    struct dev_settings new;
+    unsigned int changed;  /**< Bit mask of the SETTINGS_* to set */
+    unsigned int written;  /**< Those set */
+    int err;  /**< errno of the failed write, or rollback */
+    unsigned long ioctls;
+};
+
+static u32 struct_desc_get(const struct struct_desc *d, const void *values)
+{
+    const char *val = (const char *)values + d->offset;
+
+    if (d->size == sizeof(uint8_t))
+        return *(const uint8_t *)val;
+    return *(const uint32_t *)val;
+}
+
+/**
+ * Sets a field of the request new to its value in the profile
+ *
+ * @return 1 if it changes, 0 if not, -1 with a Python exception set if the
+ *         value is invalid or the field cannot be set
+ */
+static int plan_field(const struct struct_desc *d, const void *cur,
+                      void *new, PyObject *obj)
+{
+    unsigned long max = d->size == sizeof(uint8_t) ? UINT8_MAX : UINT32_MAX;
+    char *val = (char *)new + d->offset;
+    unsigned long value;
+
+    if (!PyInt_Check(obj) && !PyLong_Check(obj)) {
+        PyErr_Format(PyExc_TypeError, "%s must be an int, not %.50s",
+                     d->name, Py_TYPE(obj)->tp_name);
+        return -1;
+    }
+    value = PyLong_AsUnsignedLong(obj);
+    if (value == (unsigned long)-1 && PyErr_Occurred())
+        return -1;
+    if (value > max) {
+        PyErr_Format(PyExc_OverflowError, "%s must be at most %lu",
+                     d->name, max);
+        return -1;
+    }
+
+    if (value == struct_desc_get(d, cur))
+        return 0;
+    if (d->readonly) {
+        PyErr_Format(PyExc_ValueError, "%s is read-only", d->name);
+        return -1;
+    }
+    if (d->size == sizeof(uint8_t))
+        *(uint8_t *)val = value;
+    else
+        *(uint32_t *)val = value;
+    return 1;
+}
+
+/**
+ * Returns the C string of a key of the profile, NULL with a Python exception
+ * set if it is not a string or not one which can name a setting
+ */
+static const char *plan_key(PyObject *key)
+{
+    if (!PyStr_Check(key)) {
+        PyErr_Format(PyExc_TypeError,
+                     "profile keys must be str, not %.50s",
+                     Py_TYPE(key)->tp_name);
+        return NULL;
+    }
+    return dev_name_as_string(key);
+}
+
+/**
+ * Plans the request i of a device from its dict in the profile
+ *
+ * @return 1 if it changes, 0 if not, -1 with a Python exception set
+ */
+static int plan_request(struct dev_plan *plan, int i, PyObject *dict)
+{
+    const struct struct_desc *table = settings_descs[i].table;
+    const void *cur = (char *)&plan->cur + settings_requests[i].offset;
+    void *new = (char *)&plan->new + settings_requests[i].offset;
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    int changed = 0;
+
+    if (!PyDict_Check(dict)) {
+        PyErr_Format(PyExc_TypeError, "%s must be a dict, not %.50s",
+                     settings_requests[i].name, Py_TYPE(dict)->tp_name);
+        return -1;
+    }
+
+    while (PyDict_Next(dict, &pos, &key, &value)) {
+        const char *name = plan_key(key);
+        int j, ret;
+
+        if (name == NULL)
+            return -1;
+        for (j = 0; j < settings_descs[i].nr_entries; j++) {
+            if (strcmp(table[j].name, name) == 0)
+                break;
+        }
+        if (j == settings_descs[i].nr_entries) {
+            PyErr_Format(PyExc_ValueError, "unknown %s setting '%s'",
+                         settings_requests[i].name, name);
+            return -1;
+        }
+
+        ret = plan_field(&table[j], cur, new, value);
+        if (ret < 0)
+            return -1;
+        changed |= ret;
+    }
+    return changed;
+}
+
+/**
+ * Checks that the request i of a device, found in the profile, was read
+ *
+ * @return 0 on success, -1 with a Python exception set otherwise
+ */
+static int plan_check(struct dev_plan *plan, int i)
+{
+    if (plan->cur.err[i] == 0)
+        return 0;
+    errno = plan->cur.err[i];
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, plan->cur.name);
+    return -1;
+}
+
+/**
+ * Works out the requests setting a device as in the profile, those whose
+ * settings differ, into plan->new and plan->changed
+ *
+ * @return 0 on success, -1 with a Python exception set if the profile is
+ *         invalid or asks for what the device does not support
+ */
+static int plan_profile(struct dev_plan *plan, PyObject *profile)
+{
+    PyObject *key, *value, *fkey, *fvalue;
+    Py_ssize_t pos = 0, fpos;
+    int i, ret;
+
+    memcpy(&plan->new, &plan->cur, sizeof(plan->new));
+    plan->changed = 0;
+
+    while (PyDict_Next(profile, &pos, &key, &value)) {
+        const char *name = plan_key(key);
+
+        if (name == NULL)
+            return -1;
+
+        if (strcmp(name, "features") == 0) {
+            if (!PyDict_Check(value)) {
+                PyErr_Format(PyExc_TypeError,
+                             "features must be a dict, not %.50s",
+                             Py_TYPE(value)->tp_name);
+                return -1;
+            }
+            fpos = 0;
+            while (PyDict_Next(value, &fpos, &fkey, &fvalue)) {
+                const char *fname = plan_key(fkey);
+                struct ethtool_value *feature;
+
+                if (fname == NULL)
+                    return -1;
+                for (i = SETTINGS_TSO; i < SETTINGS_MAX; i++) {
+                    if (strcmp(settings_requests[i].name, fname) == 0)
+                        break;
+                }
+                if (i == SETTINGS_MAX) {
+                    PyErr_Format(PyExc_ValueError, "unknown feature '%s'",
+                                 fname);
+                    return -1;
+                }
+                if (plan_check(plan, i) < 0)
+                    return -1;
+                ret = PyObject_IsTrue(fvalue);
+                if (ret < 0)
+                    return -1;
+                feature = &plan->new.features[i - SETTINGS_TSO];
+                if (feature->data != (u32)ret) {
+                    feature->data = ret;
+                    plan->changed |= 1U << i;
+                }
+            }
+            continue;
+        }
+
+        for (i = 0; i < SETTINGS_TSO; i++) {
+            if (strcmp(settings_requests[i].name, name) == 0)
+                break;
+        }
+        if (i == SETTINGS_TSO) {
+            PyErr_Format(PyExc_ValueError, "unknown setting category '%s'", name);
+            return -1;
+        }
+        if (settings_requests[i].set_cmd == 0) {
+            PyErr_Format(PyExc_ValueError, "%s cannot be set", name);
+            return -1;
+        }
+        /* As get_all_settings() reports what is not supported */
+        if (value == Py_None)
+            continue;
+        if (plan_check(plan, i) < 0)
+            return -1;
+        ret = plan_request(plan, i, value);
+        if (ret < 0)
+            return -1;
+        if (ret)
+            plan->changed |= 1U << i;
+    }
+    return 0;
+}
+
+/* Adds the change of a setting to the dict *category, created first */
+static int settings_diff_add(PyObject *diff, PyObject **category,
+                             const char *category_name, const char *name,
+                             u32 old_value, u32 new_value)
+{
+    PyObject *change;
+    int err;
+
+    if (*category == NULL) {
+        *category = PyDict_New();
+        if (*category == NULL
+                || PyDict_SetItemString(diff, category_name, *category) < 0)
+            return -1;
+    }
+    change = Py_BuildValue("(II)", old_value, new_value);
+    if (change == NULL)
+        return -1;
+    err = PyDict_SetItemString(*category, name, change);
+    Py_DECREF(change);
+    return err;
+}
+
+/**
+ * Compares two readings of the settings of a device, those of the requests
+ * in mask which succeeded in both
+ *
+ * @return New reference to a dict shaped as a result of get_all_settings()
+ *         with only the settings which differ, as tuples of their old and
+ *         new values, NULL on failure
+ */
+PyObject *settings_diff(const struct dev_settings *old,
+                        const struct dev_settings *new, unsigned int mask)
+{
+    PyObject *diff, *category = NULL, *features = NULL;
+    int i, j;
+
+    diff = PyDict_New();
+    if (diff == NULL)
+        return NULL;
+
+    for (i = SETTINGS_RING; i < SETTINGS_MAX; i++) {
+        const void *old_values = (char *)old + settings_requests[i].offset;
+        const void *new_values = (char *)new + settings_requests[i].offset;
+
+        if (!(mask & (1U << i)) || old->err[i] != 0 || new->err[i] != 0)
+            continue;
+
+        /* The offloads go together, as in get_all_settings() */
+        if (i >= SETTINGS_TSO) {
+            u32 old_value = old->features[i - SETTINGS_TSO].data;
+            u32 new_value = new->features[i - SETTINGS_TSO].data;
+
+            if (old_value != new_value
+                    && settings_diff_add(diff, &features, "features",
+                                         settings_requests[i].name,
+                                         old_value, new_value) < 0)
+                goto err;
+            continue;
+        }
+
+        Py_CLEAR(category);
+        for (j = 0; j < settings_descs[i].nr_entries; j++) {
+            const struct struct_desc *d = &settings_descs[i].table[j];
+            u32 old_value = struct_desc_get(d, old_values);
+            u32 new_value = struct_desc_get(d, new_values);
+
+            if (old_value != new_value
+                    && settings_diff_add(diff, &category,
+                                         settings_requests[i].name, d->name,
+                                         old_value, new_value) < 0)
+                goto err;
+        }
+    }
+    Py_XDECREF(category);
+    Py_XDECREF(features);
+    return diff;
+
+err:
+    Py_XDECREF(category);
+    Py_XDECREF(features);
+    Py_DECREF(diff);
+    return NULL;
+}
+
+/* Makes the set request i of a device with the settings of data */
+static int write_request(int fd, const char *name, int i, void *data,
+                         unsigned long *ioctls)
+{
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    memcpy(ifr.ifr_name, name, IFNAMSIZ);
+    *(u32 *)data = settings_requests[i].set_cmd;
+    ifr.ifr_data = data;
+    (*ioctls)++;
+    return ioctl(fd, SIOCETHTOOL, &ifr) < 0 ? errno : 0;
+}
+
+/**
+ * Makes the set requests of apply_profile() on a device, in the order of
+ * settings_requests.  Makes no Python calls.
+ *
+ * @return Returns 0, otherwise the errno of the request failing, the last
+ *         one made
+ */
+static int write_settings(int fd, struct dev_plan *plan)
+{
+    int i, err;
+
+    for (i = 0; i < SETTINGS_MAX; i++) {
+        if (!(plan->changed & (1U << i)))
+            continue;
+        err = write_request(fd, plan->new.name, i,
+                            (char *)&plan->new + settings_requests[i].offset,
+                            &plan->ioctls);
+        if (err != 0)
+            return err;
+        plan->written |= 1U << i;
+    }
+    return 0;
+}
+
+/**
+ * Sets the settings of a device written by write_settings() back as they
+ * were read, in the reverse order.  Makes no Python calls.
+ *
+ * @return Returns 0, otherwise the errno of the first request failing; the
+ *         others are made all the same
+ */
+static int rollback_settings(int fd, struct dev_plan *plan)
+{
+    int i, err, ret = 0;
+
+    for (i = SETTINGS_MAX - 1; i >= 0; i--) {
+        if (!(plan->written & (1U << i)))
+            continue;
+        err = write_request(fd, plan->cur.name, i,
+                            (char *)&plan->cur + settings_requests[i].offset,
+                            &plan->ioctls);
+        if (err == 0)
+            plan->written &= ~(1U << i);
+        else if (ret == 0)
+            ret = err;
+    }
+    return ret;
+}
+
+/** The writes of apply_profile(), shared by the workers */
+struct apply_run {
+    struct dev_plan *plans;
+    size_t len;
+    size_t next;  /**< Next device to set, taken atomically */
+    int fd;
+    int failed;  /**< Set once a write failed, the workers stop */
+    int rollback;  /**< Whether to set back what was written instead */
+};
+
+static void *apply_worker(void *arg)
+{
+    struct apply_run *run = arg;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED))
+           < run->len) {
+        struct dev_plan *plan = &run->plans[i];
+
+        if (run->rollback) {
+            plan->err = rollback_settings(run->fd, plan);
+            continue;
+        }
+        if (__atomic_load_n(&run->failed, __ATOMIC_RELAXED))
+            break;
+        plan->err = write_settings(run->fd, plan);
+        if (plan->err != 0)
+            __atomic_store_n(&run->failed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/**
+ * Runs apply_worker() on up to nworkers threads, without the GIL; on the
+ * calling thread if a single one is asked for or none could be started
+ */
+static void apply_run(struct apply_run *run, pthread_t *threads,
+                      int nworkers)
+{
+    int i, started = 0;
+
+    run->next = 0;
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; nworkers > 1 && i < nworkers; i++) {
+        if (pthread_create(&threads[i], NULL, apply_worker, run) != 0)
+            break;
+        started++;
+    }
+    if (started == 0)
+        apply_worker(run);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    Py_END_ALLOW_THREADS
+}
+
+/**
+ * Sets devices as described by a profile, making only the requests of the
+ * settings which differ: a device already set that way is only read
+ *
+ * @param dev_or_glob  Device name, or shell pattern matching device names
+ * @param profile      Dict shaped as a result of get_all_settings(), with
+ *                     only the settings to set
+ * @param dry_run      Whether to leave the devices alone
+ * @param netns        Keyword-only namespace of the devices
+ * @param workers      Keyword-only number of devices set at once, the
+ *                     number of CPUs by default
+ *
+ * @return Python dict mapping each device name to a dict of the settings
+ *         changed, or to change with dry_run, as tuples of their old and
+ *         new values.  The profile is checked against every device before
+ *         any is set; once a request fails, no more are made and every
+ *         device is set back as it was read.
+ */
+static PyObject *apply_profile(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = {
+        "dev_or_glob", "profile", "dry_run", "netns", "workers"
+    };
+    struct ethtool_state *state = ethtool_get_state(self);
+    PyObject *argv[5] = { NULL, NULL, NULL, NULL, NULL };
+    PyObject *devs = NULL, *profile, *ret = NULL;
+    struct apply_run run = { 0 };
+    struct dev_plan *plans = NULL;
+    pthread_t *threads = NULL;
+    struct ethtool_netns *ns;
+    unsigned long ioctls = 0;
+    const char *pattern;
+    Py_ssize_t i, n = 0;
+    int dry_run = 0, glob, fd = -1;
+    long nworkers;
+
+    /* netns and workers are keyword-only */
+    if (fastcall_unpack("apply_profile", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 2,
+                        FASTCALL_NARGS > 3 ? 3 : 5, argv) < 0)
+        return NULL;
+    if (!PyStr_Check(argv[0])) {
+        PyErr_Format(PyExc_TypeError, "dev_or_glob must be str, not %.50s",
+                     Py_TYPE(argv[0])->tp_name);
+        return NULL;
+    }
+    pattern = dev_name_as_string(argv[0]);
+    if (pattern == NULL)
+        return NULL;
+    profile = argv[1];
+    if (!PyDict_Check(profile)) {
+        PyErr_Format(PyExc_TypeError, "profile must be a dict, not %.50s",
+                     Py_TYPE(profile)->tp_name);
+        return NULL;
+    }
+    if (argv[2] != NULL && (dry_run = PyObject_IsTrue(argv[2])) < 0)
+        return NULL;
+    if (argv[4] == NULL || argv[4] == Py_None) {
+        nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    } else {
+        nworkers = PyInt_AsLong(argv[4]);
+        if (nworkers == -1 && PyErr_Occurred())
+            return NULL;
+        if (nworkers <= 0) {
+            PyErr_SetString(PyExc_ValueError, "workers must be positive");
+            return NULL;
+        }
+    }
+    if (ethtool_netns_get(state, argv[3], &ns) < 0)
+        return NULL;
+
+    glob = strpbrk(pattern, "*?[") != NULL;
+    if (glob) {
+        PyObject *all = list_devices(ns);
+
+        if (all == NULL)
+            goto out;
+        devs = PyList_New(0);
+        for (i = 0; devs != NULL && i < PyList_GET_SIZE(all); i++) {
+            PyObject *name = PyList_GET_ITEM(all, i);
+            const char *s = dev_name_as_string(name);
+
+            if (s == NULL
+                    || (fnmatch(pattern, s, 0) == 0
+                        && PyList_Append(devs, name) < 0))
+                Py_CLEAR(devs);
+        }
+        Py_DECREF(all);
+    } else {
+        devs = PyList_New(1);
+        if (devs != NULL) {
+            Py_INCREF(argv[0]);
+            PyList_SET_ITEM(devs, 0, argv[0]);
+        }
+    }
+    if (devs == NULL)
+        goto out;
+    n = PyList_GET_SIZE(devs);
+
+    if (nworkers > n)
+        nworkers = n;
+    plans = calloc(n + 1, sizeof(*plans));
+    threads = calloc(nworkers + 1, sizeof(*threads));
+    if (plans == NULL || threads == NULL) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    for (i = 0; i < n; i++) {
+        const char *s = dev_name_as_string(PyList_GET_ITEM(devs, i));
+
+        if (s == NULL)
+            goto out;
+        strncpy(plans[i].cur.name, s, IFNAMSIZ - 1);
+    }
+
+    if (ns != NULL) {
+        fd = ns->ctl_fd;
+    } else {
+        fd = dev_socket();
+        if (fd < 0)
+            goto out;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < n; i++)
+        ioctls += read_settings(fd, &plans[i].cur);
+    Py_END_ALLOW_THREADS
+
+    /* Nothing is set unless the profile suits every device */
+    for (i = 0; i < n; i++) {
+        if (plans[i].cur.err[SETTINGS_DRIVER] == ENODEV) {
+            /* Removed since it was listed */
+            if (glob)
+                continue;
+            errno = ENODEV;
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+                                           plans[i].cur.name);
+            goto out;
+        }
+        if (plan_profile(&plans[i], profile) < 0)
+            goto out;
+    }
+
+    if (!dry_run) {
+        run.plans = plans;
+        run.len = n;
+        run.fd = fd;
+        apply_run(&run, threads, nworkers);
+    }
+    if (run.failed) {
+        Py_ssize_t failed;
+        int err;
+
+        for (failed = 0; plans[failed].err == 0; failed++)
+            ;
+        err = plans[failed].err;
+
+        /* All or nothing: every device goes back as it was read */
+        run.rollback = 1;
+        apply_run(&run, threads, nworkers);
+        for (i = 0; i < n && plans[i].err == 0; i++)
+            ;
+        if (i < n) {
+            PyObject *exc;
+
+            exc = PyObject_CallFunction(PyExc_IOError, "(iss)", plans[i].err,
+                                        "Setting back failed",
+                                        plans[i].cur.name);
+            if (exc != NULL) {
+                PyErr_SetObject(PyExc_IOError, exc);
+                Py_DECREF(exc);
+            }
+        } else {
+            errno = err;
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+                                           plans[failed].cur.name);
+        }
+        goto out;
+    }
+
+    ret = PyDict_New();
+    for (i = 0; ret != NULL && i < n; i++) {
+        PyObject *diff;
+
+        if (plans[i].cur.err[SETTINGS_DRIVER] == ENODEV)
+            continue;
+        diff = settings_diff(&plans[i].cur, &plans[i].new,
+                             plans[i].changed);
+        if (diff == NULL
+                || PyDict_SetItem(ret, PyList_GET_ITEM(devs, i), diff) < 0)
+            Py_CLEAR(ret);
+        Py_XDECREF(diff);
+    }
+
+out:
+    for (i = 0; plans != NULL && i < n; i++)
+        ioctls += plans[i].ioctls;
+    perf_count(ioctls, ioctls);
+    if (fd >= 0 && ns == NULL)
+        close(fd);
+    ethtool_netns_put(state, ns);
+    free(plans);
+    free(threads);
+    Py_XDECREF(devs);
+    return ret;
+}
+
+/**
+ * Defines perf_<fn>(), the module function fn() taking a device name and,
+ * for setters, the value parameter value_name, running dev_<fn>() on the
+ * device
+ */
+#define DEV_FUNCTION(fn, value_name, api) \
+    PERF_WRAPPER(perf_##fn, api, dev_function, \
+                 (PyObject *self, FASTCALL_PARAMS), \
+                 (ethtool_get_state(self), #fn, FASTCALL_ARGS, \
+                  FASTCALL_NARGS, FASTCALL_KWNAMES, value_name, dev_##fn), \
+                 &ethtool_get_state(self)->perf, \
+                 fastcall_device(FASTCALL_ARGS, FASTCALL_NARGS, \
+                                 FASTCALL_KWNAMES))
+
+/* Every exported function is accounted in the performance counters */
+DEV_FUNCTION(get_module, NULL, PERF_API_GET_MODULE)
+DEV_FUNCTION(get_businfo, NULL, PERF_API_GET_BUSINFO)
+DEV_FUNCTION(get_hwaddr, NULL, PERF_API_GET_HWADDR)
+DEV_FUNCTION(get_ipaddr, NULL, PERF_API_GET_IPADDR)
+PERF_FASTCALL_WRAPPER(get_interfaces_info, PERF_API_GET_INTERFACES_INFO)
+DEV_FUNCTION(get_netmask, NULL, PERF_API_GET_NETMASK)
+DEV_FUNCTION(get_broadcast, NULL, PERF_API_GET_BROADCAST)
+DEV_FUNCTION(get_coalesce, NULL, PERF_API_GET_COALESCE)
+DEV_FUNCTION(set_coalesce, "settings", PERF_API_SET_COALESCE)
+PERF_FASTCALL_WRAPPER(get_devices, PERF_API_GET_DEVICES)
+PERF_FASTCALL_WRAPPER(get_active_devices, PERF_API_GET_ACTIVE_DEVICES)
+PERF_FASTCALL_WRAPPER(sweep_namespaces, PERF_API_SWEEP_NAMESPACES)
+PERF_FASTCALL_WRAPPER(get_all_settings, PERF_API_GET_ALL_SETTINGS)
+PERF_FASTCALL_WRAPPER(apply_profile, PERF_API_APPLY_PROFILE)
+PERF_FASTCALL_WRAPPER(snapshot, PERF_API_SNAPSHOT)
+PERF_FASTCALL_WRAPPER(snapshot_diff, PERF_API_DIFF)
+PERF_FASTCALL_WRAPPER(snapshot_dumps, PERF_API_DUMPS)
+PERF_FASTCALL_WRAPPER(snapshot_loads, PERF_API_LOADS)
+PERF_FASTCALL_WRAPPER(snapshot_columns, PERF_API_SNAPSHOT_COLUMNS)
+DEV_FUNCTION(get_ringparam, NULL, PERF_API_GET_RINGPARAM)
+DEV_FUNCTION(set_ringparam, "settings", PERF_API_SET_RINGPARAM)
+DEV_FUNCTION(get_tso, NULL, PERF_API_GET_TSO)
+DEV_FUNCTION(set_tso, "value", PERF_API_SET_TSO)
+DEV_FUNCTION(get_ufo, NULL, PERF_API_GET_UFO)
+DEV_FUNCTION(get_gso, NULL, PERF_API_GET_GSO)
+DEV_FUNCTION(set_gso, "value", PERF_API_SET_GSO)
+DEV_FUNCTION(get_gro, NULL, PERF_API_GET_GRO)
+DEV_FUNCTION(set_gro, "value", PERF_API_SET_GRO)
+DEV_FUNCTION(get_sg, NULL, PERF_API_GET_SG)
+DEV_FUNCTION(get_link_settings, NULL, PERF_API_GET_LINK_SETTINGS)
+DEV_FUNCTION(set_link_settings, "settings", PERF_API_SET_LINK_SETTINGS)
+DEV_FUNCTION(get_ts_info, NULL, PERF_API_GET_TS_INFO)
+DEV_FUNCTION(get_flags, NULL, PERF_API_GET_FLAGS)
+DEV_FUNCTION(get_wireless_protocol, NULL, PERF_API_GET_WIRELESS_PROTOCOL)
+
+static struct PyMethodDef PyEthModuleMethods[] = {
+    {
+        .ml_name = "get_module",
+        .ml_meth = (PyCFunction)perf_get_module,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_businfo",
+        .ml_meth = (PyCFunction)perf_get_businfo,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_hwaddr",
+        .ml_meth = (PyCFunction)perf_get_hwaddr,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_ipaddr",
+        .ml_meth = (PyCFunction)perf_get_ipaddr,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_interfaces_info",
+        .ml_meth = (PyCFunction)perf_get_interfaces_info,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "Accepts a string, list or tupples of interface names. "
+        "Returns a list of ethtool.etherinfo objets with device information.  "
+        "The keyword-only netns selects the network namespace of the "
+        "devices, like for the other functions."
+    },
+    {
+        .ml_name = "get_netmask",
+        .ml_meth = (PyCFunction)perf_get_netmask,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_broadcast",
+        .ml_meth = (PyCFunction)perf_get_broadcast,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_coalesce",
+        .ml_meth = (PyCFunction)perf_get_coalesce,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "set_coalesce",
+        .ml_meth = (PyCFunction)perf_set_coalesce,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_devices",
+        .ml_meth = (PyCFunction)perf_get_devices,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_active_devices",
+        .ml_meth = (PyCFunction)perf_get_active_devices,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_ringparam",
+        .ml_meth = (PyCFunction)perf_get_ringparam,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "set_ringparam",
+        .ml_meth = (PyCFunction)perf_set_ringparam,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_tso",
+        .ml_meth = (PyCFunction)perf_get_tso,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "set_tso",
+        .ml_meth = (PyCFunction)perf_set_tso,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_ufo",
+        .ml_meth = (PyCFunction)perf_get_ufo,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_gso",
+        .ml_meth = (PyCFunction)perf_get_gso,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "set_gso",
+        .ml_meth = (PyCFunction)perf_set_gso,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_gro",
+        .ml_meth = (PyCFunction)perf_get_gro,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "set_gro",
+        .ml_meth = (PyCFunction)perf_set_gro,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_sg",
+        .ml_meth = (PyCFunction)perf_get_sg,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_link_settings",
+        .ml_meth = (PyCFunction)perf_get_link_settings,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "Returns a dict with the speed, duplex, autonegotiation "
+        "and port settings of a device.  The supported, advertising and "
+        "lp_advertising link modes are integers with bit N set for "
+        "ETHTOOL_LINK_MODE bit N."
+    },
+    {
+        .ml_name = "set_link_settings",
+        .ml_meth = (PyCFunction)perf_set_link_settings,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "Accepts a device name and a dict as returned by "
+        "get_link_settings() and applies the writable settings."
+    },
+    {
+        .ml_name = "get_ts_info",
+        .ml_meth = (PyCFunction)perf_get_ts_info,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "Returns a dict with the time stamping capabilities of a "
+        "device: so_timestamping (SOF_TIMESTAMPING_* flags), phc_index "
+        "(PTP hardware clock, -1 if none), tx_types (bit N set for "
+        "HWTSTAMP_TX_* value N) and rx_filters (bit N set for "
+        "HWTSTAMP_FILTER_* value N)."
+    },
+    {
+        .ml_name = "get_flags",
+        .ml_meth = (PyCFunction)perf_get_flags,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_wireless_protocol",
+        .ml_meth = (PyCFunction)perf_get_wireless_protocol,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+    },
+    {
+        .ml_name = "get_perf_counters",
+        .ml_meth = (PyCFunction)get_perf_counters,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Returns a dict mapping each exported function to a dict "
+        "of its performance counters: calls, ioctls, netlink_opens, "
+        "netlink_dumps, netlink_msgs, netlink_bytes, netlink_retries "
+        "(requests sent again after an interrupted dump or a full buffer), "
+        "cache_allocs, time_ns (cumulative wall time) and time_ns_max "
+        "(longest call)."
+    },
+    {
+        .ml_name = "reset_perf_counters",
+        .ml_meth = (PyCFunction)reset_perf_counters,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Zeroes all the performance counters and latency "
+        "histograms."
+    },
+    {
+        .ml_name = "get_latency_histograms",
+        .ml_meth = (PyCFunction)get_latency_histograms,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Returns a dict mapping each exported function to a list "
+        "of (low_ns, high_ns, count) tuples, one per non-empty bucket of "
+        "its wall time histogram.  Buckets are a power of two split into 8, "
+        "so the bounds are within 12.5% of the actual times.  The last "
+        "bucket has no upper bound, its high_ns is None."
+    },
+    {
+        .ml_name = "set_trace_hook",
+        .ml_meth = (PyCFunction)set_trace_hook,
+        .ml_flags = METH_O,
+        .ml_doc = "Sets a callable called after every exported function with "
+        "(function, device, duration_ns, errno), errno being 0 unless the "
+        "call raised an OSError.  None removes the hook."
+    },
+    {
+        .ml_name = "get_free_list_stats",
+        .ml_meth = (PyCFunction)get_free_list_stats,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Returns a dict mapping etherinfo and NetlinkIPaddress to "
+        "a dict describing their free list: length, limit, and the number "
+        "of objects allocated from the heap (allocs), reused from the list "
+        "(reuses) and given back to the heap (frees)."
+    },
+    {
+        .ml_name = "set_free_list_limit",
+        .ml_meth = (PyCFunction)set_free_list_limit,
+        .ml_flags = METH_O,
+        .ml_doc = "Sets how many deallocated etherinfo and NetlinkIPaddress "
+        "objects are kept for reuse, per type.  0 disables the free lists."
+    },
+    {
+        .ml_name = "set_netlink_backend",
+        .ml_meth = (PyCFunction)set_netlink_backend,
+        .ml_flags = METH_O,
+        .ml_doc = "Selects how etherinfo objects read NETLINK: 'native' "
+        "parses the messages straight from the receive buffer, 'libnl' "
+        "builds libnl caches.  The native reader leaves requests it cannot "
+        "handle to libnl.  Returns the name of the previous backend."
+    },
+    {
+        .ml_name = "set_netns_cache_limit",
+        .ml_meth = (PyCFunction)set_netns_cache_limit,
+        .ml_flags = METH_O,
+        .ml_doc = "Sets how many network namespaces passed as netns keep "
+        "their control socket and NETLINK connections open between calls, "
+        "the most recently used ones.  0 closes them after every call."
+    },
+    {
+        .ml_name = "get_all_settings",
+        .ml_meth = (PyCFunction)perf_get_all_settings,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "get_all_settings(devs=None, *, netns=None): reads the "
+        "driver information, ring parameters, coalescing, channels, pause "
+        "parameters and offloads of the given devices, all of them by "
+        "default, in one call.  Returns a dict mapping each device name to "
+        "a dict with the keys 'driver', 'ring', 'coalesce', 'channels', "
+        "'pause' and 'features', None for what the driver does not support."
+    },
+    {
+        .ml_name = "apply_profile",
+        .ml_meth = (PyCFunction)perf_apply_profile,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "apply_profile(dev_or_glob, profile, dry_run=False, *, "
+        "netns=None, workers=None): sets the device, or the devices "
+        "matching the shell pattern, as described by profile, a dict shaped "
+        "as a result of get_all_settings() with only what to set.  Only the "
+        "settings which differ are set, on up to workers devices at once "
+        "(one per CPU by default); if any fails, every device is set back.  "
+        "Returns a dict mapping each device name to the settings changed, "
+        "as (old, new) tuples; dry_run only returns what would change."
+    },
+    {
+        .ml_name = "snapshot",
+        .ml_meth = (PyCFunction)perf_snapshot,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "snapshot(settings=False, *, netns=None): takes an "
+        "ethtool.Snapshot of the interfaces, mapping their interface index "
+        "to their name, flags, MTU, hardware and IP addresses, and with "
+        "settings the settings of get_all_settings()."
+    },
+    {
+        .ml_name = "diff",
+        .ml_meth = (PyCFunction)perf_snapshot_diff,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "diff(a, b): compares two ethtool.Snapshot objects.  "
+        "Returns a dict of the interfaces 'added' and 'removed', mapping "
+        "their index to their name, and 'changed', mapping their index to "
+        "(old, new) tuples of the 'name', 'flags', 'mtu', 'hwaddr' and "
+        "'settings' which changed, and to the 'addresses' 'added' and "
+        "'removed'."
+    },
+    {
+        .ml_name = "dumps",
+        .ml_meth = (PyCFunction)perf_snapshot_dumps,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "dumps(snapshot): serializes an ethtool.Snapshot into "
+        "compact bytes, versioned, read back by loads()."
+    },
+    {
+        .ml_name = "loads",
+        .ml_meth = (PyCFunction)perf_snapshot_loads,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "loads(data): reads back an ethtool.Snapshot serialized by "
+        "dumps(), from bytes or another buffer.  Raises ValueError if the "
+        "data is not of a snapshot, or of a version it does not know."
+    },
+    {
+        .ml_name = "snapshot_columns",
+        .ml_meth = (PyCFunction)perf_snapshot_columns,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "snapshot_columns(*, netns=None): takes a columnar snapshot "
+        "of the interfaces, by interface index.  Returns a dict mapping "
+        "'ifindex', 'flags', 'mtu', the counters of the interfaces and "
+        "'name' and 'hwaddr', offsets into 'strings', to ethtool.Column "
+        "arrays exposed through the buffer protocol."
+    },
+    {
+        .ml_name = "sweep_namespaces",
+        .ml_meth = (PyCFunction)perf_sweep_namespaces,
+        .ml_flags = METH_FASTCALL_KEYWORDS,
+        .ml_doc = "sweep_namespaces(paths, what=None, workers=None): gets "
+        "the devices of many network namespaces at once, on up to workers "
+        "threads (one per CPU by default) entering the namespaces.  what "
+        "names what to get, all of it by default: 'devices', 'flags', "
+        "'mtu', 'hwaddr', 'ipv4_addresses', 'ipv6_addresses'.  Returns a "
+        "dict mapping each item of paths to a dict of them, keyed by device "
+        "name but for the list of devices, or to the OSError the namespace "
+        "failed with."
+    },
+    { .ml_name = NULL, },
+};
+
+static struct PyModuleDef moduledef;
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+/**
+ * Returns the state of the module instance a class was created by, for the
+ * class or a subclass of it
+ *
+ * @return Returns the state, otherwise NULL with a Python exception set.
+ */
+struct ethtool_state *ethtool_type_state(PyTypeObject *type)
+{
+    PyObject *m;
+#if PY_VERSION_HEX >= 0x030B0000
+    m = PyType_GetModuleByDef(type, &moduledef);
+    if (m == NULL)
+        return NULL;
+    return ethtool_get_state(m);
+#else
+    PyObject *mro = type->tp_mro;
+    Py_ssize_t i;
+
+    for (i = 0; mro != NULL && i < PyTuple_GET_SIZE(mro); i++) {
+        PyTypeObject *base = (PyTypeObject *)PyTuple_GET_ITEM(mro, i);
+
+        if (!PyType_HasFeature(base, Py_TPFLAGS_HEAPTYPE))
+            continue;
+        m = PyType_GetModule(base);
+        if (m == NULL) {
+            PyErr_Clear();
+            continue;
+        }
+        if (PyModule_GetDef(m) == &moduledef)
+            return ethtool_get_state(m);
+    }
+    PyErr_Format(PyExc_TypeError, "%s is not an ethtool class",
+                 type->tp_name);
+    return NULL;
+#endif
+}
+
+/**
+ * Creates the class of spec for a module instance and adds it to the module
+ *
+ * @param m         The module
+ * @param spec      The class
+ * @param internal  Objects are only created by the module, calling the class
+ *                  raises TypeError
+ *
+ * @return Returns a new reference to the class, otherwise NULL with a Python
+ *         exception set.
+ */
+static PyTypeObject *ethtool_add_type(PyObject *m, PyType_Spec *spec,
+                                      int internal)
+{
+    PyTypeObject *type;
+
+    type = (PyTypeObject *)PyType_FromModuleAndSpec(m, spec, NULL);
+    if (type == NULL)
+        return NULL;
+    if (internal)
+        type->tp_new = NULL;
+
+    if (PyModule_AddType(m, type) < 0) {
+        Py_DECREF(type);
+        return NULL;
+    }
+    return type;
+}
+#else
+struct ethtool_state ethtool_global_state = {
+    .nlc_mtx = ETHTOOL_MUTEX_INITIALIZER,
+    .netns_mtx = ETHTOOL_MUTEX_INITIALIZER,
+    .netns_limit = ETHTOOL_NETNS_DEFAULT_LIMIT,
+    .aio_mtx = ETHTOOL_MUTEX_INITIALIZER,
+    .perf.trace_hook_mtx = ETHTOOL_MUTEX_INITIALIZER,
+    .freelist_limit = ETHTOOL_FREELIST_DEFAULT_LIMIT,
+};
+
+struct ethtool_state *ethtool_type_state(PyTypeObject *type __unused)
+{
+    return &ethtool_global_state;
+}
+#endif
+
+/**
+ * Sets up a module instance: its classes and constants
+ *
+ * @return Returns 0 on success, otherwise -1 with a Python exception set.
+ */
+static int ethtool_exec(PyObject *m)
+{
+    struct ethtool_state *state = ethtool_get_state(m);
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+    ethtool_mutex_init(&state->nlc_mtx);
+    ethtool_mutex_init(&state->netns_mtx);
+    state->netns_limit = ETHTOOL_NETNS_DEFAULT_LIMIT;
+    ethtool_mutex_init(&state->aio_mtx);
+    ethtool_mutex_init(&state->perf.trace_hook_mtx);
+    state->freelist_limit = ETHTOOL_FREELIST_DEFAULT_LIMIT;
+
+    state->etherinfo_type = ethtool_add_type(m, &PyEtherInfo_Spec, 1);
+    if (state->etherinfo_type == NULL)
+        return -1;
+
+    state->device_type = ethtool_add_type(m, &PyEthtoolDevice_Spec, 0);
+    if (state->device_type == NULL)
+        return -1;
+
+    state->address_type = ethtool_add_type(
+        m, &ethtool_netlink_ip_address_Spec, 1);
+    if (state->address_type == NULL)
+        return -1;
+
+    state->snapshot_type = ethtool_add_type(m, &PyEthtoolSnapshot_Spec, 1);
+    if (state->snapshot_type == NULL)
+        return -1;
+
+    state->column_type = ethtool_add_type(m, &PyEthtoolColumn_Spec, 1);
+    if (state->column_type == NULL)
+        return -1;
+
+    state->stats_publisher_type = ethtool_add_type(
+        m, &PyEthtoolStatsPublisher_Spec, 0);
+    if (state->stats_publisher_type == NULL)
+        return -1;
+
+    state->stats_reader_type = ethtool_add_type(
+        m, &PyEthtoolSharedStatsReader_Spec, 0);
+    if (state->stats_reader_type == NULL)
+        return -1;
+#else
+    // Prepare the ethtool.etherinfo class
+    if (PyType_Ready(&PyEtherInfo_Type) < 0)
+        return -1;
+
+    // Prepare the ethtool.Device class
+    if (PyType_Ready(&PyEthtoolDevice_Type) < 0)
+        return -1;
+
+    // Prepare the ethtool IPv6 and IPv4 address types
+    if (PyType_Ready(&ethtool_netlink_ip_address_Type))
+        return -1;
+
+    // Prepare the ethtool.Snapshot class
+    if (PyType_Ready(&PyEthtoolSnapshot_Type) < 0)
+        return -1;
+
+    // Prepare the ethtool.Column class
+    if (PyType_Ready(&PyEthtoolColumn_Type) < 0)
+        return -1;
+
+    // Prepare the ethtool.StatsPublisher and SharedStatsReader classes
+    if (PyType_Ready(&PyEthtoolStatsPublisher_Type) < 0)
+        return -1;
+    if (PyType_Ready(&PyEthtoolSharedStatsReader_Type) < 0)
+        return -1;
+
+    state->etherinfo_type = &PyEtherInfo_Type;
+    state->device_type = &PyEthtoolDevice_Type;
+    state->address_type = &ethtool_netlink_ip_address_Type;
+    state->snapshot_type = &PyEthtoolSnapshot_Type;
+    state->column_type = &PyEthtoolColumn_Type;
+    state->stats_publisher_type = &PyEthtoolStatsPublisher_Type;
+    state->stats_reader_type = &PyEthtoolSharedStatsReader_Type;
+
+    Py_INCREF(&PyEtherInfo_Type);
+    PyModule_AddObject(m, "etherinfo", (PyObject *)&PyEtherInfo_Type);
+
+    Py_INCREF(&PyEthtoolDevice_Type);
+    PyModule_AddObject(m, "Device", (PyObject *)&PyEthtoolDevice_Type);
+
+    Py_INCREF(&ethtool_netlink_ip_address_Type);
+    PyModule_AddObject(m, "NetlinkIPaddress",
+                       (PyObject *)&ethtool_netlink_ip_address_Type);
+
+    Py_INCREF(&PyEthtoolSnapshot_Type);
+    PyModule_AddObject(m, "Snapshot", (PyObject *)&PyEthtoolSnapshot_Type);
+
+    Py_INCREF(&PyEthtoolColumn_Type);
+    PyModule_AddObject(m, "Column", (PyObject *)&PyEthtoolColumn_Type);
+
+    Py_INCREF(&PyEthtoolStatsPublisher_Type);
+    PyModule_AddObject(m, "StatsPublisher",
+                       (PyObject *)&PyEthtoolStatsPublisher_Type);
+
+    Py_INCREF(&PyEthtoolSharedStatsReader_Type);
+    PyModule_AddObject(m, "SharedStatsReader",
+                       (PyObject *)&PyEthtoolSharedStatsReader_Type);
+#endif
+
+    // Setup constants
+    /* Interface is up: */
+    PyModule_AddIntConstant(m, "IFF_UP", IFF_UP);
+    /* Broadcast address valid: */
+    PyModule_AddIntConstant(m, "IFF_BROADCAST", IFF_BROADCAST);
+    /* Turn on debugging: */
+    PyModule_AddIntConstant(m, "IFF_DEBUG", IFF_DEBUG);
+    /* Is a loopback net: */
+    PyModule_AddIntConstant(m, "IFF_LOOPBACK", IFF_LOOPBACK);
+    /* Is a point-to-point link: */
+    PyModule_AddIntConstant(m, "IFF_POINTOPOINT", IFF_POINTOPOINT);
+    /* Avoid use of trailers: */
+    PyModule_AddIntConstant(m, "IFF_NOTRAILERS", IFF_NOTRAILERS);
+    /* Resources allocated: */
+    PyModule_AddIntConstant(m, "IFF_RUNNING", IFF_RUNNING);
+    /* No address resolution protocol: */
+    PyModule_AddIntConstant(m, "IFF_NOARP", IFF_NOARP);
+    /* Receive all packets: */
+    PyModule_AddIntConstant(m, "IFF_PROMISC", IFF_PROMISC);
+    /* Receive all multicast packets: */
+    PyModule_AddIntConstant(m, "IFF_ALLMULTI", IFF_ALLMULTI);
+    /* Master of a load balancer: */
+    PyModule_AddIntConstant(m, "IFF_MASTER", IFF_MASTER);
+    /* Slave of a load balancer: */
+    PyModule_AddIntConstant(m, "IFF_SLAVE", IFF_SLAVE);
+    /* Supports multicast: */
+    PyModule_AddIntConstant(m, "IFF_MULTICAST", IFF_MULTICAST);
+    /* Can set media type: */
+    PyModule_AddIntConstant(m, "IFF_PORTSEL", IFF_PORTSEL);
+    /* Auto media select active: */
+    PyModule_AddIntConstant(m, "IFF_AUTOMEDIA", IFF_AUTOMEDIA); 
+    /* Dialup device with changing addresses: */
+    PyModule_AddIntConstant(m, "IFF_DYNAMIC", IFF_DYNAMIC);
+    /* Link speed is unknown: */
+    PyModule_AddIntConstant(m, "SPEED_UNKNOWN", SPEED_UNKNOWN);
+    /* Link duplex modes: */
+    PyModule_AddIntConstant(m, "DUPLEX_HALF", DUPLEX_HALF);
+    PyModule_AddIntConstant(m, "DUPLEX_FULL", DUPLEX_FULL);
+    PyModule_AddIntConstant(m, "DUPLEX_UNKNOWN", DUPLEX_UNKNOWN);
+    /* Connector ports: */
+    PyModule_AddIntConstant(m, "PORT_TP", PORT_TP);
+    PyModule_AddIntConstant(m, "PORT_AUI", PORT_AUI);
+    PyModule_AddIntConstant(m, "PORT_MII", PORT_MII);
+    PyModule_AddIntConstant(m, "PORT_FIBRE", PORT_FIBRE);
+    PyModule_AddIntConstant(m, "PORT_BNC", PORT_BNC);
+    PyModule_AddIntConstant(m, "PORT_DA", PORT_DA);
+    PyModule_AddIntConstant(m, "PORT_NONE", PORT_NONE);
+    PyModule_AddIntConstant(m, "PORT_OTHER", PORT_OTHER);
+    /* Autonegotiation: */
+    PyModule_AddIntConstant(m, "AUTONEG_DISABLE", AUTONEG_DISABLE);
+    PyModule_AddIntConstant(m, "AUTONEG_ENABLE", AUTONEG_ENABLE);
+    /* Time stamping capabilities: */
+    PyModule_AddIntConstant(m, "SOF_TIMESTAMPING_TX_HARDWARE",
+                            SOF_TIMESTAMPING_TX_HARDWARE);
+    PyModule_AddIntConstant(m, "SOF_TIMESTAMPING_TX_SOFTWARE",
+                            SOF_TIMESTAMPING_TX_SOFTWARE);
+    PyModule_AddIntConstant(m, "SOF_TIMESTAMPING_RX_HARDWARE",
+                            SOF_TIMESTAMPING_RX_HARDWARE);
+    PyModule_AddIntConstant(m, "SOF_TIMESTAMPING_RX_SOFTWARE",
+                            SOF_TIMESTAMPING_RX_SOFTWARE);
+    PyModule_AddIntConstant(m, "SOF_TIMESTAMPING_SOFTWARE",
+                            SOF_TIMESTAMPING_SOFTWARE);
+    PyModule_AddIntConstant(m, "SOF_TIMESTAMPING_SYS_HARDWARE",
+                            SOF_TIMESTAMPING_SYS_HARDWARE);
+    PyModule_AddIntConstant(m, "SOF_TIMESTAMPING_RAW_HARDWARE",
+                            SOF_TIMESTAMPING_RAW_HARDWARE);
+    /* Hardware transmit time stamping modes (bit numbers): */
+    PyModule_AddIntConstant(m, "HWTSTAMP_TX_OFF", HWTSTAMP_TX_OFF);
+    PyModule_AddIntConstant(m, "HWTSTAMP_TX_ON", HWTSTAMP_TX_ON);
+    PyModule_AddIntConstant(m, "HWTSTAMP_TX_ONESTEP_SYNC",
+                            HWTSTAMP_TX_ONESTEP_SYNC);
+    PyModule_AddIntConstant(m, "HWTSTAMP_TX_ONESTEP_P2P",
+                            HWTSTAMP_TX_ONESTEP_P2P);
+    /* Hardware receive time stamping filters (bit numbers): */
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_NONE", HWTSTAMP_FILTER_NONE);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_ALL", HWTSTAMP_FILTER_ALL);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_SOME", HWTSTAMP_FILTER_SOME);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V1_L4_EVENT",
+                            HWTSTAMP_FILTER_PTP_V1_L4_EVENT);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V1_L4_SYNC",
+                            HWTSTAMP_FILTER_PTP_V1_L4_SYNC);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V1_L4_DELAY_REQ",
+                            HWTSTAMP_FILTER_PTP_V1_L4_DELAY_REQ);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V2_L4_EVENT",
+                            HWTSTAMP_FILTER_PTP_V2_L4_EVENT);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V2_L4_SYNC",
+                            HWTSTAMP_FILTER_PTP_V2_L4_SYNC);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V2_L4_DELAY_REQ",
+                            HWTSTAMP_FILTER_PTP_V2_L4_DELAY_REQ);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V2_L2_EVENT",
+                            HWTSTAMP_FILTER_PTP_V2_L2_EVENT);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V2_L2_SYNC",
+                            HWTSTAMP_FILTER_PTP_V2_L2_SYNC);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V2_L2_DELAY_REQ",
+                            HWTSTAMP_FILTER_PTP_V2_L2_DELAY_REQ);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V2_EVENT",
+                            HWTSTAMP_FILTER_PTP_V2_EVENT);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V2_SYNC",
+                            HWTSTAMP_FILTER_PTP_V2_SYNC);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_PTP_V2_DELAY_REQ",
+                            HWTSTAMP_FILTER_PTP_V2_DELAY_REQ);
+    PyModule_AddIntConstant(m, "HWTSTAMP_FILTER_NTP_ALL",
+                            HWTSTAMP_FILTER_NTP_ALL);
+    /* IPv4 interface: */
+    PyModule_AddIntConstant(m, "AF_INET", AF_INET);
+    /* IPv6 interface: */
+    PyModule_AddIntConstant(m, "AF_INET6", AF_INET6);
+    /* python-ethtool version: */
+    PyModule_AddStringConstant(m, "version", "python-ethtool v" VERSION);
+
+    // Setup the ethtool.aio module
+    if (ethtool_aio_init(m) < 0)
+        return -1;
+
+    return 0;
+}
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+static int ethtool_traverse(PyObject *m, visitproc visit, void *arg)
+{
+    struct ethtool_state *state = ethtool_get_state(m);
+
+    Py_VISIT(state->perf.trace_hook);
+    Py_VISIT(state->etherinfo_type);
+    Py_VISIT(state->device_type);
+    Py_VISIT(state->address_type);
+    Py_VISIT(state->snapshot_type);
+    Py_VISIT(state->column_type);
+    Py_VISIT(state->stats_publisher_type);
+    Py_VISIT(state->stats_reader_type);
+    return 0;
+}
+
+static int ethtool_clear(PyObject *m)
+{
+    struct ethtool_state *state = ethtool_get_state(m);
+
+    Py_CLEAR(state->perf.trace_hook);
+    Py_CLEAR(state->etherinfo_type);
+    Py_CLEAR(state->device_type);
+    Py_CLEAR(state->address_type);
+    Py_CLEAR(state->snapshot_type);
+    Py_CLEAR(state->column_type);
+    Py_CLEAR(state->stats_publisher_type);
+    Py_CLEAR(state->stats_reader_type);
+    return 0;
+}
+
+static void ethtool_free(void *m)
+{
+    struct ethtool_state *state = ethtool_get_state((PyObject *)m);
+
+    ethtool_clear((PyObject *)m);
+    /* The etherinfo objects keep their class and so the module alive, the
+     * connections are normally closed by the last of them */
+    ethtool_aio_stop(state);
+    free_netlink_pool(state);
+    ethtool_netns_clear(state);
+    ethtool_freelist_clear(&state->etherinfo_freelist);
+    ethtool_freelist_clear(&state->address_freelist);
+    ethtool_mutex_destroy(&state->nlc_mtx);
+    ethtool_mutex_destroy(&state->netns_mtx);
+    ethtool_mutex_destroy(&state->aio_mtx);
+    ethtool_mutex_destroy(&state->perf.trace_hook_mtx);
+}
+
+static PyModuleDef_Slot ethtool_slots[] = {
+    {Py_mod_exec, ethtool_exec},
+#ifdef Py_mod_multiple_interpreters
+    /* All state is kept in the module state, there are no static types */
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    /* Objects changing after their creation are only touched in critical
+     * sections, the module state is protected by its own locks */
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+#endif
+
+static struct PyModuleDef moduledef = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "ethtool",
+    .m_doc = "Python ethtool module",
+    .m_methods = PyEthModuleMethods,
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+    .m_size = sizeof(struct ethtool_state),
+    .m_slots = ethtool_slots,
+    .m_traverse = ethtool_traverse,
+    .m_clear = ethtool_clear,
+    .m_free = ethtool_free,
+#else
+    .m_size = -1,
+#endif
+};
+
+MODULE_INIT_FUNC(ethtool)
+{
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+    return PyModuleDef_Init(&moduledef);
+#else
+    PyObject *m;
+    m = PyModule_Create(&moduledef);
+    if (m == NULL)
+        return NULL;
+
+    if (ethtool_exec(m) < 0)
+        return NULL;
+
+    return m;
+#endif
 }
@@ -0,0 +1,170 @@
+/*
+ * fastcall.c - METH_FASTCALL argument handling
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <Python.h>
+#include "include/py3c/compat.h"
+#include <string.h>
+
+#include "fastcall.h"
+
+/* Index of the keyword name in names, -1 if it is not one of them */
+static int fastcall_name_index(PyObject *name, const char *const *names,
+                               int max)
+{
+    const char *s;
+    int i;
+
+    if (!PyStr_Check(name))
+        return -1;
+    s = PyStr_AsString(name);
+    if (s == NULL) {
+        PyErr_Clear();
+        return -1;
+    }
+
+    for (i = 0; i < max; i++) {
+        if (strcmp(s, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* Stores the keyword argument name=value in out[] */
+static int fastcall_keyword(const char *fname, PyObject *name,
+                            PyObject *value, const char *const *names,
+                            int max, PyObject **out)
+{
+    int i = fastcall_name_index(name, names, max);
+
+    if (i < 0) {
+#if PY_MAJOR_VERSION >= 3
+        /* The name need not be encodable, format the object itself */
+        PyErr_Format(PyExc_TypeError,
+                     "%s() got an unexpected keyword argument %R",
+                     fname, name);
+#else
+        PyErr_Format(PyExc_TypeError,
+                     "%s() got an unexpected keyword argument '%s'",
+                     fname, PyString_Check(name) ?
+                     PyString_AS_STRING(name) : "?");
+#endif
+        return -1;
+    }
+    if (out[i] != NULL) {
+        PyErr_Format(PyExc_TypeError,
+                     "%s() got multiple values for argument '%s'",
+                     fname, names[i]);
+        return -1;
+    }
+    out[i] = value;
+    return 0;
+}
+
+/**
+ * Unpacks the arguments of a call made with the METH_FASTCALL_KEYWORDS
+ * convention, passed either by position or by name
+ *
+ * @param fname    Name of the function, for error messages
+ * @param args     FASTCALL_ARGS
+ * @param nargs    FASTCALL_NARGS
+ * @param kwnames  FASTCALL_KWNAMES
+ * @param names    Names of the parameters
+ * @param min      Number of required parameters
+ * @param max      Number of parameters
+ * @param out      Where to store borrowed references to the arguments,
+ *                 max entries; optional arguments not passed are set to NULL
+ *
+ * @return Returns 0 on success, otherwise -1 with a Python exception set.
+ */
+int fastcall_unpack(const char *fname, PyObject *const *args,
+                    Py_ssize_t nargs, PyObject *kwnames,
+                    const char *const *names, int min, int max,
+                    PyObject **out)
+{
+    Py_ssize_t i;
+
+    if (nargs > max) {
+        PyErr_Format(PyExc_TypeError,
+                     "%s() takes %s %d argument%s (%zd given)",
+                     fname, min == max ? "exactly" : "at most", max,
+                     max == 1 ? "" : "s", nargs);
+        return -1;
+    }
+
+    for (i = 0; i < max; i++)
+        out[i] = i < nargs ? args[i] : NULL;
+
+    if (kwnames != NULL) {
+#if PY_VERSION_HEX >= 0x03070000
+        for (i = 0; i < PyTuple_GET_SIZE(kwnames); i++) {
+            if (fastcall_keyword(fname, PyTuple_GET_ITEM(kwnames, i),
+                                 args[nargs + i], names, max, out) < 0)
+                return -1;
+        }
+#else
+        PyObject *name, *value;
+
+        i = 0;
+        while (PyDict_Next(kwnames, &i, &name, &value)) {
+            if (fastcall_keyword(fname, name, value, names, max, out) < 0)
+                return -1;
+        }
+#endif
+    }
+
+    for (i = 0; i < min; i++) {
+        if (out[i] == NULL) {
+            PyErr_Format(PyExc_TypeError,
+                         "%s() missing required argument '%s' (pos %zd)",
+                         fname, names[i], i + 1);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Returns the device name a call was made for, for passing to the trace
+ * hook: the first positional argument or the "device" keyword argument
+ *
+ * @return Borrowed reference to the device name, Py_None if there is none
+ */
+PyObject *fastcall_device(PyObject *const *args, Py_ssize_t nargs,
+                          PyObject *kwnames)
+{
+    static const char *const names[] = { "device" };
+    PyObject *device = NULL;
+
+    if (nargs > 0) {
+        device = args[0];
+    } else if (kwnames != NULL) {
+#if PY_VERSION_HEX >= 0x03070000
+        Py_ssize_t i;
+
+        for (i = 0; i < PyTuple_GET_SIZE(kwnames); i++) {
+            if (fastcall_name_index(PyTuple_GET_ITEM(kwnames, i),
+                                    names, 1) == 0) {
+                device = args[nargs + i];
+                break;
+            }
+        }
+#else
+        device = PyDict_GetItemString(kwnames, names[0]);
+#endif
+    }
+
+    if (device != NULL && PyStr_Check(device))
+        return device;
+    return Py_None;
+}
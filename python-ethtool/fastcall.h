@@ -0,0 +1,56 @@
+/*
+ * fastcall.h - METH_FASTCALL calling convention, with a fallback for
+ *              Python versions without it
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _FASTCALL_H
+#define _FASTCALL_H
+
+#include <Python.h>
+
+/*
+ * Functions declared with FASTCALL_PARAMS get their positional arguments
+ * as the C array FASTCALL_ARGS of FASTCALL_NARGS elements, without an
+ * argument tuple being built for each call.  Keyword arguments are passed
+ * in FASTCALL_KWNAMES and are best picked up with fastcall_unpack().
+ * FASTCALL_PASS hands the parameters on to another FASTCALL_PARAMS function.
+ *
+ * METH_FASTCALL only became part of the stable API in Python 3.7; older
+ * versions get METH_VARARGS | METH_KEYWORDS with the same helpers.
+ */
+#if PY_VERSION_HEX >= 0x03070000
+#define METH_FASTCALL_KEYWORDS (METH_FASTCALL | METH_KEYWORDS)
+#define FASTCALL_PARAMS \
+    PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames
+#define FASTCALL_ARGS args
+#define FASTCALL_NARGS nargs
+#define FASTCALL_PASS args, nargs, kwnames
+#else
+#define METH_FASTCALL_KEYWORDS (METH_VARARGS | METH_KEYWORDS)
+#define FASTCALL_PARAMS PyObject *args, PyObject *kwnames
+#define FASTCALL_ARGS (&PyTuple_GET_ITEM(args, 0))
+#define FASTCALL_NARGS PyTuple_GET_SIZE(args)
+#define FASTCALL_PASS args, kwnames
+#endif
+/* Keyword names (a tuple) or, without METH_FASTCALL, keyword arguments (a
+ * dict); NULL if there are none */
+#define FASTCALL_KWNAMES kwnames
+
+int fastcall_unpack(const char *fname, PyObject *const *args,
+                    Py_ssize_t nargs, PyObject *kwnames,
+                    const char *const *names, int min, int max,
+                    PyObject **out);
+
+PyObject *fastcall_device(PyObject *const *args, Py_ssize_t nargs,
+                          PyObject *kwnames);
+
+#endif
@@ -0,0 +1,163 @@
+/* freelist.c - Free lists of the etherinfo and address objects
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <Python.h>
+#include "include/py3c/compat.h"
+
+#include "freelist.h"
+#include "modstate.h"
+
+/*
+ * The lists belong to a module instance and are serialised by the GIL of its
+ * interpreter.  Free-threaded builds do not keep objects for reuse: other
+ * threads may still be looking at the memory of an object which has just
+ * been deallocated, until the interpreter says it is safe to reuse it.
+ */
+
+/* Next object in the list, kept in the word following the object header */
+#define freelist_next(op) (*(PyObject **) ((PyObject *) (op) + 1))
+
+/**
+ * Allocates an object of a type without garbage collector support, like
+ * PyObject_New(), reusing one from the free list if there is any
+ *
+ * @param fl    Free list of the type
+ * @param type  The type
+ *
+ * @return Returns the new object, or NULL with a Python exception set
+ */
+PyObject *ethtool_freelist_alloc(struct ethtool_freelist *fl,
+                                 PyTypeObject *type)
+{
+    PyObject *op = fl->head;
+
+    if (op != NULL) {
+        fl->head = freelist_next(op);
+        fl->len--;
+        ethtool_counter_add(&fl->reuses, 1);
+        return PyObject_Init(op, type);
+    }
+
+    ethtool_counter_add(&fl->allocs, 1);
+    op = (PyObject *) PyObject_Malloc(type->tp_basicsize);
+    if (op == NULL) {
+        return PyErr_NoMemory();
+    }
+    return PyObject_Init(op, type);
+}
+
+/**
+ * Deallocates an object allocated by ethtool_freelist_alloc(), whose
+ * references have been released.  The caller still releases the reference
+ * to the type the object held.
+ *
+ * @param fl     Free list of the type
+ * @param limit  How many objects the list may keep
+ * @param op     The object
+ */
+void ethtool_freelist_free(struct ethtool_freelist *fl, unsigned int limit,
+                           PyObject *op)
+{
+#ifndef Py_GIL_DISABLED
+    if (fl->len < limit) {
+        freelist_next(op) = fl->head;
+        fl->head = op;
+        fl->len++;
+        return;
+    }
+#endif
+    ethtool_counter_add(&fl->frees, 1);
+    PyObject_Free(op);
+}
+
+/* Gives objects back to the heap until the list is not longer than limit */
+static void freelist_trim(struct ethtool_freelist *fl, unsigned int limit)
+{
+    while (fl->len > limit) {
+        PyObject *op = fl->head;
+
+        fl->head = freelist_next(op);
+        fl->len--;
+        ethtool_counter_add(&fl->frees, 1);
+        PyObject_Free(op);
+    }
+}
+
+/**
+ * Gives all objects in a free list back to the heap
+ *
+ * @param fl  The free list
+ */
+void ethtool_freelist_clear(struct ethtool_freelist *fl)
+{
+    freelist_trim(fl, 0);
+}
+
+static PyObject *freelist_stats(struct ethtool_freelist *fl,
+                                unsigned int limit)
+{
+    return Py_BuildValue("{s:I,s:I,s:K,s:K,s:K}",
+                         "length", fl->len,
+                         "limit", limit,
+                         "allocs", fl->allocs,
+                         "reuses", fl->reuses,
+                         "frees", fl->frees);
+}
+
+/**
+ * Returns the state of the free lists
+ *
+ * @return Python dict mapping the type names to a dict with the length and
+ *         limit of their list and how many objects have been allocated from
+ *         the heap, reused from the list and given back to the heap
+ */
+PyObject *get_free_list_stats(PyObject *self, PyObject *args)
+{
+    struct ethtool_state *state = ethtool_get_state(self);
+    PyObject *etherinfo, *address, *ret = NULL;
+
+    etherinfo = freelist_stats(&state->etherinfo_freelist,
+                               state->freelist_limit);
+    address = freelist_stats(&state->address_freelist,
+                             state->freelist_limit);
+    if (etherinfo != NULL && address != NULL) {
+        ret = Py_BuildValue("{s:O,s:O}", "etherinfo", etherinfo,
+                            "NetlinkIPaddress", address);
+    }
+    Py_XDECREF(etherinfo);
+    Py_XDECREF(address);
+    return ret;
+}
+
+/**
+ * Sets how many etherinfo and NetlinkIPaddress objects are kept for reuse,
+ * 0 disables the free lists
+ */
+PyObject *set_free_list_limit(PyObject *self, PyObject *limit)
+{
+    struct ethtool_state *state = ethtool_get_state(self);
+    long value = PyInt_AsLong(limit);
+
+    if (value == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (value < 0 || value > UINT_MAX) {
+        PyErr_SetString(PyExc_ValueError,
+                        "free list limit must be between 0 and UINT_MAX");
+        return NULL;
+    }
+
+    state->freelist_limit = value;
+    freelist_trim(&state->etherinfo_freelist, value);
+    freelist_trim(&state->address_freelist, value);
+    Py_RETURN_NONE;
+}
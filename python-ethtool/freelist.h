@@ -0,0 +1,44 @@
+/*
+ * freelist.h - Free lists of the etherinfo and address objects
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _FREELIST_H
+#define _FREELIST_H
+
+#include <Python.h>
+
+/** Objects kept for reuse by default, per type and module instance */
+#define ETHTOOL_FREELIST_DEFAULT_LIMIT 4096
+
+/**
+ * Objects of one type which have been deallocated and are kept for reuse.
+ * A snapshot of a host creates and destroys objects by the thousand, which
+ * saves a round trip through the allocator for each of them.
+ */
+struct ethtool_freelist {
+    PyObject *head;  /**< Linked through the word following the header */
+    unsigned int len;  /**< Objects in the list */
+    unsigned long long allocs;  /**< Objects allocated from the heap */
+    unsigned long long reuses;  /**< Objects taken from the list */
+    unsigned long long frees;  /**< Objects given back to the heap */
+};
+
+PyObject *ethtool_freelist_alloc(struct ethtool_freelist *fl,
+                                 PyTypeObject *type);
+void ethtool_freelist_free(struct ethtool_freelist *fl, unsigned int limit,
+                           PyObject *op);
+void ethtool_freelist_clear(struct ethtool_freelist *fl);
+
+PyObject *get_free_list_stats(PyObject *self, PyObject *args);
+PyObject *set_free_list_limit(PyObject *self, PyObject *limit);
+
+#endif
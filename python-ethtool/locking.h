@@ -0,0 +1,75 @@
+/*
+ * locking.h - Locks for free-threaded builds of Python
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _LOCKING_H
+#define _LOCKING_H
+
+#include <Python.h>
+#include <pthread.h>
+
+/*
+ * Python 3.13 may be built without the GIL (Py_GIL_DISABLED), and then
+ * threads call into the module in parallel.  Objects which change after
+ * they are created are changed and read in per-object critical sections.
+ * With the GIL these are no-ops, and older versions do not have them.
+ */
+#if PY_VERSION_HEX < 0x030D0000
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+
+/*
+ * Lock of the module state.  It is only held for short moments without
+ * calling into Python.  From Python 3.13 on this is a PyMutex, which lets
+ * the interpreter stop the thread while it waits for the lock, as a
+ * free-threaded build needs.
+ */
+#if PY_VERSION_HEX >= 0x030D0000
+typedef PyMutex ethtool_mutex;
+#define ethtool_mutex_init(m) (*(m) = (PyMutex){ 0 })
+#define ethtool_mutex_destroy(m) ((void) (m))
+#define ethtool_mutex_lock(m) PyMutex_Lock(m)
+#define ethtool_mutex_unlock(m) PyMutex_Unlock(m)
+#else
+typedef pthread_mutex_t ethtool_mutex;
+#define ETHTOOL_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define ethtool_mutex_init(m) pthread_mutex_init(m, NULL)
+#define ethtool_mutex_destroy(m) pthread_mutex_destroy(m)
+#define ethtool_mutex_lock(m) pthread_mutex_lock(m)
+#define ethtool_mutex_unlock(m) pthread_mutex_unlock(m)
+#endif
+
+/*
+ * Counters which threads may bump in parallel, and pointers and int flags
+ * which are checked without taking the lock they are set under.  A pointer
+ * publishes the object it points to; a flag only selects a behaviour, which
+ * needs no ordering.
+ */
+#ifdef Py_GIL_DISABLED
+#define ethtool_counter_add(p, n) \
+    ((void) __atomic_fetch_add(p, n, __ATOMIC_RELAXED))
+#define ethtool_counter_set(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define ethtool_load_ptr(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ethtool_store_ptr(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define ethtool_load_flag(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define ethtool_store_flag(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#else
+#define ethtool_counter_add(p, n) ((void) (*(p) += (n)))
+#define ethtool_counter_set(p, v) ((void) (*(p) = (v)))
+#define ethtool_load_ptr(p) (*(p))
+#define ethtool_store_ptr(p, v) ((void) (*(p) = (v)))
+#define ethtool_load_flag(p) (*(p))
+#define ethtool_store_flag(p, v) ((void) (*(p) = (v)))
+#endif
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * modstate.h - State of an ethtool module instance
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _MODSTATE_H
+#define _MODSTATE_H
+
+#include <Python.h>
+#include "freelist.h"
+#include "locking.h"
+#include "perfcounters.h"
+
+/*
+ * From Python 3.9 on the module uses multi-phase initialisation (PEP 489):
+ * every import of it, e.g. one per subinterpreter, gets its own state and
+ * its own heap types, which find their module with PyType_GetModule().
+ * Older versions keep a single module instance with static types and a
+ * single static state.
+ */
+#if PY_VERSION_HEX >= 0x03090000
+#define ETHTOOL_MULTI_PHASE_INIT 1
+#endif
+
+struct nl_connection;
+struct ethtool_netns;
+struct ethtool_aio;
+
+/** Idle NETLINK connections kept open for later calls */
+#define ETHTOOL_NLC_POOL_SIZE 4
+
+/** Everything a module instance keeps between calls */
+struct ethtool_state {
+    /* NETLINK connections shared by the etherinfo objects, see netlink.c */
+    ethtool_mutex nlc_mtx;  /**< Protects the pool and the user count */
+    struct nl_connection *nlc_pool[ETHTOOL_NLC_POOL_SIZE];  /**< Idle ones */
+    unsigned int nlc_pool_len;
+    unsigned int nlconnection_users;  /**< How many NETLINK users are active */
+    int netlink_libnl;  /**< Read dumps with libnl, see set_netlink_backend() */
+
+    /* Network namespaces used last, with their sockets, see netns.c */
+    ethtool_mutex netns_mtx;  /**< Protects the cache and the references */
+    struct ethtool_netns *netns_cache;  /**< Most recently used first */
+    unsigned int netns_limit;  /**< Namespaces kept in the cache */
+
+    /* Worker thread of ethtool.aio, see aio.c */
+    ethtool_mutex aio_mtx;  /**< Protects aio */
+    struct ethtool_aio *aio;  /**< NULL until the first request */
+
+    struct perf_state perf;
+
+    /* Deallocated objects kept for reuse, see freelist.c */
+    unsigned int freelist_limit;  /**< Objects kept per type */
+    struct ethtool_freelist etherinfo_freelist;
+    struct ethtool_freelist address_freelist;
+
+    PyTypeObject *etherinfo_type;  /**< ethtool.etherinfo */
+    PyTypeObject *address_type;  /**< ethtool.NetlinkIPaddress */
+    PyTypeObject *device_type;  /**< ethtool.Device */
+    PyTypeObject *snapshot_type;  /**< ethtool.Snapshot */
+    PyTypeObject *column_type;  /**< ethtool.Column */
+    PyTypeObject *stats_publisher_type;  /**< ethtool.StatsPublisher */
+    PyTypeObject *stats_reader_type;  /**< ethtool.SharedStatsReader */
+};
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+#define ethtool_get_state(module) \
+    ((struct ethtool_state *) PyModule_GetState(module))
+
+/* Objects of heap types hold a reference to their type */
+#define ethtool_type_decref(type) Py_DECREF(type)
+
+/* The heap types are as immutable as the static types they replace */
+#ifdef Py_TPFLAGS_IMMUTABLETYPE
+#define ETHTOOL_TPFLAGS_IMMUTABLE Py_TPFLAGS_IMMUTABLETYPE
+#else
+#define ETHTOOL_TPFLAGS_IMMUTABLE 0
+#endif
+#else
+extern struct ethtool_state ethtool_global_state;
+
+#define ethtool_get_state(module) (&ethtool_global_state)
+#define ethtool_type_decref(type) ((void) (type))
+#endif
+
+struct ethtool_state *ethtool_type_state(PyTypeObject *type);
+
+#endif
@@ -19,184 +19,424 @@
 #include <bytesobject.h>
 #include "structmember.h"
 
+#include <errno.h>
+#include <string.h>
 #include <arpa/inet.h>
 #include <netlink/addr.h>
 #include <netlink/route/addr.h>
 #include <netlink/route/rtnl.h>
+#include <linux/rtnetlink.h>
 #include "etherinfo_struct.h"
 #include "etherinfo.h"
 
 
-/* IP Address parsing: */
-static PyObject *
-PyNetlinkIPaddress_from_rtnl_addr(struct rtnl_addr *addr)
+/* Length of the binary addresses of family */
+static size_t address_len(int family)
 {
-    PyNetlinkIPaddress *py_obj;
-    char buf[INET6_ADDRSTRLEN+1];
-    struct nl_addr *peer_addr = NULL, *brdcst = NULL;
+    return family == AF_INET6 ? 16 : 4;
+}
 
-    py_obj = PyObject_New(PyNetlinkIPaddress,
-                          &ethtool_netlink_ip_address_Type);
-    if (!py_obj) {
-        return NULL;
+/* Copies the binary form of a libnl address of family to dst */
+static int copy_address(unsigned char *dst, struct nl_addr *src, int family)
+{
+    if (src == NULL || nl_addr_get_len(src) != address_len(family)) {
+        return 0;
+    }
+    memcpy(dst, nl_addr_get_binary_addr(src), address_len(family));
+    return 1;
+}
+
+/* Copies the binary form of an rtnetlink address attribute to dst */
+static int copy_attr(unsigned char *dst, const struct rtattr *rta, int family)
+{
+    if (rta == NULL || RTA_PAYLOAD(rta) != address_len(family)) {
+        return 0;
     }
+    memcpy(dst, RTA_DATA(rta), address_len(family));
+    return 1;
+}
+
+/* Allocates an address object of family, whose addresses are still to be
+ * filled in */
+static PyNetlinkIPaddress *new_address(struct ethtool_state *state,
+                                       int family)
+{
+    PyNetlinkIPaddress *py_obj;
 
     /* Set IP address family.  Only AF_INET and AF_INET6 is supported */
-    py_obj->family = rtnl_addr_get_family(addr);
-    if (py_obj->family != AF_INET && py_obj->family != AF_INET6) {
+    if (family != AF_INET && family != AF_INET6) {
         PyErr_SetString(PyExc_RuntimeError,
                         "Only IPv4 (AF_INET) and IPv6 (AF_INET6) "
                         "address types are supported");
-        goto error;
+        return NULL;
     }
 
-    /* Set local IP address: */
-    memset(&buf, 0, sizeof(buf));
-    if (!inet_ntop(py_obj->family,
-                   nl_addr_get_binary_addr(rtnl_addr_get_local(addr)),
-                   buf, sizeof(buf))) {
-        PyErr_SetFromErrno(PyExc_RuntimeError);
-        goto error;
+    py_obj = (PyNetlinkIPaddress *) ethtool_freelist_alloc(
+        &state->address_freelist, state->address_type);
+    if (!py_obj) {
+        return NULL;
     }
-    py_obj->local = PyStr_FromString(buf);
-    if (!py_obj->local) {
-        goto error;
+    /* Only the binary forms are stored, the strings are made on first use */
+    memset(py_obj->strings, 0, sizeof(py_obj->strings));
+    py_obj->family = family;
+    return py_obj;
+}
+
+/* Fails the construction of an address object without a local address */
+static PyObject *no_local_address(PyNetlinkIPaddress *py_obj)
+{
+    errno = EINVAL;
+    PyErr_SetFromErrno(PyExc_RuntimeError);
+    Py_DECREF(py_obj);
+    return NULL;
+}
+
+/* IP Address parsing: */
+static PyObject *
+PyNetlinkIPaddress_from_rtnl_addr(struct ethtool_state *state,
+                                  struct rtnl_addr *addr)
+{
+    PyNetlinkIPaddress *py_obj;
+    struct nl_addr *peer_addr = NULL;
+    int family = rtnl_addr_get_family(addr);
+
+    py_obj = new_address(state, family);
+    if (!py_obj) {
+        return NULL;
     }
 
-    /* Set peer IP address: */
-    memset(&buf, 0, sizeof(buf));
-    if ((peer_addr = rtnl_addr_get_peer(addr))) {
-        nl_addr2str(peer_addr, buf, sizeof(buf));
-        py_obj->peer = PyStr_FromString(buf);
-        if (!py_obj->local) {
-            goto error;
-        }
-    } else {
-        py_obj->peer = NULL;
+    /* Set local IP address: */
+    if (!copy_address(py_obj->local, rtnl_addr_get_local(addr), family)) {
+        return no_local_address(py_obj);
     }
 
+    /* Set peer IP address: */
+    peer_addr = rtnl_addr_get_peer(addr);
+    py_obj->has_peer = copy_address(py_obj->peer, peer_addr, family);
+    py_obj->peer_prefixlen = py_obj->has_peer
+                             ? nl_addr_get_prefixlen(peer_addr) : 0;
+
     /* Set IP address prefix length (netmask): */
     py_obj->prefixlen = rtnl_addr_get_prefixlen(addr);
 
     /* Set ipv4_broadcast: */
-    py_obj->ipv4_broadcast = NULL;
-    brdcst = rtnl_addr_get_broadcast(addr);
-    if (py_obj->family == AF_INET && brdcst) {
-        memset(&buf, 0, sizeof(buf));
-        if (!inet_ntop(AF_INET, nl_addr_get_binary_addr(brdcst),
-                       buf, sizeof(buf))) {
-            PyErr_SetFromErrno(PyExc_RuntimeError);
-            goto error;
+    py_obj->has_broadcast = family == AF_INET
+        && copy_address(py_obj->broadcast, rtnl_addr_get_broadcast(addr),
+                        AF_INET);
+
+    /* Set IP address scope: */
+    py_obj->scope = rtnl_addr_get_scope(addr);
+
+    return (PyObject*)py_obj;
+}
+
+/**
+ * Creates an address object from an RTM_NEWADDR message, the way libnl
+ * would from the rtnl_addr it parses the message into
+ *
+ * @param state  Module creating the object
+ * @param ifa    Header of the message
+ * @param tb     Attributes of the message up to IFA_BROADCAST, indexed by
+ *               type
+ *
+ * @return Returns the new object, or NULL with a Python exception set
+ */
+PyObject *make_python_address_from_ifaddrmsg(struct ethtool_state *state,
+                                             const struct ifaddrmsg *ifa,
+                                             struct rtattr *tb[])
+{
+    PyNetlinkIPaddress *py_obj;
+    struct rtattr *local = tb[IFA_LOCAL], *peer = NULL;
+    int family = ifa->ifa_family;
+
+    py_obj = new_address(state, family);
+    if (!py_obj) {
+        return NULL;
+    }
+
+    /* IPv6 sends the local address as IFA_ADDRESS only, IPv4 sends both
+     * IFA_LOCAL and IFA_ADDRESS, the latter being the peer address if they
+     * differ */
+    if (local == NULL) {
+        local = tb[IFA_ADDRESS];
+    } else if (tb[IFA_ADDRESS] != NULL
+               && (RTA_PAYLOAD(tb[IFA_ADDRESS]) != RTA_PAYLOAD(local)
+                   || memcmp(RTA_DATA(tb[IFA_ADDRESS]), RTA_DATA(local),
+                             RTA_PAYLOAD(local)) != 0)) {
+        peer = tb[IFA_ADDRESS];
+    }
+
+    if (!copy_attr(py_obj->local, local, family)) {
+        return no_local_address(py_obj);
+    }
+    py_obj->has_peer = copy_attr(py_obj->peer, peer, family);
+    /* libnl only applies the prefix length to IPv6 peers */
+    if (!py_obj->has_peer) {
+        py_obj->peer_prefixlen = 0;
+    } else if (family == AF_INET6) {
+        py_obj->peer_prefixlen = ifa->ifa_prefixlen;
+    } else {
+        py_obj->peer_prefixlen = 8 * address_len(family);
+    }
+    py_obj->prefixlen = ifa->ifa_prefixlen;
+    py_obj->has_broadcast = family == AF_INET
+        && copy_attr(py_obj->broadcast, tb[IFA_BROADCAST], AF_INET);
+    py_obj->scope = ifa->ifa_scope;
+
+    return (PyObject *) py_obj;
+}
+
+/**
+ * Formats a text attribute of an address
+ *
+ * @param addr   The address
+ * @param field  The attribute
+ * @param buf    Where to write the text
+ * @param len    Size of buf, at least INET6_ADDRSTRLEN + 5
+ *
+ * @return Returns buf, or NULL if the address does not have the attribute
+ */
+const char *netlink_ip_address_format(PyNetlinkIPaddress *addr,
+                                      nlAddrField field,
+                                      char *buf, size_t len)
+{
+    size_t used;
+
+    switch (field) {
+    case NLADDR_LOCAL:
+        return inet_ntop(addr->family, addr->local, buf, len);
+
+    case NLADDR_PEER:
+        /* Like nl_addr2str(): the prefix is shown unless it is a host's */
+        if (!addr->has_peer
+                || !inet_ntop(addr->family, addr->peer, buf, len)) {
+            return NULL;
         }
-        py_obj->ipv4_broadcast = PyStr_FromString(buf);
-        if (!py_obj->ipv4_broadcast) {
-            goto error;
+        used = strlen(buf);
+        if (addr->peer_prefixlen != 8 * address_len(addr->family)) {
+            snprintf(buf + used, len - used, "/%d", addr->peer_prefixlen);
+        }
+        return buf;
+
+    case NLADDR_BROADCAST:
+        if (!addr->has_broadcast) {
+            return NULL;
         }
+        return inet_ntop(AF_INET, addr->broadcast, buf, len);
+
+    case NLADDR_SCOPE:
+        return rtnl_scope2str(addr->scope, buf, len);
+
+    default:
+        return NULL;
     }
+}
 
-    /* Set IP address scope: */
-    memset(&buf, 0, sizeof(buf));
-    rtnl_scope2str(rtnl_addr_get_scope(addr), buf, sizeof(buf));
-    py_obj->scope = PyStr_FromString(buf);
+/**
+ * Returns a text attribute of an address, made on first use
+ *
+ * @param addr   The address
+ * @param field  The attribute
+ *
+ * @return Returns a new reference to the string, Py_None if the address does
+ *         not have the attribute, or NULL on error
+ */
+PyObject *netlink_ip_address_str(PyNetlinkIPaddress *addr, nlAddrField field)
+{
+    char buf[INET6_ADDRSTRLEN + 8];
+    PyObject *ret;
 
-    return (PyObject*)py_obj;
+    /* Threads may use the same address object in parallel */
+    Py_BEGIN_CRITICAL_SECTION(addr);
+    ret = addr->strings[field];
+    if (ret == NULL
+            && netlink_ip_address_format(addr, field, buf, sizeof(buf))) {
+        ret = addr->strings[field] = PyStr_FromString(buf);
+    } else if (ret == NULL) {
+        ret = Py_None;
+    }
+    Py_XINCREF(ret);
+    Py_END_CRITICAL_SECTION();
 
-error:
-    Py_DECREF(py_obj);
-    return NULL;
+    return ret;
 }
 
 static void
 netlink_ip_address_dealloc(PyNetlinkIPaddress *obj)
 {
-    Py_DECREF(obj->local);
-    Py_XDECREF(obj->peer);
-    Py_XDECREF(obj->ipv4_broadcast);
-    Py_XDECREF(obj->scope);
+    PyTypeObject *type = Py_TYPE(obj);
+    struct ethtool_state *state = ethtool_type_state(type);
+    int i;
+
+    for (i = 0; i < NLADDR_FIELDS; i++) {
+        Py_XDECREF(obj->strings[i]);
+    }
 
-    /* We can call PyObject_Del directly rather than calling through
-       tp_free since the type is not subtypable (Py_TPFLAGS_BASETYPE is
-       not set): */
-    PyObject_Del(obj);
+    /* The type is not subtypable (Py_TPFLAGS_BASETYPE is not set), so all
+       objects come from ethtool_freelist_alloc(): */
+    ethtool_freelist_free(&state->address_freelist, state->freelist_limit,
+                          (PyObject *) obj);
+    ethtool_type_decref(type);
 }
 
 static PyObject*
 netlink_ip_address_repr(PyNetlinkIPaddress *obj)
 {
-    PyObject *result = PyStr_FromString("ethtool.NetlinkIPaddress(family=");
-    char buf[256];
+    char family[256], address[INET6_ADDRSTRLEN + 8], scope[32];
+    char netmask[32], text[INET6_ADDRSTRLEN + 8], peer[128], broadcast[128];
 
-    memset(&buf, 0, sizeof(buf));
-    nl_af2str(obj->family, buf, sizeof(buf));
-    result = PyStr_Concat(result,
-                          PyStr_FromFormat("%s, address='%s",
-                                           buf,
-                                           PyStr_AsString(obj->local)));
+    /* Built in one go from the binary forms */
+    memset(&family, 0, sizeof(family));
+    nl_af2str(obj->family, family, sizeof(family));
+    netlink_ip_address_format(obj, NLADDR_LOCAL, address, sizeof(address));
+    netlink_ip_address_format(obj, NLADDR_SCOPE, scope, sizeof(scope));
 
+    netmask[0] = 0;
     if (obj->family == AF_INET) {
-        result = PyStr_Concat(result,
-                              PyStr_FromFormat("', netmask=%d",
-                                               obj->prefixlen));
+        snprintf(netmask, sizeof(netmask), "', netmask=%d", obj->prefixlen);
     } else if (obj->family == AF_INET6) {
-        result = PyStr_Concat(result,
-                              PyStr_FromFormat("/%d'", obj->prefixlen));
+        snprintf(netmask, sizeof(netmask), "/%d'", obj->prefixlen);
     }
 
-    if (obj->peer) {
-        result = PyStr_Concat(result,
-                              PyStr_FromFormat(", peer_address='%s'",
-                                               PyStr_AsString(obj->peer)));
+    peer[0] = 0;
+    if (netlink_ip_address_format(obj, NLADDR_PEER, text, sizeof(text))) {
+        snprintf(peer, sizeof(peer), ", peer_address='%s'", text);
     }
 
-    if (obj->family == AF_INET && obj->ipv4_broadcast) {
-        result = PyStr_Concat(result,
-                              PyStr_FromFormat(", broadcast='%s'",
-                                               PyStr_AsString(
-                                                   obj->ipv4_broadcast)));
+    broadcast[0] = 0;
+    if (netlink_ip_address_format(obj, NLADDR_BROADCAST,
+                                  text, sizeof(text))) {
+        snprintf(broadcast, sizeof(broadcast), ", broadcast='%s'", text);
     }
 
-    result = PyStr_Concat(result,
-                          PyStr_FromFormat(", scope=%s)",
-                                           PyStr_AsString(obj->scope)));
+    return PyStr_FromFormat("ethtool.NetlinkIPaddress(family=%s, "
+                            "address='%s%s%s%s, scope=%s)",
+                            family, address, netmask, peer, broadcast, scope);
+}
+
+/* Getter of the text attribute whose nlAddrField is the closure */
+static PyObject *get_string(PyObject *obj, void *closure)
+{
+    nlAddrField field = (nlAddrField)(size_t) closure;
+    PyObject *ret = netlink_ip_address_str((PyNetlinkIPaddress *) obj, field);
 
-    return result;
+    /* peer_address has always been missing rather than None */
+    if (ret == Py_None && field == NLADDR_PEER) {
+        Py_DECREF(ret);
+        PyErr_SetString(PyExc_AttributeError, "peer_address");
+        return NULL;
+    }
+    return ret;
+}
+
+/* Integer of the big-endian binary address of len bytes */
+static PyObject *address_to_int(const unsigned char *bytes, size_t len)
+{
+    unsigned long long high = 0, low = 0;
+    PyObject *py_high, *py_low, *shift, *shifted, *ret;
+    size_t i;
+
+    if (len <= 8) {
+        for (i = 0; i < len; i++) {
+            low = low << 8 | bytes[i];
+        }
+        return PyInt_FromSize_t(low);
+    }
+
+    for (i = 0; i < 8; i++) {
+        high = high << 8 | bytes[i];
+        low = low << 8 | bytes[i + 8];
+    }
+    py_high = PyLong_FromUnsignedLongLong(high);
+    py_low = PyLong_FromUnsignedLongLong(low);
+    shift = PyInt_FromLong(64);
+    shifted = py_high && shift ? PyNumber_Lshift(py_high, shift) : NULL;
+    ret = shifted && py_low ? PyNumber_Or(shifted, py_low) : NULL;
+    Py_XDECREF(py_high);
+    Py_XDECREF(py_low);
+    Py_XDECREF(shift);
+    Py_XDECREF(shifted);
+    return ret;
+}
+
+static PyObject *get_packed(PyObject *obj, void *closure)
+{
+    PyNetlinkIPaddress *self = (PyNetlinkIPaddress *) obj;
+
+    return PyBytes_FromStringAndSize((const char *) self->local,
+                                     address_len(self->family));
+}
+
+static PyObject *get_address_int(PyObject *obj, void *closure)
+{
+    PyNetlinkIPaddress *self = (PyNetlinkIPaddress *) obj;
+
+    return address_to_int(self->local, address_len(self->family));
+}
+
+static PyObject *get_broadcast_int(PyObject *obj, void *closure)
+{
+    PyNetlinkIPaddress *self = (PyNetlinkIPaddress *) obj;
+
+    if (!self->has_broadcast) {
+        Py_RETURN_NONE;
+    }
+    return address_to_int(self->broadcast, sizeof(self->broadcast));
 }
 
 
 static PyMemberDef _ethtool_netlink_ip_address_members[] = {
-    {   "address",
-        T_OBJECT_EX,
-        offsetof(PyNetlinkIPaddress, local),
-        0,
-        NULL
-    },
-    {   "peer_address",
-        T_OBJECT_EX,
-        offsetof(PyNetlinkIPaddress, peer),
-        0,
-        NULL
+    {   "family",
+        T_INT,
+        offsetof(PyNetlinkIPaddress, family),
+        READONLY,
+        "Address family, AF_INET or AF_INET6"
     },
     {   "netmask",
         T_INT,
         offsetof(PyNetlinkIPaddress, prefixlen),
-        0,
-        NULL
-    },
-    {   "broadcast",
-        T_OBJECT, /* can be NULL */
-        offsetof(PyNetlinkIPaddress, ipv4_broadcast),
-        0,
+        READONLY,
         NULL
     },
-    {   "scope",
-        T_OBJECT_EX,
+    {   "scope_int",
+        T_INT,
         offsetof(PyNetlinkIPaddress, scope),
-        0,
-        NULL
+        READONLY,
+        "Address scope as a number, RT_SCOPE_*"
     },
     {NULL}  /* End of member list */
 };
 
+static PyGetSetDef _ethtool_netlink_ip_address_getset[] = {
+    {"address", get_string, NULL, NULL, (void *)(size_t) NLADDR_LOCAL},
+    {"peer_address", get_string, NULL, NULL, (void *)(size_t) NLADDR_PEER},
+    {"broadcast", get_string, NULL, NULL, (void *)(size_t) NLADDR_BROADCAST},
+    {"scope", get_string, NULL, NULL, (void *)(size_t) NLADDR_SCOPE},
+    {"packed", get_packed, NULL,
+     "Address in binary, network byte order", NULL},
+    {"address_int", get_address_int, NULL,
+     "Address as an integer", NULL},
+    {"broadcast_int", get_broadcast_int, NULL,
+     "Broadcast address as an integer, None if there is none", NULL},
+    {NULL}
+};
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+static PyType_Slot _ethtool_netlink_ip_address_slots[] = {
+    {Py_tp_dealloc, netlink_ip_address_dealloc},
+    {Py_tp_repr, netlink_ip_address_repr},
+    {Py_tp_members, _ethtool_netlink_ip_address_members},
+    {Py_tp_getset, _ethtool_netlink_ip_address_getset},
+    {0, NULL}
+};
+
+PyType_Spec ethtool_netlink_ip_address_Spec = {
+    .name = "ethtool.NetlinkIPaddress",
+    .basicsize = sizeof(PyNetlinkIPaddress),
+    .flags = Py_TPFLAGS_DEFAULT | ETHTOOL_TPFLAGS_IMMUTABLE,
+    .slots = _ethtool_netlink_ip_address_slots,
+};
+#else
 PyTypeObject ethtool_netlink_ip_address_Type = {
     PyVarObject_HEAD_INIT(0, 0)
     .tp_name = "ethtool.NetlinkIPaddress",
@@ -204,11 +444,14 @@ PyTypeObject ethtool_netlink_ip_address_Type = {
     .tp_dealloc = (destructor)netlink_ip_address_dealloc,
     .tp_repr = (reprfunc)netlink_ip_address_repr,
     .tp_members = _ethtool_netlink_ip_address_members,
+    .tp_getset = _ethtool_netlink_ip_address_getset,
 };
+#endif
 
 
 PyObject *
-make_python_address_from_rtnl_addr(struct rtnl_addr *addr)
+make_python_address_from_rtnl_addr(struct ethtool_state *state,
+                                   struct rtnl_addr *addr)
 {
     assert(addr);
 
@@ -216,7 +459,7 @@ make_python_address_from_rtnl_addr(struct rtnl_addr *addr)
 
     case AF_INET:
     case AF_INET6:
-        return PyNetlinkIPaddress_from_rtnl_addr(addr);
+        return PyNetlinkIPaddress_from_rtnl_addr(state, addr);
 
     default:
         return PyErr_SetFromErrno(PyExc_RuntimeError);
@@ -15,110 +15,265 @@
  */
 
 #include <Python.h>
-#include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <netlink/netlink.h>
 #include <netlink/socket.h>
 
 #include "etherinfo_struct.h"
+#include "etherinfo.h"
+#include "netns.h"
+#include "perfcounters.h"
+#include "rtnetlink.h"
 
-pthread_mutex_t nlc_counter_mtx = PTHREAD_MUTEX_INITIALIZER;
-static struct nl_sock *nlconnection = NULL;
+/*
+ * The etherinfo objects of a module instance share a pool of NETLINK
+ * connections, kept in the module state and closed with their last user.
+ * A connection is only used by one call at a time; a call finding the pool
+ * empty, because other threads are using the connections, opens another one.
+ * Objects created for another network namespace use the pool of its entry
+ * in the namespace cache instead, which lives as long as the entry.
+ */
+
+/* Opens the socket of a connection, in the namespace the caller is in */
+static int open_socket(void *arg)
+{
+    struct nl_connection *nlc = arg;
+
+    nlc->sock = nl_socket_alloc();
+    if (nlc->sock == NULL) {
+        return -1;
+    }
+    if (nl_connect(nlc->sock, NETLINK_ROUTE) < 0) {
+        nl_socket_free(nlc->sock);
+        nlc->sock = NULL;
+        return -1;
+    }
+    perf_nl_count_msgs(nlc->sock);
+    /* Force O_CLOEXEC flag on the NETLINK socket */
+    if (fcntl(nl_socket_get_fd(nlc->sock), F_SETFD, FD_CLOEXEC) == -1) {
+        fprintf(stderr,
+                "**WARNING** Failed to set O_CLOEXEC on NETLINK socket: "
+                "%s\n",
+                strerror(errno));
+    }
+    /* libnl asks for 32 KiB, which the dumps of large hosts overflow */
+    nl_socket_set_buffer_size(nlc->sock, nlc->rcvbuf, 0);
+    return 0;
+}
+
+/**
+ * Opens the socket of a connection, in the namespace of the connection
+ *
+ * @return Returns 0 on success, otherwise -1
+ */
+static int connect_socket(struct nl_connection *nlc)
+{
+    int err;
+
+    perf_count(netlink_opens, 1);
+    if (nlc->netns == NULL) {
+        err = open_socket(nlc);
+    } else {
+        err = ethtool_netns_run(nlc->netns, open_socket, nlc);
+    }
+    if (err < 0) {
+        nlc->sock = NULL;
+        return -1;
+    }
+    nlc->strict = 0;
+    nlc->broken = 0;
+    return 0;
+}
+
+/**
+ * Connects to the NETLINK interface
+ *
+ * @param ns  Namespace to connect in, NULL for the one of the calling thread
+ *
+ * @return Returns the connection, or NULL on error
+ */
+struct nl_connection *connect_netlink(struct ethtool_netns *ns)
+{
+    struct nl_connection *nlc;
+
+    nlc = calloc(1, sizeof(*nlc));
+    if (nlc == NULL) {
+        return NULL;
+    }
+    nlc->netns = ns;
+    nlc->bufsize = RTNETLINK_BUFSIZE;
+    nlc->rcvbuf = RTNETLINK_BUFSIZE * RTNETLINK_RCVBUF_RATIO;
+    if (nlc->rcvbuf < RTNETLINK_MIN_RCVBUF) {
+        nlc->rcvbuf = RTNETLINK_MIN_RCVBUF;
+    }
+    if (connect_socket(nlc) < 0) {
+        free(nlc);
+        return NULL;
+    }
+    return nlc;
+}
+
+/**
+ * Replaces the socket of a connection by a new one, e.g. after the kernel
+ * gave up on an answer which did not fit into its receive buffer
+ *
+ * @param nlc  The connection
+ *
+ * @return Returns 0 on success, otherwise a negative errno; the connection
+ *         is then broken
+ */
+int reconnect_netlink(struct nl_connection *nlc)
+{
+    nl_close(nlc->sock);
+    nl_socket_free(nlc->sock);
+    if (connect_socket(nlc) < 0) {
+        nlc->broken = 1;
+        return -ENOMEM;
+    }
+    return 0;
+}
 
-/* How many NETLINK users are active? */
-static unsigned int nlconnection_users = 0;
+/* Closes a connection and frees its message buffer */
+void disconnect_netlink(struct nl_connection *nlc)
+{
+    if (nlc->sock != NULL) {
+        nl_close(nlc->sock);
+        nl_socket_free(nlc->sock);
+    }
+    free(nlc->buf);
+    free(nlc->prev);
+    free(nlc);
+}
 
+/* Idle connections for the calls of an etherinfo object, under nlc_mtx */
+static void netlink_pool(PyEtherInfo *ethi, struct nl_connection ***pool,
+                         unsigned int **pool_len)
+{
+    if (ethi->netns != NULL) {
+        *pool = ethi->netns->nlc_pool;
+        *pool_len = &ethi->netns->nlc_pool_len;
+    } else {
+        *pool = ethi->state->nlc_pool;
+        *pool_len = &ethi->state->nlc_pool_len;
+    }
+}
 
 /**
- * Connects to the NETLINK interface.  This will be called
- * for each etherinfo object being generated, and it will
- * keep a separate file descriptor open for each object
+ * Takes a NETLINK connection for a call of an etherinfo object, which tags
+ * the object as a NETLINK user.  The caller holds the critical section of
+ * the object and hands the connection back with release_netlink().
  *
  * @param ethi PyEtherInfo structure (basically the "self" object)
  *
- * @return Returns 1 on success, otherwise 0.
+ * @return Returns the connection, or NULL on error
  */
-int open_netlink(PyEtherInfo *ethi)
+struct nl_connection *open_netlink(PyEtherInfo *ethi)
 {
+    struct ethtool_state *state;
+    struct nl_connection **pool;
+    unsigned int *pool_len;
+    struct nl_connection *nlc = NULL;
+
     if (!ethi) {
-        return 0;
+        return NULL;
     }
+    state = ethi->state;
+    netlink_pool(ethi, &pool, &pool_len);
 
-    /* Reuse already established NETLINK connection, if a connection exists */
-    if (nlconnection) {
-        /* If this object has not used NETLINK earlier, tag it as a user */
-        if (!ethi->nlc_active) {
-            pthread_mutex_lock(&nlc_counter_mtx);
-            nlconnection_users++;
-            pthread_mutex_unlock(&nlc_counter_mtx);
-        }
-        ethi->nlc_active = 1;
-        return 1;
-    }
-
-    /* No earlier connections exists, establish a new one */
-    nlconnection = nl_socket_alloc();
-    if (nlconnection != NULL) {
-        if (nl_connect(nlconnection, NETLINK_ROUTE) < 0) {
-            return 0;
-        }
-        /* Force O_CLOEXEC flag on the NETLINK socket */
-        if (fcntl(nl_socket_get_fd(nlconnection), F_SETFD, FD_CLOEXEC) == -1) {
-            fprintf(stderr,
-                    "**WARNING** Failed to set O_CLOEXEC on NETLINK socket: "
-                    "%s\n",
-                    strerror(errno));
-        }
-
-        /* Tag this object as an active user */
-        pthread_mutex_lock(&nlc_counter_mtx);
-        nlconnection_users++;
-        pthread_mutex_unlock(&nlc_counter_mtx);
+    ethtool_mutex_lock(&state->nlc_mtx);
+    /* If this object has not used NETLINK earlier, tag it as a user */
+    if (!ethi->nlc_active) {
+        state->nlconnection_users++;
         ethi->nlc_active = 1;
-        return 1;
-    } else {
-        return 0;
     }
+    /* Reuse an already established NETLINK connection, if one is idle */
+    if (*pool_len > 0) {
+        nlc = pool[--*pool_len];
+    }
+    ethtool_mutex_unlock(&state->nlc_mtx);
+
+    if (nlc == NULL) {
+        nlc = connect_netlink(ethi->netns);
+    }
+    return nlc;
 }
 
+/**
+ * Hands back a connection taken with open_netlink()
+ *
+ * @param ethi PyEtherInfo structure (basically the "self" object)
+ * @param nlc  The connection
+ */
+void release_netlink(PyEtherInfo *ethi, struct nl_connection *nlc)
+{
+    struct ethtool_state *state = ethi->state;
+    struct nl_connection **pool;
+    unsigned int *pool_len;
+
+    netlink_pool(ethi, &pool, &pool_len);
+    ethtool_mutex_lock(&state->nlc_mtx);
+    if (!nlc->broken && *pool_len < ETHTOOL_NLC_POOL_SIZE) {
+        pool[(*pool_len)++] = nlc;
+        nlc = NULL;
+    }
+    ethtool_mutex_unlock(&state->nlc_mtx);
+
+    /* Close connections opened while the pool was empty, and those which
+     * still have part of an answer queued */
+    if (nlc != NULL) {
+        disconnect_netlink(nlc);
+    }
+}
 
 /**
- * Return a reference to the global netlink connection
+ * Closes the connections of a pool
  *
- * @returns Returns a pointer to a NETLINK connection libnl functions can use
+ * @param pool  The idle connections
+ * @param len   Number of connections in pool, set to 0
  */
-struct nl_sock * get_nlc()
+void free_netlink_connections(struct nl_connection **pool, unsigned int *len)
 {
-    assert(nlconnection);
-    return nlconnection;
+    while (*len > 0) {
+        disconnect_netlink(pool[--*len]);
+    }
 }
 
 /**
- * Closes the NETLINK connection.  This should be called automatically whenever
- * the corresponding etherinfo object is deleted.
+ * Closes all idle NETLINK connections of a module instance
+ *
+ * @param state Module instance
+ */
+void free_netlink_pool(struct ethtool_state *state)
+{
+    free_netlink_connections(state->nlc_pool, &state->nlc_pool_len);
+}
+
+/**
+ * Closes the NETLINK connections.  This should be called automatically
+ * whenever the corresponding etherinfo object is deleted.
  *
  * @param ethi PyEtherInfo structure (basically the "self" object)
  */
 void close_netlink(PyEtherInfo *ethi)
 {
-    if (!ethi || !nlconnection) {
+    struct ethtool_state *state;
+
+    if (!ethi || !ethi->nlc_active) {
         return;
     }
+    state = ethi->state;
 
     /* Untag this object as a NETLINK user */
     ethi->nlc_active = 0;
-    pthread_mutex_lock(&nlc_counter_mtx);
-    nlconnection_users--;
-    pthread_mutex_unlock(&nlc_counter_mtx);
+    ethtool_mutex_lock(&state->nlc_mtx);
+    state->nlconnection_users--;
 
-    /* Don't close the connection if there are more users */
-    if (nlconnection_users > 0) {
-        return;
+    /* Don't close the connections if there are more users.  A user which
+     * is not running a call has handed its connection back. */
+    if (state->nlconnection_users == 0) {
+        free_netlink_pool(state);
     }
-
-    /* Close NETLINK connection */
-    nl_close(nlconnection);
-    nl_socket_free(nlconnection);
-    nlconnection = NULL;
+    ethtool_mutex_unlock(&state->nlc_mtx);
 }
@@ -0,0 +1,391 @@
+/* netns.c - Requests in other network namespaces
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <Python.h>
+#include "include/py3c/compat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "netns.h"
+#include "rtnetlink.h"
+
+/*
+ * The functions taking a netns argument accept the path of a namespace,
+ * e.g. /var/run/netns/<name> or /proc/<pid>/ns/net, or an open file
+ * descriptor of one.  Sockets belong to the namespace they are created in,
+ * for their whole life, whichever thread uses them later.  A thread which
+ * entered the namespace with setns() is only needed to create them; the
+ * process itself, and the calling thread, never leave their namespace, and
+ * nothing is forked.
+ *
+ * Each module instance keeps the namespaces used last, identified by the
+ * inode of their nsfs file, with a control socket for the ioctl() requests
+ * and a pool of NETLINK connections for the etherinfo objects created in
+ * them.  The cache and the reference counts are protected by netns_mtx, the
+ * NETLINK pools by nlc_mtx like the pool of the module instance itself.
+ */
+
+/** A call of ethtool_netns_run(), handed to the helper thread */
+struct netns_call {
+    int fd;  /**< Namespace to enter */
+    int (*fn)(void *);
+    void *arg;
+    int ret;  /**< Result of fn, or -1 if the namespace cannot be entered */
+    int err;  /**< errno after fn */
+};
+
+static void *netns_thread(void *arg)
+{
+    struct netns_call *call = arg;
+
+    if (setns(call->fd, CLONE_NEWNET) < 0) {
+        call->ret = -1;
+        call->err = errno;
+        return NULL;
+    }
+    errno = 0;
+    call->ret = call->fn(call->arg);
+    call->err = errno;
+    return NULL;
+}
+
+/**
+ * Runs fn(arg) on a helper thread in a network namespace, e.g. to create a
+ * socket in it.  The GIL is released meanwhile, fn must not call into
+ * Python.
+ *
+ * @param ns   The namespace
+ * @param fn   The function
+ * @param arg  Argument of fn
+ *
+ * @return Returns the result of fn, with errno as fn left it.  If the
+ *         namespace cannot be entered the result is -1.
+ */
+int ethtool_netns_run(struct ethtool_netns *ns, int (*fn)(void *), void *arg)
+{
+    struct netns_call call = { .fd = ns->fd, .fn = fn, .arg = arg };
+    pthread_t thread;
+    int err;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = pthread_create(&thread, NULL, netns_thread, &call);
+    if (err == 0) {
+        pthread_join(thread, NULL);
+    }
+    Py_END_ALLOW_THREADS
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    errno = call.err;
+    return call.ret;
+}
+
+/* Creates the control socket of a namespace, run in the namespace */
+static int netns_ctl_socket(void *arg __attribute__((unused)))
+{
+    return socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+}
+
+/**
+ * Opens the namespace given as netns argument
+ *
+ * @return Returns a new file descriptor of it, otherwise -1 with a Python
+ *         exception set.
+ */
+int ethtool_netns_open(PyObject *netns)
+{
+    char *path;
+    int fd;
+
+    if (PyIndex_Check(netns) || PyObject_HasAttrString(netns, "fileno")) {
+        fd = PyObject_AsFileDescriptor(netns);
+        if (fd < 0) {
+            return -1;
+        }
+        fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (fd < 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+        }
+        return fd;
+    }
+
+#if PY_MAJOR_VERSION >= 3
+    {
+        PyObject *bytes;
+
+        if (!PyUnicode_FSConverter(netns, &bytes)) {
+            return -1;
+        }
+        path = PyBytes_AS_STRING(bytes);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        }
+        Py_DECREF(bytes);
+    }
+#else
+    if (!PyArg_Parse(netns, "et", Py_FileSystemDefaultEncoding, &path)) {
+        return -1;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    }
+    PyMem_Free(path);
+#endif
+    return fd;
+}
+
+/* Closes the sockets of a namespace nobody refers to any more */
+static void netns_free(struct ethtool_netns *ns)
+{
+    free_netlink_connections(ns->nlc_pool, &ns->nlc_pool_len);
+    if (ns->ctl_fd >= 0) {
+        close(ns->ctl_fd);
+    }
+    close(ns->fd);
+    free(ns);
+}
+
+/* Drops a reference, the caller holds netns_mtx */
+static int netns_unref(struct ethtool_netns *ns)
+{
+    return --ns->refs == 0;
+}
+
+/**
+ * Removes the namespaces used longest ago from the cache until it holds no
+ * more than limit.  The caller holds netns_mtx.
+ *
+ * @return The entries nobody else refers to, linked by next, for
+ *         netns_free() once the lock is released
+ */
+static struct ethtool_netns *netns_trim(struct ethtool_state *state,
+                                        unsigned int limit)
+{
+    struct ethtool_netns **link = &state->netns_cache;
+    struct ethtool_netns *ns, *unused = NULL;
+    unsigned int i;
+
+    for (i = 0; *link != NULL && i < limit; i++) {
+        link = &(*link)->next;
+    }
+    while ((ns = *link) != NULL) {
+        *link = ns->next;
+        if (netns_unref(ns)) {
+            ns->next = unused;
+            unused = ns;
+        }
+    }
+    return unused;
+}
+
+static void netns_free_list(struct ethtool_netns *ns)
+{
+    while (ns != NULL) {
+        struct ethtool_netns *next = ns->next;
+
+        netns_free(ns);
+        ns = next;
+    }
+}
+
+/**
+ * Looks a namespace up in the cache and moves it to the front.  The caller
+ * holds netns_mtx.
+ *
+ * @return A new reference to the entry, NULL if it is not cached
+ */
+static struct ethtool_netns *netns_lookup(struct ethtool_state *state,
+                                          const struct stat *st)
+{
+    struct ethtool_netns **link;
+
+    for (link = &state->netns_cache; *link != NULL; link = &(*link)->next) {
+        struct ethtool_netns *ns = *link;
+
+        if (ns->dev == st->st_dev && ns->ino == st->st_ino) {
+            *link = ns->next;
+            ns->next = state->netns_cache;
+            state->netns_cache = ns;
+            ns->refs++;
+            return ns;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Gets the namespace of a netns argument, opening a control socket in it
+ * the first time it is used
+ *
+ * @param state  Module instance
+ * @param netns  The argument: a path, a file descriptor or an object with a
+ *               fileno() method; None or NULL for the current namespace
+ * @param ns     Where to store a reference to the namespace, to be released
+ *               with ethtool_netns_put(); NULL for the current namespace
+ *
+ * @return Returns 0 on success, otherwise -1 with a Python exception set.
+ */
+int ethtool_netns_get(struct ethtool_state *state, PyObject *netns,
+                      struct ethtool_netns **ns)
+{
+    struct ethtool_netns *entry, *unused = NULL;
+    struct stat st;
+    int fd;
+
+    *ns = NULL;
+    if (netns == NULL || netns == Py_None) {
+        return 0;
+    }
+
+    fd = ethtool_netns_open(netns);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        close(fd);
+        return -1;
+    }
+
+    ethtool_mutex_lock(&state->netns_mtx);
+    entry = netns_lookup(state, &st);
+    ethtool_mutex_unlock(&state->netns_mtx);
+    if (entry != NULL) {
+        close(fd);
+        *ns = entry;
+        return 0;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        close(fd);
+        PyErr_NoMemory();
+        return -1;
+    }
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->fd = fd;
+    /* Entering the namespace also checks that fd is one: EINVAL if not */
+    entry->ctl_fd = ethtool_netns_run(entry, netns_ctl_socket, NULL);
+    if (entry->ctl_fd < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        netns_free(entry);
+        return -1;
+    }
+
+    ethtool_mutex_lock(&state->netns_mtx);
+    /* Another thread may have been opening the same namespace */
+    *ns = netns_lookup(state, &st);
+    if (*ns == NULL && state->netns_limit > 0) {
+        entry->refs = 2;
+        entry->next = state->netns_cache;
+        state->netns_cache = entry;
+        unused = netns_trim(state, state->netns_limit);
+        *ns = entry;
+        entry = NULL;
+    }
+    ethtool_mutex_unlock(&state->netns_mtx);
+
+    if (*ns == NULL) {
+        /* Not cached, it only lives as long as the caller refers to it */
+        entry->refs = 1;
+        *ns = entry;
+    } else if (entry != NULL) {
+        netns_free(entry);
+    }
+    netns_free_list(unused);
+    return 0;
+}
+
+/**
+ * Takes another reference to a namespace returned by ethtool_netns_get()
+ */
+void ethtool_netns_hold(struct ethtool_state *state, struct ethtool_netns *ns)
+{
+    ethtool_mutex_lock(&state->netns_mtx);
+    ns->refs++;
+    ethtool_mutex_unlock(&state->netns_mtx);
+}
+
+/**
+ * Releases a reference to a namespace, NULL is ignored
+ */
+void ethtool_netns_put(struct ethtool_state *state, struct ethtool_netns *ns)
+{
+    int last;
+
+    if (ns == NULL) {
+        return;
+    }
+    ethtool_mutex_lock(&state->netns_mtx);
+    last = netns_unref(ns);
+    ethtool_mutex_unlock(&state->netns_mtx);
+    if (last) {
+        netns_free(ns);
+    }
+}
+
+/**
+ * Empties the namespace cache of a module instance
+ *
+ * @param state Module instance
+ */
+void ethtool_netns_clear(struct ethtool_state *state)
+{
+    struct ethtool_netns *unused;
+
+    ethtool_mutex_lock(&state->netns_mtx);
+    unused = netns_trim(state, 0);
+    ethtool_mutex_unlock(&state->netns_mtx);
+    netns_free_list(unused);
+}
+
+/**
+ * Sets how many namespaces keep their sockets open between calls, 0 closes
+ * them after every call
+ */
+PyObject *set_netns_cache_limit(PyObject *self, PyObject *limit)
+{
+    struct ethtool_state *state = ethtool_get_state(self);
+    struct ethtool_netns *unused;
+    long value = PyInt_AsLong(limit);
+
+    if (value == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (value < 0 || value > UINT_MAX) {
+        PyErr_SetString(PyExc_ValueError,
+                        "namespace cache limit must be between 0 and "
+                        "UINT_MAX");
+        return NULL;
+    }
+
+    ethtool_mutex_lock(&state->netns_mtx);
+    state->netns_limit = value;
+    unused = netns_trim(state, value);
+    ethtool_mutex_unlock(&state->netns_mtx);
+    netns_free_list(unused);
+    Py_RETURN_NONE;
+}
@@ -0,0 +1,53 @@
+/*
+ * netns.h - Requests in other network namespaces
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _NETNS_H
+#define _NETNS_H
+
+#include <Python.h>
+#include <sys/types.h>
+
+#include "modstate.h"
+
+/** Namespaces whose sockets are kept open by default, per module instance */
+#define ETHTOOL_NETNS_DEFAULT_LIMIT 64
+
+/**
+ * A network namespace requests were made in, and the sockets opened in it.
+ * A socket stays in the namespace it was created in, so only opening one
+ * takes a thread which entered the namespace; the requests are made by the
+ * calling thread.
+ */
+struct ethtool_netns {
+    struct ethtool_netns *next;  /**< Next in the cache, by last use */
+    dev_t dev;  /**< nsfs inode identifying the namespace */
+    ino_t ino;
+    int fd;  /**< The namespace, for opening more sockets in it */
+    int ctl_fd;  /**< Control socket for ioctls */
+    unsigned int refs;  /**< The cache, while the entry is in it, and users */
+    /** Idle NETLINK connections of the etherinfo objects, see netlink.c */
+    struct nl_connection *nlc_pool[ETHTOOL_NLC_POOL_SIZE];
+    unsigned int nlc_pool_len;
+};
+
+int ethtool_netns_open(PyObject *netns);
+int ethtool_netns_get(struct ethtool_state *state, PyObject *netns,
+                      struct ethtool_netns **ns);
+void ethtool_netns_hold(struct ethtool_state *state, struct ethtool_netns *ns);
+void ethtool_netns_put(struct ethtool_state *state, struct ethtool_netns *ns);
+int ethtool_netns_run(struct ethtool_netns *ns, int (*fn)(void *), void *arg);
+void ethtool_netns_clear(struct ethtool_state *state);
+
+PyObject *set_netns_cache_limit(PyObject *self, PyObject *limit);
+
+#endif
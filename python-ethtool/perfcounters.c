@@ -0,0 +1,402 @@
+/* perfcounters.c - Cheap per API call instrumentation counters
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <Python.h>
+#include "include/py3c/compat.h"
+#include <time.h>
+#include <netlink/netlink.h>
+#include <netlink/msg.h>
+#include <netlink/handlers.h>
+#include <netlink/socket.h>
+
+#include "perfcounters.h"
+#include "modstate.h"
+
+static const char *perf_api_names[PERF_API_MAX] = {
+    [PERF_API_NONE] = "(none)",
+    [PERF_API_GET_MODULE] = "get_module",
+    [PERF_API_GET_BUSINFO] = "get_businfo",
+    [PERF_API_GET_HWADDR] = "get_hwaddr",
+    [PERF_API_GET_IPADDR] = "get_ipaddr",
+    [PERF_API_GET_INTERFACES_INFO] = "get_interfaces_info",
+    [PERF_API_GET_NETMASK] = "get_netmask",
+    [PERF_API_GET_BROADCAST] = "get_broadcast",
+    [PERF_API_GET_COALESCE] = "get_coalesce",
+    [PERF_API_SET_COALESCE] = "set_coalesce",
+    [PERF_API_GET_DEVICES] = "get_devices",
+    [PERF_API_GET_ACTIVE_DEVICES] = "get_active_devices",
+    [PERF_API_GET_RINGPARAM] = "get_ringparam",
+    [PERF_API_SET_RINGPARAM] = "set_ringparam",
+    [PERF_API_GET_TSO] = "get_tso",
+    [PERF_API_SET_TSO] = "set_tso",
+    [PERF_API_GET_UFO] = "get_ufo",
+    [PERF_API_GET_GSO] = "get_gso",
+    [PERF_API_SET_GSO] = "set_gso",
+    [PERF_API_GET_GRO] = "get_gro",
+    [PERF_API_SET_GRO] = "set_gro",
+    [PERF_API_GET_SG] = "get_sg",
+    [PERF_API_GET_LINK_SETTINGS] = "get_link_settings",
+    [PERF_API_SET_LINK_SETTINGS] = "set_link_settings",
+    [PERF_API_GET_TS_INFO] = "get_ts_info",
+    [PERF_API_GET_FLAGS] = "get_flags",
+    [PERF_API_GET_WIRELESS_PROTOCOL] = "get_wireless_protocol",
+    [PERF_API_ETHERINFO_MAC_ADDRESS] = "etherinfo.mac_address",
+    [PERF_API_ETHERINFO_IPV4_ADDRESS] = "etherinfo.ipv4_address",
+    [PERF_API_ETHERINFO_IPV4_NETMASK] = "etherinfo.ipv4_netmask",
+    [PERF_API_ETHERINFO_IPV4_BROADCAST] = "etherinfo.ipv4_broadcast",
+    [PERF_API_ETHERINFO_GET_IPV4_ADDRESSES] = "etherinfo.get_ipv4_addresses",
+    [PERF_API_ETHERINFO_GET_IPV6_ADDRESSES] = "etherinfo.get_ipv6_addresses",
+    [PERF_API_ETHERINFO_STR] = "etherinfo.__str__",
+    [PERF_API_SWEEP_NAMESPACES] = "sweep_namespaces",
+    [PERF_API_GET_ALL_SETTINGS] = "get_all_settings",
+    [PERF_API_APPLY_PROFILE] = "apply_profile",
+    [PERF_API_SNAPSHOT] = "snapshot",
+    [PERF_API_DIFF] = "diff",
+    [PERF_API_DUMPS] = "dumps",
+    [PERF_API_LOADS] = "loads",
+    [PERF_API_SNAPSHOT_COLUMNS] = "snapshot_columns",
+    [PERF_API_STATS_PUBLISHER_SAMPLE] = "StatsPublisher.sample",
+    [PERF_API_SHARED_STATS_READER_READ] = "SharedStatsReader.read",
+    [PERF_API_AIO_SNAPSHOT] = "aio.snapshot",
+    [PERF_API_AIO_GET_COALESCE] = "aio.get_coalesce",
+    [PERF_API_AIO_GET_RINGPARAM] = "aio.get_ringparam",
+};
+
+/*
+ * With a GIL the counters of a module instance are serialised by the GIL of
+ * its interpreter, so plain counters will do; free-threaded builds bump them
+ * atomically.  Interpreters may run in parallel, which is why the call in
+ * progress is tracked per thread.
+ */
+__thread struct perf_counters *perf_current;
+
+/* Calls made by the trace hook are not traced */
+static __thread int perf_in_trace_hook;
+
+
+static unsigned long long timespec_diff_ns(const struct timespec *start,
+                                           const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000000ULL
+           + end->tv_nsec - start->tv_nsec;
+}
+
+/* Histogram bucket of a wall time */
+static int perf_hist_bucket(unsigned long long ns)
+{
+    int msb, shift, bucket;
+
+    if (ns < PERF_HIST_SUB) {
+        return ns;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    shift = msb - PERF_HIST_SUB_BITS;
+    bucket = (shift + 1) * PERF_HIST_SUB + (int)(ns >> shift) - PERF_HIST_SUB;
+    return bucket < PERF_HIST_BUCKETS ? bucket : PERF_HIST_BUCKETS - 1;
+}
+
+/* Smallest wall time counted in a histogram bucket */
+static unsigned long long perf_hist_bucket_low(int bucket)
+{
+    int shift;
+
+    if (bucket < PERF_HIST_SUB) {
+        return bucket;
+    }
+    shift = bucket / PERF_HIST_SUB - 1;
+    return (unsigned long long)(PERF_HIST_SUB + bucket % PERF_HIST_SUB)
+           << shift;
+}
+
+/**
+ * Starts accounting a call of an exported function.  Calls may nest, the
+ * counters of the enclosing call are restored by perf_call_end().
+ *
+ * @param call  Call state, must be passed to perf_call_end()
+ * @param perf  Counters of the module instance the function belongs to
+ * @param api   The function being called
+ */
+void perf_call_begin(struct perf_call *call, struct perf_state *perf,
+                     perf_api api)
+{
+    call->api = api;
+    call->perf = perf;
+    call->outer = perf_current;
+    perf_current = &perf->counters[api];
+    ethtool_counter_add(&perf_current->calls, 1);
+    clock_gettime(CLOCK_MONOTONIC, &call->start);
+}
+
+/**
+ * Finishes accounting a call started by perf_call_begin()
+ *
+ * @param call  Call state
+ */
+void perf_call_end(struct perf_call *call)
+{
+    struct timespec end;
+    unsigned long long elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = timespec_diff_ns(&call->start, &end);
+    call->elapsed = elapsed;
+
+    ethtool_counter_add(&perf_current->time_ns, elapsed);
+#ifdef Py_GIL_DISABLED
+    {
+        unsigned long long max = __atomic_load_n(&perf_current->time_ns_max,
+                                                 __ATOMIC_RELAXED);
+
+        while (elapsed > max
+               && !__atomic_compare_exchange_n(&perf_current->time_ns_max,
+                                               &max, elapsed, 1,
+                                               __ATOMIC_RELAXED,
+                                               __ATOMIC_RELAXED)) {
+        }
+    }
+#else
+    if (elapsed > perf_current->time_ns_max) {
+        perf_current->time_ns_max = elapsed;
+    }
+#endif
+    ethtool_counter_add(&perf_current->time_hist[perf_hist_bucket(elapsed)],
+                        1);
+    perf_current = call->outer;
+}
+
+/**
+ * Calls the trace hook for a finished call.  Only called when a hook is set.
+ * The exception raised by the call, if any, is preserved; exceptions raised
+ * by the hook are reported as unraisable.
+ *
+ * @param call    The finished call
+ * @param ret     Return value of the call, NULL if it raised an exception
+ * @param device  Borrowed reference to the device name, may be NULL
+ *
+ * @return ret
+ */
+PyObject *perf_trace(struct perf_call *call, PyObject *ret, PyObject *device)
+{
+    struct perf_state *perf = call->perf;
+    PyObject *type, *value, *traceback, *hook, *res;
+    long err = 0;
+
+    if (perf_in_trace_hook) {
+        return ret;
+    }
+
+    /* The hook may replace itself, or another thread may replace it */
+    ethtool_mutex_lock(&perf->trace_hook_mtx);
+    hook = perf->trace_hook;
+    Py_XINCREF(hook);
+    ethtool_mutex_unlock(&perf->trace_hook_mtx);
+    if (hook == NULL) {
+        return ret;
+    }
+
+    PyErr_Fetch(&type, &value, &traceback);
+    if (ret == NULL && type != NULL
+            && PyErr_GivenExceptionMatches(type, PyExc_EnvironmentError)) {
+        PyObject *errnum;
+
+        PyErr_NormalizeException(&type, &value, &traceback);
+        errnum = PyObject_GetAttrString(value, "errno");
+        if (errnum != NULL && PyInt_Check(errnum)) {
+            err = PyInt_AsLong(errnum);
+        }
+        Py_XDECREF(errnum);
+        PyErr_Clear();
+    }
+
+    perf_in_trace_hook = 1;
+    res = PyObject_CallFunction(hook, "sOKl", perf_api_names[call->api],
+                                device ? device : Py_None, call->elapsed,
+                                err);
+    perf_in_trace_hook = 0;
+    if (res == NULL) {
+        PyErr_WriteUnraisable(hook);
+    }
+    Py_XDECREF(res);
+    Py_DECREF(hook);
+
+    PyErr_Restore(type, value, traceback);
+    return ret;
+}
+
+
+/* libnl callback, invoked for every NETLINK message received */
+static int perf_nl_msg_in(struct nl_msg *msg, void *arg)
+{
+    perf_count(netlink_msgs, 1);
+    perf_count(netlink_bytes, nlmsg_hdr(msg)->nlmsg_len);
+    return NL_OK;
+}
+
+/**
+ * Makes a libnl socket account all messages it receives to the call in
+ * progress.  The callback is inherited by the handlers libnl clones from
+ * the socket, e.g. when filling caches.
+ *
+ * @param sock  libnl socket
+ */
+void perf_nl_count_msgs(struct nl_sock *sock)
+{
+    nl_socket_modify_cb(sock, NL_CB_MSG_IN, NL_CB_CUSTOM,
+                        perf_nl_msg_in, NULL);
+}
+
+
+/**
+ * Returns the counters of all accounted functions
+ *
+ * @return Python dict mapping function names to a dict of counters
+ */
+PyObject *get_perf_counters(PyObject *self, PyObject *args)
+{
+    struct perf_state *perf = &ethtool_get_state(self)->perf;
+    PyObject *dict;
+    int i;
+
+    dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < PERF_API_MAX; i++) {
+        struct perf_counters *c = &perf->counters[i];
+        PyObject *entry;
+
+        entry = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+                              "calls", c->calls,
+                              "ioctls", c->ioctls,
+                              "netlink_opens", c->netlink_opens,
+                              "netlink_dumps", c->netlink_dumps,
+                              "netlink_msgs", c->netlink_msgs,
+                              "netlink_bytes", c->netlink_bytes,
+                              "netlink_retries", c->netlink_retries,
+                              "cache_allocs", c->cache_allocs,
+                              "time_ns", c->time_ns,
+                              "time_ns_max", c->time_ns_max);
+        if (entry == NULL
+                || PyDict_SetItemString(dict, perf_api_names[i], entry) != 0) {
+            Py_XDECREF(entry);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(entry);
+    }
+
+    return dict;
+}
+
+/**
+ * Returns the wall time histograms of all accounted functions
+ *
+ * @return Python dict mapping function names to a list of
+ *         (low_ns, high_ns, count) tuples, one per non-empty bucket counting
+ *         the calls which took from low_ns up to but not including high_ns.
+ *         high_ns is None for the last bucket, which has no upper bound.
+ */
+PyObject *get_latency_histograms(PyObject *self, PyObject *args)
+{
+    struct perf_state *perf = &ethtool_get_state(self)->perf;
+    PyObject *dict;
+    int i, bucket;
+
+    dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < PERF_API_MAX; i++) {
+        struct perf_counters *c = &perf->counters[i];
+        PyObject *list = PyList_New(0);
+
+        if (list == NULL
+                || PyDict_SetItemString(dict, perf_api_names[i], list) != 0) {
+            Py_XDECREF(list);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(list);
+
+        for (bucket = 0; bucket < PERF_HIST_BUCKETS; bucket++) {
+            PyObject *entry;
+
+            if (c->time_hist[bucket] == 0) {
+                continue;
+            }
+            if (bucket == PERF_HIST_BUCKETS - 1) {
+                /* Every longer time ends up there as well */
+                entry = Py_BuildValue("(KOK)", perf_hist_bucket_low(bucket),
+                                      Py_None, c->time_hist[bucket]);
+            } else {
+                entry = Py_BuildValue("(KKK)", perf_hist_bucket_low(bucket),
+                                      perf_hist_bucket_low(bucket + 1),
+                                      c->time_hist[bucket]);
+            }
+            if (entry == NULL || PyList_Append(list, entry) != 0) {
+                Py_XDECREF(entry);
+                Py_DECREF(dict);
+                return NULL;
+            }
+            Py_DECREF(entry);
+        }
+    }
+
+    return dict;
+}
+
+/**
+ * Sets the callable which is called with (function, device, duration_ns,
+ * errno) after every accounted call, None removes it
+ */
+PyObject *set_trace_hook(PyObject *self, PyObject *hook)
+{
+    struct perf_state *perf = &ethtool_get_state(self)->perf;
+    PyObject *old;
+
+    if (hook != Py_None && !PyCallable_Check(hook)) {
+        PyErr_SetString(PyExc_TypeError, "trace hook must be callable or None");
+        return NULL;
+    }
+
+    if (hook == Py_None) {
+        hook = NULL;
+    } else {
+        Py_INCREF(hook);
+    }
+    ethtool_mutex_lock(&perf->trace_hook_mtx);
+    old = perf->trace_hook;
+    ethtool_store_ptr(&perf->trace_hook, hook);
+    ethtool_mutex_unlock(&perf->trace_hook_mtx);
+    /* The old hook may run code, which must not happen with the lock held */
+    Py_XDECREF(old);
+
+    Py_RETURN_NONE;
+}
+
+/**
+ * Zeroes all counters and histograms
+ */
+PyObject *reset_perf_counters(PyObject *self, PyObject *args)
+{
+    struct perf_state *perf = &ethtool_get_state(self)->perf;
+    /* struct perf_counters only has unsigned long long members */
+    unsigned long long *c = &perf->counters[0].calls;
+    size_t i, n = PERF_API_MAX * (sizeof(struct perf_counters) / sizeof(*c));
+
+    /* Calls may be in progress in other threads */
+    for (i = 0; i < n; i++)
+        ethtool_counter_set(&c[i], 0);
+    Py_RETURN_NONE;
+}
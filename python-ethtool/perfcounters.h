@@ -0,0 +1,185 @@
+/* perfcounters.h - Cheap per API call instrumentation counters
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _PERFCOUNTERS_H
+#define _PERFCOUNTERS_H
+
+#include <Python.h>
+#include <time.h>
+
+#include "fastcall.h"
+#include "locking.h"
+
+/** Every exported function and etherinfo attribute which is accounted for */
+typedef enum {
+    PERF_API_NONE,  /**< Work done outside of any accounted call */
+    PERF_API_GET_MODULE,
+    PERF_API_GET_BUSINFO,
+    PERF_API_GET_HWADDR,
+    PERF_API_GET_IPADDR,
+    PERF_API_GET_INTERFACES_INFO,
+    PERF_API_GET_NETMASK,
+    PERF_API_GET_BROADCAST,
+    PERF_API_GET_COALESCE,
+    PERF_API_SET_COALESCE,
+    PERF_API_GET_DEVICES,
+    PERF_API_GET_ACTIVE_DEVICES,
+    PERF_API_GET_RINGPARAM,
+    PERF_API_SET_RINGPARAM,
+    PERF_API_GET_TSO,
+    PERF_API_SET_TSO,
+    PERF_API_GET_UFO,
+    PERF_API_GET_GSO,
+    PERF_API_SET_GSO,
+    PERF_API_GET_GRO,
+    PERF_API_SET_GRO,
+    PERF_API_GET_SG,
+    PERF_API_GET_LINK_SETTINGS,
+    PERF_API_SET_LINK_SETTINGS,
+    PERF_API_GET_TS_INFO,
+    PERF_API_GET_FLAGS,
+    PERF_API_GET_WIRELESS_PROTOCOL,
+    PERF_API_ETHERINFO_MAC_ADDRESS,
+    PERF_API_ETHERINFO_IPV4_ADDRESS,
+    PERF_API_ETHERINFO_IPV4_NETMASK,
+    PERF_API_ETHERINFO_IPV4_BROADCAST,
+    PERF_API_ETHERINFO_GET_IPV4_ADDRESSES,
+    PERF_API_ETHERINFO_GET_IPV6_ADDRESSES,
+    PERF_API_ETHERINFO_STR,
+    PERF_API_SWEEP_NAMESPACES,
+    PERF_API_GET_ALL_SETTINGS,
+    PERF_API_APPLY_PROFILE,
+    PERF_API_SNAPSHOT,
+    PERF_API_DIFF,
+    PERF_API_DUMPS,
+    PERF_API_LOADS,
+    PERF_API_SNAPSHOT_COLUMNS,
+    PERF_API_STATS_PUBLISHER_SAMPLE,
+    PERF_API_SHARED_STATS_READER_READ,
+    PERF_API_AIO_SNAPSHOT,
+    PERF_API_AIO_GET_COALESCE,
+    PERF_API_AIO_GET_RINGPARAM,
+    PERF_API_MAX
+} perf_api;
+
+/*
+ * Wall time histogram buckets, HDR style: values below PERF_HIST_SUB are
+ * counted exactly, above that every power of two is split into PERF_HIST_SUB
+ * linear sub-buckets, which bounds the relative error to 1 / PERF_HIST_SUB.
+ * Times of 2^PERF_HIST_MAX_BITS ns (about 275 seconds) and more all end up
+ * in the last bucket.
+ */
+#define PERF_HIST_SUB_BITS 3
+#define PERF_HIST_SUB (1 << PERF_HIST_SUB_BITS)
+#define PERF_HIST_MAX_BITS 38
+#define PERF_HIST_BUCKETS ((PERF_HIST_MAX_BITS - PERF_HIST_SUB_BITS + 1) \
+                           * PERF_HIST_SUB)
+
+/** Counters kept for each perf_api entry */
+struct perf_counters {
+    unsigned long long calls;  /**< Number of calls */
+    unsigned long long ioctls;  /**< ioctl() system calls issued */
+    unsigned long long netlink_opens;  /**< NETLINK connections opened */
+    unsigned long long netlink_dumps;  /**< NETLINK dump requests sent */
+    unsigned long long netlink_msgs;  /**< NETLINK messages received */
+    unsigned long long netlink_bytes;  /**< NETLINK message bytes received */
+    unsigned long long netlink_retries;  /**< NETLINK requests sent again */
+    unsigned long long cache_allocs;  /**< libnl caches allocated */
+    unsigned long long time_ns;  /**< Cumulative wall time */
+    unsigned long long time_ns_max;  /**< Longest single call */
+    unsigned long long time_hist[PERF_HIST_BUCKETS];  /**< Wall times */
+};
+
+/** Counters and trace hook of a module instance */
+struct perf_state {
+    struct perf_counters counters[PERF_API_MAX];
+    PyObject *trace_hook;  /**< Set by set_trace_hook(), NULL if none */
+    ethtool_mutex trace_hook_mtx;  /**< Protects trace_hook */
+};
+
+/** Counters of the call the thread is running, NULL outside of any */
+extern __thread struct perf_counters *perf_current;
+
+/**
+ * Bumps a counter of the call in progress, e.g. perf_count(ioctls, 1).
+ * Work done outside of any call, which no module instance accounts for, is
+ * not counted.
+ */
+#define perf_count(field, n) do { \
+        struct perf_counters *perf_count_ = perf_current; \
+        if (perf_count_ != NULL) \
+            ethtool_counter_add(&perf_count_->field, (n)); \
+    } while (0)
+
+/** State of a single accounted call, kept on the caller's stack */
+struct perf_call {
+    perf_api api;
+    struct perf_state *perf;  /**< Module instance accounting the call */
+    struct perf_counters *outer;  /**< Counters of the enclosing call */
+    struct timespec start;
+    unsigned long long elapsed;  /**< Wall time, set by perf_call_end() */
+};
+
+void perf_call_begin(struct perf_call *call, struct perf_state *perf,
+                     perf_api api);
+void perf_call_end(struct perf_call *call);
+PyObject *perf_trace(struct perf_call *call, PyObject *ret, PyObject *device);
+
+struct nl_sock;
+void perf_nl_count_msgs(struct nl_sock *sock);
+
+PyObject *get_perf_counters(PyObject *self, PyObject *args);
+PyObject *reset_perf_counters(PyObject *self, PyObject *args);
+PyObject *get_latency_histograms(PyObject *self, PyObject *args);
+PyObject *set_trace_hook(PyObject *self, PyObject *hook);
+
+/**
+ * Defines name(), a function with the parameter list decl which accounts each
+ * call to api in the struct perf_state pstate and forwards it to fn with the
+ * arguments call.  device is only evaluated when a trace hook is set and must
+ * give a borrowed reference to the device name the call was made for (or
+ * Py_None).
+ */
+#define PERF_WRAPPER(name, api, fn, decl, call, pstate, device) \
+    static PyObject *name decl \
+    { \
+        struct perf_call perf_call_; \
+        PyObject *ret; \
+        perf_call_begin(&perf_call_, pstate, api); \
+        ret = fn call; \
+        perf_call_end(&perf_call_); \
+        if (ethtool_load_ptr(&perf_call_.perf->trace_hook) != NULL) { \
+            ret = perf_trace(&perf_call_, ret, device); \
+        } \
+        return ret; \
+    }
+
+/** Defines perf_<fn>() for the METH_FASTCALL_KEYWORDS module function fn() */
+#define PERF_FASTCALL_WRAPPER(fn, api) \
+    PERF_WRAPPER(perf_##fn, api, fn, (PyObject *self, FASTCALL_PARAMS), \
+                 (self, FASTCALL_PASS), &ethtool_get_state(self)->perf, \
+                 fastcall_device(FASTCALL_ARGS, FASTCALL_NARGS, \
+                                 FASTCALL_KWNAMES))
+
+/** Defines perf_<fn>() for the METH_NOARGS module function fn() */
+#define PERF_NOARGS_WRAPPER(fn, api) \
+    PERF_WRAPPER(perf_##fn, api, fn, (PyObject *self, PyObject *unused), \
+                 (self, unused), &ethtool_get_state(self)->perf, Py_None)
+
+/** Defines perf_<fn>() for the etherinfo attribute getter fn() */
+#define PERF_GETTER_WRAPPER(fn, api) \
+    PERF_WRAPPER(perf_##fn, api, fn, \
+                 (PyObject *obj, void *info), (obj, info), \
+                 &((PyEtherInfo *) obj)->state->perf, \
+                 ((PyEtherInfo *) obj)->device)
+
+#endif
@@ -0,0 +1,474 @@
+/* rtnetlink.c - Minimal rtnetlink reader for the dump hot path
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <Python.h>
+#include "include/py3c/compat.h"
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netlink/netlink.h>
+#include <netlink/socket.h>
+
+#include "rtnetlink.h"
+#include "modstate.h"
+#include "perfcounters.h"
+
+/*
+ * libnl parses every message of a dump into objects of its own, kept in a
+ * cache, which etherinfo.c then searches for the few attributes it needs.
+ * The functions below send a request on the socket of a pooled libnl
+ * connection and hand the messages straight from the receive buffer of the
+ * connection to a handler.  Requests the reader cannot answer, because the
+ * kernel rejects them or a message is larger than RTNETLINK_MAX_BUFSIZE, are
+ * left to libnl, see etherinfo.c.
+ */
+
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+
+/**
+ * Starts a request
+ *
+ * @param req     The request
+ * @param type    Message type, e.g. RTM_GETADDR
+ * @param flags   NLM_F_* flags besides NLM_F_REQUEST
+ * @param hdrlen  Size of the family specific header, which is zeroed
+ */
+void rtnetlink_request_init(struct rtnetlink_request *req, int type,
+                            int flags, size_t hdrlen)
+{
+    memset(req, 0, sizeof(*req));
+    req->nlh.nlmsg_len = NLMSG_LENGTH(hdrlen);
+    req->nlh.nlmsg_type = type;
+    req->nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+}
+
+/**
+ * Appends an attribute to a request
+ *
+ * @return Returns 0 on success, -EMSGSIZE if the request is full
+ */
+int rtnetlink_request_attr(struct rtnetlink_request *req, int type,
+                           const void *data, size_t len)
+{
+    struct rtattr *rta;
+    size_t offset = NLMSG_ALIGN(req->nlh.nlmsg_len);
+
+    if (offset + RTA_SPACE(len) > offsetof(struct rtnetlink_request,
+                                           one_part)) {
+        return -EMSGSIZE;
+    }
+    rta = (struct rtattr *) ((char *) req + offset);
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    req->nlh.nlmsg_len = offset + RTA_SPACE(len);
+    return 0;
+}
+
+/**
+ * Indexes the attributes of a message by type.  Types above max are
+ * ignored, as are all but the last of repeated attributes.
+ *
+ * @param tb   Where to store the attributes, max + 1 entries
+ * @param max  Highest attribute type of interest
+ * @param rta  First attribute
+ * @param len  Length of the attributes
+ */
+void rtnetlink_parse_attrs(struct rtattr *tb[], int max, struct rtattr *rta,
+                           int len)
+{
+    memset(tb, 0, sizeof(struct rtattr *) * (max + 1));
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        unsigned short type = rta->rta_type & NLA_TYPE_MASK;
+
+        if (type <= max) {
+            tb[type] = rta;
+        }
+    }
+}
+
+/**
+ * Turns the strict checking of requests on or off.  With it, the kernel
+ * filters address dumps by the interface index in the request.  Kernels
+ * before 4.20 do not support it, which is only tried once.
+ *
+ * @return Returns whether strict checking is on
+ */
+int rtnetlink_set_strict(struct nl_connection *nlc, int on)
+{
+    if (nlc->strict < 0 || nlc->strict == on) {
+        return nlc->strict > 0;
+    }
+    if (setsockopt(nl_socket_get_fd(nlc->sock), SOL_NETLINK,
+                   NETLINK_GET_STRICT_CHK, &on, sizeof(on)) < 0) {
+        nlc->strict = on ? -1 : nlc->strict;
+        return 0;
+    }
+    nlc->strict = on;
+    return on;
+}
+
+/* Sleeps for the backoff of an attempt, from 1 on */
+static void rtnetlink_sleep(int attempt)
+{
+    unsigned long long ns;
+    struct timespec ts;
+
+    ns = (unsigned long long) RTNETLINK_BACKOFF_NS << (attempt - 1);
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+/**
+ * Waits before trying an interrupted dump again: not at all the first time,
+ * then RTNETLINK_BACKOFF_NS, doubling every time
+ *
+ * @param attempt  Number of the attempt which failed, from 0
+ */
+void rtnetlink_backoff(int attempt)
+{
+    if (attempt <= 0) {
+        return;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    rtnetlink_sleep(attempt);
+    Py_END_ALLOW_THREADS
+}
+
+/* Asks for a socket receive buffer of size bytes */
+static void rtnetlink_set_rcvbuf(struct nl_connection *nlc, size_t size)
+{
+    nlc->rcvbuf = size < RTNETLINK_MAX_RCVBUF ? size : RTNETLINK_MAX_RCVBUF;
+    nl_socket_set_buffer_size(nlc->sock, nlc->rcvbuf, 0);
+}
+
+/* Makes room for datagrams of len bytes, returns 0 if they are too large.
+ * The new buffer is allocated by the next request. */
+static int rtnetlink_grow(struct nl_connection *nlc, size_t len)
+{
+    size_t size = nlc->bufsize;
+
+    while (size < len) {
+        size *= 2;
+    }
+    if (size > RTNETLINK_MAX_BUFSIZE) {
+        return 0;
+    }
+    free(nlc->buf);
+    free(nlc->prev);
+    nlc->buf = NULL;
+    nlc->prev = NULL;
+    nlc->bufsize = size;
+    if ((size_t) nlc->rcvbuf < size * RTNETLINK_RCVBUF_RATIO) {
+        rtnetlink_set_rcvbuf(nlc, size * RTNETLINK_RCVBUF_RATIO);
+    }
+    return 1;
+}
+
+/* Gives the kernel more room for answers after it ran out of it, which
+ * takes a new socket: the old one may still be in the middle of a dump */
+static int rtnetlink_overrun(struct nl_connection *nlc)
+{
+    if (nlc->rcvbuf >= RTNETLINK_MAX_RCVBUF) {
+        return 0;
+    }
+    nlc->rcvbuf = nlc->rcvbuf < RTNETLINK_MAX_RCVBUF / 2
+                  ? 2 * nlc->rcvbuf : RTNETLINK_MAX_RCVBUF;
+    return reconnect_netlink(nlc) == 0;
+}
+
+/* Receives the next datagram into the message buffer of the connection.
+ * Returns its length, which is larger than the buffer if the datagram was
+ * cut off, or a negative errno. */
+static ssize_t rtnetlink_recv(struct nl_connection *nlc, int flags)
+{
+    ssize_t len;
+
+    do {
+        /* With MSG_TRUNC, NETLINK tells the length of the whole datagram */
+        len = recv(nl_socket_get_fd(nlc->sock), nlc->buf, nlc->bufsize,
+                   flags | MSG_TRUNC);
+    } while (len < 0 && errno == EINTR);
+
+    return len < 0 ? -errno : len;
+}
+
+/* Reads and drops the rest of an answer.  The kernel adds the next part of
+ * a dump to the socket when the previous one is read, so the answer is
+ * complete once nothing is queued any more. */
+static void rtnetlink_drain(struct nl_connection *nlc)
+{
+    while (rtnetlink_recv(nlc, MSG_DONTWAIT) >= 0) {
+    }
+}
+
+/* Whether a message repeats one of the previous part of a dump.  The
+ * kernel resumes dumps at the position where the previous part ended, so
+ * entries added in front meanwhile make it send the last ones again.  The
+ * dump is not always flagged as interrupted then. */
+static int rtnetlink_repeated(const struct nlmsghdr *first,
+                              const unsigned char *prev, ssize_t len)
+{
+    const struct nlmsghdr *nlh;
+
+    for (nlh = (const struct nlmsghdr *) prev; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+        if (nlh->nlmsg_len == first->nlmsg_len
+                && nlh->nlmsg_type == first->nlmsg_type
+                && memcmp(NLMSG_DATA(nlh), NLMSG_DATA(first),
+                          NLMSG_PAYLOAD(nlh, 0)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Sends a request once and hands the messages answering it to a handler
+ *
+ * @param needed  Set to the size of a datagram which did not fit into the
+ *                message buffer
+ *
+ * @return Returns 0 on success, -EMSGSIZE if a datagram did not fit into the
+ *         message buffer, -ENOBUFS if the kernel ran out of socket receive
+ *         buffer, -EINTR if a dump was interrupted by changes, -EAGAIN if
+ *         the answer to a one_part request took several datagrams,
+ *         otherwise a negative errno
+ */
+static int rtnetlink_query_once(struct nl_connection *nlc,
+                                struct rtnetlink_request *req,
+                                rtnetlink_msg_handler handler, void *arg,
+                                size_t *needed)
+{
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    int fd = nl_socket_get_fd(nlc->sock);
+    int err = 0, done = 0, interrupted = 0, parts = 0;
+    unsigned int seq;
+    ssize_t ret, received, prev_len = 0;
+
+    if (nlc->buf == NULL) {
+        nlc->buf = malloc(nlc->bufsize);
+        if (nlc->buf == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    /* libnl expects the answers to its own requests to be numbered one
+     * after the other, so the numbers of the socket are left to it */
+    seq = ++nlc->seq;
+    req->nlh.nlmsg_seq = seq;
+    req->nlh.nlmsg_pid = nl_socket_get_local_port(nlc->sock);
+    if (req->nlh.nlmsg_flags & NLM_F_DUMP) {
+        perf_count(netlink_dumps, 1);
+    }
+
+    do {
+        ret = sendto(fd, req, req->nlh.nlmsg_len, 0,
+                     (struct sockaddr *) &kernel, sizeof(kernel));
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return -errno;
+    }
+
+    while (!done) {
+        struct nlmsghdr *nlh;
+        ssize_t len = rtnetlink_recv(nlc, 0);
+
+        if (len < 0) {
+            /* What is left of the answer could be taken for the answer to
+             * the next request */
+            nlc->broken = 1;
+            return (int) len;
+        }
+        if ((size_t) len > nlc->bufsize) {
+            /* The end of the answer may have been cut off with the rest */
+            *needed = len;
+            rtnetlink_drain(nlc);
+            return -EMSGSIZE;
+        }
+
+        received = len;
+        nlh = (struct nlmsghdr *) nlc->buf;
+        if (NLMSG_OK(nlh, len) && nlh->nlmsg_seq == seq
+                && nlh->nlmsg_type != NLMSG_DONE && ++parts > 1) {
+            if (req->one_part) {
+                rtnetlink_drain(nlc);
+                return -EAGAIN;
+            }
+            if (rtnetlink_repeated(nlh, nlc->prev, prev_len)) {
+                interrupted = 1;
+            }
+        }
+
+        for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            /* Left over from an earlier request */
+            if (nlh->nlmsg_seq != seq) {
+                continue;
+            }
+            perf_count(netlink_msgs, 1);
+            perf_count(netlink_bytes, nlh->nlmsg_len);
+
+            /* The links or addresses changed while they were dumped */
+            if (nlh->nlmsg_flags & NLM_F_DUMP_INTR) {
+                interrupted = 1;
+            }
+
+            if (nlh->nlmsg_type == NLMSG_DONE) {
+                int *status = NLMSG_DATA(nlh);
+
+                if (nlh->nlmsg_len >= NLMSG_LENGTH(sizeof(*status))
+                        && *status < 0 && err == 0) {
+                    err = *status;
+                }
+                done = 1;
+                break;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *e = NLMSG_DATA(nlh);
+
+                if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*e))) {
+                    err = err ? err : -EBADMSG;
+                } else if (e->error < 0 && err == 0) {
+                    err = e->error;
+                }
+                done = 1;
+                break;
+            }
+            if (err == 0) {
+                handler(nlh, arg);
+            }
+            if (!(nlh->nlmsg_flags & NLM_F_MULTI)) {
+                done = 1;
+                break;
+            }
+        }
+
+        /* Keep the part to compare the next one with */
+        if (!done && nlc->prev == NULL) {
+            nlc->prev = malloc(nlc->bufsize);
+        }
+        if (!done && nlc->prev != NULL) {
+            unsigned char *part = nlc->buf;
+
+            nlc->buf = nlc->prev;
+            nlc->prev = part;
+            prev_len = received;
+        }
+    }
+
+    if (err == 0 && interrupted) {
+        err = -EINTR;
+    }
+    return err;
+}
+
+/**
+ * Sends a request and hands every message answering it to a handler, until
+ * the end of a dump, the reply to a single request, or an error reported by
+ * the kernel.  The answer is read completely, so the connection can be used
+ * for the next request, unless receiving fails: the connection is then
+ * marked as broken and closed once it is released.
+ *
+ * The request is sent again, up to RTNETLINK_RETRIES times, if the answer
+ * did not fit into the message or socket receive buffer, which are grown
+ * first, or if a dump was interrupted by changes to what was dumped, after
+ * rtnetlink_backoff().  The handler is then called with NULL to forget the
+ * messages of the previous attempt.
+ *
+ * @param nlc      NETLINK connection taken with open_netlink()
+ * @param req      The request
+ * @param handler  Called with every message other than errors and the end
+ *                 of a dump
+ * @param arg      Passed to the handler
+ *
+ * @return Returns 0 on success, otherwise a negative errno: -EINTR if the
+ *         dump was still interrupted after all retries, -EAGAIN if the
+ *         answer to a one_part request took several datagrams
+ */
+int rtnetlink_query(struct nl_connection *nlc, struct rtnetlink_request *req,
+                    rtnetlink_msg_handler handler, void *arg)
+{
+    size_t needed = 0;
+    int attempt, err;
+
+    for (attempt = 0; ; attempt++) {
+        err = rtnetlink_query_once(nlc, req, handler, arg, &needed);
+        if (err == 0 || attempt == RTNETLINK_RETRIES
+                || (!nlc->nogil && PyErr_Occurred())) {
+            break;
+        }
+
+        if (err == -EMSGSIZE) {
+            if (!rtnetlink_grow(nlc, needed)) {
+                break;
+            }
+        } else if (err == -ENOBUFS) {
+            if (!rtnetlink_overrun(nlc)) {
+                break;
+            }
+        } else if (err == -EINTR) {
+            if (!nlc->nogil) {
+                rtnetlink_backoff(attempt);
+            } else if (attempt > 0) {
+                rtnetlink_sleep(attempt);
+            }
+        } else {
+            break;
+        }
+        perf_count(netlink_retries, 1);
+        handler(NULL, arg);
+    }
+    return err;
+}
+
+/**
+ * Selects how the etherinfo objects read NETLINK dumps
+ *
+ * @param name  "native" for the reader in this file, "libnl" for libnl
+ *
+ * @return Returns the name of the backend used until now
+ */
+PyObject *set_netlink_backend(PyObject *self, PyObject *name)
+{
+    struct ethtool_state *state = ethtool_get_state(self);
+    const char *value = PyStr_AsString(name);
+    PyObject *previous;
+    int libnl;
+
+    if (value == NULL) {
+        return NULL;
+    }
+    if (strcmp(value, "native") == 0) {
+        libnl = 0;
+    } else if (strcmp(value, "libnl") == 0) {
+        libnl = 1;
+    } else {
+        PyErr_Format(PyExc_ValueError,
+                     "unknown NETLINK backend '%s', "
+                     "expected 'native' or 'libnl'", value);
+        return NULL;
+    }
+
+    previous = PyStr_FromString(ethtool_load_flag(&state->netlink_libnl)
+                                ? "libnl" : "native");
+    if (previous != NULL) {
+        ethtool_store_flag(&state->netlink_libnl, libnl);
+    }
+    return previous;
+}
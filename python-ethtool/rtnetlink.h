@@ -0,0 +1,97 @@
+/*
+ * rtnetlink.h - Minimal rtnetlink reader for the dump hot path
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _RTNETLINK_H
+#define _RTNETLINK_H
+
+#include <Python.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/** Initial size of the message buffer of a connection.  The kernel does not
+ *  put more than 32 KiB of a dump into a single datagram, unless a single
+ *  message is larger; the buffer then grows up to RTNETLINK_MAX_BUFSIZE. */
+#ifndef RTNETLINK_BUFSIZE
+#define RTNETLINK_BUFSIZE 32768
+#endif
+#define RTNETLINK_MAX_BUFSIZE (1 << 20)
+
+/** Socket receive buffer (SO_RCVBUF) per byte of message buffer, at least
+ *  RTNETLINK_MIN_RCVBUF: the kernel fails dumps whose next part, up to
+ *  32 KiB, does not fit.  It grows when the kernel runs out of it, up to
+ *  RTNETLINK_MAX_RCVBUF, and is capped by net.core.rmem_max as well. */
+#define RTNETLINK_RCVBUF_RATIO 8
+#define RTNETLINK_MIN_RCVBUF (256 << 10)
+#define RTNETLINK_MAX_RCVBUF (16 << 20)
+
+/** Dumps interrupted by concurrent changes (NLM_F_DUMP_INTR) are tried this
+ *  many more times, RTNETLINK_BACKOFF_NS apart, doubling every time */
+#define RTNETLINK_RETRIES 5
+#define RTNETLINK_BACKOFF_NS 1000000
+
+struct ethtool_netns;
+
+/** A NETLINK connection of the pool, see netlink.c */
+struct nl_connection {
+    struct nl_sock *sock;  /**< libnl socket, shared with the libnl fallback */
+    unsigned char *buf;  /**< Message buffer, allocated on first use */
+    unsigned char *prev;  /**< Previous part of a dump, same size as buf */
+    size_t bufsize;  /**< Size of buf, or of the next one allocated */
+    int rcvbuf;  /**< SO_RCVBUF asked for */
+    unsigned int seq;  /**< Last sequence number, apart from libnl's own */
+    int strict;  /**< NETLINK_GET_STRICT_CHK: 1 on, 0 off, -1 unsupported */
+    int broken;  /**< Not to be reused: an answer was not read completely */
+    struct ethtool_netns *netns;  /**< Namespace of sock, NULL for the
+                                   *   current one */
+    int nogil;  /**< Used by a thread without the GIL: no Python calls */
+};
+
+/**
+ * Called with every message answering a request, and with NULL when the
+ * answer is about to be read again: the messages handled so far are to be
+ * forgotten.
+ */
+typedef void (*rtnetlink_msg_handler)(struct nlmsghdr *nlh, void *arg);
+
+/** A request: the header, the family specific header and some attributes */
+struct rtnetlink_request {
+    struct nlmsghdr nlh;
+    union {
+        struct ifinfomsg ifi;
+        struct ifaddrmsg ifa;
+    } u;
+    char attrs[64];
+    /* Not sent */
+    int one_part;  /**< Give up with -EAGAIN on a second datagram of data */
+};
+
+void rtnetlink_request_init(struct rtnetlink_request *req, int type,
+                            int flags, size_t hdrlen);
+int rtnetlink_request_attr(struct rtnetlink_request *req, int type,
+                           const void *data, size_t len);
+int rtnetlink_query(struct nl_connection *nlc, struct rtnetlink_request *req,
+                    rtnetlink_msg_handler handler, void *arg);
+void rtnetlink_parse_attrs(struct rtattr *tb[], int max, struct rtattr *rta,
+                           int len);
+int rtnetlink_set_strict(struct nl_connection *nlc, int on);
+void rtnetlink_backoff(int attempt);
+
+/* netlink.c */
+struct nl_connection *connect_netlink(struct ethtool_netns *ns);
+int reconnect_netlink(struct nl_connection *nlc);
+void disconnect_netlink(struct nl_connection *nlc);
+void free_netlink_connections(struct nl_connection **pool, unsigned int *len);
+
+PyObject *set_netlink_backend(PyObject *self, PyObject *name);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * settings.h - The tuning settings of a device, read in one go
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _SETTINGS_H
+#define _SETTINGS_H
+
+#include <Python.h>
+#if !defined IFNAMSIZ
+#include <net/if.h>
+#endif
+
+typedef unsigned long long u64;
+typedef __uint32_t u32;
+typedef __uint16_t u16;
+typedef __uint8_t u8;
+typedef __int32_t s32;
+typedef __int8_t s8;
+
+#include "ethtool-copy.h"
+
+/* The requests of get_all_settings(), in the order they are made */
+enum {
+    SETTINGS_DRIVER,
+    SETTINGS_RING,
+    SETTINGS_COALESCE,
+    SETTINGS_CHANNELS,
+    SETTINGS_PAUSE,
+    SETTINGS_TSO,
+    SETTINGS_GSO,
+    SETTINGS_GRO,
+    SETTINGS_SG,
+    SETTINGS_MAX
+};
+
+/** The settings of a device, as read by get_all_settings() */
+struct dev_settings {
+    char name[IFNAMSIZ];
+    int err[SETTINGS_MAX];  /**< errno of each request, 0 on success */
+    struct ethtool_drvinfo drvinfo;
+    struct ethtool_ringparam ring;
+    struct ethtool_coalesce coal;
+    struct ethtool_channels channels;
+    struct ethtool_pauseparam pause;
+    struct ethtool_value features[SETTINGS_MAX - SETTINGS_TSO];
+};
+
+unsigned int read_settings(int fd, struct dev_settings *settings);
+PyObject *settings_dict(struct dev_settings *settings);
+PyObject *settings_diff(const struct dev_settings *old,
+                        const struct dev_settings *new, unsigned int mask);
+
+#endif
@@ -0,0 +1,836 @@
+/*
+ * shmstats.c - Interface counters published in shared memory
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <Python.h>
+#include "include/py3c/compat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/if.h>
+#include <linux/if_link.h>
+
+#include "device.h"
+#include "etherinfo_struct.h"
+#include "fastcall.h"
+#include "netns.h"
+#include "perfcounters.h"
+#include "rtnetlink.h"
+#include "shmstats.h"
+#include "sweep.h"
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+/*
+ * An ethtool.StatsPublisher samples the counters of the interfaces with a
+ * NETLINK dump and writes them to a file mapped in shared memory, usually
+ * on /dev/shm.  Any number of ethtool.SharedStatsReader objects, in other
+ * processes, map the same file and read the latest sample with no system
+ * call at all.
+ *
+ * The sample is guarded by a sequence lock: the publisher makes the
+ * sequence number odd, writes the sample, then makes it even again.
+ * Readers copy the sample out and start over if the number was odd or
+ * changed meanwhile, so they never see half a sample and never hold up
+ * the publisher.
+ *
+ * The file is created under another name and renamed into place, and the
+ * file it replaces is marked closed: readers of a stopped publisher find
+ * out, instead of getting the last sample forever.
+ */
+
+#define SHM_MAGIC "ETHSTATS"
+#define SHM_VERSION 1
+
+/* The first counters of struct rtnl_link_stats64, as snapshot_columns() */
+#define SHM_COUNTERS 10
+
+static const char *const shm_counter_names[SHM_COUNTERS] = {
+    "rx_packets", "tx_packets", "rx_bytes", "tx_bytes", "rx_errors",
+    "tx_errors", "rx_dropped", "tx_dropped", "multicast", "collisions",
+};
+
+/** Start of the file, followed by capacity entries */
+struct shm_header {
+    char magic[8];
+    __u32 version;
+    __u32 capacity;  /**< Entries the file has room for */
+    __u32 counters;  /**< Counters per entry, SHM_COUNTERS */
+    __u32 closed;  /**< Set once the publisher is gone or replaced */
+    __u64 seq;  /**< Odd while the publisher writes a sample */
+    __u64 samples;  /**< Samples written so far */
+    __u64 timestamp;  /**< CLOCK_REALTIME of the sample, in nanoseconds */
+    __u32 count;  /**< Entries of the sample */
+    __u32 reserved[3];
+};
+
+/** An interface of the sample */
+struct shm_entry {
+    __s32 ifindex;
+    __u32 flags;
+    char name[IFNAMSIZ];
+    __u64 counters[SHM_COUNTERS];
+};
+
+#define SHM_SIZE(capacity) \
+    (sizeof(struct shm_header) + (capacity) * sizeof(struct shm_entry))
+
+/* Attempts of a reader while the publisher writes, before giving up */
+#define SHM_READ_TRIES 1000
+
+/** ethtool.StatsPublisher object */
+typedef struct {
+    PyObject_HEAD
+    struct ethtool_state *state;  /**< Module the class belongs to */
+    struct shm_header *shm;  /**< NULL once closed */
+    size_t size;
+    PyObject *netns;  /**< The netns argument, NULL for the current one */
+} PyEthtoolStatsPublisher;
+
+/** ethtool.SharedStatsReader object */
+typedef struct {
+    PyObject_HEAD
+    struct ethtool_state *state;  /**< Module the class belongs to */
+    const struct shm_header *shm;  /**< NULL once closed */
+    size_t size;
+    unsigned int capacity;  /**< Entries the mapping has room for */
+    struct shm_header *copy;  /**< Of the latest sample read */
+} PyEthtoolSharedStatsReader;
+
+static struct shm_entry *shm_entries(const struct shm_header *shm)
+{
+    return (struct shm_entry *)(shm + 1);
+}
+
+/**
+ * Maps a file of published counters, checking it is one
+ *
+ * @param size  Set to the size of the mapping
+ *
+ * @return Returns the mapping, NULL with a Python exception set
+ */
+static void *shm_map(int fd, int prot, const char *path, size_t *size)
+{
+    const struct shm_header *shm;
+    struct stat st;
+    void *map;
+
+    if (fstat(fd, &st) < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(*shm)) {
+        PyErr_Format(PyExc_ValueError, "%s: not a file of published "
+                     "counters", path);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        return NULL;
+    }
+
+    shm = map;
+    if (memcmp(shm->magic, SHM_MAGIC, sizeof(shm->magic)) != 0
+            || shm->version != SHM_VERSION || shm->counters != SHM_COUNTERS
+            || SHM_SIZE((size_t)shm->capacity) > (size_t)st.st_size) {
+        PyErr_Format(PyExc_ValueError, "%s: not a file of published "
+                     "counters, or of another version", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+    return map;
+}
+
+/*
+ * Maps the file a new publisher replaces, to mark it closed for its readers
+ * once the new file is in place.  NULL if there is none, or it is left as it
+ * is.
+ */
+static struct shm_header *shm_map_old(const char *path, size_t *size)
+{
+    struct shm_header *shm;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    shm = shm_map(fd, PROT_READ | PROT_WRITE, path, size);
+    close(fd);
+    if (shm == NULL)
+        PyErr_Clear();
+    return shm;
+}
+
+/**
+ * Creates the file of a publisher with room for capacity entries
+ *
+ * @return Returns 0 on success, -1 with a Python exception set
+ */
+static int shm_create(PyEthtoolStatsPublisher *self, const char *path,
+                      unsigned int capacity)
+{
+    size_t len = strlen(path), old_size;
+    struct shm_header *old;
+    char *tmp;
+    int fd;
+
+    tmp = malloc(len + sizeof(".XXXXXX"));
+    if (tmp == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        free(tmp);
+        return -1;
+    }
+    self->size = SHM_SIZE((size_t)capacity);
+    /* The readers need not be root */
+    if (fchmod(fd, 0644) < 0 || ftruncate(fd, self->size) < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        goto err;
+    }
+    self->shm = mmap(NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    if (self->shm == MAP_FAILED) {
+        self->shm = NULL;
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        goto err;
+    }
+
+    memcpy(self->shm->magic, SHM_MAGIC, sizeof(self->shm->magic));
+    self->shm->version = SHM_VERSION;
+    self->shm->capacity = capacity;
+    self->shm->counters = SHM_COUNTERS;
+
+    /* The readers of the old file keep reading it until it is replaced */
+    old = shm_map_old(path, &old_size);
+    if (rename(tmp, path) < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        if (old != NULL)
+            munmap(old, old_size);
+        goto err;
+    }
+    if (old != NULL) {
+        __atomic_store_n(&old->closed, 1, __ATOMIC_RELEASE);
+        munmap(old, old_size);
+    }
+    close(fd);
+    free(tmp);
+    return 0;
+
+err:
+    if (self->shm != NULL) {
+        munmap(self->shm, self->size);
+        self->shm = NULL;
+    }
+    close(fd);
+    unlink(tmp);
+    free(tmp);
+    return -1;
+}
+
+/**
+ * Writes the links of a dump to the file of a publisher, as a new sample.
+ * Makes no Python calls.
+ *
+ * @return Returns the number of links written
+ */
+static unsigned int shm_publish(struct shm_header *shm, struct sweep_buf *buf)
+{
+    struct shm_entry *entries = shm_entries(shm);
+    struct nlmsghdr *nlh;
+    struct timespec now;
+    size_t len = buf->len;
+    unsigned int count = 0;
+    __u64 seq = shm->seq;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    /* Readers of the entries see the odd number first */
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (nlh = (struct nlmsghdr *) buf->data;
+            NLMSG_OK(nlh, len) && count < shm->capacity;
+            nlh = NLMSG_NEXT(nlh, len)) {
+        struct shm_entry *entry = &entries[count];
+        struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+        struct rtattr *tb[IFLA_MAX + 1];
+        size_t size;
+
+        if (nlh->nlmsg_type != RTM_NEWLINK
+                || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+            continue;
+        rtnetlink_parse_attrs(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+        if (tb[IFLA_IFNAME] == NULL)
+            continue;
+
+        entry->ifindex = ifi->ifi_index;
+        entry->flags = ifi->ifi_flags;
+        memset(entry->name, 0, IFNAMSIZ);
+        size = strnlen(RTA_DATA(tb[IFLA_IFNAME]), RTA_PAYLOAD(tb[IFLA_IFNAME]));
+        if (size >= IFNAMSIZ)
+            size = IFNAMSIZ - 1;
+        memcpy(entry->name, RTA_DATA(tb[IFLA_IFNAME]), size);
+        memset(entry->counters, 0, sizeof(entry->counters));
+        if (tb[IFLA_STATS64] != NULL) {
+            size = RTA_PAYLOAD(tb[IFLA_STATS64]);
+            if (size > sizeof(entry->counters))
+                size = sizeof(entry->counters);
+            memcpy(entry->counters, RTA_DATA(tb[IFLA_STATS64]), size);
+        }
+        count++;
+    }
+    shm->count = count;
+    shm->samples++;
+    shm->timestamp = (__u64)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+    return count;
+}
+
+static PyObject *publisher_new(PyTypeObject *type, PyObject *args __unused,
+                               PyObject *kwds __unused)
+{
+    struct ethtool_state *state = ethtool_type_state(type);
+    PyEthtoolStatsPublisher *self;
+
+    if (state == NULL)
+        return NULL;
+
+    self = (PyEthtoolStatsPublisher *)type->tp_alloc(type, 0);
+    if (self != NULL)
+        self->state = state;
+    return (PyObject *)self;
+}
+
+static int publisher_init(PyEthtoolStatsPublisher *self, PyObject *args,
+                          PyObject *kwds)
+{
+    static char *kwlist[] = { "path", "capacity", "netns", NULL };
+    PyObject *netns = NULL;
+    unsigned int capacity = 1024;
+    const char *path;
+    struct ethtool_netns *ns;
+
+    /* netns is keyword-only where the Python version can tell */
+#if PY_MAJOR_VERSION >= 3
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|I$O:StatsPublisher",
+                                     kwlist, &path, &capacity, &netns))
+        return -1;
+#else
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|IO:StatsPublisher",
+                                     kwlist, &path, &capacity, &netns))
+        return -1;
+#endif
+    if (capacity == 0 || capacity > INT_MAX / sizeof(struct shm_entry)) {
+        PyErr_SetString(PyExc_ValueError, "capacity out of range");
+        return -1;
+    }
+    if (self->shm != NULL) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "StatsPublisher is initialised already");
+        return -1;
+    }
+
+    /* Fails now rather than at the first sample */
+    if (ethtool_netns_get(self->state, netns, &ns) < 0)
+        return -1;
+    ethtool_netns_put(self->state, ns);
+    if (netns != NULL && netns != Py_None) {
+        Py_INCREF(netns);
+        self->netns = netns;
+    }
+
+    return shm_create(self, path, capacity);
+}
+
+/**
+ * Publishes a new sample of the counters of the interfaces
+ *
+ * @return Python int of the interfaces published, those beyond the capacity
+ *         being left out; NULL with a Python exception set
+ */
+static PyObject *publisher_sample(PyEthtoolStatsPublisher *self,
+                                  PyObject *notused __unused)
+{
+    struct sweep_ns dump = { .fd = -1 };
+    struct nl_connection *nlc;
+    struct ethtool_netns *ns;
+    PyObject *ret = NULL;
+    unsigned int count = 0;
+    int err;
+
+    if (self->shm == NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "I/O operation on closed StatsPublisher");
+        return NULL;
+    }
+    if (ethtool_netns_get(self->state, self->netns, &ns) < 0)
+        return NULL;
+
+    nlc = connect_netlink(ns);
+    if (nlc == NULL) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Could not open a NETLINK connection");
+        goto out;
+    }
+    err = sweep_dump_nogil(nlc, -1, 1, &dump);
+    disconnect_netlink(nlc);
+    if (err < 0) {
+        errno = -err;
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto out;
+    }
+
+    /* A single writer, the sequence lock does not order writers */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->shm != NULL)
+        count = shm_publish(self->shm, &dump.links);
+    Py_END_CRITICAL_SECTION();
+    ret = PyInt_FromLong(count);
+
+out:
+    sweep_ns_release(&dump);
+    ethtool_netns_put(self->state, ns);
+    return ret;
+}
+
+static PyObject *publisher_close(PyEthtoolStatsPublisher *self,
+                                 PyObject *notused __unused)
+{
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->shm != NULL) {
+        __atomic_store_n(&self->shm->closed, 1, __ATOMIC_RELEASE);
+        munmap(self->shm, self->size);
+        self->shm = NULL;
+    }
+    Py_END_CRITICAL_SECTION();
+    Py_RETURN_NONE;
+}
+
+static PyObject *publisher_enter(PyEthtoolStatsPublisher *self,
+                                 PyObject *notused __unused)
+{
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *publisher_exit(PyEthtoolStatsPublisher *self,
+                                PyObject *args __unused)
+{
+    return publisher_close(self, NULL);
+}
+
+static void publisher_dealloc(PyEthtoolStatsPublisher *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+    if (self->shm != NULL) {
+        __atomic_store_n(&self->shm->closed, 1, __ATOMIC_RELEASE);
+        munmap(self->shm, self->size);
+    }
+    Py_XDECREF(self->netns);
+    type->tp_free((PyObject *)self);
+    ethtool_type_decref(type);
+}
+
+PERF_WRAPPER(perf_publisher_sample, PERF_API_STATS_PUBLISHER_SAMPLE,
+             publisher_sample,
+             (PyEthtoolStatsPublisher *self, PyObject *notused),
+             (self, notused), &self->state->perf, Py_None)
+
+static PyMethodDef publisher_methods[] = {
+    {"sample", (PyCFunction)perf_publisher_sample, METH_NOARGS,
+     "Publishes the counters of the interfaces now, returns the number of "
+     "interfaces published"},
+    {"close", (PyCFunction)publisher_close, METH_NOARGS,
+     "Stops publishing, the readers find the file closed"},
+    {"__enter__", (PyCFunction)publisher_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction)publisher_exit, METH_VARARGS, NULL},
+    {NULL}
+};
+
+static const char publisher_doc[] =
+    "StatsPublisher(path, capacity=1024, *, netns=None)\n\n"
+    "Publishes the counters of the interfaces, those of "
+    "ethtool.snapshot_columns(), to the file path, mapped in shared memory "
+    "by ethtool.SharedStatsReader objects.  Each call of sample() reads "
+    "them with a NETLINK dump, in the network namespace netns if given, "
+    "and writes up to capacity interfaces.  The file is created anew, "
+    "replacing any file of an earlier publisher.";
+
+/**
+ * Copies the latest sample out of the file, once the publisher is done
+ * writing it.  Makes no system call unless the publisher is writing.
+ *
+ * @return Returns the copy, NULL with a Python exception set
+ */
+static const struct shm_header *reader_copy(PyEthtoolSharedStatsReader *self)
+{
+    const struct shm_header *shm = self->shm;
+    struct shm_header *copy = self->copy;
+    int tries;
+
+    if (shm == NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "I/O operation on closed SharedStatsReader");
+        return NULL;
+    }
+
+    for (tries = 0; tries < SHM_READ_TRIES; tries++) {
+        __u64 seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        unsigned int count;
+
+        if (!(seq & 1)) {
+            memcpy(copy, shm, sizeof(*copy));
+            count = copy->count;
+            if (count > self->capacity)
+                count = self->capacity;
+            memcpy(shm_entries(copy), shm_entries(shm),
+                   count * sizeof(struct shm_entry));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq) {
+                copy->count = count;
+                break;
+            }
+        }
+        sched_yield();
+    }
+
+    if (tries == SHM_READ_TRIES) {
+        errno = EAGAIN;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return NULL;
+    }
+    if (copy->closed) {
+        errno = ESTALE;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return NULL;
+    }
+    return copy;
+}
+
+static PyObject *reader_new(PyTypeObject *type, PyObject *args __unused,
+                            PyObject *kwds __unused)
+{
+    struct ethtool_state *state = ethtool_type_state(type);
+    PyEthtoolSharedStatsReader *self;
+
+    if (state == NULL)
+        return NULL;
+
+    self = (PyEthtoolSharedStatsReader *)type->tp_alloc(type, 0);
+    if (self != NULL)
+        self->state = state;
+    return (PyObject *)self;
+}
+
+static int reader_init(PyEthtoolSharedStatsReader *self, PyObject *args,
+                       PyObject *kwds)
+{
+    static char *kwlist[] = { "path", NULL };
+    const char *path;
+    void *map;
+    int fd;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s:SharedStatsReader",
+                                     kwlist, &path))
+        return -1;
+    if (self->shm != NULL) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "SharedStatsReader is initialised already");
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        return -1;
+    }
+    map = shm_map(fd, PROT_READ, path, &self->size);
+    close(fd);
+    if (map == NULL)
+        return -1;
+
+    self->copy = malloc(self->size);
+    if (self->copy == NULL) {
+        munmap(map, self->size);
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->shm = map;
+    self->capacity = (self->size - sizeof(*self->shm))
+                     / sizeof(struct shm_entry);
+    return 0;
+}
+
+/* Builds the dict of the counters of an entry */
+static PyObject *reader_entry_dict(const struct shm_entry *entry)
+{
+    PyObject *dict = PyDict_New();
+    int i;
+
+    for (i = 0; dict != NULL && i < SHM_COUNTERS; i++) {
+        PyObject *value = PyLong_FromUnsignedLongLong(entry->counters[i]);
+
+        if (value == NULL
+                || PyDict_SetItemString(dict, shm_counter_names[i],
+                                        value) < 0)
+            Py_CLEAR(dict);
+        Py_XDECREF(value);
+    }
+    return dict;
+}
+
+/**
+ * Reads the latest sample
+ *
+ * @param device  Interface to read the counters of, all of them if omitted
+ *
+ * @return Python dict of the counters of the device, or mapping the name
+ *         of each interface to its counters; NULL with a Python exception
+ *         set, IOError ENODEV if the device is not in the sample, ESTALE
+ *         if the publisher is gone
+ */
+static PyObject *reader_read(PyEthtoolSharedStatsReader *self,
+                             FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "device" };
+    PyObject *argv[1] = { NULL }, *ret = NULL;
+    const struct shm_header *copy;
+    const struct shm_entry *entries;
+    const char *device = NULL;
+    unsigned int i;
+
+    if (fastcall_unpack("read", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 0, 1, argv) < 0)
+        return NULL;
+    if (argv[0] != NULL && argv[0] != Py_None) {
+        if (!PyStr_Check(argv[0])) {
+            PyErr_SetString(PyExc_TypeError,
+                            "read() argument must be a device name");
+            return NULL;
+        }
+        device = dev_name_as_string(argv[0]);
+        if (device == NULL)
+            return NULL;
+    }
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    copy = reader_copy(self);
+    if (copy == NULL)
+        goto out;
+    entries = shm_entries(copy);
+
+    if (device != NULL) {
+        for (i = 0; i < copy->count; i++) {
+            if (strncmp(entries[i].name, device, IFNAMSIZ) == 0)
+                break;
+        }
+        if (i < copy->count) {
+            ret = reader_entry_dict(&entries[i]);
+        } else {
+            errno = ENODEV;
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, device);
+        }
+        goto out;
+    }
+
+    ret = PyDict_New();
+    for (i = 0; ret != NULL && i < copy->count; i++) {
+        PyObject *counters = reader_entry_dict(&entries[i]);
+
+        if (counters == NULL
+                || PyDict_SetItemString(ret, entries[i].name, counters) < 0)
+            Py_CLEAR(ret);
+        Py_XDECREF(counters);
+    }
+
+out:
+    Py_END_CRITICAL_SECTION();
+    return ret;
+}
+
+static PyObject *reader_get_samples(PyEthtoolSharedStatsReader *self,
+                                    void *closure __unused)
+{
+    const struct shm_header *copy;
+    PyObject *ret = NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    copy = reader_copy(self);
+    if (copy != NULL)
+        ret = PyLong_FromUnsignedLongLong(copy->samples);
+    Py_END_CRITICAL_SECTION();
+    return ret;
+}
+
+static PyObject *reader_get_timestamp(PyEthtoolSharedStatsReader *self,
+                                      void *closure __unused)
+{
+    const struct shm_header *copy;
+    PyObject *ret = NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    copy = reader_copy(self);
+    if (copy != NULL)
+        ret = PyFloat_FromDouble(copy->timestamp / 1e9);
+    Py_END_CRITICAL_SECTION();
+    return ret;
+}
+
+static PyObject *reader_close(PyEthtoolSharedStatsReader *self,
+                              PyObject *notused __unused)
+{
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->shm != NULL) {
+        munmap((void *)self->shm, self->size);
+        self->shm = NULL;
+    }
+    Py_END_CRITICAL_SECTION();
+    Py_RETURN_NONE;
+}
+
+static PyObject *reader_enter(PyEthtoolSharedStatsReader *self,
+                              PyObject *notused __unused)
+{
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *reader_exit(PyEthtoolSharedStatsReader *self,
+                             PyObject *args __unused)
+{
+    return reader_close(self, NULL);
+}
+
+static void reader_dealloc(PyEthtoolSharedStatsReader *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+    if (self->shm != NULL)
+        munmap((void *)self->shm, self->size);
+    free(self->copy);
+    type->tp_free((PyObject *)self);
+    ethtool_type_decref(type);
+}
+
+PERF_WRAPPER(perf_reader_read, PERF_API_SHARED_STATS_READER_READ,
+             reader_read, (PyEthtoolSharedStatsReader *self, FASTCALL_PARAMS),
+             (self, FASTCALL_PASS), &self->state->perf,
+             fastcall_device(FASTCALL_ARGS, FASTCALL_NARGS, FASTCALL_KWNAMES))
+
+static PyMethodDef reader_methods[] = {
+    {"read", (PyCFunction)perf_reader_read, METH_FASTCALL_KEYWORDS,
+     "read(device=None): returns the counters of the device in the latest "
+     "sample, or a dict mapping each interface name to its counters"},
+    {"close", (PyCFunction)reader_close, METH_NOARGS,
+     "Unmaps the file"},
+    {"__enter__", (PyCFunction)reader_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction)reader_exit, METH_VARARGS, NULL},
+    {NULL}
+};
+
+static PyGetSetDef reader_getset[] = {
+    {"samples", (getter)reader_get_samples, NULL,
+     "Number of samples published so far", NULL},
+    {"timestamp", (getter)reader_get_timestamp, NULL,
+     "Time of the latest sample, in seconds since the epoch, 0.0 before the "
+     "first", NULL},
+    {NULL}
+};
+
+static const char reader_doc[] =
+    "SharedStatsReader(path)\n\n"
+    "Reads the counters an ethtool.StatsPublisher publishes to the file "
+    "path, mapped in shared memory: reading the latest sample takes no "
+    "system call.  Once the publisher is closed or replaced by another, "
+    "reads raise IOError ESTALE and a new reader has to be opened.";
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+static PyType_Slot publisher_slots[] = {
+    {Py_tp_new, publisher_new},
+    {Py_tp_init, publisher_init},
+    {Py_tp_dealloc, publisher_dealloc},
+    {Py_tp_methods, publisher_methods},
+    {Py_tp_doc, (void *)publisher_doc},
+    {0, NULL}
+};
+
+PyType_Spec PyEthtoolStatsPublisher_Spec = {
+    .name = "ethtool.StatsPublisher",
+    .basicsize = sizeof(PyEthtoolStatsPublisher),
+    .flags = Py_TPFLAGS_DEFAULT | ETHTOOL_TPFLAGS_IMMUTABLE,
+    .slots = publisher_slots,
+};
+
+static PyType_Slot reader_slots[] = {
+    {Py_tp_new, reader_new},
+    {Py_tp_init, reader_init},
+    {Py_tp_dealloc, reader_dealloc},
+    {Py_tp_methods, reader_methods},
+    {Py_tp_getset, reader_getset},
+    {Py_tp_doc, (void *)reader_doc},
+    {0, NULL}
+};
+
+PyType_Spec PyEthtoolSharedStatsReader_Spec = {
+    .name = "ethtool.SharedStatsReader",
+    .basicsize = sizeof(PyEthtoolSharedStatsReader),
+    .flags = Py_TPFLAGS_DEFAULT | ETHTOOL_TPFLAGS_IMMUTABLE,
+    .slots = reader_slots,
+};
+#else
+PyTypeObject PyEthtoolStatsPublisher_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ethtool.StatsPublisher",
+    .tp_basicsize = sizeof(PyEthtoolStatsPublisher),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = publisher_new,
+    .tp_init = (initproc)publisher_init,
+    .tp_dealloc = (destructor)publisher_dealloc,
+    .tp_methods = publisher_methods,
+    .tp_doc = publisher_doc,
+};
+
+PyTypeObject PyEthtoolSharedStatsReader_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ethtool.SharedStatsReader",
+    .tp_basicsize = sizeof(PyEthtoolSharedStatsReader),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = reader_new,
+    .tp_init = (initproc)reader_init,
+    .tp_dealloc = (destructor)reader_dealloc,
+    .tp_methods = reader_methods,
+    .tp_getset = reader_getset,
+    .tp_doc = reader_doc,
+};
+#endif
@@ -0,0 +1,29 @@
+/*
+ * shmstats.h - Interface counters published in shared memory
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _SHMSTATS_H
+#define _SHMSTATS_H
+
+#include <Python.h>
+
+#include "modstate.h"
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+extern PyType_Spec PyEthtoolStatsPublisher_Spec;
+extern PyType_Spec PyEthtoolSharedStatsReader_Spec;
+#else
+extern PyTypeObject PyEthtoolStatsPublisher_Type;
+extern PyTypeObject PyEthtoolSharedStatsReader_Type;
+#endif
+
+#endif
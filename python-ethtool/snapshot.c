@@ -0,0 +1,1186 @@
+/*
+ * snapshot.c - Snapshots of the interfaces of a namespace, and their diff
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <Python.h>
+#include "include/py3c/compat.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if.h>
+
+#include "device.h"
+#include "etherinfo_struct.h"
+#include "etherinfo.h"
+#include "netns.h"
+#include "perfcounters.h"
+#include "rtnetlink.h"
+#include "settings.h"
+#include "snapshot.h"
+#include "sweep.h"
+
+/*
+ * A snapshot keeps the links and addresses of a dump in arrays sorted by
+ * interface index, and makes no Python objects of them until asked: diff()
+ * walks two snapshots side by side, making objects of the changes only.
+ */
+
+#define SNAP_HWADDR_LEN 32  /* MAX_ADDR_LEN */
+
+/** An interface of a snapshot */
+struct snap_link {
+    int ifindex;
+    unsigned int flags;  /**< Of NETLINK, beyond the 16 bits of get_flags() */
+    unsigned int mtu;
+    char name[IFNAMSIZ];
+    unsigned char hwaddr[SNAP_HWADDR_LEN];
+    unsigned char hwaddr_len;
+    size_t addr_first;  /**< Its addresses in the array of the snapshot */
+    size_t addr_count;
+};
+
+/** An address of an interface, the local one for point-to-point links */
+struct snap_addr {
+    int ifindex;
+    unsigned char family;
+    unsigned char prefixlen;
+    unsigned char addr[16];  /**< Zero padded for IPv4 */
+};
+
+/** ethtool.Snapshot object */
+typedef struct {
+    PyObject_HEAD
+    struct snap_link *links;  /**< Sorted by interface index */
+    size_t nlinks;
+    struct snap_addr *addrs;  /**< Sorted by interface index, then address */
+    size_t naddrs;
+    struct dev_settings *settings;  /**< One per link, NULL unless read */
+} PyEthtoolSnapshot;
+
+static int snap_link_cmp(const void *a, const void *b)
+{
+    const struct snap_link *x = a, *y = b;
+
+    return (x->ifindex > y->ifindex) - (x->ifindex < y->ifindex);
+}
+
+static int snap_addr_cmp(const void *a, const void *b)
+{
+    const struct snap_addr *x = a, *y = b;
+    int ret;
+
+    if (x->ifindex != y->ifindex)
+        return x->ifindex < y->ifindex ? -1 : 1;
+    if (x->family != y->family)
+        return x->family < y->family ? -1 : 1;
+    ret = memcmp(x->addr, y->addr, sizeof(x->addr));
+    if (ret != 0)
+        return ret;
+    return (x->prefixlen > y->prefixlen) - (x->prefixlen < y->prefixlen);
+}
+
+/* Counts the messages of a dump, an upper bound of its entries */
+static size_t snap_count(struct sweep_buf *buf)
+{
+    struct nlmsghdr *nlh;
+    size_t len = buf->len, n = 0;
+
+    for (nlh = (struct nlmsghdr *) buf->data; NLMSG_OK(nlh, len);
+            nlh = NLMSG_NEXT(nlh, len))
+        n++;
+    return n;
+}
+
+/**
+ * Fills in the links of a snapshot from the RTM_NEWLINK messages of a dump
+ *
+ * @return Returns 0 on success, -1 if out of memory
+ */
+static int snap_parse_links(PyEthtoolSnapshot *snap, struct sweep_buf *buf)
+{
+    struct nlmsghdr *nlh;
+    size_t len = buf->len;
+
+    snap->links = calloc(snap_count(buf) + 1, sizeof(*snap->links));
+    if (snap->links == NULL)
+        return -1;
+
+    for (nlh = (struct nlmsghdr *) buf->data; NLMSG_OK(nlh, len);
+            nlh = NLMSG_NEXT(nlh, len)) {
+        struct snap_link *link = &snap->links[snap->nlinks];
+        struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+        struct rtattr *tb[IFLA_MAX + 1];
+        size_t size;
+
+        if (nlh->nlmsg_type != RTM_NEWLINK
+                || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+            continue;
+        rtnetlink_parse_attrs(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+        if (tb[IFLA_IFNAME] == NULL)
+            continue;
+
+        link->ifindex = ifi->ifi_index;
+        link->flags = ifi->ifi_flags;
+        if (tb[IFLA_MTU] != NULL && RTA_PAYLOAD(tb[IFLA_MTU]) >= sizeof(__u32))
+            link->mtu = *(__u32 *) RTA_DATA(tb[IFLA_MTU]);
+        size = strnlen(RTA_DATA(tb[IFLA_IFNAME]), RTA_PAYLOAD(tb[IFLA_IFNAME]));
+        if (size >= IFNAMSIZ)
+            size = IFNAMSIZ - 1;
+        memcpy(link->name, RTA_DATA(tb[IFLA_IFNAME]), size);
+        if (tb[IFLA_ADDRESS] != NULL) {
+            size = RTA_PAYLOAD(tb[IFLA_ADDRESS]);
+            if (size > SNAP_HWADDR_LEN)
+                size = SNAP_HWADDR_LEN;
+            memcpy(link->hwaddr, RTA_DATA(tb[IFLA_ADDRESS]), size);
+            link->hwaddr_len = size;
+        }
+        snap->nlinks++;
+    }
+
+    qsort(snap->links, snap->nlinks, sizeof(*snap->links), snap_link_cmp);
+    return 0;
+}
+
+/**
+ * Fills in the addresses of a snapshot from the RTM_NEWADDR messages of a
+ * dump, once its links are
+ *
+ * @return Returns 0 on success, -1 if out of memory
+ */
+static int snap_parse_addrs(PyEthtoolSnapshot *snap, struct sweep_buf *buf)
+{
+    struct nlmsghdr *nlh;
+    size_t len = buf->len, i, j;
+
+    snap->addrs = calloc(snap_count(buf) + 1, sizeof(*snap->addrs));
+    if (snap->addrs == NULL)
+        return -1;
+
+    for (nlh = (struct nlmsghdr *) buf->data; NLMSG_OK(nlh, len);
+            nlh = NLMSG_NEXT(nlh, len)) {
+        struct snap_addr *addr = &snap->addrs[snap->naddrs];
+        struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+        struct rtattr *tb[IFA_BROADCAST + 1];
+        struct rtattr *rta;
+        size_t size;
+
+        if (nlh->nlmsg_type != RTM_NEWADDR
+                || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+            continue;
+        if (ifa->ifa_family == AF_INET)
+            size = 4;
+        else if (ifa->ifa_family == AF_INET6)
+            size = 16;
+        else
+            continue;
+        rtnetlink_parse_attrs(tb, IFA_BROADCAST, IFA_RTA(ifa),
+                              IFA_PAYLOAD(nlh));
+        /* IFA_ADDRESS is the peer of a point-to-point IPv4 link */
+        rta = tb[IFA_LOCAL] != NULL ? tb[IFA_LOCAL] : tb[IFA_ADDRESS];
+        if (rta == NULL || RTA_PAYLOAD(rta) < size)
+            continue;
+
+        addr->ifindex = ifa->ifa_index;
+        addr->family = ifa->ifa_family;
+        addr->prefixlen = ifa->ifa_prefixlen;
+        memcpy(addr->addr, RTA_DATA(rta), size);
+        snap->naddrs++;
+    }
+
+    qsort(snap->addrs, snap->naddrs, sizeof(*snap->addrs), snap_addr_cmp);
+
+    /* Both are sorted by interface index: each link gets a range */
+    for (i = 0, j = 0; i < snap->nlinks; i++) {
+        struct snap_link *link = &snap->links[i];
+
+        /* Of links created between the two dumps */
+        while (j < snap->naddrs && snap->addrs[j].ifindex < link->ifindex)
+            j++;
+        link->addr_first = j;
+        while (j < snap->naddrs && snap->addrs[j].ifindex == link->ifindex)
+            j++;
+        link->addr_count = j - link->addr_first;
+    }
+    return 0;
+}
+
+/**
+ * Reads the settings of every link of a snapshot, without the GIL
+ *
+ * @return Returns 0 on success, -1 with a Python exception set otherwise
+ */
+static int snap_read_settings(PyEthtoolSnapshot *snap,
+                              struct ethtool_netns *ns)
+{
+    unsigned long ioctls = 0;
+    size_t i;
+    int fd;
+
+    snap->settings = calloc(snap->nlinks + 1, sizeof(*snap->settings));
+    if (snap->settings == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < snap->nlinks; i++)
+        memcpy(snap->settings[i].name, snap->links[i].name, IFNAMSIZ);
+
+    if (ns != NULL) {
+        fd = ns->ctl_fd;
+    } else {
+        fd = dev_socket();
+        if (fd < 0)
+            return -1;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < snap->nlinks; i++)
+        ioctls += read_settings(fd, &snap->settings[i]);
+    Py_END_ALLOW_THREADS
+    perf_count(ioctls, ioctls);
+
+    if (ns == NULL)
+        close(fd);
+    return 0;
+}
+
+/* Finds a link of a snapshot, returns its position or -1 */
+static Py_ssize_t snap_find(PyEthtoolSnapshot *snap, PyObject *key)
+{
+    size_t lo = 0, hi = snap->nlinks;
+    long ifindex;
+
+    if (!PyInt_Check(key) && !PyLong_Check(key))
+        return -1;
+    ifindex = PyInt_AsLong(key);
+    if (ifindex == -1 && PyErr_Occurred()) {
+        PyErr_Clear();
+        return -1;
+    }
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (snap->links[mid].ifindex == ifindex)
+            return mid;
+        if (snap->links[mid].ifindex < ifindex)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+/* Formats an address as address/prefix length */
+static PyObject *snap_addr_str(const struct snap_addr *addr)
+{
+    char buf[INET6_ADDRSTRLEN];
+
+    inet_ntop(addr->family, addr->addr, buf, sizeof(buf));
+    return PyStr_FromFormat("%s/%d", buf, addr->prefixlen);
+}
+
+static PyObject *snap_hwaddr(const struct snap_link *link)
+{
+    return format_hwaddr_data(link->hwaddr, link->hwaddr_len);
+}
+
+/* Appends an address to a list, returns 0 on success */
+static int snap_addr_append(PyObject *list, const struct snap_addr *addr)
+{
+    PyObject *str = snap_addr_str(addr);
+    int err;
+
+    if (str == NULL)
+        return -1;
+    err = PyList_Append(list, str);
+    Py_DECREF(str);
+    return err;
+}
+
+/**
+ * Builds the dict of a link of a snapshot
+ *
+ * @return New reference to the dict, NULL with a Python exception set
+ */
+static PyObject *snap_link_dict(PyEthtoolSnapshot *snap, size_t i)
+{
+    const struct snap_link *link = &snap->links[i];
+    PyObject *dict, *ipv4, *ipv6, *hwaddr, *settings = NULL;
+    size_t j;
+
+    ipv4 = PyList_New(0);
+    ipv6 = PyList_New(0);
+    hwaddr = snap_hwaddr(link);
+    if (ipv4 == NULL || ipv6 == NULL || hwaddr == NULL)
+        goto err;
+    for (j = link->addr_first; j < link->addr_first + link->addr_count; j++) {
+        const struct snap_addr *addr = &snap->addrs[j];
+
+        if (snap_addr_append(addr->family == AF_INET ? ipv4 : ipv6,
+                             addr) < 0)
+            goto err;
+    }
+    if (snap->settings != NULL) {
+        /* Removed before its settings were read */
+        if (snap->settings[i].err[SETTINGS_DRIVER] == ENODEV) {
+            Py_INCREF(Py_None);
+            settings = Py_None;
+        } else {
+            settings = settings_dict(&snap->settings[i]);
+            if (settings == NULL)
+                goto err;
+        }
+    }
+
+    dict = Py_BuildValue("{s:s,s:I,s:I,s:O,s:O,s:O}",
+                         "name", link->name,
+                         "flags", link->flags,
+                         "mtu", link->mtu,
+                         "hwaddr", hwaddr,
+                         "ipv4_addresses", ipv4,
+                         "ipv6_addresses", ipv6);
+    if (dict != NULL && settings != NULL
+            && PyDict_SetItemString(dict, "settings", settings) < 0)
+        Py_CLEAR(dict);
+    Py_DECREF(ipv4);
+    Py_DECREF(ipv6);
+    Py_DECREF(hwaddr);
+    Py_XDECREF(settings);
+    return dict;
+
+err:
+    Py_XDECREF(ipv4);
+    Py_XDECREF(ipv6);
+    Py_XDECREF(hwaddr);
+    return NULL;
+}
+
+static Py_ssize_t snapshot_length(PyEthtoolSnapshot *self)
+{
+    return self->nlinks;
+}
+
+static PyObject *snapshot_subscript(PyEthtoolSnapshot *self, PyObject *key)
+{
+    Py_ssize_t i = snap_find(self, key);
+
+    if (i < 0) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    return snap_link_dict(self, i);
+}
+
+static int snapshot_contains(PyEthtoolSnapshot *self, PyObject *key)
+{
+    return snap_find(self, key) >= 0;
+}
+
+static PyObject *snapshot_keys(PyEthtoolSnapshot *self,
+                               PyObject *unused __unused)
+{
+    PyObject *list = PyList_New(self->nlinks);
+    size_t i;
+
+    for (i = 0; list != NULL && i < self->nlinks; i++) {
+        PyObject *ifindex = PyInt_FromLong(self->links[i].ifindex);
+
+        if (ifindex == NULL) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, i, ifindex);
+    }
+    return list;
+}
+
+static PyObject *snapshot_iter(PyEthtoolSnapshot *self)
+{
+    PyObject *keys = snapshot_keys(self, NULL), *iter;
+
+    if (keys == NULL)
+        return NULL;
+    iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iter;
+}
+
+static PyObject *snapshot_repr(PyEthtoolSnapshot *self)
+{
+    return PyStr_FromFormat("<ethtool.Snapshot of %zd interfaces%s>",
+                            (Py_ssize_t) self->nlinks,
+                            self->settings != NULL ? " with settings" : "");
+}
+
+static void snapshot_dealloc(PyEthtoolSnapshot *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+    free(self->links);
+    free(self->addrs);
+    free(self->settings);
+    type->tp_free((PyObject *)self);
+    ethtool_type_decref(type);
+}
+
+/**
+ * Takes a snapshot of the interfaces of a namespace: their names, flags,
+ * MTU, hardware and IP addresses, with a NETLINK dump of each
+ *
+ * @param settings  Whether to read the settings of get_all_settings() too
+ * @param netns     Keyword-only namespace of the interfaces
+ *
+ * @return New ethtool.Snapshot object, NULL with a Python exception set
+ */
+PyObject *snapshot(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "settings", "netns" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    PyObject *argv[2] = { NULL, NULL };
+    PyEthtoolSnapshot *snap = NULL;
+    struct sweep_ns dump = { .fd = -1 };
+    struct nl_connection *nlc;
+    struct ethtool_netns *ns;
+    int with_settings = 0, err;
+
+    /* netns is keyword-only */
+    if (fastcall_unpack("snapshot", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 0,
+                        FASTCALL_NARGS > 1 ? 1 : 2, argv) < 0)
+        return NULL;
+    if (argv[0] != NULL && (with_settings = PyObject_IsTrue(argv[0])) < 0)
+        return NULL;
+    if (ethtool_netns_get(state, argv[1], &ns) < 0)
+        return NULL;
+
+    nlc = connect_netlink(ns);
+    if (nlc == NULL) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Could not open a NETLINK connection");
+        goto out;
+    }
+    err = sweep_dump_nogil(nlc, AF_UNSPEC, 0, &dump);
+    disconnect_netlink(nlc);
+    if (err < 0) {
+        errno = -err;
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto out;
+    }
+
+    snap = (PyEthtoolSnapshot *)state->snapshot_type->tp_alloc(
+        state->snapshot_type, 0);
+    if (snap == NULL)
+        goto out;
+    if (snap_parse_links(snap, &dump.links) < 0
+            || snap_parse_addrs(snap, &dump.addrs) < 0) {
+        PyErr_NoMemory();
+        Py_CLEAR(snap);
+        goto out;
+    }
+    if (with_settings && snap_read_settings(snap, ns) < 0)
+        Py_CLEAR(snap);
+
+out:
+    sweep_ns_release(&dump);
+    ethtool_netns_put(state, ns);
+    return (PyObject *)snap;
+}
+
+/* Adds a change to the dict of the changes of a link, created first */
+static int snap_change(PyObject *changed, PyObject **change, int ifindex,
+                       const char *key, PyObject *value)
+{
+    int err;
+
+    if (value == NULL)
+        return -1;
+    if (*change == NULL) {
+        PyObject *index = PyInt_FromLong(ifindex);
+
+        *change = PyDict_New();
+        if (index == NULL || *change == NULL
+                || PyDict_SetItem(changed, index, *change) < 0) {
+            Py_XDECREF(index);
+            Py_DECREF(value);
+            return -1;
+        }
+        Py_DECREF(index);
+    }
+    err = PyDict_SetItemString(*change, key, value);
+    Py_DECREF(value);
+    return err;
+}
+
+/* Builds an (old, new) tuple of the hardware addresses of a link */
+static PyObject *snap_hwaddr_change(const struct snap_link *old,
+                                    const struct snap_link *new)
+{
+    PyObject *old_hwaddr = snap_hwaddr(old), *new_hwaddr = snap_hwaddr(new);
+    PyObject *ret = NULL;
+
+    if (old_hwaddr != NULL && new_hwaddr != NULL)
+        ret = PyTuple_Pack(2, old_hwaddr, new_hwaddr);
+    Py_XDECREF(old_hwaddr);
+    Py_XDECREF(new_hwaddr);
+    return ret;
+}
+
+/**
+ * Builds the dict of the addresses added to and removed from a link, both
+ * of them sorted
+ *
+ * @return New reference to the dict, to None if they are the same, NULL
+ *         with a Python exception set
+ */
+static PyObject *snap_addrs_change(const struct snap_addr *old, size_t nold,
+                                   const struct snap_addr *new, size_t nnew)
+{
+    PyObject *added = NULL, *removed = NULL, *ret = NULL;
+    size_t i = 0, j = 0;
+
+    while (i < nold || j < nnew) {
+        int cmp = i == nold ? 1 : j == nnew ? -1
+                  : snap_addr_cmp(&old[i], &new[j]);
+        PyObject **list = cmp < 0 ? &removed : &added;
+
+        if (cmp == 0) {
+            i++;
+            j++;
+            continue;
+        }
+        if (*list == NULL && (*list = PyList_New(0)) == NULL)
+            goto out;
+        if (snap_addr_append(*list, cmp < 0 ? &old[i++] : &new[j++]) < 0)
+            goto out;
+    }
+
+    if (added == NULL && removed == NULL) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    if (added == NULL)
+        added = PyList_New(0);
+    if (removed == NULL)
+        removed = PyList_New(0);
+    if (added != NULL && removed != NULL)
+        ret = Py_BuildValue("{s:O,s:O}", "added", added, "removed", removed);
+
+out:
+    Py_XDECREF(added);
+    Py_XDECREF(removed);
+    return ret;
+}
+
+/**
+ * Adds what differs between a link of two snapshots to changed
+ *
+ * @return Returns 0 on success, -1 with a Python exception set
+ */
+static int snap_diff_link(PyObject *changed, PyEthtoolSnapshot *a, size_t i,
+                          PyEthtoolSnapshot *b, size_t j)
+{
+    const struct snap_link *old = &a->links[i], *new = &b->links[j];
+    PyObject *change = NULL, *value;
+    int err = -1;
+
+    if (strcmp(old->name, new->name) != 0
+            && snap_change(changed, &change, old->ifindex, "name",
+                           Py_BuildValue("(ss)", old->name, new->name)) < 0)
+        goto out;
+    if (old->flags != new->flags
+            && snap_change(changed, &change, old->ifindex, "flags",
+                           Py_BuildValue("(II)", old->flags,
+                                         new->flags)) < 0)
+        goto out;
+    if (old->mtu != new->mtu
+            && snap_change(changed, &change, old->ifindex, "mtu",
+                           Py_BuildValue("(II)", old->mtu, new->mtu)) < 0)
+        goto out;
+    if ((old->hwaddr_len != new->hwaddr_len
+            || memcmp(old->hwaddr, new->hwaddr, old->hwaddr_len) != 0)
+            && snap_change(changed, &change, old->ifindex, "hwaddr",
+                           snap_hwaddr_change(old, new)) < 0)
+        goto out;
+
+    value = snap_addrs_change(&a->addrs[old->addr_first], old->addr_count,
+                              &b->addrs[new->addr_first], new->addr_count);
+    if (value == Py_None)
+        Py_DECREF(value);
+    else if (snap_change(changed, &change, old->ifindex, "addresses",
+                         value) < 0)
+        goto out;
+
+    if (a->settings != NULL && b->settings != NULL) {
+        value = settings_diff(&a->settings[i], &b->settings[j], ~0U);
+        if (value != NULL && PyDict_Size(value) == 0)
+            Py_DECREF(value);
+        else if (snap_change(changed, &change, old->ifindex, "settings",
+                             value) < 0)
+            goto out;
+    }
+    err = 0;
+
+out:
+    Py_XDECREF(change);
+    return err;
+}
+
+/* Adds a link of a snapshot to the dict of those added or removed */
+static int snap_add_name(PyObject *dict, const struct snap_link *link)
+{
+    PyObject *index = PyInt_FromLong(link->ifindex);
+    PyObject *name = PyStr_FromString(link->name);
+    int err = -1;
+
+    if (index != NULL && name != NULL)
+        err = PyDict_SetItem(dict, index, name);
+    Py_XDECREF(index);
+    Py_XDECREF(name);
+    return err;
+}
+
+/**
+ * Compares two snapshots, walking their interfaces side by side
+ *
+ * @param a  The older snapshot
+ * @param b  The newer one
+ *
+ * @return Python dict with the interfaces 'added' and 'removed', dicts
+ *         mapping their index to their name, and those 'changed', mapping
+ *         their index to a dict of (old, new) tuples of what changed:
+ *         'name', 'flags', 'mtu', 'hwaddr', 'addresses', a dict of those
+ *         'added' and 'removed', and 'settings', shaped as a result of
+ *         get_all_settings() if both snapshots have the settings
+ */
+PyObject *snapshot_diff(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "a", "b" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    PyObject *argv[2] = { NULL, NULL };
+    PyObject *ret, *added, *removed, *changed;
+    PyEthtoolSnapshot *a, *b;
+    size_t i = 0, j = 0;
+
+    if (fastcall_unpack("diff", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 2, 2, argv) < 0)
+        return NULL;
+    if (!PyObject_TypeCheck(argv[0], state->snapshot_type)
+            || !PyObject_TypeCheck(argv[1], state->snapshot_type)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "diff() compares ethtool.Snapshot objects");
+        return NULL;
+    }
+    a = (PyEthtoolSnapshot *)argv[0];
+    b = (PyEthtoolSnapshot *)argv[1];
+
+    ret = PyDict_New();
+    added = PyDict_New();
+    removed = PyDict_New();
+    changed = PyDict_New();
+    if (ret == NULL || added == NULL || removed == NULL || changed == NULL
+            || PyDict_SetItemString(ret, "added", added) < 0
+            || PyDict_SetItemString(ret, "removed", removed) < 0
+            || PyDict_SetItemString(ret, "changed", changed) < 0)
+        goto err;
+
+    while (i < a->nlinks || j < b->nlinks) {
+        int err;
+
+        if (j == b->nlinks || (i < a->nlinks
+                               && a->links[i].ifindex < b->links[j].ifindex))
+            err = snap_add_name(removed, &a->links[i++]);
+        else if (i == a->nlinks || a->links[i].ifindex > b->links[j].ifindex)
+            err = snap_add_name(added, &b->links[j++]);
+        else
+            err = snap_diff_link(changed, a, i++, b, j++);
+        if (err < 0)
+            goto err;
+    }
+
+    Py_DECREF(added);
+    Py_DECREF(removed);
+    Py_DECREF(changed);
+    return ret;
+
+err:
+    Py_XDECREF(ret);
+    Py_XDECREF(added);
+    Py_XDECREF(removed);
+    Py_XDECREF(changed);
+    return NULL;
+}
+
+/*
+ * The serialized form of a snapshot, for shipping it elsewhere.  Numbers are
+ * unsigned LEB128 varints unless said otherwise, strings a length byte then
+ * their bytes:
+ *
+ *   "ETSN", the version byte (SNAP_VERSION), a flags byte (SNAP_F_*)
+ *   the number of links, the number of addresses
+ *   for each link, by interface index:
+ *       its index, flags and MTU, its name and hardware address as strings,
+ *       its number of addresses, then for each of them a family byte (4 or
+ *       6), a prefix length byte and the 4 or 16 bytes of the address
+ *   with SNAP_F_SETTINGS, for each link and each request of
+ *   get_all_settings():
+ *       its errno, then if 0 the driver, version, fw_version and bus_info
+ *       strings of the driver request, or the number of 32 bit words of the
+ *       structure of any other request, then those words
+ */
+
+#define SNAP_MAGIC "ETSN"
+#define SNAP_VERSION 1
+#define SNAP_F_SETTINGS 0x01
+
+/* The largest varint, of 64 bits */
+#define SNAP_VARINT_MAX 10
+
+/* The structures of the requests of get_all_settings(), but the driver's */
+static const struct {
+    size_t offset;
+    size_t size;
+} snap_settings_data[SETTINGS_MAX] = {
+    [SETTINGS_RING] = { offsetof(struct dev_settings, ring),
+                        sizeof(struct ethtool_ringparam) },
+    [SETTINGS_COALESCE] = { offsetof(struct dev_settings, coal),
+                            sizeof(struct ethtool_coalesce) },
+    [SETTINGS_CHANNELS] = { offsetof(struct dev_settings, channels),
+                            sizeof(struct ethtool_channels) },
+    [SETTINGS_PAUSE] = { offsetof(struct dev_settings, pause),
+                         sizeof(struct ethtool_pauseparam) },
+    [SETTINGS_TSO] = { offsetof(struct dev_settings, features[0]),
+                       sizeof(struct ethtool_value) },
+    [SETTINGS_GSO] = { offsetof(struct dev_settings, features[1]),
+                       sizeof(struct ethtool_value) },
+    [SETTINGS_GRO] = { offsetof(struct dev_settings, features[2]),
+                       sizeof(struct ethtool_value) },
+    [SETTINGS_SG] = { offsetof(struct dev_settings, features[3]),
+                      sizeof(struct ethtool_value) },
+};
+
+/* The strings of the driver request */
+static const size_t snap_drvinfo_strings[] = {
+    offsetof(struct ethtool_drvinfo, driver),
+    offsetof(struct ethtool_drvinfo, version),
+    offsetof(struct ethtool_drvinfo, fw_version),
+    offsetof(struct ethtool_drvinfo, bus_info),
+};
+
+#define SNAP_DRVINFO_NSTRINGS \
+    (sizeof(snap_drvinfo_strings) / sizeof(snap_drvinfo_strings[0]))
+#define SNAP_DRVINFO_STRLEN 32
+
+/* The most a snapshot serializes to */
+static size_t snap_dumps_size(PyEthtoolSnapshot *snap)
+{
+    size_t link = 4 * SNAP_VARINT_MAX + 1 + IFNAMSIZ + 1 + SNAP_HWADDR_LEN;
+    size_t settings = 0;
+    int i;
+
+    if (snap->settings != NULL) {
+        for (i = 0; i < SETTINGS_MAX; i++)
+            settings += 2 * SNAP_VARINT_MAX
+                        + snap_settings_data[i].size / 4 * SNAP_VARINT_MAX;
+        settings += SNAP_DRVINFO_NSTRINGS
+                    * (1 + SNAP_DRVINFO_STRLEN);
+    }
+    return sizeof(SNAP_MAGIC) + 2 + 2 * SNAP_VARINT_MAX
+           + snap->nlinks * (link + settings) + snap->naddrs * (2 + 16);
+}
+
+static unsigned char *snap_put_varint(unsigned char *p, unsigned long long v)
+{
+    while (v >= 0x80) {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static unsigned char *snap_put_string(unsigned char *p, const char *s,
+                                      size_t max)
+{
+    size_t len = strnlen(s, max);
+
+    *p++ = len;
+    memcpy(p, s, len);
+    return p + len;
+}
+
+/**
+ * Serializes a snapshot into compact bytes, read back by loads()
+ *
+ * @param snapshot  The ethtool.Snapshot
+ *
+ * @return New bytes object, NULL with a Python exception set
+ */
+PyObject *snapshot_dumps(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "snapshot" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    PyObject *argv[1] = { NULL }, *ret;
+    PyEthtoolSnapshot *snap;
+    unsigned char *buf, *p;
+    size_t i, j;
+    int k;
+
+    if (fastcall_unpack("dumps", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 1, 1, argv) < 0)
+        return NULL;
+    if (!PyObject_TypeCheck(argv[0], state->snapshot_type)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "dumps() serializes ethtool.Snapshot objects");
+        return NULL;
+    }
+    snap = (PyEthtoolSnapshot *)argv[0];
+
+    buf = malloc(snap_dumps_size(snap));
+    if (buf == NULL)
+        return PyErr_NoMemory();
+
+    p = buf;
+    memcpy(p, SNAP_MAGIC, 4);
+    p += 4;
+    *p++ = SNAP_VERSION;
+    *p++ = snap->settings != NULL ? SNAP_F_SETTINGS : 0;
+    p = snap_put_varint(p, snap->nlinks);
+    /* Of the links only, for those created between the two dumps */
+    for (i = 0, j = 0; i < snap->nlinks; i++)
+        j += snap->links[i].addr_count;
+    p = snap_put_varint(p, j);
+
+    for (i = 0; i < snap->nlinks; i++) {
+        const struct snap_link *link = &snap->links[i];
+
+        p = snap_put_varint(p, link->ifindex);
+        p = snap_put_varint(p, link->flags);
+        p = snap_put_varint(p, link->mtu);
+        p = snap_put_string(p, link->name, IFNAMSIZ);
+        *p++ = link->hwaddr_len;
+        memcpy(p, link->hwaddr, link->hwaddr_len);
+        p += link->hwaddr_len;
+        p = snap_put_varint(p, link->addr_count);
+        for (j = link->addr_first; j < link->addr_first + link->addr_count;
+                j++) {
+            const struct snap_addr *addr = &snap->addrs[j];
+            size_t size = addr->family == AF_INET ? 4 : 16;
+
+            *p++ = size == 4 ? 4 : 6;
+            *p++ = addr->prefixlen;
+            memcpy(p, addr->addr, size);
+            p += size;
+        }
+    }
+
+    for (i = 0; snap->settings != NULL && i < snap->nlinks; i++) {
+        const struct dev_settings *settings = &snap->settings[i];
+
+        for (k = 0; k < SETTINGS_MAX; k++) {
+            const u32 *words = (const u32 *)((const char *)settings
+                                             + snap_settings_data[k].offset);
+            size_t n = snap_settings_data[k].size / 4;
+
+            p = snap_put_varint(p, settings->err[k]);
+            if (settings->err[k] != 0)
+                continue;
+            if (k == SETTINGS_DRIVER) {
+                for (j = 0; j < SNAP_DRVINFO_NSTRINGS; j++)
+                    p = snap_put_string(
+                        p, (const char *)&settings->drvinfo
+                        + snap_drvinfo_strings[j], SNAP_DRVINFO_STRLEN);
+                continue;
+            }
+            p = snap_put_varint(p, n);
+            for (j = 0; j < n; j++)
+                p = snap_put_varint(p, words[j]);
+        }
+    }
+
+    ret = PyBytes_FromStringAndSize((char *)buf, p - buf);
+    free(buf);
+    return ret;
+}
+
+/** Reads serialized snapshot data, unless past its end */
+struct snap_reader {
+    const unsigned char *p;
+    const unsigned char *end;
+    int bad;  /**< Set once the data turns out to be truncated or invalid */
+};
+
+static unsigned long long snap_get_varint(struct snap_reader *r,
+                                          unsigned long long max)
+{
+    unsigned long long v = 0;
+    int shift;
+
+    for (shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        unsigned char byte = *r->p++;
+
+        v |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            if (v > max)
+                break;
+            return v;
+        }
+    }
+    r->bad = 1;
+    return 0;
+}
+
+static unsigned char snap_get_byte(struct snap_reader *r)
+{
+    if (r->p >= r->end) {
+        r->bad = 1;
+        return 0;
+    }
+    return *r->p++;
+}
+
+/* Copies len bytes into buf, of size bytes */
+static void snap_get_bytes(struct snap_reader *r, void *buf, size_t len,
+                           size_t size)
+{
+    if (len > size || len > (size_t)(r->end - r->p)) {
+        r->bad = 1;
+        return;
+    }
+    memcpy(buf, r->p, len);
+    r->p += len;
+}
+
+/* Reads a string into buf, of size bytes, leaving it NUL terminated */
+static void snap_get_string(struct snap_reader *r, char *buf, size_t size)
+{
+    snap_get_bytes(r, buf, snap_get_byte(r), size - 1);
+}
+
+/* Reads the links and addresses of a snapshot, returns 0 on success */
+static int snap_loads_links(PyEthtoolSnapshot *snap, struct snap_reader *r)
+{
+    /* The least a link or an address takes, to not trust the counts */
+    size_t nlinks = snap_get_varint(r, (r->end - r->p) / 6);
+    size_t naddrs = snap_get_varint(r, (r->end - r->p) / 6);
+    size_t i, j;
+
+    if (r->bad)
+        return 0;
+    snap->links = calloc(nlinks + 1, sizeof(*snap->links));
+    snap->addrs = calloc(naddrs + 1, sizeof(*snap->addrs));
+    if (snap->links == NULL || snap->addrs == NULL)
+        return -1;
+
+    for (i = 0; i < nlinks && !r->bad; i++) {
+        struct snap_link *link = &snap->links[i];
+
+        link->ifindex = snap_get_varint(r, INT_MAX);
+        link->flags = snap_get_varint(r, UINT32_MAX);
+        link->mtu = snap_get_varint(r, UINT32_MAX);
+        snap_get_string(r, link->name, IFNAMSIZ);
+        link->hwaddr_len = snap_get_byte(r);
+        snap_get_bytes(r, link->hwaddr, link->hwaddr_len, SNAP_HWADDR_LEN);
+        link->addr_first = snap->naddrs;
+        link->addr_count = snap_get_varint(r, naddrs - snap->naddrs);
+        if (i > 0 && link->ifindex <= link[-1].ifindex)
+            r->bad = 1;
+
+        for (j = 0; j < link->addr_count && !r->bad; j++) {
+            struct snap_addr *addr = &snap->addrs[snap->naddrs++];
+            unsigned char family = snap_get_byte(r);
+
+            addr->ifindex = link->ifindex;
+            addr->family = family == 4 ? AF_INET : AF_INET6;
+            addr->prefixlen = snap_get_byte(r);
+            if (family != 4 && family != 6)
+                r->bad = 1;
+            snap_get_bytes(r, addr->addr, family == 4 ? 4 : 16,
+                           sizeof(addr->addr));
+            if (j > 0 && snap_addr_cmp(&addr[-1], addr) > 0)
+                r->bad = 1;
+        }
+        snap->nlinks++;
+    }
+    if (snap->naddrs != naddrs)
+        r->bad = 1;
+    return 0;
+}
+
+/* Reads the settings of the links of a snapshot, returns 0 on success */
+static int snap_loads_settings(PyEthtoolSnapshot *snap, struct snap_reader *r)
+{
+    size_t i, j;
+    int k;
+
+    snap->settings = calloc(snap->nlinks + 1, sizeof(*snap->settings));
+    if (snap->settings == NULL)
+        return -1;
+
+    for (i = 0; i < snap->nlinks && !r->bad; i++) {
+        struct dev_settings *settings = &snap->settings[i];
+
+        memcpy(settings->name, snap->links[i].name, IFNAMSIZ);
+        for (k = 0; k < SETTINGS_MAX && !r->bad; k++) {
+            u32 *words = (u32 *)((char *)settings
+                                 + snap_settings_data[k].offset);
+            size_t n;
+
+            settings->err[k] = snap_get_varint(r, INT_MAX);
+            if (settings->err[k] != 0)
+                continue;
+            if (k == SETTINGS_DRIVER) {
+                for (j = 0; j < SNAP_DRVINFO_NSTRINGS; j++)
+                    snap_get_string(r, (char *)&settings->drvinfo
+                                    + snap_drvinfo_strings[j],
+                                    SNAP_DRVINFO_STRLEN);
+                continue;
+            }
+            /* Of another version of the structure, the words both have */
+            n = snap_get_varint(r, r->end - r->p);
+            for (j = 0; j < n && !r->bad; j++) {
+                u32 word = snap_get_varint(r, UINT32_MAX);
+
+                if (j < snap_settings_data[k].size / 4)
+                    words[j] = word;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Reads back a snapshot serialized by dumps()
+ *
+ * @param data  Bytes-like object of the serialized snapshot
+ *
+ * @return New ethtool.Snapshot object, NULL with a Python exception set
+ */
+PyObject *snapshot_loads(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "data" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    PyObject *argv[1] = { NULL };
+    PyEthtoolSnapshot *snap;
+    struct snap_reader r;
+    unsigned char version, flags;
+    Py_buffer view;
+    int err;
+
+    if (fastcall_unpack("loads", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 1, 1, argv) < 0)
+        return NULL;
+    if (PyObject_GetBuffer(argv[0], &view, PyBUF_SIMPLE) < 0)
+        return NULL;
+
+    r.p = view.buf;
+    r.end = r.p + view.len;
+    r.bad = 0;
+    if (view.len < 6 || memcmp(r.p, SNAP_MAGIC, 4) != 0) {
+        PyErr_SetString(PyExc_ValueError, "not a serialized ethtool.Snapshot");
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    version = r.p[4];
+    flags = r.p[5];
+    r.p += 6;
+    if (version != SNAP_VERSION) {
+        PyErr_Format(PyExc_ValueError,
+                     "unsupported ethtool.Snapshot version %d", version);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    snap = (PyEthtoolSnapshot *)state->snapshot_type->tp_alloc(
+        state->snapshot_type, 0);
+    if (snap == NULL) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    err = snap_loads_links(snap, &r);
+    if (err == 0 && !r.bad && (flags & SNAP_F_SETTINGS))
+        err = snap_loads_settings(snap, &r);
+    if (r.p != r.end)
+        r.bad = 1;
+    PyBuffer_Release(&view);
+
+    if (err < 0) {
+        PyErr_NoMemory();
+        Py_CLEAR(snap);
+    } else if (r.bad) {
+        PyErr_SetString(PyExc_ValueError,
+                        "truncated or invalid ethtool.Snapshot data");
+        Py_CLEAR(snap);
+    }
+    return (PyObject *)snap;
+}
+
+static PyMethodDef snapshot_methods[] = {
+    {"keys", (PyCFunction)snapshot_keys, METH_NOARGS,
+     "Returns the interface indexes of the snapshot, in order"},
+    {NULL}
+};
+
+static const char snapshot_doc[] =
+    "Interfaces of a network namespace at a point in time, as taken by "
+    "ethtool.snapshot(): a mapping of their interface index to a dict of "
+    "their name, flags, MTU, hardware address, IPv4 and IPv6 addresses and, "
+    "if read, settings.  Snapshots are compared with ethtool.diff().";
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+static PyType_Slot snapshot_slots[] = {
+    {Py_tp_dealloc, snapshot_dealloc},
+    {Py_tp_repr, snapshot_repr},
+    {Py_tp_iter, snapshot_iter},
+    {Py_tp_methods, snapshot_methods},
+    {Py_tp_doc, (void *)snapshot_doc},
+    {Py_mp_length, snapshot_length},
+    {Py_mp_subscript, snapshot_subscript},
+    {Py_sq_contains, snapshot_contains},
+    {0, NULL}
+};
+
+PyType_Spec PyEthtoolSnapshot_Spec = {
+    .name = "ethtool.Snapshot",
+    .basicsize = sizeof(PyEthtoolSnapshot),
+    .flags = Py_TPFLAGS_DEFAULT | ETHTOOL_TPFLAGS_IMMUTABLE,
+    .slots = snapshot_slots,
+};
+#else
+static PyMappingMethods snapshot_as_mapping = {
+    .mp_length = (lenfunc)snapshot_length,
+    .mp_subscript = (binaryfunc)snapshot_subscript,
+};
+
+static PySequenceMethods snapshot_as_sequence = {
+    .sq_contains = (objobjproc)snapshot_contains,
+};
+
+PyTypeObject PyEthtoolSnapshot_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ethtool.Snapshot",
+    .tp_basicsize = sizeof(PyEthtoolSnapshot),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)snapshot_dealloc,
+    .tp_repr = (reprfunc)snapshot_repr,
+    .tp_as_mapping = &snapshot_as_mapping,
+    .tp_as_sequence = &snapshot_as_sequence,
+    .tp_iter = (getiterfunc)snapshot_iter,
+    .tp_methods = snapshot_methods,
+    .tp_doc = snapshot_doc,
+};
+#endif
@@ -0,0 +1,33 @@
+/*
+ * snapshot.h - Snapshots of the interfaces of a namespace, and their diff
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <Python.h>
+
+#include "fastcall.h"
+#include "modstate.h"
+
+#ifdef ETHTOOL_MULTI_PHASE_INIT
+extern PyType_Spec PyEthtoolSnapshot_Spec;
+#else
+extern PyTypeObject PyEthtoolSnapshot_Type;
+#endif
+
+PyObject *snapshot(PyObject *self, FASTCALL_PARAMS);
+PyObject *snapshot_diff(PyObject *self, FASTCALL_PARAMS);
+PyObject *snapshot_dumps(PyObject *self, FASTCALL_PARAMS);
+PyObject *snapshot_loads(PyObject *self, FASTCALL_PARAMS);
+
+#endif
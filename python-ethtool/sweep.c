@@ -0,0 +1,667 @@
+/* sweep.c - Queries of many network namespaces in parallel
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <Python.h>
+#include "include/py3c/compat.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/if.h>
+
+#include "etherinfo_struct.h"
+#include "etherinfo.h"
+#include "netns.h"
+#include "perfcounters.h"
+#include "rtnetlink.h"
+#include "sweep.h"
+
+/*
+ * sweep_namespaces() hands the namespaces out to a pool of worker threads
+ * which enter them one after the other with setns(), open a NETLINK socket
+ * there and dump the links and addresses.  The workers neither hold the GIL
+ * nor call into Python: they keep copies of the messages, which the calling
+ * thread turns into the results once they are done.
+ */
+
+static const char *const sweep_names[SWEEP_MAX] = {
+    [SWEEP_DEVICES] = "devices",
+    [SWEEP_FLAGS] = "flags",
+    [SWEEP_MTU] = "mtu",
+    [SWEEP_HWADDR] = "hwaddr",
+    [SWEEP_IPV4] = "ipv4_addresses",
+    [SWEEP_IPV6] = "ipv6_addresses",
+};
+
+/** A sweep, shared by the workers */
+struct sweep {
+    struct sweep_ns *ns;
+    size_t len;
+    size_t next;  /**< Next namespace to query, taken atomically */
+    int addr_family;  /**< Addresses to dump, -1 for none */
+};
+
+/** A worker thread and the counters of its NETLINK requests */
+struct sweep_worker {
+    struct sweep *sweep;
+    pthread_t thread;
+    struct perf_counters counters;
+};
+
+/* rtnetlink_query() handler keeping a copy of every message */
+static void sweep_msg(struct nlmsghdr *nlh, void *arg)
+{
+    struct sweep_buf *buf = arg;
+    size_t len;
+
+    /* The dump is read again, start over */
+    if (nlh == NULL) {
+        buf->len = 0;
+        return;
+    }
+    len = NLMSG_ALIGN(nlh->nlmsg_len);
+    if (buf->len + len > buf->size) {
+        size_t size = buf->size ? buf->size : 4096;
+        unsigned char *data;
+
+        while (size < buf->len + len) {
+            size *= 2;
+        }
+        data = realloc(buf->data, size);
+        if (data == NULL) {
+            buf->nomem = 1;
+            return;
+        }
+        buf->data = data;
+        buf->size = size;
+    }
+    memcpy(buf->data + buf->len, nlh, nlh->nlmsg_len);
+    buf->len += len;
+}
+
+/**
+ * Dumps the links and, if addr_family is not -1, the addresses of the
+ * namespace a NETLINK connection was opened in.  Makes no Python calls.
+ *
+ * @param nlc          The connection, flagged nogil
+ * @param addr_family  Addresses to dump, see sweep_addr_family()
+ * @param stats        Whether the links come with their statistics
+ * @param ns           Where to keep the messages
+ *
+ * @return Returns 0 on success, otherwise a negative errno
+ */
+int sweep_dump(struct nl_connection *nlc, int addr_family, int stats,
+               struct sweep_ns *ns)
+{
+    struct rtnetlink_request req;
+    int err;
+
+    rtnetlink_request_init(&req, RTM_GETLINK, NLM_F_DUMP, sizeof(req.u.ifi));
+    req.u.ifi.ifi_family = AF_UNSPEC;
+#ifdef RTEXT_FILTER_SKIP_STATS
+    if (!stats) {
+        /* The statistics make up most of the message */
+        __u32 mask = RTEXT_FILTER_SKIP_STATS;
+
+        rtnetlink_request_attr(&req, IFLA_EXT_MASK, &mask, sizeof(mask));
+    }
+#endif
+    err = rtnetlink_query(nlc, &req, sweep_msg, &ns->links);
+
+    if (err == 0 && addr_family >= 0) {
+        rtnetlink_request_init(&req, RTM_GETADDR, NLM_F_DUMP,
+                               sizeof(req.u.ifa));
+        req.u.ifa.ifa_family = addr_family;
+        err = rtnetlink_query(nlc, &req, sweep_msg, &ns->addrs);
+    }
+    if (err == 0 && (ns->links.nomem || ns->addrs.nomem)) {
+        err = -ENOMEM;
+    }
+    return err;
+}
+
+/* Adds the NETLINK requests counted privately to those of the call */
+static void sweep_count_requests(const struct perf_counters *c)
+{
+    perf_count(netlink_opens, c->netlink_opens);
+    perf_count(netlink_dumps, c->netlink_dumps);
+    perf_count(netlink_msgs, c->netlink_msgs);
+    perf_count(netlink_bytes, c->netlink_bytes);
+    perf_count(netlink_retries, c->netlink_retries);
+}
+
+/**
+ * Does sweep_dump() on the calling thread with the GIL released.  Other
+ * threads may bump the counters of the call meanwhile, so the requests are
+ * counted privately and added once the GIL is held again.
+ *
+ * @return Returns 0 on success, otherwise a negative errno
+ */
+int sweep_dump_nogil(struct nl_connection *nlc, int addr_family, int stats,
+                     struct sweep_ns *ns)
+{
+    struct perf_counters counters, *outer = perf_current;
+    int err;
+
+    memset(&counters, 0, sizeof(counters));
+    nlc->nogil = 1;
+    Py_BEGIN_ALLOW_THREADS
+    perf_current = &counters;
+    err = sweep_dump(nlc, addr_family, stats, ns);
+    perf_current = outer;
+    Py_END_ALLOW_THREADS
+    sweep_count_requests(&counters);
+    return err;
+}
+
+/* Dumps the links and addresses of the namespace the worker is in */
+static int sweep_query(struct sweep *sweep, struct sweep_ns *ns)
+{
+    struct nl_connection *nlc;
+    int err;
+
+    nlc = connect_netlink(NULL);
+    if (nlc == NULL) {
+        return -ENOMEM;
+    }
+    nlc->nogil = 1;
+    err = sweep_dump(nlc, sweep->addr_family, 0, ns);
+    disconnect_netlink(nlc);
+    return err;
+}
+
+static void *sweep_worker(void *arg)
+{
+    struct sweep_worker *worker = arg;
+    struct sweep *sweep = worker->sweep;
+    size_t i;
+
+    perf_current = &worker->counters;
+    while ((i = __atomic_fetch_add(&sweep->next, 1, __ATOMIC_RELAXED))
+           < sweep->len) {
+        struct sweep_ns *ns = &sweep->ns[i];
+
+        if (ns->fd < 0) {
+            continue;
+        }
+        if (setns(ns->fd, CLONE_NEWNET) < 0) {
+            ns->err = errno;
+            continue;
+        }
+        ns->err = -sweep_query(sweep, ns);
+    }
+    return NULL;
+}
+
+/**
+ * Runs the sweep on up to nworkers threads, without the GIL
+ *
+ * @return Returns 0 on success, otherwise an errno: no thread could be
+ *         started
+ */
+static int sweep_run(struct sweep *sweep, struct sweep_worker *workers,
+                     int nworkers)
+{
+    int i, started = 0, err = 0;
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < nworkers; i++) {
+        workers[i].sweep = sweep;
+        err = pthread_create(&workers[i].thread, NULL, sweep_worker,
+                             &workers[i]);
+        if (err != 0) {
+            break;
+        }
+        started++;
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    Py_END_ALLOW_THREADS
+
+    return started > 0 ? 0 : err;
+}
+
+/**
+ * Gives the address family to dump for what was asked for
+ *
+ * @return Returns AF_INET, AF_INET6, AF_UNSPEC for both or -1 for none
+ */
+int sweep_addr_family(int mask)
+{
+    if (mask & (1 << SWEEP_IPV4)) {
+        return (mask & (1 << SWEEP_IPV6)) ? AF_UNSPEC : AF_INET;
+    }
+    if (mask & (1 << SWEEP_IPV6)) {
+        return AF_INET6;
+    }
+    return -1;
+}
+
+/* Adds the counters of the workers to those of the call */
+static void sweep_count(struct sweep_worker *workers, int nworkers)
+{
+    int i;
+
+    for (i = 0; i < nworkers; i++) {
+        sweep_count_requests(&workers[i].counters);
+    }
+}
+
+/**
+ * Parses the what argument of sweep_namespaces()
+ *
+ * @return Returns a bit per SWEEP_* asked for, otherwise -1 with a Python
+ *         exception set.
+ */
+int sweep_parse_what(PyObject *what)
+{
+    PyObject *seq;
+    Py_ssize_t i;
+    int mask = 0;
+
+    if (what == NULL || what == Py_None) {
+        return (1 << SWEEP_MAX) - 1;
+    }
+    if (PyStr_Check(what)) {
+        seq = PyTuple_Pack(1, what);
+    } else {
+        seq = PySequence_Fast(what, "what must be a string or a sequence "
+                              "of strings");
+    }
+    if (seq == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        const char *name = PyStr_Check(item) ? PyStr_AsString(item) : NULL;
+        int j;
+
+        for (j = 0; name != NULL && j < SWEEP_MAX; j++) {
+            if (strcmp(name, sweep_names[j]) == 0) {
+                break;
+            }
+        }
+        if (name == NULL || j == SWEEP_MAX) {
+            PyErr_Format(PyExc_ValueError,
+                         "what must name devices, flags, mtu, hwaddr, "
+                         "ipv4_addresses or ipv6_addresses, not %.50R",
+                         item);
+            Py_DECREF(seq);
+            return -1;
+        }
+        mask |= 1 << j;
+    }
+    Py_DECREF(seq);
+    return mask;
+}
+
+/* Creates result[name] = value, stealing the reference to value */
+static int sweep_set(PyObject *result, int what, PyObject *value)
+{
+    int err;
+
+    if (value == NULL) {
+        return -1;
+    }
+    err = PyDict_SetItemString(result, sweep_names[what], value);
+    Py_DECREF(value);
+    return err;
+}
+
+/* Adds the device of an RTM_NEWLINK message to the result */
+static int sweep_link(PyObject *result, PyObject *names, int mask,
+                      struct nlmsghdr *nlh)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    struct rtattr *tb[IFLA_MAX + 1];
+    PyObject *name, *index, *value;
+    int err = -1;
+
+    if (nlh->nlmsg_type != RTM_NEWLINK
+            || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi))) {
+        return 0;
+    }
+    rtnetlink_parse_attrs(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+    if (tb[IFLA_IFNAME] == NULL) {
+        return 0;
+    }
+
+    name = PyStr_FromStringAndSize(RTA_DATA(tb[IFLA_IFNAME]),
+                                   strnlen(RTA_DATA(tb[IFLA_IFNAME]),
+                                           RTA_PAYLOAD(tb[IFLA_IFNAME])));
+    index = PyInt_FromLong(ifi->ifi_index);
+    if (name == NULL || index == NULL
+            || PyDict_SetItem(names, index, name) < 0) {
+        goto out;
+    }
+
+    if (mask & (1 << SWEEP_DEVICES)) {
+        if (PyList_Append(PyDict_GetItemString(result, "devices"), name) < 0)
+            goto out;
+    }
+    if (mask & (1 << SWEEP_FLAGS)) {
+        value = PyInt_FromLong(ifi->ifi_flags);
+        if (value == NULL
+                || PyDict_SetItem(PyDict_GetItemString(result, "flags"),
+                                  name, value) < 0) {
+            Py_XDECREF(value);
+            goto out;
+        }
+        Py_DECREF(value);
+    }
+    if (mask & (1 << SWEEP_MTU)) {
+        value = PyInt_FromLong(tb[IFLA_MTU] ? *(__u32 *) RTA_DATA(tb[IFLA_MTU])
+                               : 0);
+        if (value == NULL
+                || PyDict_SetItem(PyDict_GetItemString(result, "mtu"),
+                                  name, value) < 0) {
+            Py_XDECREF(value);
+            goto out;
+        }
+        Py_DECREF(value);
+    }
+    if (mask & (1 << SWEEP_HWADDR)) {
+        value = format_hwaddr(tb[IFLA_ADDRESS]);
+        if (value == NULL
+                || PyDict_SetItem(PyDict_GetItemString(result, "hwaddr"),
+                                  name, value) < 0) {
+            Py_XDECREF(value);
+            goto out;
+        }
+        Py_DECREF(value);
+    }
+    /* Devices without addresses get an empty list */
+    if (mask & (1 << SWEEP_IPV4)) {
+        value = PyList_New(0);
+        if (value == NULL
+                || PyDict_SetItem(PyDict_GetItemString(result,
+                                                       "ipv4_addresses"),
+                                  name, value) < 0) {
+            Py_XDECREF(value);
+            goto out;
+        }
+        Py_DECREF(value);
+    }
+    if (mask & (1 << SWEEP_IPV6)) {
+        value = PyList_New(0);
+        if (value == NULL
+                || PyDict_SetItem(PyDict_GetItemString(result,
+                                                       "ipv6_addresses"),
+                                  name, value) < 0) {
+            Py_XDECREF(value);
+            goto out;
+        }
+        Py_DECREF(value);
+    }
+    err = 0;
+
+out:
+    Py_XDECREF(name);
+    Py_XDECREF(index);
+    return err;
+}
+
+/* Adds the address of an RTM_NEWADDR message to the result */
+static int sweep_address(struct ethtool_state *state, PyObject *result,
+                         PyObject *names, int mask, struct nlmsghdr *nlh)
+{
+    struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+    struct rtattr *tb[IFA_BROADCAST + 1];
+    PyObject *index, *name, *list, *addr;
+    const char *key;
+    int err;
+
+    if (nlh->nlmsg_type != RTM_NEWADDR
+            || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa))) {
+        return 0;
+    }
+    if (ifa->ifa_family == AF_INET && (mask & (1 << SWEEP_IPV4))) {
+        key = sweep_names[SWEEP_IPV4];
+    } else if (ifa->ifa_family == AF_INET6 && (mask & (1 << SWEEP_IPV6))) {
+        key = sweep_names[SWEEP_IPV6];
+    } else {
+        return 0;
+    }
+
+    index = PyInt_FromLong(ifa->ifa_index);
+    if (index == NULL) {
+        return -1;
+    }
+    name = PyDict_GetItem(names, index);
+    Py_DECREF(index);
+    /* A device created between the two dumps */
+    if (name == NULL) {
+        return 0;
+    }
+    list = PyDict_GetItem(PyDict_GetItemString(result, key), name);
+
+    rtnetlink_parse_attrs(tb, IFA_BROADCAST, IFA_RTA(ifa), IFA_PAYLOAD(nlh));
+    addr = make_python_address_from_ifaddrmsg(state, ifa, tb);
+    if (addr == NULL) {
+        return -1;
+    }
+    err = PyList_Append(list, addr);
+    Py_DECREF(addr);
+    return err;
+}
+
+/**
+ * Turns the messages of a namespace into its result
+ *
+ * @return Returns a new reference to a dict with an entry per what asked
+ *         for, an OSError instance if the namespace could not be queried,
+ *         otherwise NULL with a Python exception set.
+ */
+PyObject *sweep_result(struct ethtool_state *state, int mask,
+                       struct sweep_ns *ns)
+{
+    PyObject *result, *names;
+    struct nlmsghdr *nlh;
+    size_t len;
+    int i;
+
+    if (ns->err != 0) {
+        return PyObject_CallFunction(PyExc_OSError, "is", ns->err,
+                                     strerror(ns->err));
+    }
+
+    result = PyDict_New();
+    names = PyDict_New();  /* Interface index to name */
+    if (result == NULL || names == NULL) {
+        goto err;
+    }
+    for (i = 0; i < SWEEP_MAX; i++) {
+        if (!(mask & (1 << i))) {
+            continue;
+        }
+        if (sweep_set(result, i, i == SWEEP_DEVICES ? PyList_New(0)
+                      : PyDict_New()) < 0) {
+            goto err;
+        }
+    }
+
+    len = ns->links.len;
+    for (nlh = (struct nlmsghdr *) ns->links.data; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+        if (sweep_link(result, names, mask, nlh) < 0) {
+            goto err;
+        }
+    }
+    len = ns->addrs.len;
+    for (nlh = (struct nlmsghdr *) ns->addrs.data; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+        if (sweep_address(state, result, names, mask, nlh) < 0) {
+            goto err;
+        }
+    }
+
+    Py_DECREF(names);
+    return result;
+
+err:
+    Py_XDECREF(result);
+    Py_XDECREF(names);
+    return NULL;
+}
+
+/* Frees the messages kept for a namespace */
+void sweep_ns_release(struct sweep_ns *ns)
+{
+    free(ns->links.data);
+    free(ns->addrs.data);
+    memset(&ns->links, 0, sizeof(ns->links));
+    memset(&ns->addrs, 0, sizeof(ns->addrs));
+}
+
+/**
+ * Opens the namespaces of a sweep
+ *
+ * @param paths   Sequence of the netns arguments
+ * @param ns      Set up for each of them
+ * @param errors  Set to the OSError raised opening a namespace, NULL for
+ *                those which were opened
+ *
+ * @return Returns 0 on success, otherwise -1 with a Python exception set.
+ */
+static int sweep_open(PyObject *paths, struct sweep_ns *ns, PyObject **errors)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < PySequence_Fast_GET_SIZE(paths); i++) {
+        PyObject *type, *value, *tb;
+
+        ns[i].fd = ethtool_netns_open(PySequence_Fast_GET_ITEM(paths, i));
+        if (ns[i].fd >= 0) {
+            continue;
+        }
+        /* A namespace which is gone is reported in its result */
+        if (!PyErr_ExceptionMatches(PyExc_OSError)) {
+            return -1;
+        }
+        PyErr_Fetch(&type, &value, &tb);
+        PyErr_NormalizeException(&type, &value, &tb);
+        Py_XDECREF(type);
+        Py_XDECREF(tb);
+        errors[i] = value;
+    }
+    return 0;
+}
+
+/**
+ * Queries many network namespaces in parallel
+ *
+ * @param paths    Sequence of namespaces, as for the netns arguments
+ * @param what     Name or sequence of names of what to get: devices,
+ *                 flags, mtu, hwaddr, ipv4_addresses, ipv6_addresses; all
+ *                 of them by default
+ * @param workers  Number of threads, the number of CPUs by default
+ *
+ * @return Python dict mapping each namespace of paths to a dict mapping
+ *         each name in what to the list of devices or a dict mapping the
+ *         device names to their value, or to the OSError the namespace
+ *         failed with
+ */
+PyObject *sweep_namespaces(PyObject *self, FASTCALL_PARAMS)
+{
+    static const char *const names[] = { "paths", "what", "workers" };
+    struct ethtool_state *state = ethtool_get_state(self);
+    PyObject *argv[3] = { NULL, NULL, NULL };
+    PyObject *paths, *ret = NULL, **errors = NULL;
+    struct sweep sweep = { 0 };
+    struct sweep_worker *workers = NULL;
+    long nworkers;
+    int mask, err;
+    size_t i;
+
+    if (fastcall_unpack("sweep_namespaces", FASTCALL_ARGS, FASTCALL_NARGS,
+                        FASTCALL_KWNAMES, names, 1, 3, argv) < 0)
+        return NULL;
+    mask = sweep_parse_what(argv[1]);
+    if (mask < 0)
+        return NULL;
+    if (argv[2] == NULL || argv[2] == Py_None) {
+        nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    } else {
+        nworkers = PyInt_AsLong(argv[2]);
+        if (nworkers == -1 && PyErr_Occurred())
+            return NULL;
+        if (nworkers <= 0) {
+            PyErr_SetString(PyExc_ValueError, "workers must be positive");
+            return NULL;
+        }
+    }
+
+    sweep.addr_family = sweep_addr_family(mask);
+
+    paths = PySequence_Fast(argv[0], "paths must be a sequence");
+    if (paths == NULL)
+        return NULL;
+    sweep.len = PySequence_Fast_GET_SIZE(paths);
+    if (nworkers > (long) sweep.len)
+        nworkers = sweep.len;
+    sweep.ns = calloc(sweep.len + 1, sizeof(*sweep.ns));
+    errors = calloc(sweep.len + 1, sizeof(*errors));
+    workers = calloc(nworkers + 1, sizeof(*workers));
+    if (sweep.ns == NULL || errors == NULL || workers == NULL) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    for (i = 0; i < sweep.len; i++)
+        sweep.ns[i].fd = -1;
+
+    if (sweep_open(paths, sweep.ns, errors) < 0)
+        goto out;
+    if (nworkers > 0) {
+        err = sweep_run(&sweep, workers, nworkers);
+        if (err != 0) {
+            errno = err;
+            PyErr_SetFromErrno(PyExc_OSError);
+            goto out;
+        }
+        sweep_count(workers, nworkers);
+    }
+
+    ret = PyDict_New();
+    for (i = 0; ret != NULL && i < sweep.len; i++) {
+        PyObject *result = errors[i];
+
+        if (result != NULL)
+            Py_INCREF(result);
+        else
+            result = sweep_result(state, mask, &sweep.ns[i]);
+        if (result == NULL
+                || PyDict_SetItem(ret, PySequence_Fast_GET_ITEM(paths, i),
+                                  result) < 0) {
+            Py_CLEAR(ret);
+        }
+        Py_XDECREF(result);
+    }
+
+out:
+    for (i = 0; sweep.ns != NULL && i < sweep.len; i++) {
+        if (sweep.ns[i].fd >= 0)
+            close(sweep.ns[i].fd);
+        sweep_ns_release(&sweep.ns[i]);
+        Py_XDECREF(errors[i]);
+    }
+    free(sweep.ns);
+    free(errors);
+    free(workers);
+    Py_DECREF(paths);
+    return ret;
+}
@@ -0,0 +1,62 @@
+/*
+ * sweep.h - Queries of many network namespaces in parallel
+ *
+ * This application is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef _SWEEP_H
+#define _SWEEP_H
+
+#include <Python.h>
+#include <stddef.h>
+
+#include "fastcall.h"
+#include "modstate.h"
+
+/* What can be asked for, one bit each */
+enum {
+    SWEEP_DEVICES,
+    SWEEP_FLAGS,
+    SWEEP_MTU,
+    SWEEP_HWADDR,
+    SWEEP_IPV4,
+    SWEEP_IPV6,
+    SWEEP_MAX
+};
+
+/** Messages of a dump, one after the other */
+struct sweep_buf {
+    unsigned char *data;
+    size_t len;
+    size_t size;
+    int nomem;  /**< A message did not fit and could not be added */
+};
+
+/** A namespace of the sweep */
+struct sweep_ns {
+    int fd;  /**< The namespace, -1 if it could not be opened */
+    int err;  /**< errno of the failed query, 0 on success */
+    struct sweep_buf links;  /**< RTM_NEWLINK messages */
+    struct sweep_buf addrs;  /**< RTM_NEWADDR messages */
+};
+
+int sweep_parse_what(PyObject *what);
+int sweep_addr_family(int mask);
+int sweep_dump(struct nl_connection *nlc, int addr_family, int stats,
+               struct sweep_ns *ns);
+int sweep_dump_nogil(struct nl_connection *nlc, int addr_family, int stats,
+                     struct sweep_ns *ns);
+PyObject *sweep_result(struct ethtool_state *state, int mask,
+                       struct sweep_ns *ns);
+void sweep_ns_release(struct sweep_ns *ns);
+
+PyObject *sweep_namespaces(PyObject *self, FASTCALL_PARAMS);
+
+#endif
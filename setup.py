@@ -143,10 +143,21 @@ setup(name='ethtool',
               'ethtool',
               sources=[
                   'python-ethtool/ethtool.c',
+                  'python-ethtool/aio.c',
                   'python-ethtool/etherinfo.c',
                   'python-ethtool/etherinfo_obj.c',
                   'python-ethtool/netlink.c',
-                  'python-ethtool/netlink-address.c'],
+                  'python-ethtool/netlink-address.c',
+                  'python-ethtool/netns.c',
+                  'python-ethtool/perfcounters.c',
+                  'python-ethtool/snapshot.c',
+                  'python-ethtool/columns.c',
+                  'python-ethtool/shmstats.c',
+                  'python-ethtool/device_obj.c',
+                  'python-ethtool/fastcall.c',
+                  'python-ethtool/freelist.c',
+                  'python-ethtool/rtnetlink.c',
+                  'python-ethtool/sweep.c'],
               extra_compile_args=[
                   '-fno-strict-aliasing', '-Wno-unused-function'],
               define_macros=[('VERSION', '"%s"' % version)],
@@ -0,0 +1,213 @@
+# -*- coding: utf-8 -*-
+
+"""Allocation benchmark for the etherinfo and NetlinkIPaddress objects.
+
+Populates a private network namespace with interfaces and one device with
+many IPv6 addresses, then runs snapshot cycles, each timed in three phases:
+get_interfaces_info() on all interfaces (which only creates the etherinfo
+objects), get_ipv6_addresses() on the large device (a single NETLINK dump
+creating an object per address) and the release of the snapshot.  A random
+share of the address objects of every cycle is kept alive until the next
+one, like a consumer caching part of a snapshot, which is what fragments
+the heap.
+
+The cycles are run with the free lists disabled and with the given limits
+(see ethtool.set_free_list_limit()).  For each setting the time per object
+of each phase, the resident set size after every cycle and the free list
+counters are reported.
+
+Must be run as root.
+
+Usage:
+    python -m tests.bench_alloc [--interfaces 1000] [--addresses 20000]
+                                [--limits 0,4096,65536] [-o results.json]
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import gc
+import json
+import platform
+import os
+import random
+import sys
+import time
+
+import ethtool
+
+from .bench_ethtool import clock_ns, ip, percentile, unshare_netns
+from .bench_scaling import interface_kind, populate
+from .soak_ethtool import rss
+
+BIG_DEVICE = 'alloc0'
+
+
+def add_many_addresses(count):
+    """Creates BIG_DEVICE with count IPv6 addresses"""
+    import subprocess
+
+    commands = ['link add %s type veth peer name %sp' % (BIG_DEVICE,
+                                                        BIG_DEVICE),
+                'link set %s up' % BIG_DEVICE]
+    commands += ['address add fd10::%x:%x/64 dev %s nodad' %
+                 (i >> 16, i & 0xffff, BIG_DEVICE) for i in range(count)]
+    proc = subprocess.Popen(('ip', '-force', '-batch', '-'),
+                            stdin=subprocess.PIPE)
+    proc.communicate(('\n'.join(commands) + '\n').encode())
+    if proc.returncode != 0:
+        raise RuntimeError('ip -batch failed adding addresses')
+
+
+PHASES = ('etherinfo alloc', 'address dump+alloc', 'dealloc')
+
+
+def cycle(devices, big, keep, kept):
+    """One snapshot cycle, returns the wall time of each phase"""
+    start = clock_ns()
+    eis = ethtool.get_interfaces_info(devices)
+    infos_done = clock_ns()
+    addresses = big.get_ipv6_addresses()
+    addresses_done = clock_ns()
+
+    # Part of the snapshot outlives the cycle
+    new_kept = [a for a in addresses if random.random() < keep]
+    mark = clock_ns()
+    del eis, addresses
+    del kept[:]
+    end = clock_ns()
+    kept.extend(new_kept)
+    return (infos_done - start, addresses_done - infos_done, end - mark)
+
+
+def measure(limit, devices, big, cycles, warmup, keep):
+    ethtool.set_free_list_limit(limit)
+    random.seed(42)
+    kept = []
+    for _ in range(warmup):
+        cycle(devices, big, keep, kept)
+    gc.collect()
+
+    before = ethtool.get_free_list_stats()
+    times = dict((phase, []) for phase in PHASES)
+    rss_samples = []
+    for _ in range(cycles):
+        for phase, t in zip(PHASES, cycle(devices, big, keep, kept)):
+            times[phase].append(t)
+        rss_samples.append(rss())
+    after = ethtool.get_free_list_stats()
+    del kept[:]
+
+    objects = len(devices) + len(big.get_ipv6_addresses())
+    counters = {}
+    for name in after:
+        counters[name] = dict((key, after[name][key] - before[name][key])
+                              for key in ('allocs', 'reuses', 'frees'))
+    phases = {}
+    for phase, samples in times.items():
+        samples.sort()
+        count = len(devices) if phase == 'etherinfo alloc' else objects
+        phases[phase] = {
+            'p50_ns': percentile(samples, 50),
+            'p99_ns': percentile(samples, 99),
+            'p50_ns_per_object': percentile(samples, 50) / count,
+        }
+    return {
+        'limit': limit,
+        'cycles': cycles,
+        'objects_per_cycle': objects,
+        'phases': phases,
+        'rss_first': rss_samples[0],
+        'rss_last': rss_samples[-1],
+        'rss_max': max(rss_samples),
+        'free_lists': counters,
+    }
+
+
+def parse_args(argv=None):
+    parser = argparse.ArgumentParser(
+        description='Measure allocation cost and fragmentation of the '
+        'ethtool snapshot objects')
+    parser.add_argument('--interfaces', type=int, default=1000,
+                        help='interfaces with a few addresses each '
+                        '(default: %(default)s)')
+    parser.add_argument('--addresses', type=int, default=20000,
+                        help='IPv6 addresses on the large device '
+                        '(default: %(default)s)')
+    parser.add_argument('--limits', default='0,%d,65536' %
+                        ethtool.get_free_list_stats()['etherinfo']['limit'],
+                        help='comma separated free list limits to compare '
+                        '(default: %(default)s)')
+    parser.add_argument('-c', '--cycles', type=int, default=20,
+                        help='measured cycles per limit (default: 20)')
+    parser.add_argument('-w', '--warmup', type=int, default=3,
+                        help='cycles run before measuring (default: 3)')
+    parser.add_argument('--keep', type=float, default=0.1,
+                        help='share of the address objects kept until the '
+                        'next cycle (default: 0.1)')
+    parser.add_argument('-o', '--output',
+                        help='write the results as JSON to this file')
+    return parser.parse_args(argv)
+
+
+def main(argv=None):
+    args = parse_args(argv)
+    limits = [int(limit) for limit in args.limits.split(',')]
+
+    if os.geteuid() != 0:
+        print('The allocation benchmark must be run as root', file=sys.stderr)
+        return 2
+
+    unshare_netns()
+    ip('link', 'set', 'lo', 'up')
+    kind = interface_kind()
+    start = time.time()
+    populate(0, args.interfaces, kind)
+    add_many_addresses(args.addresses)
+    print('%d %s interfaces and %d addresses created in %.1fs' %
+          (args.interfaces, kind, args.addresses, time.time() - start))
+    sys.stdout.flush()
+
+    devices = ethtool.get_devices()
+    big = ethtool.get_interfaces_info(BIG_DEVICE)[0]
+
+    results = []
+    for limit in limits:
+        r = measure(limit, devices, big, args.cycles, args.warmup, args.keep)
+        results.append(r)
+        reuses = sum(c['reuses'] for c in r['free_lists'].values())
+        allocs = sum(c['allocs'] for c in r['free_lists'].values())
+        print('limit %d: %d objects/cycle, RSS %.1f -> %.1f MiB '
+              '(max %.1f), reused %d, allocated %d' %
+              (limit, r['objects_per_cycle'], r['rss_first'] / 2.0 ** 20,
+               r['rss_last'] / 2.0 ** 20, r['rss_max'] / 2.0 ** 20,
+               reuses, allocs))
+        for phase in PHASES:
+            p = r['phases'][phase]
+            print('  %-20s p50 %9.1f us  p99 %9.1f us  %6.1f ns/object' %
+                  (phase, p['p50_ns'] / 1e3, p['p99_ns'] / 1e3,
+                   p['p50_ns_per_object']))
+        sys.stdout.flush()
+
+    if args.output:
+        report = {
+            'meta': {
+                'ethtool_version': ethtool.version,
+                'python': platform.python_version(),
+                'kernel': platform.release(),
+                'timestamp': time.strftime('%Y-%m-%dT%H:%M:%SZ',
+                                           time.gmtime()),
+                'interfaces': args.interfaces,
+                'addresses': args.addresses,
+                'keep': args.keep,
+            },
+            'results': results,
+        }
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,407 @@
+# -*- coding: utf-8 -*-
+
+"""Microbenchmarks for the functions exported by the ethtool module.
+
+Every exported function is timed call by call against a set of devices.
+Latency percentiles and the throughput of a tight loop are written as JSON,
+so results of two builds can be compared with --compare.
+
+When run as root, the benchmark moves itself into a private network
+namespace and creates its own devices there (loopback, a dummy or veth
+device and, if the kernel has it, a netdevsim device), so results do not
+depend on the host configuration.
+
+Usage:
+    python -m tests.bench_ethtool [-n ITERATIONS] [-o results.json]
+                                  [--compare baseline.json]
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import ctypes
+import errno
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+import time
+
+import ethtool
+
+CLONE_NEWNET = 0x40000000
+
+NETDEVSIM_ID = 4242
+
+BENCH_ADDRESSES = (
+    '198.51.100.1/24 broadcast 198.51.100.255',
+    '203.0.113.1/24 broadcast 203.0.113.255',
+    '2001:db8::1/64',
+    '2001:db8:1::1/64',
+)
+
+if hasattr(time, 'perf_counter_ns'):
+    clock_ns = time.perf_counter_ns
+else:
+    def clock_ns():
+        return int(time.perf_counter() * 1e9)
+
+
+# ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#  private network namespace
+# ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+def unshare_netns():
+    """Moves the current process into a new, empty network namespace"""
+    if hasattr(os, 'unshare'):
+        os.unshare(os.CLONE_NEWNET)
+        return
+
+    libc = ctypes.CDLL(None, use_errno=True)
+    if libc.unshare(CLONE_NEWNET) != 0:
+        err = ctypes.get_errno()
+        raise OSError(err, os.strerror(err))
+
+
+def ip(*args):
+    """Runs ip(8), returns True on success"""
+    with open(os.devnull, 'w') as devnull:
+        return subprocess.call(('ip', ) + args, stdout=devnull,
+                               stderr=devnull) == 0
+
+
+def add_addresses(devname, addresses=BENCH_ADDRESSES):
+    for address in addresses:
+        ip('address', 'add', *(address.split() + ['dev', devname]))
+
+
+def create_netdevsim():
+    """Creates a netdevsim device in the current namespace, if possible"""
+    try:
+        with open('/sys/bus/netdevsim/new_device', 'w') as f:
+            f.write('%d 1\n' % NETDEVSIM_ID)
+    except (IOError, OSError):
+        return None
+
+    path = '/sys/bus/netdevsim/devices/netdevsim%d/net' % NETDEVSIM_ID
+    for _ in range(100):
+        if os.path.isdir(path) and os.listdir(path):
+            return os.listdir(path)[0]
+        time.sleep(0.01)
+    return None
+
+
+def remove_netdevsim():
+    try:
+        with open('/sys/bus/netdevsim/del_device', 'w') as f:
+            f.write('%d\n' % NETDEVSIM_ID)
+    except (IOError, OSError):
+        pass
+
+
+def setup_private_netns():
+    """Sets up the benchmark devices in a private network namespace.
+
+    Returns the list of device names to benchmark.
+    """
+    unshare_netns()
+    ip('link', 'set', 'lo', 'up')
+    devices = ['lo']
+
+    if ip('link', 'add', 'bench0', 'type', 'dummy'):
+        devices.append('bench0')
+    elif ip('link', 'add', 'bench0', 'type', 'veth',
+            'peer', 'name', 'bench1'):
+        ip('link', 'set', 'bench1', 'up')
+        devices.append('bench0')
+
+    nsim = create_netdevsim()
+    if nsim:
+        devices.append(nsim)
+
+    for devname in devices[1:]:
+        ip('link', 'set', devname, 'up')
+        add_addresses(devname)
+
+    return devices
+
+
+# ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#  measurements
+# ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+def percentile(sorted_samples, pct):
+    if not sorted_samples:
+        return 0
+    k = (len(sorted_samples) - 1) * pct / 100.0
+    lo = int(k)
+    hi = min(lo + 1, len(sorted_samples) - 1)
+    return sorted_samples[lo] + (sorted_samples[hi] -
+                                 sorted_samples[lo]) * (k - lo)
+
+
+def measure(fn, iterations, warmup):
+    """Times fn() call by call and in a tight loop.
+
+    Exceptions raised by fn() are part of what is being measured (e.g.
+    EOPNOTSUPP from a driver), the errno of the last one is reported.
+    """
+    error = None
+    for _ in range(warmup):
+        try:
+            fn()
+        except (IOError, OSError) as e:
+            error = e.errno
+
+    samples = []
+    for _ in range(iterations):
+        start = clock_ns()
+        try:
+            fn()
+        except (IOError, OSError):
+            pass
+        samples.append(clock_ns() - start)
+
+    start = clock_ns()
+    for _ in range(iterations):
+        try:
+            fn()
+        except (IOError, OSError):
+            pass
+    loop_ns = clock_ns() - start
+
+    samples.sort()
+    result = {
+        'iterations': iterations,
+        'mean_ns': sum(samples) / len(samples),
+        'min_ns': samples[0],
+        'p50_ns': percentile(samples, 50),
+        'p90_ns': percentile(samples, 90),
+        'p99_ns': percentile(samples, 99),
+        'p999_ns': percentile(samples, 99.9),
+        'max_ns': samples[-1],
+        'calls_per_sec': iterations * 1e9 / loop_ns if loop_ns else 0,
+    }
+    if error is not None:
+        result['errno'] = error
+        result['error'] = errno.errorcode.get(error, str(error))
+    return result
+
+
+def etherinfo_attributes(ei):
+    return (ei.mac_address, ei.ipv4_address, ei.ipv4_netmask,
+            ei.ipv4_broadcast, ei.get_ipv4_addresses(),
+            ei.get_ipv6_addresses())
+
+
+def device_benchmarks(devname):
+    """(name, callable) pairs for the functions taking a device name"""
+    per_device = ('get_flags', 'get_hwaddr', 'get_ipaddr', 'get_netmask',
+                  'get_broadcast', 'get_module', 'get_businfo', 'get_tso',
+                  'get_ufo', 'get_gso', 'get_gro', 'get_sg', 'get_coalesce',
+                  'get_ringparam', 'get_link_settings', 'get_ts_info',
+                  'get_wireless_protocol', 'get_all_settings')
+    benchmarks = []
+    for fnname in per_device:
+        fn = getattr(ethtool, fnname, None)
+        if fn is not None:
+            benchmarks.append((fnname, lambda fn=fn: fn(devname)))
+
+    device = getattr(ethtool, 'Device', None)
+    if device is not None:
+        handle = device(devname)
+        for fnname in per_device:
+            fn = getattr(handle, fnname, None)
+            if fn is not None:
+                benchmarks.append(('Device.' + fnname, fn))
+
+    ei = ethtool.get_interfaces_info(devname)[0]
+    benchmarks.extend((
+        ('get_interfaces_info',
+         lambda: ethtool.get_interfaces_info(devname)),
+        ('get_interfaces_info+attributes',
+         lambda: etherinfo_attributes(
+             ethtool.get_interfaces_info(devname)[0])),
+        ('etherinfo.mac_address', lambda: ei.mac_address),
+        ('etherinfo.ipv4_address', lambda: ei.ipv4_address),
+        ('etherinfo.get_ipv4_addresses', ei.get_ipv4_addresses),
+        ('etherinfo.get_ipv6_addresses', ei.get_ipv6_addresses),
+        ('str(etherinfo)', lambda: str(ei)),
+    ))
+    return benchmarks
+
+
+def settings_one_by_one(devices):
+    """What get_all_settings() reads, with a call per device and setting"""
+    for devname in devices:
+        for fnname in ('get_module', 'get_businfo', 'get_ringparam',
+                       'get_coalesce', 'get_tso', 'get_gso', 'get_gro',
+                       'get_sg'):
+            try:
+                getattr(ethtool, fnname)(devname)
+            except (IOError, OSError):
+                pass
+
+
+def global_benchmarks():
+    benchmarks = [
+        ('get_devices', ethtool.get_devices),
+        ('get_active_devices', ethtool.get_active_devices),
+        ('get_interfaces_info(all)',
+         lambda: ethtool.get_interfaces_info(ethtool.get_devices())),
+    ]
+    if hasattr(ethtool, 'get_all_settings'):
+        benchmarks.extend((
+            ('get_all_settings(all)', ethtool.get_all_settings),
+            ('settings one by one(all)',
+             lambda: settings_one_by_one(ethtool.get_devices())),
+        ))
+    if hasattr(ethtool, 'SharedStatsReader'):
+        # The mappings outlive the file
+        tmpdir = tempfile.mkdtemp()
+        path = os.path.join(tmpdir, 'stats')
+        publisher = ethtool.StatsPublisher(path)
+        publisher.sample()
+        reader = ethtool.SharedStatsReader(path)
+        os.unlink(path)
+        os.rmdir(tmpdir)
+        benchmarks.extend((
+            ('snapshot_columns', ethtool.snapshot_columns),
+            ('StatsPublisher.sample', publisher.sample),
+            ('SharedStatsReader.read', reader.read),
+        ))
+    return benchmarks
+
+
+def run(devices, iterations, warmup, only=None, verbose=True):
+    results = {}
+
+    def bench(key, fn):
+        if only and not any(pattern in key for pattern in only):
+            return
+        results[key] = measure(fn, iterations, warmup)
+        if verbose:
+            r = results[key]
+            print('%-45s p50 %9.1f us  p99 %9.1f us  %10.0f calls/s%s' %
+                  (key, r['p50_ns'] / 1e3, r['p99_ns'] / 1e3,
+                   r['calls_per_sec'],
+                   '  (%s)' % r['error'] if 'error' in r else ''))
+            sys.stdout.flush()
+
+    for name, fn in global_benchmarks():
+        bench(name, fn)
+
+    for devname in devices:
+        for name, fn in device_benchmarks(devname):
+            bench('%s[%s]' % (name, devname), fn)
+
+    return results
+
+
+# ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#  reporting
+# ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+def metadata(args, devices, private_netns):
+    return {
+        'ethtool_version': ethtool.version,
+        'python': platform.python_version(),
+        'implementation': platform.python_implementation(),
+        'kernel': platform.release(),
+        'machine': platform.machine(),
+        'timestamp': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'iterations': args.iterations,
+        'warmup': args.warmup,
+        'private_netns': private_netns,
+        'netlink_backend': args.netlink_backend,
+        'devices': devices,
+    }
+
+
+def compare(baseline, results, threshold):
+    """Prints the benchmarks which got slower than threshold times the
+    baseline, returns the number of regressions found"""
+    regressions = 0
+    for key, new in sorted(results.items()):
+        old = baseline.get(key)
+        if old is None or not old.get('p50_ns'):
+            continue
+        ratio = new['p50_ns'] / old['p50_ns']
+        marker = ''
+        if ratio > threshold:
+            marker = '  REGRESSION'
+            regressions += 1
+        print('%-45s p50 %9.1f -> %9.1f us  x%.2f%s' %
+              (key, old['p50_ns'] / 1e3, new['p50_ns'] / 1e3, ratio, marker))
+    return regressions
+
+
+def parse_args(argv=None):
+    parser = argparse.ArgumentParser(
+        description='Benchmark the functions of the ethtool module')
+    parser.add_argument('-n', '--iterations', type=int, default=2000,
+                        help='timed calls per benchmark (default: 2000)')
+    parser.add_argument('-w', '--warmup', type=int, default=100,
+                        help='untimed calls before measuring (default: 100)')
+    parser.add_argument('-d', '--device', action='append', dest='devices',
+                        help='benchmark this device (may be repeated); '
+                        'implies --no-netns')
+    parser.add_argument('-k', '--only', action='append',
+                        help='only run benchmarks whose name contains this')
+    parser.add_argument('--no-netns', action='store_true',
+                        help='do not create a private network namespace')
+    parser.add_argument('--netlink-backend', choices=('native', 'libnl'),
+                        default='native',
+                        help='how etherinfo objects read NETLINK '
+                        '(default: native)')
+    parser.add_argument('-o', '--output',
+                        help='write the results as JSON to this file')
+    parser.add_argument('--compare', metavar='BASELINE',
+                        help='compare against a JSON file written by -o')
+    parser.add_argument('--threshold', type=float, default=1.25,
+                        help='p50 slowdown ratio reported as a regression '
+                        '(default: 1.25)')
+    return parser.parse_args(argv)
+
+
+def main(argv=None):
+    args = parse_args(argv)
+    ethtool.set_netlink_backend(args.netlink_backend)
+
+    private_netns = False
+    if args.devices:
+        devices = args.devices
+    elif not args.no_netns and os.geteuid() == 0:
+        devices = setup_private_netns()
+        private_netns = True
+    else:
+        devices = ethtool.get_active_devices()
+
+    try:
+        results = run(devices, args.iterations, args.warmup, args.only)
+    finally:
+        if private_netns:
+            remove_netdevsim()
+
+    report = {
+        'meta': metadata(args, devices, private_netns),
+        'results': results,
+    }
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)['results']
+        if compare(baseline, results, args.threshold):
+            return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,182 @@
+# -*- coding: utf-8 -*-
+
+"""Benchmark of queries sweeping many network namespaces.
+
+Creates the given number of network namespaces, each with its loopback
+device up, and takes a snapshot of every one of them through the netns
+arguments: get_devices(), get_interfaces_info() with the IPv4 and IPv6
+addresses of each device, and get_flags() on each device.  The namespaces
+are swept three times: with an empty namespace cache, again with all of
+them cached (see ethtool.set_netns_cache_limit()), and with the default
+cache limit, below the number of namespaces, which leaves every sweep
+opening its sockets again.  Then the same is asked of
+ethtool.sweep_namespaces(), which sweeps them on a pool of threads.
+
+For comparison, the same snapshot is taken by a new Python process entering
+a sample of the namespaces with nsenter(1), the usual way of doing it
+without netns arguments, and extrapolated to all of them.
+
+Must be run as root.
+
+Usage:
+    python -m tests.bench_netns [--namespaces 500] [--baseline-sample 20]
+                                 [--workers N]
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import ctypes
+import os
+import subprocess
+import sys
+
+import ethtool
+
+from .bench_ethtool import clock_ns, ip, unshare_netns
+
+CLONE_NEWNET = 0x40000000
+
+SNAPSHOT = '''
+import ethtool
+devices = ethtool.get_devices()
+for ei in ethtool.get_interfaces_info(devices):
+    ei.get_ipv4_addresses()
+    ei.get_ipv6_addresses()
+for device in devices:
+    ethtool.get_flags(device)
+'''
+
+
+def setns(fd):
+    """Moves the current thread into the network namespace fd"""
+    if hasattr(os, 'setns'):
+        os.setns(fd, CLONE_NEWNET)
+        return
+
+    libc = ctypes.CDLL(None, use_errno=True)
+    if libc.setns(fd, CLONE_NEWNET) != 0:
+        err = ctypes.get_errno()
+        raise OSError(err, os.strerror(err))
+
+
+def create_namespaces(count):
+    """Creates count network namespaces with lo up, returns a file
+    descriptor of each; the caller stays in its own namespace"""
+    own = os.open('/proc/self/ns/net', os.O_RDONLY)
+    fds = []
+    try:
+        for i in range(count):
+            unshare_netns()
+            ip('link', 'set', 'lo', 'up')
+            fds.append(os.open('/proc/thread-self/ns/net', os.O_RDONLY))
+    finally:
+        setns(own)
+        os.close(own)
+    return fds
+
+
+def snapshot(netns):
+    """Takes the snapshot of SNAPSHOT in the namespace netns"""
+    devices = ethtool.get_devices(netns=netns)
+    for ei in ethtool.get_interfaces_info(devices, netns=netns):
+        ei.get_ipv4_addresses()
+        ei.get_ipv6_addresses()
+    for device in devices:
+        ethtool.get_flags(device, netns=netns)
+
+
+def sweep(fds):
+    """Snapshots every namespace, returns the time taken in seconds and
+    the sockets opened"""
+    ethtool.reset_perf_counters()
+    start = clock_ns()
+    for fd in fds:
+        snapshot(fd)
+    elapsed = (clock_ns() - start) / 1e9
+    opens = sum(c['netlink_opens']
+                for c in ethtool.get_perf_counters().values())
+    return elapsed, opens
+
+
+def parallel_sweep(fds, workers):
+    """Snapshots every namespace with sweep_namespaces(), returns the time
+    taken in seconds and the sockets opened"""
+    ethtool.reset_perf_counters()
+    start = clock_ns()
+    result = ethtool.sweep_namespaces(
+        fds, what=('devices', 'flags', 'ipv4_addresses', 'ipv6_addresses'),
+        workers=workers)
+    elapsed = (clock_ns() - start) / 1e9
+    for fd, snap in result.items():
+        if isinstance(snap, OSError):
+            raise snap
+    opens = ethtool.get_perf_counters()['sweep_namespaces']['netlink_opens']
+    return elapsed, opens
+
+
+def baseline(fds):
+    """Snapshots every namespace in a process of its own, returns the time
+    taken in seconds"""
+    start = clock_ns()
+    for fd in fds:
+        subprocess.check_call(('nsenter', '--net=/proc/%d/fd/%d' %
+                               (os.getpid(), fd),
+                               sys.executable, '-c', SNAPSHOT))
+    return (clock_ns() - start) / 1e9
+
+
+def parse_args(argv=None):
+    parser = argparse.ArgumentParser(
+        description='Sweep queries over many network namespaces')
+    parser.add_argument('--namespaces', type=int, default=500,
+                        help='network namespaces to create '
+                        '(default: %(default)s)')
+    parser.add_argument('--baseline-sample', type=int, default=20,
+                        help='namespaces snapshotted by a process of their '
+                        'own, 0 to skip (default: %(default)s)')
+    parser.add_argument('--workers', type=int, default=None,
+                        help='threads of sweep_namespaces() '
+                        '(default: one per CPU)')
+    return parser.parse_args(argv)
+
+
+def main(argv=None):
+    args = parse_args(argv)
+
+    if os.geteuid() != 0:
+        print('The namespace benchmark must be run as root', file=sys.stderr)
+        return 2
+
+    fds = create_namespaces(args.namespaces)
+    print('%d namespaces' % len(fds))
+
+    def report(name, elapsed, opens):
+        print('%-22s %8.3f s %8.3f ms/namespace %6d NETLINK opens' %
+              (name, elapsed, elapsed * 1e3 / len(fds), opens))
+        sys.stdout.flush()
+
+    try:
+        ethtool.set_netns_cache_limit(len(fds))
+        report('cold', *sweep(fds))
+        report('cached', *sweep(fds))
+        # Empty the cache, then go back to the default limit
+        ethtool.set_netns_cache_limit(0)
+        ethtool.set_netns_cache_limit(64)
+        report('limit 64', *sweep(fds))
+        report('sweep_namespaces', *parallel_sweep(fds, args.workers))
+        report('sweep_namespaces 1 thread', *parallel_sweep(fds, 1))
+
+        sample = fds[:args.baseline_sample]
+        if sample:
+            elapsed = baseline(sample) * len(fds) / len(sample)
+            report('process per namespace', elapsed, 0)
+    finally:
+        for fd in fds:
+            os.close(fd)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,242 @@
+# -*- coding: utf-8 -*-
+
+"""Interface count scaling benchmark for the ethtool module.
+
+Populates a private network namespace with a growing number of dummy
+interfaces (veth pairs when the dummy driver is not available), each with
+two IPv4 and two IPv6 addresses, and times the device listing and
+etherinfo paths at every step.  The growth of each measurement with the
+number of interfaces N is reported as the exponent k of N^k between
+consecutive steps and as a least-squares fit over all of them.
+
+Reading the etherinfo attributes of every interface is quadratic with the
+current implementation, so it is measured on a sample of the interfaces
+and reported per interface; multiply by N for the cost of a full sweep.
+
+Must be run as root.
+
+Usage:
+    python -m tests.bench_scaling [--sizes 100,1000,5000,20000]
+                                  [-o results.json]
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import json
+import math
+import os
+import platform
+import random
+import subprocess
+import sys
+import time
+
+import ethtool
+
+from .bench_ethtool import clock_ns, ip, percentile, unshare_netns
+
+DEFAULT_SIZES = (100, 1000, 5000, 20000)
+
+
+def interface_name(i):
+    return 'sc%d' % i
+
+
+def batch_commands(i, kind):
+    """ip -batch commands creating interface number i"""
+    name = interface_name(i)
+    a, b = (i >> 8) & 0xff, i & 0xff
+    if kind == 'dummy':
+        commands = ['link add %s type dummy' % name]
+    else:
+        commands = ['link add %s type veth peer name %sp' % (name, name),
+                    'link set %sp up' % name]
+    commands += [
+        'link set %s up' % name,
+        'address add 10.%d.%d.1/24 broadcast 10.%d.%d.255 dev %s' %
+        (a, b, a, b, name),
+        'address add 10.%d.%d.2/24 dev %s' % (a, b, name),
+        'address add fd00:%x::1/64 dev %s' % (i, name),
+        'address add fd01:%x::1/64 dev %s' % (i, name),
+    ]
+    return commands
+
+
+def populate(start, end, kind):
+    """Creates the interfaces start..end-1 with a single ip -batch run"""
+    commands = []
+    for i in range(start, end):
+        commands.extend(batch_commands(i, kind))
+
+    proc = subprocess.Popen(('ip', '-force', '-batch', '-'),
+                            stdin=subprocess.PIPE)
+    proc.communicate(('\n'.join(commands) + '\n').encode())
+    if proc.returncode != 0:
+        raise RuntimeError('ip -batch failed creating interfaces %d-%d' %
+                           (start, end - 1))
+
+
+def interface_kind():
+    """Finds out which virtual interface type this kernel can create"""
+    if ip('link', 'add', 'scprobe', 'type', 'dummy'):
+        ip('link', 'del', 'scprobe')
+        return 'dummy'
+    if ip('link', 'add', 'scprobe', 'type', 'veth', 'peer', 'name',
+          'scprobep'):
+        ip('link', 'del', 'scprobe')
+        return 'veth'
+    raise RuntimeError('Neither dummy nor veth interfaces can be created')
+
+
+def time_calls(fn, repeat):
+    """Returns the sorted wall times of repeat calls of fn()"""
+    samples = []
+    for _ in range(repeat):
+        start = clock_ns()
+        fn()
+        samples.append(clock_ns() - start)
+    samples.sort()
+    return samples
+
+
+def read_all_attributes(ei):
+    return (ei.mac_address, ei.ipv4_address, ei.ipv4_netmask,
+            ei.ipv4_broadcast, ei.get_ipv4_addresses(),
+            ei.get_ipv6_addresses())
+
+
+def measure_step(n, repeat, sample):
+    names = [interface_name(i) for i in random.sample(range(n),
+                                                      min(sample, n))]
+    infos = ethtool.get_interfaces_info(names)
+
+    measurements = {
+        'get_devices':
+            time_calls(ethtool.get_devices, repeat),
+        'get_active_devices':
+            time_calls(ethtool.get_active_devices, repeat),
+        'get_interfaces_info(all)':
+            time_calls(lambda: ethtool.get_interfaces_info(
+                ethtool.get_devices()), repeat),
+        'etherinfo attributes (per interface)':
+            [time_calls(lambda: read_all_attributes(ei), 1)[0]
+             for ei in infos],
+        'str(etherinfo) (per interface)':
+            [time_calls(lambda: str(ei), 1)[0] for ei in infos],
+    }
+
+    results = {}
+    for name, samples in measurements.items():
+        samples.sort()
+        results[name] = {
+            'samples': len(samples),
+            'p50_ns': percentile(samples, 50),
+            'p99_ns': percentile(samples, 99),
+            'max_ns': samples[-1],
+        }
+    return results
+
+
+def growth(steps, name):
+    """Exponent k of N^k between consecutive steps and over all steps"""
+    points = [(step['interfaces'], step['results'][name]['p50_ns'])
+              for step in steps if step['results'][name]['p50_ns'] > 0]
+    pairwise = []
+    for (n1, t1), (n2, t2) in zip(points, points[1:]):
+        pairwise.append(math.log(t2 / t1) / math.log(n2 / n1))
+
+    fit = None
+    if len(points) >= 2:
+        xs = [math.log(n) for n, _ in points]
+        ys = [math.log(t) for _, t in points]
+        mx, my = sum(xs) / len(xs), sum(ys) / len(ys)
+        sxx = sum((x - mx) ** 2 for x in xs)
+        if sxx:
+            fit = sum((x - mx) * (y - my) for x, y in zip(xs, ys)) / sxx
+    return {'pairwise': pairwise, 'fit': fit}
+
+
+def parse_args(argv=None):
+    parser = argparse.ArgumentParser(
+        description='Measure how the ethtool module scales with the number '
+        'of interfaces')
+    parser.add_argument('--sizes', default=','.join(map(str, DEFAULT_SIZES)),
+                        help='comma separated interface counts '
+                        '(default: %(default)s)')
+    parser.add_argument('-r', '--repeat', type=int, default=5,
+                        help='calls per measurement of the functions '
+                        'covering all interfaces (default: 5)')
+    parser.add_argument('-s', '--sample', type=int, default=50,
+                        help='interfaces whose attributes are read at '
+                        'every step (default: 50)')
+    parser.add_argument('--netlink-backend', choices=('native', 'libnl'),
+                        default='native',
+                        help='how etherinfo objects read NETLINK '
+                        '(default: native)')
+    parser.add_argument('-o', '--output',
+                        help='write the results as JSON to this file')
+    return parser.parse_args(argv)
+
+
+def main(argv=None):
+    args = parse_args(argv)
+    ethtool.set_netlink_backend(args.netlink_backend)
+    sizes = sorted(int(size) for size in args.sizes.split(','))
+
+    if os.geteuid() != 0:
+        print('The scaling benchmark must be run as root', file=sys.stderr)
+        return 2
+
+    unshare_netns()
+    ip('link', 'set', 'lo', 'up')
+    kind = interface_kind()
+
+    steps = []
+    created = 0
+    for n in sizes:
+        start = time.time()
+        populate(created, n, kind)
+        created = n
+        print('%d %s interfaces created in %.1fs' %
+              (n, kind, time.time() - start))
+        sys.stdout.flush()
+
+        results = measure_step(n, args.repeat, args.sample)
+        steps.append({'interfaces': n, 'results': results})
+        for name, r in sorted(results.items()):
+            print('  %-40s p50 %12.1f us  p99 %12.1f us' %
+                  (name, r['p50_ns'] / 1e3, r['p99_ns'] / 1e3))
+        sys.stdout.flush()
+
+    report = {
+        'meta': {
+            'ethtool_version': ethtool.version,
+            'python': platform.python_version(),
+            'kernel': platform.release(),
+            'timestamp': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+            'interface_kind': kind,
+            'repeat': args.repeat,
+            'sample': args.sample,
+            'netlink_backend': args.netlink_backend,
+        },
+        'steps': steps,
+        'growth': {},
+    }
+
+    print('\nGrowth with the number of interfaces (time ~ N^k):')
+    for name in sorted(steps[0]['results']):
+        report['growth'][name] = g = growth(steps, name)
+        print('  %-40s k = %s  (steps: %s)' %
+              (name, '%.2f' % g['fit'] if g['fit'] is not None else 'n/a',
+               ', '.join('%.2f' % k for k in g['pairwise'])))
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
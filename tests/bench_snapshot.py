@@ -0,0 +1,171 @@
+# -*- coding: utf-8 -*-
+
+"""Benchmark of the change detection of ethtool.snapshot() and ethtool.diff().
+
+Moves itself into a private network namespace, creates the given number of
+devices there, each with an IPv4 address, and takes a snapshot of them.
+Then changes a few of them (MTU, hardware address, flags and addresses),
+takes another snapshot and times diff() of the two, and of a snapshot with
+itself, where nothing changed.
+
+For comparison, the same changes are looked for the usual way: reading
+get_interfaces_info() twice and comparing the attributes of every device
+in Python, and the snapshot is serialized as JSON of its dicts.
+
+Must be run as root.
+
+Usage:
+    python -m tests.bench_snapshot [--devices 10000] [--changes 100]
+                                   [--iterations 20]
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+import ethtool
+
+from .bench_ethtool import clock_ns, ip, unshare_netns
+
+
+def ip_batch(commands):
+    """Runs many ip(8) commands at once, going on after a failed one,
+    returns True if none failed"""
+    with open(os.devnull, 'w') as devnull:
+        proc = subprocess.Popen(('ip', '-force', '-batch', '-'),
+                                stdin=subprocess.PIPE, stdout=devnull,
+                                stderr=devnull)
+        proc.communicate('\n'.join(commands).encode())
+    return proc.returncode == 0
+
+
+def create_devices(count):
+    """Creates count devices named bench<N>, returns their names"""
+    names = ['bench%d' % i for i in range(count)]
+    for kind in ('dummy', 'ifb'):
+        if ip_batch('link add %s type %s' % (name, kind) for name in names):
+            break
+    else:
+        raise RuntimeError('neither dummy nor ifb devices can be created')
+    ip_batch('address add 10.%d.%d.1/24 dev %s' % (i >> 8, i & 255, name)
+             for i, name in enumerate(names))
+    return names
+
+
+def change_devices(names, count):
+    """Changes count of the devices, a different way each; ifb devices
+    keep their hardware address"""
+    commands = []
+    for i, name in enumerate(names[:count]):
+        commands.append((
+            'link set %s mtu 1400' % name,
+            'link set %s address 02:00:00:00:%02x:%02x' % (name, i >> 8,
+                                                          i & 255),
+            'link set %s up' % name,
+            'address add 192.0.2.%d/32 dev %s' % (i % 250 + 1, name),
+        )[i % 4])
+    ip_batch(commands)
+
+
+def interfaces_info():
+    """Reads what diff() compares the usual way, keyed by device name"""
+    result = {}
+    for ei in ethtool.get_interfaces_info(ethtool.get_devices()):
+        result[ei.device] = (
+            ei.mac_address, ethtool.get_flags(ei.device),
+            sorted((a.address, a.netmask)
+                   for a in ei.get_ipv4_addresses()),
+            sorted((a.address, a.netmask)
+                   for a in ei.get_ipv6_addresses()))
+    return result
+
+
+def python_diff(a, b):
+    """Compares two results of interfaces_info() attribute by attribute"""
+    changed = {}
+    for name in set(a) | set(b):
+        if a.get(name) != b.get(name):
+            changed[name] = (a.get(name), b.get(name))
+    return changed
+
+
+def snapshot_json(snap):
+    """Serializes a snapshot the usual way, as JSON of its dicts"""
+    return json.dumps(dict((ifindex, snap[ifindex]) for ifindex in snap))
+
+
+def timed(fn, *args):
+    """Calls fn, returns its result and the time taken in seconds"""
+    start = clock_ns()
+    result = fn(*args)
+    return result, (clock_ns() - start) / 1e9
+
+
+def best_of(iterations, fn, *args):
+    """Returns the shortest time taken by fn in seconds"""
+    return min(timed(fn, *args)[1] for i in range(iterations))
+
+
+def parse_args(argv=None):
+    parser = argparse.ArgumentParser(
+        description='Detect changes of many interfaces')
+    parser.add_argument('--devices', type=int, default=10000,
+                        help='devices to create (default: %(default)s)')
+    parser.add_argument('--changes', type=int, default=100,
+                        help='devices to change (default: %(default)s)')
+    parser.add_argument('--iterations', type=int, default=20,
+                        help='diff() calls timed (default: %(default)s)')
+    return parser.parse_args(argv)
+
+
+def main(argv=None):
+    args = parse_args(argv)
+
+    if os.geteuid() != 0:
+        print('The snapshot benchmark must be run as root', file=sys.stderr)
+        return 2
+
+    unshare_netns()
+    ip('link', 'set', 'lo', 'up')
+    names = create_devices(args.devices)
+    print('%d devices, %d changed' % (len(names) + 1, args.changes))
+
+    def report(name, elapsed):
+        print('%-28s %10.3f ms' % (name, elapsed * 1e3))
+        sys.stdout.flush()
+
+    before, elapsed = timed(ethtool.snapshot)
+    report('snapshot()', elapsed)
+    info_before, elapsed = timed(interfaces_info)
+    report('get_interfaces_info()', elapsed)
+    report('snapshot_columns()', best_of(args.iterations,
+                                         ethtool.snapshot_columns))
+
+    change_devices(names, args.changes)
+    after = ethtool.snapshot()
+    info_after = interfaces_info()
+
+    diff = ethtool.diff(before, after)
+    print('diff(): %d changed' % len(diff['changed']))
+    report('diff(), nothing changed', best_of(args.iterations, ethtool.diff,
+                                              before, before))
+    report('diff()', best_of(args.iterations, ethtool.diff, before, after))
+    report('compared in Python', best_of(args.iterations, python_diff,
+                                         info_before, info_after))
+
+    data = ethtool.dumps(after)
+    report('dumps()', best_of(args.iterations, ethtool.dumps, after))
+    report('loads()', best_of(args.iterations, ethtool.loads, data))
+    text = snapshot_json(after)
+    report('dicts as JSON', best_of(args.iterations, snapshot_json, after))
+    report('loads() of the JSON', best_of(args.iterations, json.loads, text))
+    print('dumps(): %d bytes, JSON: %d bytes' % (len(data), len(text)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
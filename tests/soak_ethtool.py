@@ -0,0 +1,123 @@
+# -*- coding: utf-8 -*-
+
+"""Long-running polling soak test for the ethtool module.
+
+Calls the etherinfo getters, the NetlinkIPaddress representation and a
+Device getter over and over, like a monitoring agent polling for months,
+and checks that neither the resident set size nor the memory traced by
+tracemalloc keeps growing.  Both are sampled after a warm-up, which lets
+caches and allocator pools settle, and again at the end.
+
+Usage:
+    python -m tests.soak_ethtool [--calls 1000000] [--device lo]
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import gc
+import os
+import sys
+import time
+
+import ethtool
+
+try:
+    import tracemalloc
+except ImportError:  # Python 2
+    tracemalloc = None
+
+DEFAULT_CALLS = 1000000
+
+# Growth allowed between the warm-up and the end of the run
+MAX_RSS_GROWTH = 2 << 20
+MAX_TRACED_GROWTH = 64 << 10
+
+
+def rss():
+    """Resident set size of the process in bytes"""
+    with open('/proc/self/statm') as f:
+        return int(f.read().split()[1]) * os.sysconf('SC_PAGE_SIZE')
+
+
+def getters(device):
+    """The calls made in turn, one getter call each"""
+    ei = ethtool.get_interfaces_info(device)[0]
+    dev = ethtool.Device(device)
+    return (
+        lambda: ei.mac_address,
+        lambda: ei.ipv4_address,
+        lambda: ei.ipv4_netmask,
+        lambda: ei.ipv4_broadcast,
+        lambda: [repr(a) for a in ei.get_ipv4_addresses()],
+        lambda: [repr(a) for a in ei.get_ipv6_addresses()],
+        lambda: str(ei),
+        lambda: dev.get_flags(),
+    )
+
+
+def memory():
+    gc.collect()
+    traced = tracemalloc.get_traced_memory()[0] if tracemalloc else 0
+    return rss(), traced
+
+
+def soak(calls=DEFAULT_CALLS, device='lo', verbose=False):
+    """Makes calls getter calls on device
+
+    Returns the growth of the resident set size and of the memory traced by
+    tracemalloc (0 if not available) in bytes.
+    """
+    fns = getters(device)
+    warmup = max(calls // 10, len(fns))
+
+    def run(n):
+        for i in range(n // len(fns)):
+            for fn in fns:
+                fn()
+
+    if tracemalloc:
+        tracemalloc.start()
+    try:
+        run(warmup)
+        rss_start, traced_start = memory()
+        start = time.time()
+        run(calls - warmup)
+        rss_end, traced_end = memory()
+    finally:
+        if tracemalloc:
+            tracemalloc.stop()
+
+    if verbose:
+        elapsed = time.time() - start
+        print('%d calls in %.1f s, %.1f us per call' %
+              (calls - warmup, elapsed, elapsed * 1e6 / (calls - warmup)))
+        print('RSS:     %d -> %d bytes' % (rss_start, rss_end))
+        if tracemalloc:
+            print('traced:  %d -> %d bytes' % (traced_start, traced_end))
+    return rss_end - rss_start, traced_end - traced_start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--calls', type=int, default=DEFAULT_CALLS,
+                        help='number of getter calls (default %(default)d)')
+    parser.add_argument('--device', default='lo',
+                        help='device polled (default %(default)s)')
+    args = parser.parse_args()
+
+    rss_growth, traced_growth = soak(args.calls, args.device, verbose=True)
+    ok = True
+    if rss_growth > MAX_RSS_GROWTH:
+        print('FAIL: RSS grew by %d bytes' % rss_growth)
+        ok = False
+    if traced_growth > MAX_TRACED_GROWTH:
+        print('FAIL: traced memory grew by %d bytes' % traced_growth)
+        ok = False
+    if ok:
+        print('OK')
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,150 @@
+# -*- coding: utf-8 -*-
+
+"""Stress test of NETLINK dumps racing with address changes.
+
+Populates a private network namespace with one device with many IPv6
+addresses, then reads them over and over while other addresses are added
+to and removed from the same device at a given rate.  The kernel
+marks dumps which overlap with a change as interrupted (NLM_F_DUMP_INTR);
+they must be dumped again rather than coming back with addresses missing
+or repeated.  Every result must hold each of the addresses configured at
+the start exactly once, and the number of retries is taken from the
+performance counters.  Dumps which are still interrupted after all retries
+are given up on, which the more likely the higher the rate.
+
+Must be run as root.
+
+Usage:
+    python -m tests.stress_dumps [--addresses 5000] [--rate 200]
+                                 [--seconds 10]
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import errno
+import os
+import subprocess
+import sys
+import threading
+import time
+
+import ethtool
+
+from .bench_alloc import BIG_DEVICE, add_many_addresses
+from .bench_ethtool import clock_ns, ip, percentile, unshare_netns
+
+
+def churn(stop, rate):
+    """Adds and removes rate addresses per second on BIG_DEVICE until stop
+    is set"""
+    proc = subprocess.Popen(('ip', '-force', '-batch', '-'),
+                            stdin=subprocess.PIPE,
+                            stderr=open(os.devnull, 'w'))
+    tick = 0.01
+    per_tick = max(1, int(rate * tick))
+    i = 0
+    while not stop.wait(tick):
+        commands = []
+        for j in range(per_tick):
+            address = 'fd20::%x/64' % ((i + j) & 0xffff)
+            commands.append('address add %s dev %s nodad' %
+                            (address, BIG_DEVICE))
+            commands.append('address del %s dev %s' %
+                            (address, BIG_DEVICE))
+        proc.stdin.write(('\n'.join(commands) + '\n').encode())
+        proc.stdin.flush()
+        i += per_tick
+    proc.stdin.close()
+    proc.wait()
+
+
+def stress(big, expected, seconds):
+    """Reads the addresses of big for seconds, returns the statistics"""
+    stats = {'calls': 0, 'mismatches': 0, 'interrupted': 0, 'errors': 0}
+    samples = []
+    ethtool.reset_perf_counters()
+    end = time.time() + seconds
+    while time.time() < end:
+        start = clock_ns()
+        try:
+            addresses = big.get_ipv6_addresses()
+        except OSError as e:
+            # Given up after RTNETLINK_RETRIES, which is reported
+            if e.errno == errno.EINTR:
+                stats['interrupted'] += 1
+            else:
+                stats['errors'] += 1
+            continue
+        finally:
+            samples.append(clock_ns() - start)
+            stats['calls'] += 1
+        # Only the addresses added by churn() come and go
+        stable = [a.packed for a in addresses if a.packed in expected]
+        if len(stable) != len(expected) or set(stable) != expected:
+            stats['mismatches'] += 1
+
+    counters = ethtool.get_perf_counters()['etherinfo.get_ipv6_addresses']
+    samples.sort()
+    stats['netlink_retries'] = counters['netlink_retries']
+    stats['netlink_dumps'] = counters['netlink_dumps']
+    stats['p50_ns'] = percentile(samples, 50)
+    stats['p99_ns'] = percentile(samples, 99)
+    return stats
+
+
+def parse_args(argv=None):
+    parser = argparse.ArgumentParser(
+        description='Read NETLINK dumps while addresses change')
+    parser.add_argument('--addresses', type=int, default=5000,
+                        help='IPv6 addresses on the dumped device '
+                        '(default: %(default)s)')
+    parser.add_argument('--rate', type=int, default=200,
+                        help='addresses added and removed per second '
+                        '(default: %(default)s)')
+    parser.add_argument('--seconds', type=float, default=10,
+                        help='duration per NETLINK backend '
+                        '(default: %(default)s)')
+    return parser.parse_args(argv)
+
+
+def main(argv=None):
+    args = parse_args(argv)
+
+    if os.geteuid() != 0:
+        print('The dump stress test must be run as root', file=sys.stderr)
+        return 2
+
+    unshare_netns()
+    ip('link', 'set', 'lo', 'up')
+    add_many_addresses(args.addresses)
+
+    big = ethtool.get_interfaces_info(BIG_DEVICE)[0]
+    expected = set(a.packed for a in big.get_ipv6_addresses())
+
+    stop = threading.Event()
+    churner = threading.Thread(target=churn, args=(stop, args.rate))
+    churner.start()
+    failed = False
+    try:
+        for backend in ('native', 'libnl'):
+            ethtool.set_netlink_backend(backend)
+            stats = stress(big, expected, args.seconds)
+            print('%-6s %6d calls, %d dumps, %d retries, %d given up, '
+                  '%d mismatches, %d errors, p50 %.1f ms, p99 %.1f ms' %
+                  (backend, stats['calls'], stats['netlink_dumps'],
+                   stats['netlink_retries'], stats['interrupted'],
+                   stats['mismatches'], stats['errors'],
+                   stats['p50_ns'] / 1e6, stats['p99_ns'] / 1e6))
+            sys.stdout.flush()
+            failed = failed or stats['mismatches'] or stats['errors']
+    finally:
+        stop.set()
+        churner.join()
+        ethtool.set_netlink_backend('native')
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -19,6 +19,15 @@
 #   Author: Dave Malcolm <dmalcolm@redhat.com>
 # ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
+import errno
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import sysconfig
+import tempfile
+import time
 import unittest
 
 import ethtool
@@ -146,6 +155,21 @@ class EthtoolTests(unittest.TestCase):
 
         self.assertIsInt(ethtool.get_sg(devname))
 
+        # Loopback has no link to negotiate
+        if devname == 'lo':
+            self.assertRaisesIOError(ethtool.get_link_settings, (devname, ),
+                                     '[Errno 95] Operation not supported')
+        else:
+            try:
+                settings = ethtool.get_link_settings(devname)
+            except (OSError, IOError):
+                # Not every driver implements link settings
+                pass
+            else:
+                for key in ('speed', 'duplex', 'port', 'autoneg',
+                            'supported', 'advertising', 'lp_advertising'):
+                    self.assertIsInt(settings[key])
+
         try:
             self.assertIsInt(ethtool.get_ufo(devname))
         except (OSError, IOError):
@@ -155,6 +179,12 @@ class EthtoolTests(unittest.TestCase):
 
         self.assertIsInt(ethtool.get_tso(devname))
 
+        ts_info = ethtool.get_ts_info(devname)
+        for key in ('so_timestamping', 'phc_index', 'tx_types', 'rx_filters'):
+            self.assertIsInt(ts_info[key])
+        if ts_info['phc_index'] < 0:
+            self.assertEqual(ts_info['phc_index'], -1)
+
         # TODO: self.assertIsString(ethtool.set_coalesce(devname))
 
         # TODO: self.assertIsString(ethtool.set_ringparam(devname))
@@ -212,13 +242,13 @@ class EthtoolTests(unittest.TestCase):
         get_fns = ('get_broadcast', 'get_businfo', 'get_coalesce', 'get_flags',
                    'get_gso', 'get_gso', 'get_hwaddr', 'get_ipaddr',
                    'get_module', 'get_netmask', 'get_ringparam', 'get_sg',
-                   'get_tso', 'get_ufo')
+                   'get_tso', 'get_ufo', 'get_link_settings', 'get_ts_info')
         for fnname in get_fns:
             self.assertRaisesNoSuchDevice(getattr(ethtool, fnname),
                                           INVALID_DEVICE_NAME)
 
         set_fns = ('set_coalesce', 'set_ringparam', 'set_tso', 'set_gso',
-                   'set_gro')
+                   'set_gro', 'set_link_settings')
         for fnname in set_fns:
             # Currently this fails, with an IOError from
             #   ethtool.c:__struct_desc_from_dict
@@ -228,6 +258,375 @@ class EthtoolTests(unittest.TestCase):
                 self.assertRaisesNoSuchDevice(getattr(ethtool, fnname),
                                               INVALID_DEVICE_NAME, 42)
 
+    def test_set_link_settings_range(self):
+        # A veth device has link settings but cannot set them, the values
+        # are checked before the request is sent
+        try:
+            proc = subprocess.Popen(('unshare', '-n', 'sleep', '60'))
+        except OSError:
+            self.skipTest('unshare is not available')
+        try:
+            netns = '/proc/%d/ns/net' % proc.pid
+            for i in range(100):
+                if os.readlink(netns) != os.readlink('/proc/self/ns/net'):
+                    break
+                time.sleep(0.01)
+            with open(os.devnull, 'w') as devnull:
+                if subprocess.call(('nsenter', '--net=' + netns, 'ip', 'link',
+                                    'add', 'veth0', 'type', 'veth', 'peer',
+                                    'name', 'veth1'), stderr=devnull) != 0:
+                    self.skipTest('veth devices cannot be created')
+            settings = ethtool.get_link_settings('veth0', netns=netns)
+            for duplex in (257, -1):
+                settings['duplex'] = duplex
+                self.assertRaises(OverflowError, ethtool.set_link_settings,
+                                  'veth0', settings, netns=netns)
+        finally:
+            proc.kill()
+            proc.wait()
+
+    def test_get_all_settings(self):
+        def or_none(fn, devname):
+            try:
+                return fn(devname)
+            except (IOError, OSError) as e:
+                if e.errno != errno.EOPNOTSUPP:
+                    raise
+                return None
+
+        devices = ethtool.get_devices()
+        settings = ethtool.get_all_settings()
+        self.assertEqual(sorted(settings), sorted(devices))
+        for devname in devices:
+            dev = settings[devname]
+            self.assertEqual(dev['ring'],
+                             or_none(ethtool.get_ringparam, devname))
+            self.assertEqual(dev['coalesce'],
+                             or_none(ethtool.get_coalesce, devname))
+            if dev['driver'] is None:
+                self.assertEqual(or_none(ethtool.get_businfo, devname), None)
+            else:
+                self.assertEqual(dev['driver']['bus_info'],
+                                 ethtool.get_businfo(devname))
+            for name in ('tso', 'gso', 'gro', 'sg'):
+                self.assertEqual(
+                    dev['features'][name],
+                    or_none(getattr(ethtool, 'get_' + name), devname))
+            for key in ('channels', 'pause'):
+                if dev[key] is not None:
+                    for value in dev[key].values():
+                        self.assertIsInt(value)
+
+        self.assertEqual(ethtool.get_all_settings('lo'),
+                         {'lo': settings['lo']})
+        self.assertRaisesNoSuchDevice(ethtool.get_all_settings,
+                                      ['lo', INVALID_DEVICE_NAME])
+        self.assertRaises(TypeError, ethtool.get_all_settings, [1])
+        self.assertRaises(ValueError, ethtool.get_all_settings,
+                          ['lo', 'lo\x00junk'])
+        if sys.version_info[0] >= 3:
+            self.assertRaises(UnicodeEncodeError, ethtool.get_all_settings,
+                              ['\udcff'])
+
+    def test_apply_profile(self):
+        # Only dry runs on the devices of the host
+        settings = ethtool.get_all_settings()
+        for devname, dev in settings.items():
+            del dev['driver']
+            self.assertEqual(ethtool.apply_profile(devname, dev,
+                                                   dry_run=True),
+                             {devname: {}})
+            ring = dev['ring']
+            if ring is not None:
+                self.assertEqual(ethtool.apply_profile(
+                    devname, {'ring': {'rx_pending': ring['rx_pending'] + 1}},
+                    dry_run=True),
+                    {devname: {'ring': {'rx_pending': (
+                        ring['rx_pending'], ring['rx_pending'] + 1)}}})
+                self.assertRaises(ValueError, ethtool.apply_profile, devname,
+                                  {'ring': {'rx_max_pending':
+                                            ring['rx_max_pending'] + 1}},
+                                  dry_run=True)
+        self.assertEqual(sorted(ethtool.apply_profile('*', {}, True)),
+                         sorted(settings))
+        self.assertEqual(ethtool.apply_profile(INVALID_DEVICE_NAME + '*', {}),
+                         {})
+        self.assertRaisesNoSuchDevice(ethtool.apply_profile,
+                                      INVALID_DEVICE_NAME, {})
+        for profile in ({'speed': {}}, {'driver': {}},
+                        {'features': {'lro': 1}}):
+            self.assertRaises(ValueError, ethtool.apply_profile, 'lo',
+                              profile, dry_run=True)
+        self.assertRaises(TypeError, ethtool.apply_profile, 'lo', [])
+        for profile in ({1: {}}, {'features': {1: True}}):
+            self.assertRaises(TypeError, ethtool.apply_profile, 'lo',
+                              profile, dry_run=True)
+        self.assertRaises(ValueError, ethtool.apply_profile, 'lo\x00junk',
+                          {}, dry_run=True)
+        if sys.version_info[0] >= 3:
+            for dev, profile in (('\udcff', {}), ('x\udcff*', {}),
+                                 ('lo', {'\udcff': 1})):
+                self.assertRaises(UnicodeEncodeError, ethtool.apply_profile,
+                                  dev, profile, dry_run=True)
+        # Not supported by the loopback device
+        self.assertRaises(IOError, ethtool.apply_profile, 'lo',
+                          {'ring': {'rx_pending': 1}})
+
+        # Setting things takes a namespace of its own
+        try:
+            proc = subprocess.Popen(('unshare', '-n', 'sleep', '60'))
+        except OSError:
+            self.skipTest('unshare is not available')
+        try:
+            netns = '/proc/%d/ns/net' % proc.pid
+            for i in range(100):
+                if os.readlink(netns) != os.readlink('/proc/self/ns/net'):
+                    break
+                time.sleep(0.01)
+            profile = {'features': {'gro': 0, 'sg': 1}}
+            try:
+                self.assertEqual(ethtool.apply_profile('lo', profile,
+                                                       netns=netns),
+                                 {'lo': {'features': {'gro': (1, 0)}}})
+            except OSError as e:
+                if e.errno == errno.EPERM:
+                    self.skipTest('setting devices needs CAP_NET_ADMIN')
+                raise
+            self.assertEqual(ethtool.get_gro('lo', netns=netns), 0)
+
+            # Nothing left to set, the 9 requests of get_all_settings()
+            # only read the settings
+            ethtool.reset_perf_counters()
+            self.assertEqual(ethtool.apply_profile('l?', profile,
+                                                   netns=netns),
+                             {'lo': {}})
+            self.assertEqual(
+                ethtool.get_perf_counters()['apply_profile']['ioctls'], 9)
+
+            # All or nothing: scatter-gather is fixed on the loopback device,
+            # GSO gets set back on every device
+            with open(os.devnull, 'w') as devnull:
+                for i in range(3):
+                    if subprocess.call(('nsenter', '--net=' + netns, 'ip',
+                                        'link', 'add', 'ifb%d' % i, 'type',
+                                        'ifb'), stderr=devnull) != 0:
+                        self.skipTest('ifb devices cannot be created')
+            profile = {'features': {'gso': 0, 'sg': 0}}
+            settings = ethtool.get_all_settings(netns=netns)
+            self.assertRaises(IOError, ethtool.apply_profile, '*', profile,
+                              netns=netns, workers=4)
+            self.assertEqual(ethtool.get_all_settings(netns=netns), settings)
+            self.assertEqual(
+                ethtool.apply_profile('ifb*', profile, netns=netns,
+                                      workers=2),
+                dict.fromkeys(('ifb0', 'ifb1', 'ifb2'),
+                              {'features': {'gso': (1, 0), 'sg': (1, 0)}}))
+            self.assertRaises(ValueError, ethtool.apply_profile, 'lo', {},
+                              workers=0)
+        finally:
+            proc.kill()
+            proc.wait()
+
+    def test_snapshot(self):
+        ethtool.reset_perf_counters()
+        snap = ethtool.snapshot()
+        # The dump without the GIL is counted against the call
+        c = ethtool.get_perf_counters()['snapshot']
+        self.assertEqual(c['netlink_dumps'], 2)
+        self.assertTrue(c['netlink_msgs'] >= len(snap))
+        devices = ethtool.get_devices()
+        self.assertEqual(len(snap), len(devices))
+        self.assertEqual(list(snap), sorted(snap.keys()))
+        for ifindex in snap:
+            link = snap[ifindex]
+            self.assertTrue(link['name'] in devices)
+            self.assertTrue(ifindex in snap)
+            self.assertEqual(ethtool.Device(ifindex).name, link['name'])
+            # The flags of NETLINK go beyond the 16 bits of get_flags()
+            self.assertEqual(link['flags'] & 0xffff,
+                             ethtool.get_flags(link['name']))
+            ei = ethtool.get_interfaces_info(link['name'])[0]
+            self.assertEqual(sorted(link['ipv4_addresses']),
+                             sorted('%s/%d' % (a.address, a.netmask)
+                                    for a in ei.get_ipv4_addresses()))
+            self.assertFalse('settings' in link)
+        self.assertFalse(0 in snap)
+        self.assertFalse('lo' in snap)
+        self.assertRaises(KeyError, snap.__getitem__, 0)
+        self.assertEqual(ethtool.diff(snap, snap),
+                         {'added': {}, 'removed': {}, 'changed': {}})
+        self.assertRaises(TypeError, ethtool.diff, snap, {})
+        self.assertRaises(TypeError, ethtool.Snapshot)
+
+        with_settings = ethtool.snapshot(settings=True)
+        settings = ethtool.get_all_settings()
+        for ifindex in with_settings:
+            link = with_settings[ifindex]
+            self.assertEqual(link['settings'], settings.get(link['name']))
+
+        # Changes are made in a namespace of its own
+        try:
+            proc = subprocess.Popen(('unshare', '-n', 'sleep', '60'))
+        except OSError:
+            self.skipTest('unshare is not available')
+        try:
+            netns = '/proc/%d/ns/net' % proc.pid
+            for i in range(100):
+                if os.readlink(netns) != os.readlink('/proc/self/ns/net'):
+                    break
+                time.sleep(0.01)
+
+            def ip(*args):
+                with open(os.devnull, 'w') as devnull:
+                    if subprocess.call(('nsenter', '--net=' + netns, 'ip') +
+                                       args, stderr=devnull) != 0:
+                        self.skipTest('ip %s failed' % ' '.join(args))
+
+            try:
+                before = ethtool.snapshot(True, netns=netns)
+            except OSError as e:
+                if e.errno == errno.EPERM:
+                    self.skipTest('entering a network namespace needs '
+                                  'CAP_SYS_ADMIN')
+                raise
+            self.assertEqual([link['name'] for link in
+                              (before[i] for i in before)], ['lo'])
+            ip('link', 'add', 'ifb0', 'type', 'ifb')
+            ip('link', 'add', 'ifb1', 'type', 'ifb')
+            after = ethtool.snapshot(True, netns=netns)
+            added = ethtool.diff(before, after)['added']
+            self.assertEqual(sorted(added.values()), ['ifb0', 'ifb1'])
+            index = dict((name, i) for i, name in added.items())
+
+            before = after
+            ip('link', 'set', 'lo', 'up')
+            ip('link', 'set', 'ifb0', 'mtu', '1400')
+            ip('link', 'set', 'ifb0', 'name', 'ifb2')
+            ip('address', 'add', '192.0.2.1/24', 'dev', 'ifb2')
+            ip('link', 'del', 'ifb1')
+            ethtool.apply_profile('ifb2', {'features': {'gro': 0}},
+                                  netns=netns)
+            after = ethtool.snapshot(True, netns=netns)
+            diff = ethtool.diff(before, after)
+            self.assertEqual(diff['added'], {})
+            self.assertEqual(diff['removed'], {index['ifb1']: 'ifb1'})
+            self.assertEqual(diff['changed'][index['ifb0']], {
+                'name': ('ifb0', 'ifb2'),
+                'mtu': (1500, 1400),
+                'addresses': {'added': ['192.0.2.1/24'], 'removed': []},
+                'settings': {'features': {'gro': (1, 0)}},
+            })
+            lo = diff['changed'][1]
+            self.assertTrue(lo['flags'][1] & ethtool.IFF_UP)
+            self.assertTrue('127.0.0.1/8' in lo['addresses']['added'])
+            # Without the settings of both, settings are not compared
+            self.assertFalse('settings' in ethtool.diff(
+                before, ethtool.snapshot(netns=netns))['changed'][
+                    index['ifb0']])
+        finally:
+            proc.kill()
+            proc.wait()
+
+    def test_snapshot_dumps(self):
+        for snap in (ethtool.snapshot(), ethtool.snapshot(settings=True)):
+            data = ethtool.dumps(snap)
+            self.assertTrue(isinstance(data, bytes))
+            loaded = ethtool.loads(data)
+            self.assertEqual(list(loaded), list(snap))
+            for ifindex in snap:
+                self.assertEqual(loaded[ifindex], snap[ifindex])
+            self.assertEqual(ethtool.diff(snap, loaded),
+                             {'added': {}, 'removed': {}, 'changed': {}})
+            self.assertEqual(ethtool.dumps(loaded), data)
+            self.assertEqual(ethtool.dumps(ethtool.loads(bytearray(data))),
+                             data)
+
+        self.assertRaises(TypeError, ethtool.dumps, {})
+        self.assertRaises(ValueError, ethtool.loads, b'')
+        self.assertRaises(ValueError, ethtool.loads, b'{"lo": {}}')
+        # Another version, truncated and with trailing data
+        self.assertRaises(ValueError, ethtool.loads,
+                          data[:4] + b'\xff' + data[5:])
+        for i in range(len(data)):
+            self.assertRaises(ValueError, ethtool.loads, data[:i])
+        self.assertRaises(ValueError, ethtool.loads, data + b'\0')
+
+    def test_snapshot_columns(self):
+        columns = ethtool.snapshot_columns()
+        snap = ethtool.snapshot()
+
+        def values(name):
+            view = memoryview(columns[name])
+            self.assertTrue(view.readonly)
+            self.assertEqual(len(view), len(columns[name]))
+            return struct.unpack(view.format * len(view), view.tobytes())
+
+        strings = bytes(memoryview(columns['strings']).tobytes())
+
+        def string(offset):
+            return strings[offset:strings.index(b'\0', offset)].decode()
+
+        self.assertEqual(list(values('ifindex')), list(snap))
+        for i, ifindex in enumerate(values('ifindex')):
+            link = snap[ifindex]
+            self.assertEqual(string(values('name')[i]), link['name'])
+            self.assertEqual(string(values('hwaddr')[i]), link['hwaddr'])
+            self.assertEqual(values('mtu')[i], link['mtu'])
+        for name in ('rx_packets', 'tx_bytes', 'rx_dropped', 'collisions'):
+            self.assertEqual(memoryview(columns[name]).format, 'Q')
+            self.assertEqual(len(values(name)), len(snap))
+        # The strings are distinct
+        self.assertEqual(len(set(strings.split(b'\0'))),
+                         strings.count(b'\0') + 1)
+        self.assertRaises(TypeError, ethtool.snapshot_columns, None)
+
+    def test_shared_stats(self):
+        tmpdir = tempfile.mkdtemp()
+        try:
+            path = os.path.join(tmpdir, 'stats')
+            publisher = ethtool.StatsPublisher(path)
+            reader = ethtool.SharedStatsReader(path)
+            self.assertEqual(reader.read(), {})
+            self.assertEqual(reader.samples, 0)
+            self.assertEqual(reader.timestamp, 0.0)
+
+            devices = ethtool.get_devices()
+            self.assertEqual(publisher.sample(), len(devices))
+            stats = reader.read()
+            self.assertEqual(sorted(stats), sorted(devices))
+            self.assertEqual(reader.samples, 1)
+            self.assertTrue(abs(reader.timestamp - time.time()) < 60)
+            publisher.sample()
+            self.assertEqual(reader.samples, 2)
+            self.assertEqual(sorted(reader.read('lo')), sorted(stats['lo']))
+            for name, value in reader.read('lo').items():
+                self.assertTrue(value >= stats['lo'][name])
+            self.assertRaisesNoSuchDevice(reader.read, INVALID_DEVICE_NAME)
+            self.assertRaises(ValueError, reader.read, 'lo\x00junk')
+            self.assertRaises(TypeError, reader.read, 1)
+
+            # A new publisher replaces the file, the readers of the old
+            # one have to open it again
+            with ethtool.StatsPublisher(path, 1) as replacement:
+                self.assertEqual(replacement.sample(), 1)
+                self.assertRaises(IOError, reader.read)
+                with ethtool.SharedStatsReader(path) as new_reader:
+                    self.assertEqual(len(new_reader.read()), 1)
+                    self.assertEqual(new_reader.samples, 1)
+            self.assertRaises(ValueError, replacement.sample)
+            publisher.sample()
+            reader.close()
+            self.assertRaises(ValueError, reader.read)
+
+            self.assertRaises(ValueError, ethtool.StatsPublisher, path, 0)
+            with open(path, 'wb') as f:
+                f.write(b'\0' * 4096)
+            self.assertRaises(ValueError, ethtool.SharedStatsReader, path)
+            self.assertRaises(IOError, ethtool.SharedStatsReader,
+                              os.path.join(tmpdir, 'missing'))
+        finally:
+            shutil.rmtree(tmpdir)
+
     def test_get_interface_info_invalid(self):
         eis = ethtool.get_interfaces_info(INVALID_DEVICE_NAME)
         self.assertEqual(len(eis), 1)
@@ -265,6 +664,450 @@ class EthtoolTests(unittest.TestCase):
         for ei in eis:
             self._verify_etherinfo_object(ei)
 
+    def test_address_accessors(self):
+        import binascii
+        import socket
+
+        for ei in ethtool.get_interfaces_info(ethtool.get_devices()):
+            for addr in ei.get_ipv4_addresses() + ei.get_ipv6_addresses():
+                self.assertTrue(addr.family in (ethtool.AF_INET,
+                                                ethtool.AF_INET6))
+                self.assertEqual(addr.packed,
+                                 socket.inet_pton(addr.family, addr.address))
+                self.assertEqual(addr.address_int,
+                                 int(binascii.hexlify(addr.packed), 16))
+                self.assertIsInt(addr.scope_int)
+                if addr.broadcast is None:
+                    self.assertEqual(addr.broadcast_int, None)
+                else:
+                    packed = socket.inet_pton(addr.family, addr.broadcast)
+                    self.assertEqual(addr.broadcast_int,
+                                     int(binascii.hexlify(packed), 16))
+                self.assertRaises((AttributeError, TypeError), setattr,
+                                  addr, 'address', '1.2.3.4')
+
+    def test_netlink_backends(self):
+        def snapshot():
+            ret = []
+            for ei in ethtool.get_interfaces_info(ethtool.get_devices()):
+                ret.append((str(ei), ei.mac_address, ei.ipv4_address,
+                            ei.ipv4_netmask, ei.ipv4_broadcast,
+                            [repr(a) for a in ei.get_ipv4_addresses()],
+                            [(repr(a), a.packed, a.scope_int)
+                             for a in ei.get_ipv6_addresses()]))
+            return ret
+
+        self.assertRaises(ValueError, ethtool.set_netlink_backend, 'x')
+        # Both backends share the pooled connections
+        eis = ethtool.get_interfaces_info(ethtool.get_devices())
+        addresses = [[repr(a) for a in ei.get_ipv6_addresses()] for ei in eis]
+        self.assertEqual(ethtool.set_netlink_backend('libnl'), 'native')
+        try:
+            self.assertEqual([[repr(a) for a in ei.get_ipv6_addresses()]
+                              for ei in eis], addresses)
+            ethtool.reset_perf_counters()
+            expected = snapshot()
+            counters = ethtool.get_perf_counters()
+            self.assertTrue(
+                counters['etherinfo.get_ipv6_addresses']['cache_allocs'] > 0)
+        finally:
+            self.assertEqual(ethtool.set_netlink_backend('native'), 'libnl')
+        self.assertEqual(snapshot(), expected)
+
+        # Devices which do not exist
+        ei = ethtool.get_interfaces_info(INVALID_DEVICE_NAME)[0]
+        self.assertRaisesNoSuchDevice(ei.get_ipv4_addresses)
+        self.assertRaisesNoSuchDevice(getattr, ei, 'mac_address')
+
+    def test_device(self):
+        for devname in ethtool.get_active_devices():
+            if devname.startswith('tun') or devname.startswith('wg'):
+                continue
+            dev = ethtool.Device(devname)
+            self.assertEqual(dev.name, devname)
+            self.assertTrue(dev.ifindex > 0)
+            self.assertEqual(ethtool.Device(dev.ifindex).name, devname)
+
+            for fnname in ('get_flags', 'get_hwaddr', 'get_gso', 'get_gro',
+                           'get_sg', 'get_tso', 'get_ts_info'):
+                self.assertEqual(getattr(dev, fnname)(),
+                                 getattr(ethtool, fnname)(devname))
+            if devname == 'lo':
+                self.assertRaisesIOError(dev.get_module, (),
+                                         '[Errno 95] Operation not supported')
+                self.assertRaisesIOError(dev.get_ringparam, (),
+                                         '[Errno 95] Operation not supported')
+
+            self.assertRaises(TypeError, dev.get_flags, 1)
+            self.assertRaises(TypeError, dev.set_tso)
+
+            with dev:
+                pass
+            self.assertRaises(ValueError, dev.get_flags)
+
+    def test_keyword_arguments(self):
+        self.assertEqual(ethtool.get_flags(device='lo'),
+                         ethtool.get_flags('lo'))
+        self.assertEqual(ethtool.Device('lo').get_flags(),
+                         ethtool.get_flags('lo'))
+        self.assertEqual(
+            [ei.device for ei in ethtool.get_interfaces_info(devices='lo')],
+            ['lo'])
+        self.assertRaises(TypeError, ethtool.get_flags)
+        self.assertRaises(TypeError, ethtool.get_flags, 'lo', 'lo')
+        self.assertRaises(TypeError, ethtool.get_flags, 'lo', device='lo')
+        self.assertRaises(TypeError, ethtool.get_flags, devname='lo')
+        if sys.version_info[0] >= 3:
+            self.assertRaises(TypeError, ethtool.get_flags,
+                              **{'\udcff': 1})
+        self.assertRaises(TypeError, ethtool.set_gro, 'lo')
+        self.assertRaises(TypeError, ethtool.set_gro, device='lo')
+        self.assertRaises(TypeError, ethtool.get_devices, 'lo')
+
+    def test_device_invalid(self):
+        self.assertRaisesNoSuchDevice(ethtool.Device, INVALID_DEVICE_NAME)
+        self.assertRaises(TypeError, ethtool.Device, 1.5)
+
+    def test_device_name_string(self):
+        for fn in (ethtool.get_flags, ethtool.Device):
+            self.assertRaises(ValueError, fn, 'lo\x00junk')
+            if sys.version_info[0] >= 3:
+                self.assertRaises(UnicodeEncodeError, fn, '\udcff')
+
+    def test_perf_counters(self):
+        ethtool.reset_perf_counters()
+        counters = ethtool.get_perf_counters()
+        for name, c in counters.items():
+            self.assertEqual(sum(c.values()), 0, name)
+
+        ethtool.get_flags('lo')
+        ethtool.get_flags('lo')
+        self.assertRaisesNoSuchDevice(ethtool.get_flags, INVALID_DEVICE_NAME)
+        ei = ethtool.get_interfaces_info('lo')[0]
+        ei.get_ipv4_addresses()
+
+        counters = ethtool.get_perf_counters()
+        self.assertEqual(counters['get_flags']['calls'], 3)
+        self.assertEqual(counters['get_flags']['ioctls'], 3)
+        self.assertEqual(counters['get_flags']['netlink_dumps'], 0)
+        self.assertTrue(counters['get_flags']['time_ns'] >=
+                        counters['get_flags']['time_ns_max'] > 0)
+        c = counters['etherinfo.get_ipv4_addresses']
+        self.assertEqual(c['calls'], 1)
+        self.assertTrue(c['netlink_dumps'] >= 1)
+        self.assertTrue(c['netlink_retries'] < c['netlink_msgs'])
+        # The native reader parses the dumps without libnl caches
+        self.assertEqual(c['cache_allocs'], 0)
+        self.assertTrue(c['netlink_msgs'] >= 1)
+        self.assertTrue(c['netlink_bytes'] >= c['netlink_msgs'] * 16)
+
+        ethtool.reset_perf_counters()
+        self.assertEqual(ethtool.get_perf_counters()['get_flags']['calls'], 0)
+
+    def test_latency_histograms(self):
+        ethtool.reset_perf_counters()
+        for i in range(10):
+            ethtool.get_flags('lo')
+
+        histograms = ethtool.get_latency_histograms()
+        self.assertEqual(histograms['get_businfo'], [])
+        buckets = histograms['get_flags']
+        self.assertEqual(sum(count for low, high, count in buckets), 10)
+        for low, high, count in buckets:
+            self.assertTrue(0 <= low < high)
+            self.assertTrue(high - low <= max(1, low // 8))
+        self.assertEqual(buckets, sorted(buckets))
+
+        ethtool.reset_perf_counters()
+        self.assertEqual(ethtool.get_latency_histograms()['get_flags'], [])
+
+    def test_trace_hook(self):
+        calls = []
+
+        def hook(*args):
+            calls.append(args)
+            # Calls made by the hook itself are not traced
+            ethtool.get_flags('lo')
+
+        ethtool.set_trace_hook(hook)
+        try:
+            ethtool.get_flags('lo')
+            self.assertRaisesNoSuchDevice(ethtool.get_flags,
+                                          INVALID_DEVICE_NAME)
+            ethtool.get_devices()
+            ei = ethtool.get_interfaces_info('lo')[0]
+            ei.get_ipv4_addresses()
+        finally:
+            ethtool.set_trace_hook(None)
+        ethtool.get_flags('lo')
+
+        self.assertEqual([c[:2] for c in calls],
+                         [('get_flags', 'lo'),
+                          ('get_flags', INVALID_DEVICE_NAME),
+                          ('get_devices', None),
+                          ('get_interfaces_info', 'lo'),
+                          ('etherinfo.get_ipv4_addresses', 'lo')])
+        for function, device, duration_ns, err in calls:
+            self.assertTrue(duration_ns > 0)
+        self.assertEqual([c[3] for c in calls], [0, 19, 0, 0, 0])
+
+        self.assertRaises(TypeError, ethtool.set_trace_hook, 42)
+
+    def test_threads(self):
+        import threading
+
+        # Without the GIL (free-threaded builds) the threads really share the
+        # objects and the NETLINK connections at the same time
+        nthreads, iterations = 8, 50
+        eis = ethtool.get_interfaces_info(ethtool.get_active_devices())
+        dev = ethtool.Device('lo')
+
+        def read(ei):
+            return (ei.device, ei.mac_address, ei.ipv4_address,
+                    [a.address for a in ei.get_ipv4_addresses()],
+                    [a.address for a in ei.get_ipv6_addresses()])
+
+        expected = [read(ei) for ei in eis]
+        flags = dev.get_flags()
+        results, errors = [], []
+
+        def worker():
+            try:
+                for i in range(iterations):
+                    results.append([read(ei) for ei in eis])
+                    results.append(dev.get_flags())
+                    str(eis[i % len(eis)])
+            except Exception as e:
+                errors.append(e)
+
+        ethtool.reset_perf_counters()
+        threads = [threading.Thread(target=worker) for i in range(nthreads)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        self.assertEqual(errors, [])
+        self.assertEqual(len(results), nthreads * iterations * 2)
+        for result in results:
+            self.assertEqual(result, flags if isinstance(result, int)
+                             else expected)
+        counters = ethtool.get_perf_counters()
+        self.assertEqual(counters['get_flags']['calls'],
+                         nthreads * iterations)
+        self.assertEqual(counters['etherinfo.mac_address']['calls'],
+                         nthreads * iterations * len(eis))
+
+    def test_free_lists(self):
+        stats = ethtool.get_free_list_stats()
+        self.assertEqual(sorted(stats), ['NetlinkIPaddress', 'etherinfo'])
+        limit = stats['etherinfo']['limit']
+        self.assertRaises(ValueError, ethtool.set_free_list_limit, -1)
+        self.assertRaises(TypeError, ethtool.set_free_list_limit, 'x')
+
+        try:
+            ethtool.set_free_list_limit(1000)
+            devices = ethtool.get_devices()
+            ethtool.get_interfaces_info(devices)
+            before = ethtool.get_free_list_stats()['etherinfo']
+            eis = ethtool.get_interfaces_info(devices)
+            after = ethtool.get_free_list_stats()['etherinfo']
+            self.assertEqual(after['allocs'] + after['reuses'] -
+                             before['allocs'] - before['reuses'],
+                             len(devices))
+            if not sysconfig.get_config_var('Py_GIL_DISABLED'):
+                self.assertEqual(after['reuses'] - before['reuses'],
+                                 len(devices))
+            del eis
+
+            ethtool.set_free_list_limit(0)
+            for stats in ethtool.get_free_list_stats().values():
+                self.assertEqual(stats['length'], 0)
+                self.assertEqual(stats['limit'], 0)
+            self.assertEqual(len(ethtool.get_interfaces_info(devices)),
+                             len(devices))
+            self.assertEqual(
+                ethtool.get_free_list_stats()['etherinfo']['length'], 0)
+        finally:
+            ethtool.set_free_list_limit(limit)
+
+    def test_netns(self):
+        own = '/proc/self/ns/net'
+        try:
+            devices = ethtool.get_devices(netns=own)
+        except OSError as e:
+            if e.errno == errno.EPERM:
+                self.skipTest('entering a network namespace needs '
+                              'CAP_SYS_ADMIN')
+            raise
+        self.assertEqual(devices, ethtool.get_devices())
+        self.assertEqual(ethtool.get_active_devices(netns=own),
+                         ethtool.get_active_devices())
+        self.assertEqual(ethtool.get_flags('lo', netns=own),
+                         ethtool.get_flags('lo'))
+        self.assertEqual(ethtool.Device('lo', netns=own).get_flags(),
+                         ethtool.get_flags('lo'))
+        ei = ethtool.get_interfaces_info('lo', netns=own)[0]
+        self.assertEqual([a.address for a in ei.get_ipv4_addresses()],
+                         [a.address for a in ethtool.get_interfaces_info(
+                             'lo')[0].get_ipv4_addresses()])
+
+        # The sockets of a namespace are kept for the next calls
+        ethtool.reset_perf_counters()
+        ethtool.get_interfaces_info('lo', netns=own)[0].get_ipv4_addresses()
+        counters = ethtool.get_perf_counters()
+        self.assertEqual(
+            counters['etherinfo.get_ipv4_addresses']['netlink_opens'], 0)
+
+        self.assertRaises(OSError, ethtool.get_devices, netns='/nonexistent')
+        self.assertRaises(OSError, ethtool.get_flags, 'lo',
+                          netns='/proc/self/stat')
+        self.assertRaises(TypeError, ethtool.get_devices, netns=1.5)
+        self.assertRaises(TypeError, ethtool.get_flags, 'lo', own)
+        self.assertRaises(ValueError, ethtool.set_netns_cache_limit, -1)
+
+        # A namespace of its own only has a loopback device, which is down
+        try:
+            proc = subprocess.Popen(('unshare', '-n', 'sleep', '60'))
+        except OSError:
+            self.skipTest('unshare is not available')
+        try:
+            other = '/proc/%d/ns/net' % proc.pid
+            for i in range(100):
+                if os.readlink(other) != os.readlink(own):
+                    break
+                time.sleep(0.01)
+            with open(other) as f:
+                self.assertEqual(ethtool.get_devices(netns=f), ['lo'])
+            self.assertEqual(ethtool.get_active_devices(netns=other), [])
+            self.assertFalse(ethtool.get_flags('lo', netns=other) &
+                             ethtool.IFF_UP)
+            ei = ethtool.get_interfaces_info('lo', netns=other)[0]
+            self.assertEqual(ei.get_ipv4_addresses(), [])
+            for device in devices:
+                if device != 'lo':
+                    self.assertRaises(IOError, ethtool.Device, device,
+                                      netns=other)
+
+            # Both namespaces at once, each on a worker thread
+            result = ethtool.sweep_namespaces(
+                [own, other, '/nonexistent'], workers=2)
+            self.assertEqual(sorted(result[own]['devices']), sorted(devices))
+            # The flags of NETLINK go beyond the 16 bits of get_flags()
+            self.assertEqual(result[own]['flags']['lo'] & 0xffff,
+                             ethtool.get_flags('lo'))
+            self.assertEqual(
+                [a.address for a in result[own]['ipv4_addresses']['lo']],
+                [a.address for a in ethtool.get_interfaces_info(
+                    'lo')[0].get_ipv4_addresses()])
+            self.assertEqual(result[other]['devices'], ['lo'])
+            self.assertEqual(result[other]['ipv6_addresses'], {'lo': []})
+            self.assertTrue(isinstance(result['/nonexistent'], OSError))
+            self.assertEqual(ethtool.sweep_namespaces([other], what='mtu'),
+                             {other: {'mtu': {'lo': 65536}}})
+            self.assertRaises(ValueError, ethtool.sweep_namespaces, [own],
+                              what='speed')
+            self.assertRaises(ValueError, ethtool.sweep_namespaces, [own],
+                              workers=0)
+        finally:
+            proc.kill()
+            proc.wait()
+
+    @unittest.skipIf(sys.version_info < (3, 5), 'asyncio')
+    def test_aio(self):
+        import asyncio
+
+        loop = asyncio.new_event_loop()
+        asyncio.set_event_loop(loop)
+        try:
+            snapshot = loop.run_until_complete(ethtool.aio.snapshot())
+            self.assertEqual(sorted(snapshot['devices']),
+                             sorted(ethtool.get_devices()))
+            self.assertEqual(snapshot['flags']['lo'] & 0xffff,
+                             ethtool.get_flags('lo'))
+            self.assertEqual(
+                loop.run_until_complete(ethtool.aio.snapshot('devices')),
+                {'devices': snapshot['devices']})
+
+            # Errors are those of the blocking functions, raised by the
+            # future
+            self.assertRaisesIOError(
+                loop.run_until_complete, (ethtool.aio.get_coalesce('lo'),),
+                '[Errno 95] Operation not supported')
+            self.assertRaisesNoSuchDevice(
+                loop.run_until_complete,
+                ethtool.aio.get_ringparam(INVALID_DEVICE_NAME))
+            self.assertRaises(TypeError, ethtool.aio.get_coalesce, 1)
+            self.assertRaises(ValueError, ethtool.aio.get_coalesce,
+                              'lo\x00junk')
+            self.assertRaises(UnicodeEncodeError, ethtool.aio.get_coalesce,
+                              '\udcff')
+
+            # Many requests in flight at once
+            results = loop.run_until_complete(asyncio.gather(
+                *[ethtool.aio.snapshot('mtu') for i in range(50)]))
+            self.assertEqual(results, [{'mtu': snapshot['mtu']}] * 50)
+        finally:
+            asyncio.set_event_loop(None)
+            loop.close()
+
+    def test_soak(self):
+        from .soak_ethtool import soak, MAX_RSS_GROWTH, MAX_TRACED_GROWTH
+
+        # A short run of tests.soak_ethtool: polling must not leak
+        rss_growth, traced_growth = soak(40000)
+        self.assertTrue(rss_growth <= MAX_RSS_GROWTH, rss_growth)
+        self.assertTrue(traced_growth <= MAX_TRACED_GROWTH, traced_growth)
+
+    @unittest.skipIf(sys.version_info < (3, 9),
+                     'single-phase module initialisation')
+    def test_module_instances(self):
+        import importlib.util
+
+        # Every import of the module, e.g. one per subinterpreter, has its
+        # own classes, counters and NETLINK connection
+        spec = importlib.util.find_spec('ethtool')
+        other = importlib.util.module_from_spec(spec)
+        spec.loader.exec_module(other)
+        self.assertFalse(other.Device is ethtool.Device)
+
+        ethtool.reset_perf_counters()
+        other.reset_perf_counters()
+        ei = other.get_interfaces_info('lo')[0]
+        self.assertTrue(isinstance(ei, other.etherinfo))
+        self.assertFalse(isinstance(ei, ethtool.etherinfo))
+        for addr in ei.get_ipv4_addresses():
+            self.assertTrue(isinstance(addr, other.NetlinkIPaddress))
+        other.Device('lo').get_flags()
+        self.assertEqual(other.get_perf_counters()['get_flags']['calls'], 1)
+        self.assertEqual(ethtool.get_perf_counters()['get_flags']['calls'], 0)
+
+        class Device(other.Device):
+            pass
+
+        Device('lo').get_flags()
+        self.assertEqual(other.get_perf_counters()['get_flags']['calls'], 2)
+
+        self.assertRaises(TypeError, other.etherinfo)
+        self.assertRaises(TypeError, other.NetlinkIPaddress)
+
+    @unittest.skipIf(sys.version_info < (3, 9),
+                     'single-phase module initialisation')
+    def test_module_collected(self):
+        import gc
+        import importlib.util
+        import weakref
+
+        # The classes of a module instance refer back to it, the cycles
+        # must be collectable once the module is dropped
+        spec = importlib.util.find_spec('ethtool')
+        other = importlib.util.module_from_spec(spec)
+        spec.loader.exec_module(other)
+        ref = weakref.ref(other)
+        del other
+        gc.collect()
+        self.assertTrue(ref() is None)
+
 
 if __name__ == '__main__':
     unittest.main()
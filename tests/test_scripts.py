@@ -105,6 +105,28 @@ generic receive offload: on
 '''.format(expected_ufo=expected_ufo)
                          )
 
+    def test_show_settings_lo(self):
+        self.assertIsNone(peth.show_settings(loopback))
+        self.assertEqual(self._output(),
+                         'Settings for {}:\n  NOT supported!\n'.format(loopback)
+                         )
+
+    def test_show_time_stamping_lo(self):
+        self.assertIsNone(peth.show_time_stamping(loopback))
+        lines = self._output().split('\n')
+        self.assertEqual(lines[0],
+                         'Time stamping parameters for {}:'.format(loopback))
+        self.assertEqual(lines[1], 'Capabilities:')
+        self.assertIn('\tsoftware-transmit     (SOF_TIMESTAMPING_TX_SOFTWARE)',
+                      lines)
+        self.assertIn('PTP Hardware Clock: none', lines)
+
+    def test_link_modes2str(self):
+        self.assertEqual(peth.link_modes2str(0), 'Not reported')
+        self.assertEqual(peth.link_modes2str((1 << 5) | (1 << 6)),
+                         '1000baseT/Full')
+        self.assertEqual(peth.link_modes2str(1 << 70), '400000baseSR8/Full')
+
     # Tests for another device
     if device:
         def test_driver_eth(self):